@@ -45,7 +45,8 @@ extern "C"{
         PRT_STATUS_EVENT_UNHANDLED = 3,  /**< Indicates failure of a machine to handle an event.            */
         PRT_STATUS_QUEUE_OVERFLOW = 4,   /**< Indicates that a queue has grown too large.                   */
         PRT_STATUS_ILLEGAL_SEND = 5,	 /**< Indicates illegal use of send primitive for sending message across process */
-        PRT_STATUS_COUNT = 6,            /**< The valid number of status codes.                             */
+        PRT_STATUS_MEMORY_QUOTA = 6,     /**< Indicates that a machine or its process has allocated more than its memory quota. */
+        PRT_STATUS_COUNT = 7,            /**< The valid number of status codes.                             */
     } PRT_STATUS;
 
     /** Represents a running P program. Every process has a GUID and client is responsible
@@ -79,6 +80,16 @@ extern "C"{
         PRT_SCHEDULINGPOLICY_COOPERATIVE    /**< This policy means the caller plans to advance the state machine from a separate thread using PrtRunProcess */
     } PRT_SCHEDULINGPOLICY;
 
+    /** Decides what happens to a machine that takes its process, or itself, over a memory quota.
+    *   In both cases the errorHandler is called with PRT_STATUS_MEMORY_QUOTA once the machine finishes its current step.
+    *   @see PrtSetMemoryQuotas
+    */
+    typedef enum PRT_QUOTAPOLICY
+    {
+        PRT_QUOTAPOLICY_REPORT,  /**< The machine keeps running after the error is reported */
+        PRT_QUOTAPOLICY_HALT     /**< The machine is halted after the error is reported, freeing its variables and queue */
+    } PRT_QUOTAPOLICY;
+
 	/** Represents a snapshot of the state of a machine at a given point in time.  This is useful for logging.
 	*/
 	typedef struct PRT_MACHINESTATE
@@ -96,6 +107,124 @@ extern "C"{
 	* the caller retains ownership of all these pointers.
 	*/
     typedef void(PRT_CALL_CONV * PRT_LOG_FUN)(PRT_STEP step, PRT_MACHINESTATE* senderState, PRT_MACHINEINST *receiver, PRT_VALUE *eventid, PRT_VALUE *payload);
+
+    /** Allocates size bytes from an allocator. Must not return NULL.
+    *   state is the state field of the allocator being called.
+    */
+    typedef void *(PRT_CALL_CONV * PRT_ALLOC_FUN)(_Inout_ void *state, _In_ size_t size);
+
+    /** Resizes a block of oldSize bytes previously returned by the same allocator to newSize bytes. Must not return NULL. */
+    typedef void *(PRT_CALL_CONV * PRT_REALLOC_FUN)(_Inout_ void *state, _Inout_ void *ptr, _In_ size_t oldSize, _In_ size_t newSize);
+
+    /** Returns a block of size bytes previously returned by the same allocator. */
+    typedef void(PRT_CALL_CONV * PRT_DEALLOC_FUN)(_Inout_ void *state, _Inout_ void *ptr, _In_ size_t size);
+
+    /** An allocator is a table of memory functions. The runtime remembers which allocator produced
+    *   every block, so a block is always returned to the allocator it came from, even if it is freed
+    *   by a different process or thread. Allocators that are shared by several threads must be thread-safe.
+    *   @see PrtStartProcessEx
+    *   @see PrtSetAllocator
+    */
+    typedef struct PRT_ALLOCATOR
+    {
+        PRT_ALLOC_FUN   allocFun;    /**< Allocates a block.                                               */
+        PRT_REALLOC_FUN reallocFun;  /**< Resizes a block. If NULL, the runtime allocates, copies and frees. */
+        PRT_DEALLOC_FUN freeFun;     /**< Frees a block.                                                   */
+        void            *state;      /**< Passed as the first argument to each function.                   */
+    } PRT_ALLOCATOR;
+
+    /** Stands for no particular NUMA node. */
+#define PRT_NUMA_NODE_ANY 0xFFFFFFFF
+
+    /** Finds the NUMA node of the calling thread. Must return a node below the nNodes of its topology.
+    *   state is the state field of the topology being asked.
+    */
+    typedef PRT_UINT32(PRT_CALL_CONV * PRT_CURRENT_NODE_FUN)(_Inout_ void *state);
+
+    /** Describes the NUMA nodes a process places its machines on.
+    *   @see PrtSetNumaTopology
+    */
+    typedef struct PRT_NUMA_TOPOLOGY
+    {
+        PRT_UINT32           nNodes;          /**< The number of nodes, numbered from 0.                 */
+        PRT_CURRENT_NODE_FUN currentNodeFun;  /**< Finds the node of the calling thread. Must be thread-safe. */
+        void                 *state;          /**< Passed as the first argument to currentNodeFun.      */
+    } PRT_NUMA_TOPOLOGY;
+
+    /** Reads the clock of a process in milliseconds. Must never go backwards.
+    *   state is the state field of the clock being read.
+    */
+    typedef PRT_UINT64(PRT_CALL_CONV * PRT_CLOCK_FUN)(_Inout_ void *state);
+
+    /** The clock a process measures receive deadlines and timers on.
+    *   @see PrtSetClock
+    */
+    typedef struct PRT_CLOCK
+    {
+        PRT_CLOCK_FUN   nowFun;  /**< Reads the clock. Must be thread-safe.          */
+        void            *state;  /**< Passed as the first argument to nowFun.        */
+    } PRT_CLOCK;
+
+    /** What became of an event sent with PrtTrySend.
+    *   @see PrtTrySend
+    */
+    typedef enum PRT_SEND_STATUS
+    {
+        PRT_SEND_ACCEPTED,  /**< The event is in the queue of the receiver, or was dropped because the receiver has halted */
+        PRT_SEND_SHED,      /**< The admission policy of the receiver turned the event away                         */
+        PRT_SEND_OVERFLOW   /**< The queue of the receiver is full, or holds the most instances of the event it may    */
+    } PRT_SEND_STATUS;
+
+    /** Decides whether a machine takes an event sent with PrtTrySend. Called with the machine locked, so it must not call
+    *   into the runtime. state is the state field of the policy.
+    *   @returns PRT_TRUE to take the event, PRT_FALSE to shed it.
+    */
+    typedef PRT_BOOLEAN(PRT_CALL_CONV * PRT_ADMISSION_FUN)(_Inout_ void *state, _In_ PRT_MACHINEINST *receiver, _In_ PRT_UINT32 eventIndex, _In_ PRT_UINT32 queueLength);
+
+    /** The kinds of admission policy.
+    *   @see PRT_ADMISSION_POLICY
+    */
+    typedef enum PRT_ADMISSION_KIND
+    {
+        PRT_ADMISSION_ALWAYS,       /**< Every event is taken while there is room for it                                  */
+        PRT_ADMISSION_QUEUE_LENGTH, /**< Events are shed while the queue holds limit events or more                      */
+        PRT_ADMISSION_TOKEN_BUCKET, /**< Events are taken at rate per second, in bursts of up to limit                    */
+        PRT_ADMISSION_QUEUE_DELAY,  /**< Events are shed, ever more often, while events wait longer than limit ms to be
+                                         dequeued for a whole interval; the controlled delay (CoDel) scheme               */
+        PRT_ADMISSION_CUSTOM        /**< admitFun decides                                                                 */
+    } PRT_ADMISSION_KIND;
+
+    /** Decides which of the events sent with PrtTrySend the machines of one type take, so that a host can push back on
+    *   the clients of a machine that falls behind instead of letting its queue grow without bound.
+    *   @see PrtSetAdmissionPolicy
+    */
+    typedef struct PRT_ADMISSION_POLICY
+    {
+        PRT_ADMISSION_KIND  kind;
+        PRT_UINT32          limit;     /**< Queue length, burst size, or target delay in ms, by kind   */
+        PRT_UINT32          rate;      /**< PRT_ADMISSION_TOKEN_BUCKET: events per second                */
+        PRT_UINT32          interval;  /**< PRT_ADMISSION_QUEUE_DELAY: ms the delay may stay above limit */
+        PRT_ADMISSION_FUN   admitFun;  /**< PRT_ADMISSION_CUSTOM: decides; must be thread-safe          */
+        void                *state;    /**< Passed as the first argument to admitFun.                   */
+    } PRT_ADMISSION_POLICY;
+
+    /** A timer that sends an event to a machine.
+    *   @see PrtMkEventTimer
+    */
+    typedef struct PRT_EVENT_TIMER PRT_EVENT_TIMER;
+
+    /** Machines of one type that share state out by key.
+    *   @see PrtMkMachineGroup
+    */
+    typedef struct PRT_MACHINE_GROUP PRT_MACHINE_GROUP;
+
+    /** A blocking foreign function, such as file I/O or a database lookup, that a helper thread runs for a machine.
+    *   It must not touch the machine or its process, except to make the value it returns.
+    *   @param[in,out] arg The argument the function was handed with.
+    *   @returns The result for the machine, or NULL for a null value.
+    *   @see PrtPostBlocking
+    */
+    typedef PRT_VALUE *(PRT_CALL_CONV * PRT_BLOCKING_FUN)(_Inout_ void *arg);
 	
     /** Starts a new Process running program.
     *   @param[in] guid Id for process; client must guarantee uniqueness for processes that may communicate. Cannot be 0-0-0-0.
@@ -113,6 +242,66 @@ extern "C"{
         _In_ PRT_LOG_FUN loggerFun
         );
 
+    /** Starts a new Process running program whose memory is drawn from allocator.
+    *   All machines, queues, frames and values created while running this process are allocated from allocator.
+    *   @param[in] guid Id for process; client must guarantee uniqueness for processes that may communicate. Cannot be 0-0-0-0.
+    *   @param[in] program Program to run (not cloned). Client must free. Client cannot free or modify before calling PrtStopProcess.
+    *   @param[in] errorFun  The error function to call if an error status occurrs. Must be thread-safe. If NULL, then no error reporting.
+    *   @param[in] loggerFun The logging function to call when a machine step occurrs. Must be thread-safe. If NULL, then no logging.
+    *   @param[in] allocator The allocator for this process (not cloned), or NULL for the default allocator. Must outlive the process.
+    *   @returns A pointer to a new process. Client must free with PrtStopProcess
+    *   @see PrtStartProcess
+    *   @see PrtMkArenaAllocator
+    */
+    PRT_API PRT_PROCESS * PRT_CALL_CONV PrtStartProcessEx(
+        _In_ PRT_GUID guid,
+        _In_ PRT_PROGRAMDECL *program,
+        _In_ PRT_ERROR_FUN errorFun,
+        _In_ PRT_LOG_FUN loggerFun,
+        _In_ PRT_ALLOCATOR *allocator
+        );
+
+    /** Sets the allocator used by PrtMalloc, PrtCalloc and PrtRealloc on the calling thread.
+    *   The runtime sets the allocator of the owning process whenever it runs a machine or creates,
+    *   sends to or steps one, so clients only need this to build values on a process's heap from foreign code.
+    *   @param[in] allocator The new allocator, or NULL for the default allocator.
+    *   @returns The allocator that was previously set; pass it back to restore it.
+    */
+    PRT_API PRT_ALLOCATOR * PRT_CALL_CONV PrtSetAllocator(_In_ PRT_ALLOCATOR *allocator);
+
+    /** Makes a thread-caching arena allocator. Small blocks are carved out of large chunks and recycled through
+    *   per-thread free lists, so most allocations take no lock. All memory is released at once by PrtFreeArenaAllocator.
+    *   @returns A thread-safe allocator. Client must free with PrtFreeArenaAllocator.
+    *   @see PrtStartProcessEx
+    */
+    PRT_API PRT_ALLOCATOR * PRT_CALL_CONV PrtMkArenaAllocator(void);
+
+    /** Releases every block allocated from an arena, whether or not it was freed.
+    *   No thread may use the arena, or memory drawn from it, afterwards.
+    *   @param[in,out] allocator An allocator made by PrtMkArenaAllocator.
+    */
+    PRT_API void PRT_CALL_CONV PrtFreeArenaAllocator(_Inout_ PRT_ALLOCATOR *allocator);
+
+    /** Makes a thread-caching arena allocator like PrtMkArenaAllocator whose chunks are placed on a NUMA node,
+    *   so that small blocks are local to threads running on that node. Large blocks come from the system heap.
+    *   @param[in] node The node to place chunks on, or PRT_NUMA_NODE_ANY for no particular node.
+    *   @returns A thread-safe allocator. Client must free with PrtFreeArenaAllocator.
+    *   @see PrtSetNumaTopology
+    */
+    PRT_API PRT_ALLOCATOR * PRT_CALL_CONV PrtMkNodeArenaAllocator(_In_ PRT_UINT32 node);
+
+    /** Hands the free blocks the calling thread caches for arena allocators back to their arenas.
+    *   The threads of the runtime do this when they end, and PrtRunProcess before it returns. Any other thread that used
+    *   an arena should do it before it ends, or the blocks it caches are only reclaimed when the arena is freed.
+    */
+    PRT_API void PRT_CALL_CONV PrtFlushArenaCaches(void);
+
+    /** Returns the bytes an arena holds from the system, in chunks and in blocks too large for a chunk.
+    *   @param[in] allocator An allocator made by PrtMkArenaAllocator or PrtMkNodeArenaAllocator.
+    *   @returns The size of the arena in bytes.
+    */
+    PRT_API size_t PRT_CALL_CONV PrtGetArenaAllocatorSize(_In_ PRT_ALLOCATOR *allocator);
+
 
 	/** If you want to start creating PRT_VALUES before starting the process, then you need to call this function.
 	*   @param[in] program Program to run (not cloned). Client must free. Client cannot free or modify before calling PrtStopProcess.
@@ -140,6 +329,178 @@ extern "C"{
     */
     PRT_API void PRT_CALL_CONV PrtRunProcess(PRT_PROCESS *process);
 
+    /** Turns on memory accounting for this process and sets its quotas. Memory is charged to the machine that is
+    *   running (or receiving an event) when it is allocated, and to its process, until it is freed.
+    *   Quotas are checked when memory is allocated; the offending machine is dealt with according to policy
+    *   as soon as it finishes its current step, so the process is never aborted for exceeding a quota.
+    *   Only memory allocated after this call is counted.
+    *   @param[in] process The process to limit.
+    *   @param[in] processQuota The number of bytes all machines of the process may hold, or 0 for no limit.
+    *   @param[in] machineQuota The number of bytes each machine may hold, or 0 for no limit. Applies to existing machines too.
+    *   @param[in] policy What to do with a machine that exceeds either quota.
+    *   @see PrtSetMachineMemoryQuota
+    *   @see PRT_STATUS_MEMORY_QUOTA
+    */
+    PRT_API void PRT_CALL_CONV PrtSetMemoryQuotas(
+        _Inout_ PRT_PROCESS *process,
+        _In_ size_t processQuota,
+        _In_ size_t machineQuota,
+        _In_ PRT_QUOTAPOLICY policy
+        );
+
+    /** Overrides the quota of one machine. Has no effect until PrtSetMemoryQuotas has been called for its process.
+    *   @param[in] machine The machine to limit.
+    *   @param[in] quota The number of bytes the machine may hold, or 0 for no limit.
+    */
+    PRT_API void PRT_CALL_CONV PrtSetMachineMemoryQuota(_Inout_ PRT_MACHINEINST *machine, _In_ size_t quota);
+
+    /** Gets the number of bytes, including runtime bookkeeping, currently charged to a process by memory accounting.
+    *   @see PrtSetMemoryQuotas
+    */
+    PRT_API size_t PRT_CALL_CONV PrtGetProcessMemoryUsage(_In_ PRT_PROCESS *process);
+
+    /** Gets the number of bytes, including runtime bookkeeping, currently charged to a machine by memory accounting.
+    *   @see PrtSetMemoryQuotas
+    */
+    PRT_API size_t PRT_CALL_CONV PrtGetMachineMemoryUsage(_In_ PRT_MACHINEINST *machine);
+
+    /** An idle period that turns hibernation off. This is the default. */
+#define PRT_HIBERNATE_NEVER 0xFFFFFFFF
+
+    /** Makes the runtime hibernate machines that have had nothing to do for a while. A hibernated machine keeps only its
+    *   identity; its variables, state stack and deferred and action sets are serialized into a compact blob, and its event queue
+    *   and stacks are released. The machine is rebuilt transparently when the next event is sent to it.
+    *   Idle machines are found as other machines finish running, and by PrtHibernateIdleMachines.
+    *   Machines blocked in a receive, or holding deferred events, are never hibernated.
+    *   @param[in,out] process The process whose machines may hibernate.
+    *   @param[in] idlePeriod Milliseconds a machine must have been idle before it is hibernated, or PRT_HIBERNATE_NEVER.
+    *   @see PrtHibernateIdleMachines
+    */
+    PRT_API void PRT_CALL_CONV PrtSetHibernationPolicy(_Inout_ PRT_PROCESS *process, _In_ PRT_UINT32 idlePeriod);
+
+    /** Hibernates every machine of a process that has been idle for the period set by PrtSetHibernationPolicy.
+    *   @param[in,out] process The process to sweep.
+    *   @returns The number of machines hibernated by this call.
+    */
+    PRT_API PRT_UINT32 PRT_CALL_CONV PrtHibernateIdleMachines(_Inout_ PRT_PROCESS *process);
+
+    /** Tests whether a machine is hibernated.
+    *   @see PrtSetHibernationPolicy
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtIsMachineHibernated(_In_ PRT_MACHINEINST *machine);
+
+    /** Makes a process NUMA-aware. Every machine gets a home node when it is made: the node set by PrtSetPlacementHint
+    *   on the creating thread, or else the node the creating thread runs on. The machine, its queue, variables and
+    *   the values it makes are allocated from an arena on its home node instead of from the allocator of the process,
+    *   and PrtStepProcess runs the machines homed on the caller's node before any other, taking on the others only
+    *   when the home machines are idle or now and then, so that no machine starves.
+    *   Values made by a machine must not be used after the process is stopped, as with an arena allocator.
+    *   Must be called before the process makes its first machine.
+    *   @param[in,out] process The process to place.
+    *   @param[in] topology The nodes to place machines on (copied), or NULL for the nodes of the platform.
+    *   @see PrtGetMachineHomeNode
+    */
+    PRT_API void PRT_CALL_CONV PrtSetNumaTopology(_Inout_ PRT_PROCESS *process, _In_ PRT_NUMA_TOPOLOGY *topology);
+
+    /** Sets the home node of machines made by the calling thread in NUMA-aware processes.
+    *   @param[in] node A node of the process topology, or PRT_NUMA_NODE_ANY to use the node the thread runs on.
+    *   @returns The hint that was previously set; pass it back to restore it.
+    *   @see PrtSetNumaTopology
+    */
+    PRT_API PRT_UINT32 PRT_CALL_CONV PrtSetPlacementHint(_In_ PRT_UINT32 node);
+
+    /** Gets the home node of a machine.
+    *   @returns The node, or PRT_NUMA_NODE_ANY if the process of the machine is not NUMA-aware.
+    *   @see PrtSetNumaTopology
+    */
+    PRT_API PRT_UINT32 PRT_CALL_CONV PrtGetMachineHomeNode(_In_ PRT_MACHINEINST *machine);
+
+    /** The version of the file format written by PrtCheckpointProcess. Files of any other version are rejected by PrtRestoreProcess. */
+#define PRT_CHECKPOINT_VERSION 4
+
+    /** Writes the state of every machine of a process to a file: current state, state stack, variables and queued events.
+    *   Foreign values are written by the serializeFun of their type, which must be set for every foreign type that occurs.
+    *   No machine may be running or blocked in a receive, so call this when the process is quiescent. Queued events
+    *   that expire keep the time they have left to live, which runs on in the restored process from when it is restored.
+    *   @param[in] process The process to checkpoint.
+    *   @param[in] path The file to write. The checkpoint is written to path with ".tmp" appended, made durable, and then
+    *   renamed over path, so a checkpoint that fails leaves the one already at path as it was.
+    *   @returns PRT_TRUE if the checkpoint was written, PRT_FALSE if the file could not be written or some machine is not at rest.
+    *   @see PrtRestoreProcess
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtCheckpointProcess(_In_ PRT_PROCESS *process, _In_ const char *path);
+
+    /** Starts a process from a file written by PrtCheckpointProcess. The process gets the guid it was checkpointed with,
+    *   and every machine gets back its id, so machine values saved anywhere stay valid. The file is mapped rather than read,
+    *   and each machine's queue is allocated at its final size. Machines that had events queued run before this returns.
+    *   @param[in] path The file to read.
+    *   @param[in] program The program the checkpointed process was running.
+    *   @param[in] errorFun The function to call when an error happens.
+    *   @param[in] logFun The function to call for logging.
+    *   @param[in] allocator The allocator the process draws its memory from, NULL for the default allocator.
+    *   @returns The restored process, or NULL if the file is missing, of another version, was written for another program,
+    *   or is truncated or corrupt.
+    *   @see PrtCheckpointProcess
+    */
+    PRT_API PRT_PROCESS * PRT_CALL_CONV PrtRestoreProcess(
+        _In_ const char *path,
+        _In_ PRT_PROGRAMDECL *program,
+        _In_ PRT_ERROR_FUN errorFun,
+        _In_ PRT_LOG_FUN logFun,
+        _In_ PRT_ALLOCATOR *allocator
+        );
+
+    /** Starts recording the scheduling decisions of a process into a compact binary log, so that a run that went wrong
+    *   can be reproduced with PrtReplayProcess: which machine each step ran, the order in which events reached each queue,
+    *   and each nondeterministic choice of a machine, along with the machines made and events sent by the host.
+    *   Each decision costs a few bytes and one short critical section, so a recording can be kept on in production.
+    *   The recording is not charged to the memory of the process, and holds at most PRT_RECORDING_DEFAULT_LIMIT bytes
+    *   unless PrtSetRecordingLimit says otherwise.
+    *   Must be called before the process makes its first machine.
+    *   @param[in,out] process The process to record.
+    *   @see PrtGetRecording
+    */
+    PRT_API void PRT_CALL_CONV PrtStartRecording(_Inout_ PRT_PROCESS *process);
+
+    /** The bytes a recording holds by default; once they are used up, recording stops. */
+#define PRT_RECORDING_DEFAULT_LIMIT (16u << 20)
+
+    /** Takes a chunk of a recording off the recorder. Called with the recorder locked, on the thread whose record filled it,
+    *   so it must not call into the runtime. The chunks, in the order they are passed, make up the recording.
+    *   state is the flushState passed to PrtSetRecordingLimit.
+    */
+    typedef void(PRT_CALL_CONV * PRT_RECORDING_FUN)(_Inout_ void *state, _In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size);
+
+    /** Bounds the memory a recording holds. Once the records hold limit bytes they are passed to flushFun and the recorder
+    *   starts over; the rest of the recording is passed when the process stops. Without a flushFun, recording stops with the
+    *   last record that fits.
+    *   @param[in,out] process A process passed to PrtStartRecording.
+    *   @param[in] limit The bytes the recorder may hold; must not be 0.
+    *   @param[in] flushFun Takes the recording a chunk at a time, or NULL to keep only its first limit bytes.
+    *   @param[in] flushState Passed as the first argument to flushFun.
+    */
+    PRT_API void PRT_CALL_CONV PrtSetRecordingLimit(_Inout_ PRT_PROCESS *process, _In_ PRT_UINT32 limit, _In_ PRT_RECORDING_FUN flushFun, _In_ void *flushState);
+
+    /** Copies what has been recorded so far, less what was passed to a flush function; the recording goes on.
+    *   Can be called from the error handler of the process.
+    *   @param[in] process A process passed to PrtStartRecording.
+    *   @param[out] size The number of bytes in the copy.
+    *   @returns The copy, to be freed with PrtFree, or NULL if the process is not being recorded.
+    */
+    PRT_API PRT_UINT8 * PRT_CALL_CONV PrtGetRecording(_In_ PRT_PROCESS *process, _Out_ PRT_UINT32 *size);
+
+    /** Runs a recording again on the calling thread, forcing the recorded order of steps, enqueues and choices.
+    *   The process must be fresh and started for the same program; it is switched to PRT_SCHEDULINGPOLICY_COOPERATIVE,
+    *   and the host must not touch it until this returns. Events the replay makes before their recorded turn are held back
+    *   until the events recorded before them have reached the same queue.
+    *   @param[in,out] process The process to replay into.
+    *   @param[in] recording The bytes returned by PrtGetRecording, or the chunks passed to a flush function, joined.
+    *   @param[in] size The number of bytes in recording.
+    *   @returns PRT_TRUE if the run was reproduced, PRT_FALSE if it went differently from the recording, or if the recording
+    *   is truncated, corrupt or of another program, in which case nothing is run.
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtReplayProcess(_Inout_ PRT_PROCESS *process, _In_ const PRT_UINT8 *recording, _In_ PRT_UINT32 size);
+
 
     typedef enum PRT_STEP_RESULT
     {
@@ -169,11 +530,135 @@ extern "C"{
     */
     PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtWaitForWork(PRT_PROCESS *process);
 
+    /** Seeds the nondeterministic choices of the machines of a process. Every machine chooses from a stream of its own,
+    *   derived from the seed and the id of the machine, so with the same seed a machine makes the same choices in every run,
+    *   whatever the other machines do and whichever thread runs it. The seed of a new process is taken from the clock.
+    *   Machines the process already has start their streams over.
+    *   @param[in,out] process The process to seed.
+    *   @param[in] seed The seed.
+    *   @see PrtGetChoiceSeed
+    *   @see PrtMkNondetBoolValue
+    */
+    PRT_API void PRT_CALL_CONV PrtSetChoiceSeed(_Inout_ PRT_PROCESS *process, _In_ PRT_UINT64 seed);
+
+    /** Gets the seed of the nondeterministic choices of a process, so that a run can be repeated with PrtSetChoiceSeed.
+    *   @see PrtSetChoiceSeed
+    */
+    PRT_API PRT_UINT64 PRT_CALL_CONV PrtGetChoiceSeed(_In_ PRT_PROCESS *process);
+
+    /** Sets the clock a process measures receive deadlines and timers on, so that tests can move time by hand.
+    *   Must be called before any machine of the process waits with a deadline, and before any timer is started.
+    *   @param[in,out] process The process.
+    *   @param[in] clock The clock (copied), or NULL for PrtGetMonotonicTime.
+    *   @see PrtFireTimers
+    */
+    PRT_API void PRT_CALL_CONV PrtSetClock(_Inout_ PRT_PROCESS *process, _In_ PRT_CLOCK *clock);
+
+    /** Reads the clock of a process.
+    *   @returns The time in milliseconds, on the scale of receive deadlines and timers.
+    *   @see PrtSetClock
+    */
+    PRT_API PRT_UINT64 PRT_CALL_CONV PrtGetProcessTime(_In_ PRT_PROCESS *process);
+
+    /** Ends the receives of a process whose deadlines have passed, and fires its timers that have run out.
+    *   PrtStepProcess calls this, and PrtWaitForWork wakes up in time for the next deadline, so cooperative hosts need
+    *   not. Under the task-neutral policy a timer thread of the process calls it, started with the first deadline,
+    *   unless the process has a clock set by PrtSetClock; then the host calls it after moving the clock.
+    *   @param[in,out] process The process.
+    *   @returns The number of deadlines and timers that passed.
+    */
+    PRT_API PRT_UINT32 PRT_CALL_CONV PrtFireTimers(_Inout_ PRT_PROCESS *process);
+
+    /** Makes a timer that sends an event to a machine when it runs out. Timers are kept on the timer wheel of the process,
+    *   so starting, restarting and cancelling one take constant time however many there are, and the event goes through
+    *   the queue of the machine like any other. A recorded process records it as an event sent by the host.
+    *   @param[in,out] machine The machine the event goes to.
+    *   @param[in] eventIndex The event to send.
+    *   @returns The timer, not started; freed by PrtFreeEventTimer or when the process stops.
+    *   @see PrtFireTimers
+    */
+    PRT_API PRT_EVENT_TIMER * PRT_CALL_CONV PrtMkEventTimer(_Inout_ PRT_MACHINEINST *machine, _In_ PRT_UINT32 eventIndex);
+
+    /** Starts a timer, or starts it over if it is running, so that it sends its event once delay milliseconds have passed
+    *   on the clock of the process.
+    *   @param[in,out] timer The timer.
+    *   @param[in] delay Milliseconds from now.
+    *   @param[in] payload The payload of the event (moved), or NULL for a null value. The payload of a start over is freed.
+    */
+    PRT_API void PRT_CALL_CONV PrtStartEventTimer(_Inout_ PRT_EVENT_TIMER *timer, _In_ PRT_UINT32 delay, _In_ PRT_VALUE *payload);
+
+    /** Stops a timer before it sends its event, and frees the payload.
+    *   @param[in,out] timer The timer.
+    *   @returns PRT_TRUE if the timer was running; PRT_FALSE if it was not started, or has sent its event.
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtCancelEventTimer(_Inout_ PRT_EVENT_TIMER *timer);
+
+    /** Cancels a timer made by PrtMkEventTimer and frees it.
+    *   @param[in,out] timer The timer.
+    */
+    PRT_API void PRT_CALL_CONV PrtFreeEventTimer(_Inout_ PRT_EVENT_TIMER *timer);
+
+    /** Sets how many helper threads a process runs blocking foreign functions on. The helpers are started by the
+    *   first blocking job, with four threads unless this was called before.
+    *   @param[in,out] process The process.
+    *   @param[in] count The number of helper threads, at least 1.
+    *   @see PrtPostBlocking
+    */
+    PRT_API void PRT_CALL_CONV PrtSetHelperThreads(_Inout_ PRT_PROCESS *process, _In_ PRT_UINT32 count);
+
+    /** Runs a blocking foreign function on a helper thread of the process of a machine, and sends the machine an event
+    *   with its result as the payload once it returns. The caller does not wait, so foreign code running in a handler
+    *   can start a slow operation and let the machine handle its outcome as an event; the scheduler threads never block on it.
+    *   Every job runs, even one still waiting for a helper when the process is stopped, but results that come in
+    *   after PrtStopProcess was called are dropped. A recorded process records the event as one sent by the host.
+    *   @param[in,out] machine The machine the result goes to.
+    *   @param[in] fun The blocking function.
+    *   @param[in,out] arg Passed to fun; owned by fun until it returns.
+    *   @param[in] eventIndex The event to send, whose payload type the result must inhabit.
+    *   @see PrtSetHelperThreads
+    */
+    PRT_API void PRT_CALL_CONV PrtPostBlocking(
+        _Inout_ PRT_MACHINEINST *machine,
+        _In_ PRT_BLOCKING_FUN fun,
+        _Inout_ void *arg,
+        _In_ PRT_UINT32 eventIndex
+        );
+
+    /** Watches a file descriptor for a machine, and sends the machine an event once the descriptor is ready, so that
+    *   the machine does its I/O in handlers that never block. The descriptors of a process are watched by one thread of
+    *   its own, started with the first one, which waits on them all at once; the event goes through the queue of the machine
+    *   like any other, with the PRT_POLL_READ, PRT_POLL_WRITE and PRT_POLL_HUP bits that were found as an int payload.
+    *   A descriptor is watched once: the machine calls this again to hear of it again, typically after reading or writing
+    *   until it would block. A hang-up is reported whatever the interest. A descriptor is watched for one machine at a time,
+    *   until PrtUnwatchFd or until the machine halts. A recorded process records the event as one sent by the host,
+    *   and a replayed process watches nothing.
+    *   @param[in,out] machine The machine the event goes to.
+    *   @param[in] fd The file descriptor, which stays open while it is watched.
+    *   @param[in] interest PRT_POLL_READ and PRT_POLL_WRITE bits.
+    *   @param[in] eventIndex The event to send, whose payload type must admit an int.
+    *   @returns PRT_FALSE if the descriptor cannot be watched, or the configuration cannot watch file descriptors.
+    *   @see PrtUnwatchFd
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtWatchFd(
+        _Inout_ PRT_MACHINEINST *machine,
+        _In_ PRT_INT32 fd,
+        _In_ PRT_UINT32 interest,
+        _In_ PRT_UINT32 eventIndex
+        );
+
+    /** Stops watching a file descriptor before it is closed. An event the descriptor was found ready for may still come
+    *   if it was sent already.
+    *   @param[in,out] machine The machine the descriptor is watched for.
+    *   @param[in] fd The file descriptor.
+    *   @see PrtWatchFd
+    */
+    PRT_API void PRT_CALL_CONV PrtUnwatchFd(_Inout_ PRT_MACHINEINST *machine, _In_ PRT_INT32 fd);
+
     /** Stops a started process. Reclaims all resources allocated to the process.
     *   Client must call exactly once for each started process. Once called,
     *   no other API function affecting this process can occur from any thread.
     *   Once called, no interaction with data owned by this process should occur from any thread.
-    *  This method also causes PrtRunProcess and PrtWaitForWork to terminate.
+    *  This method also causes PrtRunProcess and PrtWaitForWork to terminate, and waits for the blocking jobs of the process.
     *   @param[in,out] process The process to stop.
     *   @see PRT_PROCESS
     *   @see PrtStartProcess
@@ -261,6 +746,170 @@ extern "C"{
 		...
 	);
 
+	/** Sends an event that expires if the receiver has not dequeued it within a time to live, in place of the time to
+	* live in the declaration of the event. A machine lets go of the expired events it comes to rather than handling them,
+	* so a machine that falls behind catches up instead of working on requests whose senders have given up.
+	* @param[in] senderState The current state of the sender machine, or NULL for the host, as for PrtSend.
+	* @param[in,out] receiver The machine that will receive the event.
+	* @param[in] event The event to send (cloned, user frees).
+	* @param[in] payload The payload (cloned, user frees), or NULL for a null value.
+	* @param[in] timeToLive Milliseconds of process time the event may wait in the queue, or 0 for ever.
+	* @see PrtSetExpiryEvent
+	* @see PrtGetExpiredEventCount
+	*/
+	PRT_API void PRT_CALL_CONV PrtSendWithTimeToLive(
+		_In_ PRT_MACHINESTATE *senderState,
+		_Inout_ PRT_MACHINEINST *receiver,
+		_In_ PRT_VALUE *event,
+		_In_ PRT_VALUE *payload,
+		_In_ PRT_UINT32 timeToLive
+	);
+
+	/** Sets what the machines of a process do with an event that expires in their queue. By default they drop it; with
+	* an expiry event set, the event is replaced in the queue by the expiry event, whose payload is the index of the
+	* event that expired, so that a machine can tell the sender its request was dropped.
+	* @param[in,out] process The process.
+	* @param[in] eventIndex The expiry event, which takes an int payload, or PRT_SPECIAL_EVENT_NULL to drop expired events.
+	* @see PrtSendWithTimeToLive
+	*/
+	PRT_API void PRT_CALL_CONV PrtSetExpiryEvent(
+		_Inout_ PRT_PROCESS *process,
+		_In_ PRT_UINT32 eventIndex
+	);
+
+	/** Gets the number of events that expired in the queue of a machine, whether dropped or replaced by the expiry event.
+	* @param[in] machine The machine.
+	* @see PrtSendWithTimeToLive
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtGetExpiredEventCount(_In_ PRT_MACHINEINST *machine);
+
+	/** Sends an event that the receiver may turn away, for hosts that take requests from outside the program and would
+	* rather push back on a client than fail the process or let a queue grow without bound. Unlike PrtSend, a full queue
+	* is not an error, and the admission policy of the receiver's type may shed the event. Sends between machines are
+	* never shed.
+	* @param[in] senderState The current state of the sender machine, or NULL for the host, as for PrtSend.
+	* @param[in,out] receiver The machine that will receive the event.
+	* @param[in] event The event to send (cloned, user frees).
+	* @param[in] payload The payload (cloned, user frees), or NULL for a null value.
+	* @returns Whether the event was taken; an event that was not is freed.
+	* @see PrtSetAdmissionPolicy
+	*/
+	PRT_API PRT_SEND_STATUS PRT_CALL_CONV PrtTrySend(
+		_In_ PRT_MACHINESTATE *senderState,
+		_Inout_ PRT_MACHINEINST *receiver,
+		_In_ PRT_VALUE *event,
+		_In_ PRT_VALUE *payload
+	);
+
+	/** Sets the admission policy that decides which events sent with PrtTrySend the machines of a type take. Each
+	* machine keeps its own count of queue delay and tokens. Must be called before PrtTrySend sends to machines of the type.
+	* @param[in,out] process The process.
+	* @param[in] renamedMachine The machine type, as for PrtMkMachine.
+	* @param[in] policy The policy (copied); PRT_ADMISSION_ALWAYS by default.
+	* @see PrtTrySend
+	*/
+	PRT_API void PRT_CALL_CONV PrtSetAdmissionPolicy(
+		_Inout_ PRT_PROCESS *process,
+		_In_ PRT_UINT32 renamedMachine,
+		_In_ PRT_ADMISSION_POLICY *policy
+	);
+
+	/** Sends the same event to many machines of a process. The payload is type checked and copied once, and the copy is
+	* shared by the queues of all the receivers, each of which gets a copy of its own only when it dequeues the event;
+	* a receiver that halts first never copies it. So fanning an event out costs the sender little more than taking the
+	* lock of each receiver, however large the payload.
+	* @param[in] senderState The current state of the sender machine, or NULL for the host, as for PrtSend.
+	* @param[in,out] receivers The machines that will receive the event, all of the same process.
+	* @param[in] nReceivers The number of receivers.
+	* @param[in] event The event to send (cloned, user frees).
+	* @param[in] payload The payload (cloned, user frees), or NULL for a null value.
+	* @see PrtSend
+	*/
+	PRT_API void PRT_CALL_CONV PrtBroadcast(
+		_In_ PRT_MACHINESTATE *senderState,
+		_Inout_ PRT_MACHINEINST **receivers,
+		_In_ PRT_UINT32 nReceivers,
+		_In_ PRT_VALUE *event,
+		_In_ PRT_VALUE *payload
+	);
+
+	/** Makes the handlers of a process hold back the events they send until the step they run in ends, and then send
+	* them grouped by receiver, so that a machine handling an event that fans out to several others locks and schedules
+	* each of them once, however many events it sends it. The events to each receiver keep the order they were sent in,
+	* but a receiver may get them after events another receiver of the same step sends it in the meantime. Under the
+	* task-neutral scheduler, no receiver runs before the handler that sends to it has finished. Off by default, and
+	* while the process is recorded or replayed.
+	* @param[in,out] process The process.
+	* @param[in] buffer PRT_TRUE to hold back sends, PRT_FALSE to send each at once.
+	*/
+	PRT_API void PRT_CALL_CONV PrtSetSendBuffering(
+		_Inout_ PRT_PROCESS *process,
+		_In_ PRT_BOOLEAN buffer
+	);
+
+	/** Makes a group of machines of one type, among which keys are shared out, so that each key always goes to the same
+	* member. Events are sent to the member of a key with PrtSendToGroup, straight from the sender, so sharded state
+	* needs no router machine that every request goes through. Keys are routed with consistent hashing: when the group
+	* grows from n to m members, only the share of keys that go to the new members, (m - n) / m, moves.
+	* @param[in,out] process The process that will own the members.
+	* @param[in] renamedMachine The machine type of the members, as for PrtMkMachine.
+	* @param[in] size The number of members, at least 1.
+	* @param[in] payload The payload to pass to the start state of every member (cloned, user frees), or NULL for a null value.
+	* @returns The group; freed by PrtFreeMachineGroup or when the process stops. Its members are machines of the process.
+	* @see PrtResizeMachineGroup
+	*/
+	PRT_API PRT_MACHINE_GROUP * PRT_CALL_CONV PrtMkMachineGroup(
+		_Inout_ PRT_PROCESS *process,
+		_In_ PRT_UINT32 renamedMachine,
+		_In_ PRT_UINT32 size,
+		_In_ PRT_VALUE *payload
+	);
+
+	/** Changes the number of members keys are routed to. A group that grows makes the members it has not had yet; one
+	* that shrinks keeps the members it leaves out, which handle the events they have, and routes keys to them again if it
+	* grows back. Not to be called for a group while it is being resized on another thread.
+	* @param[in,out] group The group.
+	* @param[in] size The number of members, at least 1.
+	*/
+	PRT_API void PRT_CALL_CONV PrtResizeMachineGroup(
+		_Inout_ PRT_MACHINE_GROUP *group,
+		_In_ PRT_UINT32 size
+	);
+
+	/** Gets the number of members keys are routed to.
+	* @param[in] group The group.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtGetMachineGroupSize(_In_ PRT_MACHINE_GROUP *group);
+
+	/** Gets the member of a group that a key is routed to.
+	* @param[in] group The group.
+	* @param[in] key The key; keys equal by PrtIsEqualValue go to the same member.
+	*/
+	PRT_API PRT_MACHINEINST * PRT_CALL_CONV PrtGetGroupMember(
+		_In_ PRT_MACHINE_GROUP *group,
+		_In_ PRT_VALUE *key
+	);
+
+	/** Sends an event to the member of a group that a key is routed to.
+	* @param[in] senderState The current state of the sender machine, or NULL for the host, as for PrtSend.
+	* @param[in] group The group.
+	* @param[in] key The key.
+	* @param[in] event The event to send (cloned, user frees).
+	* @param[in] payload The payload (cloned, user frees), or NULL for a null value.
+	*/
+	PRT_API void PRT_CALL_CONV PrtSendToGroup(
+		_In_ PRT_MACHINESTATE *senderState,
+		_In_ PRT_MACHINE_GROUP *group,
+		_In_ PRT_VALUE *key,
+		_In_ PRT_VALUE *event,
+		_In_ PRT_VALUE *payload
+	);
+
+	/** Frees a group made by PrtMkMachineGroup. Its members go on as machines of the process.
+	* @param[in,out] group The group.
+	*/
+	PRT_API void PRT_CALL_CONV PrtFreeMachineGroup(_Inout_ PRT_MACHINE_GROUP *group);
+
 	/** Sends message to P state machine.  This is for internal use only.
 	* @param[in] sender The sender machine (from which we compute the PRT_MACHINESTATE) for PrtSend.
 	* @param[in,out] receiver The machine that will receive this message.
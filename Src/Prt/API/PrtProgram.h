@@ -50,6 +50,7 @@ typedef struct PRT_EVENTDECL
 
 	PRT_UINT32 nAnnotations;      /**< Number of annotations                                                   */
 	void       **annotations;     /**< An array of annotations                                                 */
+	PRT_UINT32 timeToLive;        /**< Milliseconds an instance may wait in a queue before it expires, 0 for ever */
 } PRT_EVENTDECL;
 
 /** Represents a set of P events and the set packed into a bit vector */
@@ -91,7 +92,7 @@ typedef struct PRT_FUNDECL
 	PRT_UINT32 declIndex;        /**< index of function in owner machine                                    */
 	PRT_UINT32 ownerMachIndex;   /**< index of owner machine in program                                     */
 	PRT_STRING name;             /**< name (NULL is anonymous)                                              */
-	PRT_SM_FUN implementation;   /**< implementation                                                        */
+	PRT_SM_FUN implementation;   /**< implementation (NULL if the body is empty and never called directly) */
 	PRT_UINT32 numParameters;    /**< number of parameters (1 for anonymous functions)                      */
 	PRT_UINT32 maxNumLocals;     /**< number of local variables including nested scopes                     */
 	PRT_UINT32 numEnvVars;       /**< number of local variables in enclosing scopes (0 for named functions) */
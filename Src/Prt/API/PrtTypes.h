@@ -151,6 +151,23 @@ typedef PRT_STRING(PRT_CALL_CONV *PRT_FORGN_TOSTRING)(_In_ PRT_UINT64 frgnVal);
 */
 typedef PRT_BOOLEAN(PRT_CALL_CONV *PRT_FORGN_ISEQUAL)(_In_ PRT_UINT64 frgnVal1, _In_ PRT_UINT64 frgnVal2);
 
+struct PRT_BYTE_BUFFER; /* forward declaration */
+
+/** The PRT_FORGN_SERIALIZE function is called to write a foreign value into a process checkpoint.
+*   It must append enough bytes to buffer, with PrtWriteBytes, for PRT_FORGN_DESERIALIZE to rebuild an equal value in another process.
+*   @see PRT_FORGN_DESERIALIZE
+*   @see PrtCheckpointProcess
+*/
+typedef void(PRT_CALL_CONV *PRT_FORGN_SERIALIZE)(_In_ PRT_UINT64 frgnVal, _Inout_ struct PRT_BYTE_BUFFER *buffer);
+
+/** The PRT_FORGN_DESERIALIZE function is called to rebuild a foreign value written by PRT_FORGN_SERIALIZE.
+*   It must read, with PrtReadBytes, exactly the bytes that were written, advancing position past them.
+*   The bytes it is given are known to hold as many as were written; a value that reads any other number is rejected.
+*   @see PRT_FORGN_SERIALIZE
+*   @see PrtRestoreProcess
+*/
+typedef PRT_UINT64(PRT_CALL_CONV *PRT_FORGN_DESERIALIZE)(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position);
+
 /** Represents a P foreign type declaration */
 typedef struct PRT_FOREIGNTYPEDECL
 {
@@ -166,6 +183,9 @@ typedef struct PRT_FOREIGNTYPEDECL
 
 	PRT_UINT32      nAnnotations;   /**< Number of annotations                              */
 	void            **annotations;  /**< An array of annotations                            */
+
+	PRT_FORGN_SERIALIZE   serializeFun;   /**< Function that writes a value to a checkpoint, NULL if values cannot be checkpointed */
+	PRT_FORGN_DESERIALIZE deserializeFun; /**< Function that reads a value from a checkpoint, NULL if values cannot be checkpointed */
 } PRT_FOREIGNTYPEDECL;
 
 /* The number of foreign type decls */
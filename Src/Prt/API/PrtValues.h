@@ -571,13 +571,107 @@ extern "C"{
 	*/
 	PRT_API void PRT_CALL_CONV PrtFreeValue(_Inout_ PRT_VALUE *value);
 
+	/** A growable array of bytes that values are serialized into. Zero-initialize before the first write.
+	*/
+	typedef struct PRT_BYTE_BUFFER
+	{
+		PRT_UINT8  *bytes;     /**< The bytes written so far, NULL if none.      */
+		PRT_UINT32 size;       /**< The number of bytes written.                 */
+		PRT_UINT32 capacity;   /**< The number of bytes that fit before resizing. */
+	} PRT_BYTE_BUFFER;
+
+	/** Appends count bytes to a buffer. The buffer is grown with PrtRealloc as needed, and freed with PrtFree.
+	* @param[in,out] buffer The buffer to append to.
+	* @param[in] bytes The bytes to append.
+	* @param[in] count The number of bytes to append.
+	*/
+	PRT_API void PRT_CALL_CONV PrtWriteBytes(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ const void *bytes, _In_ PRT_UINT32 count);
+
+	/** Copies count bytes out of an array of serialized data.
+	* @param[in] bytes The serialized data.
+	* @param[in,out] position The index of the first byte to read; advanced past the bytes read.
+	* @param[out] dest Receives the bytes.
+	* @param[in] count The number of bytes to read.
+	*/
+	PRT_API void PRT_CALL_CONV PrtReadBytes(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position, _Out_ void *dest, _In_ PRT_UINT32 count);
+
+	/** Copies count bytes out of size bytes of serialized data, if that many are left.
+	* @param[in] bytes The serialized data.
+	* @param[in] size The number of bytes in bytes.
+	* @param[in,out] position The index of the first byte to read; advanced past the bytes read.
+	* @param[out] dest Receives the bytes.
+	* @param[in] count The number of bytes to read.
+	* @returns PRT_TRUE if the bytes were read, PRT_FALSE if fewer than count are left.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtTryReadBytes(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _Out_ void *dest, _In_ PRT_UINT32 count);
+
+	/** Appends an unsigned integer 7 bits at a time, so that numbers below 128 take a single byte.
+	* @param[in,out] buffer The buffer to append to.
+	* @param[in] value The number to append.
+	*/
+	PRT_API void PRT_CALL_CONV PrtWriteVarUInt32(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_UINT32 value);
+
+	/** Reads an unsigned integer written by PrtWriteVarUInt32.
+	* @param[in] bytes The serialized data.
+	* @param[in,out] position The index of the first byte to read; advanced past the bytes read.
+	* @returns The number.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtReadVarUInt32(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position);
+
+	/** Reads an unsigned integer written by PrtWriteVarUInt32 out of size bytes of serialized data.
+	* @param[in] bytes The serialized data.
+	* @param[in] size The number of bytes in bytes.
+	* @param[in,out] position The index of the first byte to read; advanced past the bytes read.
+	* @param[out] value Receives the number.
+	* @returns PRT_TRUE if a number was read, PRT_FALSE if the data ends first or does not hold a 32-bit number.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtTryReadVarUInt32(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _Out_ PRT_UINT32 *value);
+
+	/** Says how foreign values are encoded by PrtSerializeValue. */
+	typedef enum PRT_SERIALIZE_MODE
+	{
+		PRT_SERIALIZE_LOCAL,    /**< Foreign values are cloned into the encoding by handle. Decode once, in this address space. */
+		PRT_SERIALIZE_PORTABLE  /**< Foreign values are encoded by the serializeFun of their type. Decode anywhere the program is loaded. */
+	} PRT_SERIALIZE_MODE;
+
+	/** Appends a compact binary encoding of value to a buffer. Small integers and lengths take a single byte.
+	* @param[in,out] buffer The buffer to append to.
+	* @param[in] value The value to serialize.
+	* @param[in] mode How to encode foreign values. PRT_SERIALIZE_PORTABLE requires serializeFun on every foreign type in value.
+	* @see PrtDeserializeValue
+	*/
+	PRT_API void PRT_CALL_CONV PrtSerializeValue(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_VALUE *value, _In_ PRT_SERIALIZE_MODE mode);
+
+	/** Rebuilds a value written by PrtSerializeValue. A PRT_SERIALIZE_LOCAL encoding owns the foreign handles in it,
+	* so it must be deserialized exactly once.
+	* @param[in] bytes The serialized data.
+	* @param[in,out] position The index of the encoded value; advanced past it.
+	* @param[in] mode The mode the value was serialized with.
+	* @returns The value. Caller is responsible for freeing.
+	*/
+	PRT_API PRT_VALUE * PRT_CALL_CONV PrtDeserializeValue(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position, _In_ PRT_SERIALIZE_MODE mode);
+
+	/** Rebuilds a value written by PrtSerializeValue out of size bytes of data that may be truncated or corrupt, such as a
+	* file. Kinds, lengths and foreign type tags are checked against what is left; event indices and machine ids are not.
+	* @param[in] bytes The serialized data.
+	* @param[in] size The number of bytes in bytes.
+	* @param[in,out] position The index of the encoded value; advanced past it.
+	* @param[in] mode The mode the value was serialized with.
+	* @returns The value, or NULL if the data does not hold one. Caller is responsible for freeing.
+	* @see PrtDeserializeValue
+	*/
+	PRT_API PRT_VALUE * PRT_CALL_CONV PrtTryDeserializeValue(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _In_ PRT_SERIALIZE_MODE mode);
+
 	/** Shallow test that value members are non-null.
 	* @param[in] value The value to check.
 	*/
 	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtIsValidValue(_In_ PRT_VALUE *value);
 
-	/** Nondeterministic Boolean choice
+	/** Nondeterministic Boolean choice. A choice made by a machine is drawn from the stream of the machine,
+	* and is recorded or replayed along with its process; other choices come from PrtChoose.
 	* @returns A nondeterministic Boolean value.  Caller is responsible for freeing.
+	* @see PrtSetChoiceSeed
+	* @see PrtStartRecording
 	*/
 	PRT_API PRT_VALUE * PRT_CALL_CONV PrtMkNondetBoolValue(void);
 
@@ -7,6 +7,69 @@ void PrtSetForeignTypes(
 	prtForeignTypeDecls = program->foreignTypes;
 }
 
+/* Odd multiplier that spreads the clock over the bits of a default choice seed */
+#define PRT_CHOICE_SEED_MIX 0x9E3779B97F4A7C15ULL
+
+/* The number of processes started so far */
+static volatile PRT_UINT32 prtProcessCount = 0;
+
+static PRT_UINT64 PRT_CALL_CONV PrtGetPlatformTime(_Inout_ void *state)
+{
+	return PrtGetMonotonicTime();
+}
+
+// Fires the timers of a task-neutral process on the platform clock; a clock set by PrtSetClock is left to the host.
+static void PRT_CALL_CONV PrtRunTimerThread(_Inout_ void *arg)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)arg;
+	while (!process->timerThreadStopping)
+	{
+		long maxWaitTime = -1;
+		if (process->clock.nowFun == &PrtGetPlatformTime)
+		{
+			PrtAdvanceTimerWheel(&process->timers, PrtGetMonotonicTime());
+			PRT_UINT32 delay = PrtGetTimerDelay(&process->timers, PrtGetMonotonicTime());
+			maxWaitTime = delay == PRT_TIMER_NONE ? -1 : (long)delay;
+		}
+		PrtWaitSemaphore(process->timerWake, maxWaitTime);
+	}
+	PrtFlushArenaCaches();
+}
+
+// Called under the lock of the timer wheel of a process when a timer is armed ahead of the time the threads that fire
+// its timers sleep until: the workers of a cooperative process, or the timer thread of a task-neutral one.
+static void PrtWakeTimerWaiters(_Inout_ void *state)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)state;
+	if (process->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE)
+	{
+		PrtSignalWork(process);
+	}
+	else if (process->clock.nowFun == &PrtGetPlatformTime && !process->timerThreadStopping)
+	{
+		if (process->timerWake == NULL)
+		{
+			process->timerWake = PrtCreateSemaphore(0, 32767);
+			process->timerThread = PrtCreateThread(&PrtRunTimerThread, process);
+		}
+		PrtReleaseSemaphore(process->timerWake);
+	}
+}
+
+static void PrtStopTimerThread(_Inout_ PRT_PROCESS_PRIV *process)
+{
+	PrtAcquireLock(&process->timers.lock);
+	process->timerThreadStopping = PRT_TRUE;
+	PRT_SEMAPHORE timerWake = process->timerWake;
+	PrtReleaseLock(&process->timers.lock);
+	if (timerWake != NULL)
+	{
+		PrtReleaseSemaphore(timerWake);
+		PrtJoinThread(process->timerThread);
+		PrtDestroySemaphore(timerWake);
+	}
+}
+
 /*********************************************************************************
 
 Public Functions
@@ -19,46 +82,173 @@ PrtStartProcess(
     _In_ PRT_ERROR_FUN errorFun,
     _In_ PRT_LOG_FUN logFun
 )
+{
+	return PrtStartProcessEx(guid, program, errorFun, logFun, NULL);
+}
+
+PRT_PROCESS *
+PrtStartProcessEx(
+    _In_ PRT_GUID guid,
+    _In_ PRT_PROGRAMDECL *program,
+    _In_ PRT_ERROR_FUN errorFun,
+    _In_ PRT_LOG_FUN logFun,
+    _In_ PRT_ALLOCATOR *allocator
+)
 {
 	PrtSetForeignTypes(program);
 
     PRT_PROCESS_PRIV *process;
+    PRT_ALLOCATOR *prevAllocator = PrtSetAllocator(allocator);
     process = (PRT_PROCESS_PRIV *)PrtMalloc(sizeof(PRT_PROCESS_PRIV));
+    PrtSetAllocator(prevAllocator);
     process->guid = guid;
     process->program = program;
     process->errorHandler = errorFun;
     process->logHandler = logFun;
-    process->processLock = PrtCreateMutex();
+    PrtInitLock(&process->processLock);
     process->machineCount = 0;
     process->machines = NULL;
     process->numMachines = 0;
     process->schedulingPolicy = PRT_SCHEDULINGPOLICY_TASKNEUTRAL;
     process->schedulerInfo = NULL;
     process->terminating = PRT_FALSE;
+    process->allocator = allocator;
+    process->memory.allocator = allocator;
+    process->memory.parent = NULL;
+    process->memory.tracked = PRT_FALSE;
+    process->memory.quota = 0;
+    process->memory.used = 0;
+    process->memory.overQuota = PRT_FALSE;
+    process->memory.exceeded = PRT_FALSE;
+    process->machineQuota = 0;
+    process->quotaPolicy = PRT_QUOTAPOLICY_REPORT;
+    process->idlePeriod = PRT_HIBERNATE_NEVER;
+    process->hibernateCursor = 0;
+    process->recorder = NULL;
+    process->replayer = NULL;
+    process->numaNodes = NULL;
+    process->clock.nowFun = &PrtGetPlatformTime;
+    process->clock.state = NULL;
+    PrtInitTimerWheel(&process->timers, PrtGetMonotonicTime(), &PrtWakeTimerWaiters, process);
+    process->timerWake = NULL;
+    process->timerThreadStopping = PRT_FALSE;
+    process->eventTimers = NULL;
+    process->groups = NULL;
+    process->expiryEvent = PRT_SPECIAL_EVENT_NULL;
+    process->admission = NULL;
+    process->hasCalls = PRT_FALSE;
+    process->bufferSends = PRT_FALSE;
+    PrtIndexFunctions(process);
+    process->helperThreads = PRT_HELPER_THREADS_DEFAULT;
+    process->helpers = NULL;
+    process->io = NULL;
+    // processes started in the same millisecond still get different seeds.
+    process->choiceSeed = PrtGetMonotonicTime() * PRT_CHOICE_SEED_MIX + PrtAtomicIncrement(&prtProcessCount);
 
     return (PRT_PROCESS *)process;
 }
 
+PRT_API void
+PrtSetChoiceSeed(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_UINT64 seed
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAcquireLock(&privateProcess->processLock);
+	privateProcess->choiceSeed = seed;
+	for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
+	{
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)privateProcess->machines[i];
+		if (!(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED))
+		{
+			PrtSeedMachineChoices(context);
+		}
+	}
+	PrtReleaseLock(&privateProcess->processLock);
+}
+
+PRT_API PRT_UINT64
+PrtGetChoiceSeed(
+	_In_ PRT_PROCESS *process
+)
+{
+	return ((PRT_PROCESS_PRIV *)process)->choiceSeed;
+}
+
+PRT_API void
+PrtSetClock(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_CLOCK *clock
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(privateProcess->timers.armed == 0, "The clock of a process is set before any machine waits on it");
+	if (clock != NULL)
+	{
+		privateProcess->clock = *clock;
+	}
+	else
+	{
+		privateProcess->clock.nowFun = &PrtGetPlatformTime;
+		privateProcess->clock.state = NULL;
+	}
+	privateProcess->timers.cursor = PrtGetProcessTime(process);
+
+	// the timer thread waits on the clock it had; the next timer wakes it up to look at this one.
+	privateProcess->timers.wakeAt = PRT_TIMER_WAKE_NEVER;
+}
+
+PRT_API PRT_UINT64
+PrtGetProcessTime(
+	_In_ PRT_PROCESS *process
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	return privateProcess->clock.nowFun(privateProcess->clock.state);
+}
+
+PRT_API PRT_UINT32
+PrtFireTimers(
+	_Inout_ PRT_PROCESS *process
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	if (privateProcess->timers.armed == 0)
+	{
+		return 0;
+	}
+	return PrtAdvanceTimerWheel(&privateProcess->timers, PrtGetProcessTime(process));
+}
+
 PRT_API PRT_BOOLEAN
 PrtWaitForWork(PRT_PROCESS* process)
 {
     PRT_PROCESS_PRIV* privateProcess = (PRT_PROCESS_PRIV*)process;
-    PrtLockMutex(privateProcess->processLock);
+    PrtAcquireLock(&privateProcess->processLock);
 
     PrtAssert(privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE, "PrtWaitForWork can only be called when PrtSetSchedulingPolicy has set PRT_SCHEDULINGPOLICY_COOPERATIVE mode");
     PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
 
-    info->threadsWaiting++;
+    PrtAtomicIncrement(&info->threadsWaiting);
 
-    PrtUnlockMutex(privateProcess->processLock);
+    PrtReleaseLock(&privateProcess->processLock);
 
-    PrtWaitSemaphore(info->workAvailable, -1);
+    // a worker that goes to sleep while a timer is armed wakes up in time for PrtStepProcess to fire it, and one
+    // armed later wakes it if it is due sooner.
+    PRT_UINT32 delay = PrtGetTimerDelay(&privateProcess->timers, PrtGetProcessTime(process));
+    long maxWaitTime = delay == PRT_TIMER_NONE ? -1 : (long)delay;
+
+    // work scheduled after the last PrtStepProcess of this thread, while no thread was counted, signalled nobody.
+    if (PrtAtomicCompareExchange(&info->workPending, 1, 0) != 1)
+    {
+        PrtWaitSemaphore(info->workAvailable, maxWaitTime);
+    }
 
-    PrtLockMutex(privateProcess->processLock);
-    info->threadsWaiting--;
+    PrtAcquireLock(&privateProcess->processLock);
+    PRT_UINT32 threadsWaiting = PrtAtomicDecrement(&info->threadsWaiting);
     PRT_BOOLEAN terminating = privateProcess->terminating;
-    PRT_UINT32 threadsWaiting = info->threadsWaiting;
-    PrtUnlockMutex(privateProcess->processLock);
+    PrtReleaseLock(&privateProcess->processLock);
 
     if (terminating && threadsWaiting == 0)
     {
@@ -91,6 +281,7 @@ PrtSetSchedulingPolicy(PRT_PROCESS *process, PRT_SCHEDULINGPOLICY policy)
 
             info->workAvailable = PrtCreateSemaphore(0, 32767);
             info->threadsWaiting = 0;
+            info->workPending = 0;
             info->allThreadsStopped = PrtCreateSemaphore(0, 32767);
 
             privateProcess->schedulerInfo = info;
@@ -117,10 +308,12 @@ PrtRunProcess(PRT_PROCESS *process
         PRT_STEP_RESULT result = PrtStepProcess(process);
         switch (result) {
         case PRT_STEP_TERMINATING:
+            PrtFlushArenaCaches();
             return;
         case PRT_STEP_IDLE:
             if (PrtWaitForWork(process) == PRT_TRUE)
             {
+                PrtFlushArenaCaches();
                 return;
             }
             break;
@@ -131,6 +324,199 @@ PrtRunProcess(PRT_PROCESS *process
     }
 }
 
+PRT_API void
+PrtSetMemoryQuotas(
+	_Inout_ PRT_PROCESS *process,
+	_In_ size_t processQuota,
+	_In_ size_t machineQuota,
+	_In_ PRT_QUOTAPOLICY policy
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAcquireLock(&privateProcess->processLock);
+	privateProcess->memory.tracked = PRT_TRUE;
+	privateProcess->memory.quota = processQuota;
+	privateProcess->machineQuota = machineQuota;
+	privateProcess->quotaPolicy = policy;
+	for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
+	{
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)privateProcess->machines[i];
+		context->memory.tracked = PRT_TRUE;
+		context->memory.quota = machineQuota;
+	}
+	for (PRT_UINT32 i = 0; privateProcess->numaNodes != NULL && i < privateProcess->numaTopology.nNodes; i++)
+	{
+		privateProcess->numaNodes[i].memory.tracked = PRT_TRUE;
+	}
+	PrtReleaseLock(&privateProcess->processLock);
+}
+
+PRT_API void
+PrtSetMachineMemoryQuota(
+	_Inout_ PRT_MACHINEINST *machine,
+	_In_ size_t quota
+)
+{
+	((PRT_MACHINEINST_PRIV *)machine)->memory.quota = quota;
+}
+
+PRT_API size_t
+PrtGetProcessMemoryUsage(
+	_In_ PRT_PROCESS *process
+)
+{
+	return ((PRT_PROCESS_PRIV *)process)->memory.used;
+}
+
+PRT_API size_t
+PrtGetMachineMemoryUsage(
+	_In_ PRT_MACHINEINST *machine
+)
+{
+	return ((PRT_MACHINEINST_PRIV *)machine)->memory.used;
+}
+
+PRT_API void
+PrtSetHibernationPolicy(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_UINT32 idlePeriod
+)
+{
+	((PRT_PROCESS_PRIV *)process)->idlePeriod = idlePeriod;
+}
+
+PRT_API PRT_UINT32
+PrtHibernateIdleMachines(
+	_Inout_ PRT_PROCESS *process
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_UINT32 hibernated = 0;
+	if (privateProcess->idlePeriod == PRT_HIBERNATE_NEVER)
+	{
+		return 0;
+	}
+
+	PRT_UINT64 now = PrtGetMonotonicTime();
+	PrtAcquireLock(&privateProcess->processLock);
+	PRT_UINT32 numMachines = privateProcess->numMachines;
+	PrtReleaseLock(&privateProcess->processLock);
+	for (PRT_UINT32 i = 0; i < numMachines; i++)
+	{
+		PrtAcquireLock(&privateProcess->processLock);
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)privateProcess->machines[i];
+		PrtReleaseLock(&privateProcess->processLock);
+
+		PrtAcquireLock(&context->stateMachineLock);
+		if (now - context->idleSince >= privateProcess->idlePeriod && PrtHibernateMachine(context))
+		{
+			hibernated++;
+		}
+		PrtReleaseLock(&context->stateMachineLock);
+	}
+	return hibernated;
+}
+
+PRT_API PRT_BOOLEAN
+PrtIsMachineHibernated(
+	_In_ PRT_MACHINEINST *machine
+)
+{
+	return ((PRT_MACHINEINST_PRIV *)machine)->hibernatedState != NULL;
+}
+
+/* The home node of machines made by this thread, PRT_NUMA_NODE_ANY for the node it runs on */
+static PRT_THREAD_LOCAL PRT_UINT32 prtPlacementHint = PRT_NUMA_NODE_ANY;
+
+static PRT_UINT32 PRT_CALL_CONV PrtGetPlatformNode(_Inout_ void *state)
+{
+	return PrtGetCurrentNumaNode();
+}
+
+PRT_API void
+PrtSetNumaTopology(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_NUMA_TOPOLOGY *topology
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(privateProcess->numMachines == 0, "The topology must be set before the first machine is made");
+	PrtAssert(privateProcess->numaNodes == NULL, "The topology can only be set once");
+	if (topology != NULL)
+	{
+		PrtAssert(topology->nNodes > 0 && topology->currentNodeFun != NULL, "Topology must have a node and a way to find it");
+		privateProcess->numaTopology = *topology;
+	}
+	else
+	{
+		privateProcess->numaTopology.nNodes = PrtGetNumaNodeCount();
+		privateProcess->numaTopology.currentNodeFun = &PrtGetPlatformNode;
+		privateProcess->numaTopology.state = NULL;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+	PRT_NUMA_NODE *nodes = (PRT_NUMA_NODE *)PrtCalloc(privateProcess->numaTopology.nNodes, sizeof(PRT_NUMA_NODE));
+	PrtSetMemoryAccount(prevAccount);
+	for (PRT_UINT32 i = 0; i < privateProcess->numaTopology.nNodes; i++)
+	{
+		nodes[i].allocator = PrtMkNodeArenaAllocator(i);
+		nodes[i].memory.allocator = nodes[i].allocator;
+		nodes[i].memory.parent = &privateProcess->memory;
+		nodes[i].memory.tracked = privateProcess->memory.tracked;
+	}
+	privateProcess->numaNodes = nodes;
+}
+
+PRT_API PRT_UINT32
+PrtSetPlacementHint(
+	_In_ PRT_UINT32 node
+)
+{
+	PRT_UINT32 previous = prtPlacementHint;
+	prtPlacementHint = node;
+	return previous;
+}
+
+PRT_API PRT_UINT32
+PrtGetMachineHomeNode(
+	_In_ PRT_MACHINEINST *machine
+)
+{
+	return ((PRT_MACHINEINST_PRIV *)machine)->homeNode;
+}
+
+PRT_UINT32
+PrtChooseHomeNode(
+	_In_ PRT_PROCESS_PRIV *process
+)
+{
+	if (process->numaNodes == NULL)
+	{
+		return PRT_NUMA_NODE_ANY;
+	}
+	PRT_UINT32 node = prtPlacementHint != PRT_NUMA_NODE_ANY
+		? prtPlacementHint
+		: process->numaTopology.currentNodeFun(process->numaTopology.state);
+	PrtAssert(node < process->numaTopology.nNodes, "Home node must be a node of the process topology");
+	return node;
+}
+
+void
+PrtFreeNumaNodes(
+	_Inout_ PRT_PROCESS_PRIV *process
+)
+{
+	if (process->numaNodes != NULL)
+	{
+		for (PRT_UINT32 i = 0; i < process->numaTopology.nNodes; i++)
+		{
+			PrtFreeArenaAllocator(process->numaNodes[i].allocator);
+		}
+		PrtFree(process->numaNodes);
+		process->numaNodes = NULL;
+	}
+}
+
 void
 PrtStopProcess(
 	_Inout_ PRT_PROCESS* process
@@ -138,7 +524,7 @@ PrtStopProcess(
 {
 	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
 
-	PrtLockMutex(privateProcess->processLock);
+	PrtAcquireLock(&privateProcess->processLock);
 	privateProcess->terminating = PRT_TRUE;
 	PRT_BOOLEAN waitForThreads = PRT_FALSE;
 	PRT_COOPERATIVE_SCHEDULER* info = NULL;
@@ -157,29 +543,45 @@ PrtStopProcess(
 			}
 		}
 	}
-	PrtUnlockMutex(privateProcess->processLock);
+	PrtReleaseLock(&privateProcess->processLock);
 
 	if (waitForThreads)
 	{
 		PrtWaitSemaphore(info->allThreadsStopped, -1);
 	}
+	PrtStopTimerThread(privateProcess);
+	PrtStopIoLoop(privateProcess);
+	PrtStopHelpers(privateProcess);
 
 	// ok, now we can safely start deleting things...
 	for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
+	{
+		PrtCleanupMachine((PRT_MACHINEINST_PRIV *)privateProcess->machines[i]);
+	}
+
+	// a foreign value a machine held may free an event timer, so the rest are freed only now.
+	PrtFreeEventTimers(privateProcess);
+	PrtFreeMachineGroups(privateProcess);
+
+	// a machine may hold values charged to another machine's account, so free the accounts only after every machine is cleaned up.
+	for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
 	{
 		PRT_MACHINEINST *context = privateProcess->machines[i];
 		PRT_MACHINEINST_PRIV * privContext = (PRT_MACHINEINST_PRIV *)context;
-		PrtCleanupMachine(privContext);
-		if (privContext->stateMachineLock != NULL)
-		{
-			PrtDestroyMutex(privContext->stateMachineLock);
-		}
+		PrtDestroyLock(&privContext->stateMachineLock);
+		PrtFree(privContext->callStack);
+		PrtFree(privContext->funStack);
 		PrtFree(context);
 	}
 
 	PrtFree(privateProcess->machines);
+	PrtFree(privateProcess->admission);
+	PrtDestroyTimerWheel(&privateProcess->timers);
+	PrtFreeFunctionIndex(privateProcess);
+	PrtFreeNumaNodes(privateProcess);
 	PrtDestroyCooperativeScheduler(info);
-	PrtDestroyMutex(privateProcess->processLock);
+	PrtFreeRecorder(privateProcess);
+	PrtDestroyLock(&privateProcess->processLock);
 	PrtFree(process);
 }
 
@@ -187,16 +589,7 @@ FORCEINLINE
 PRT_FUNDECL *
 GetFunDeclHelper(_In_ PRT_PROCESS	*process, _In_ PRT_UINT32 instanceOf, _In_ PRT_UINT32 funIndex)
 {
-	PRT_UINT32 isMachineLocal = funIndex % 2;
-	PRT_UINT32 arrayIndex = funIndex / 2;
-	if (isMachineLocal)
-	{
-		return &process->program->machines[instanceOf]->funs[arrayIndex];
-	}
-	else
-	{
-		return process->program->globalFuns[arrayIndex];
-	}
+	return ((PRT_PROCESS_PRIV *)process)->funTables[instanceOf][funIndex].decl;
 }
 
 
@@ -275,6 +668,7 @@ PrtMkMachine(
 {
 	PRT_VALUE *payload = NULL;
 	PRT_UINT32 instanceOf = ((PRT_PROCESS_PRIV *)process)->program->renameMap[renamedMachine];
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&((PRT_PROCESS_PRIV *)process)->memory);
 
 	if (numArgs == 0)
 	{
@@ -325,6 +719,7 @@ PrtMkMachine(
 	PRT_MACHINEINST* result = (PRT_MACHINEINST*)PrtMkMachinePrivate((PRT_PROCESS_PRIV *)process, renamedMachine, instanceOf, payload);
 	// free the payload since we cloned it here, and PrtMkMachinePrivate also clones it.
 	PrtFreeValue(payload);
+	PrtSetMemoryAccount(prevAccount);
 	return result;
 }
 
@@ -363,6 +758,8 @@ PrtSend(
 	...
 )
 {
+	// the payload is owned by the receiver from now on, so build it on the receiver's heap.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&((PRT_MACHINEINST_PRIV *)receiver)->memory);
 	PRT_VALUE *payload = NULL;
 	if (numArgs == 0)
 	{
@@ -408,8 +805,121 @@ PrtSend(
 		PrtFree(args);
 	}
     PrtSendPrivate(senderState, (PRT_MACHINEINST_PRIV *)receiver, event, payload);
+	PrtSetMemoryAccount(prevAccount);
+}
+
+void
+PrtSendWithTimeToLive(
+	_In_ PRT_MACHINESTATE			*senderState,
+	_Inout_ PRT_MACHINEINST			*receiver,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload,
+	_In_ PRT_UINT32					timeToLive
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)receiver;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_VALUE *copy = payload != NULL ? PrtCloneValue(payload) : PrtMkNullValue();
+	PrtSendPrivateWithTimeToLive(senderState, context, event, copy, timeToLive);
+	PrtSetMemoryAccount(prevAccount);
+}
+
+PRT_SEND_STATUS
+PrtTrySend(
+	_In_ PRT_MACHINESTATE			*senderState,
+	_Inout_ PRT_MACHINEINST			*receiver,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)receiver;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_VALUE *copy = payload != NULL ? PrtCloneValue(payload) : PrtMkNullValue();
+	PRT_SEND_STATUS status = PrtTrySendPrivate(senderState, context, event, copy);
+	PrtSetMemoryAccount(prevAccount);
+	return status;
+}
+
+void
+PrtSetExpiryEvent(
+	_Inout_ PRT_PROCESS				*process,
+	_In_ PRT_UINT32					eventIndex
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(eventIndex < privateProcess->program->nEvents && eventIndex != PRT_SPECIAL_EVENT_HALT, "The expiry event must be a valid event");
+	if (eventIndex != PRT_SPECIAL_EVENT_NULL)
+	{
+		PRT_VALUE *sample = PrtMkIntValue(0);
+		PrtAssert(PrtInhabitsType(sample, privateProcess->program->events[eventIndex]->type), "The expiry event must take an int payload");
+		PrtFreeValue(sample);
+	}
+	privateProcess->expiryEvent = eventIndex;
+}
+
+PRT_UINT32
+PrtGetExpiredEventCount(
+	_In_ PRT_MACHINEINST			*machine
+)
+{
+	return ((PRT_MACHINEINST_PRIV *)machine)->expiredEvents;
 }
 
+void
+PrtBroadcast(
+	_In_ PRT_MACHINESTATE			*senderState,
+	_Inout_ PRT_MACHINEINST			**receivers,
+	_In_ PRT_UINT32					nReceivers,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload
+)
+{
+	if (nReceivers == 0)
+	{
+		return;
+	}
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)receivers[0]->process;
+	PRT_VALUE *nullPayload = NULL;
+	if (payload == NULL)
+	{
+		nullPayload = PrtMkNullValue();
+		payload = nullPayload;
+	}
+	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
+	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType((PRT_MACHINEINST_PRIV *)receivers[0], event)), "Payload must be member of event payload type");
+
+	if (process->replayer != NULL)
+	{
+		// a replay may hold a send back until it is due, so every receiver gets a payload of its own.
+		for (PRT_UINT32 i = 0; i < nReceivers; i++)
+		{
+			PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&((PRT_MACHINEINST_PRIV *)receivers[i])->memory);
+			PrtSendPrivate(senderState, (PRT_MACHINEINST_PRIV *)receivers[i], event, PrtCloneValue(payload));
+			PrtSetMemoryAccount(prevAccount);
+		}
+		if (nullPayload != NULL)
+		{
+			PrtFreeValue(nullPayload);
+		}
+		return;
+	}
+
+	// the copy belongs to no one receiver, so it is charged to the process until the last of them lets go of it.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+	PRT_SHARED_PAYLOAD *shared = (PRT_SHARED_PAYLOAD *)PrtMalloc(sizeof(PRT_SHARED_PAYLOAD));
+	shared->value = PrtCloneValue(payload);
+	PrtSetMemoryAccount(prevAccount);
+	shared->refs = nReceivers;
+	if (nullPayload != NULL)
+	{
+		PrtFreeValue(nullPayload);
+	}
+	for (PRT_UINT32 i = 0; i < nReceivers; i++)
+	{
+		PrtAssert(receivers[i]->process == (PRT_PROCESS *)process, "A broadcast goes to machines of one process");
+		PrtSendShared(senderState, (PRT_MACHINEINST_PRIV *)receivers[i], event, shared);
+	}
+}
 
 void 
 PRT_CALL_CONV PrtSendInternal(
@@ -423,6 +933,7 @@ PRT_CALL_CONV PrtSendInternal(
 	PRT_MACHINESTATE senderState;
 	PrtGetMachineState(sender, &senderState);
 
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&((PRT_MACHINEINST_PRIV *)receiver)->memory);
 	PRT_VALUE *payload = NULL;
 	if (numArgs == 0)
 	{
@@ -469,4 +980,5 @@ PRT_CALL_CONV PrtSendInternal(
 	}
 
 	PrtSendPrivate(&senderState, (PRT_MACHINEINST_PRIV *)receiver, event, payload);
+	PrtSetMemoryAccount(prevAccount);
 }
\ No newline at end of file
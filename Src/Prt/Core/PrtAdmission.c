@@ -0,0 +1,154 @@
+#include "PrtExecution.h"
+
+//
+// Admission policies decide which of the events a host sends with PrtTrySend a machine takes. Each machine keeps its
+// own state for the policy of its type, made on the first PrtTrySend to it, so the machines that never see one pay for
+// nothing. The queue delay policy follows CoDel (Nichols and Jacobson): it looks at how long the events a machine
+// dequeues have waited, and once that has stayed above the target for a whole interval it sheds one event, then
+// another after interval / sqrt(2), and so on ever more often, until an event is dequeued in time again.
+//
+
+static PRT_UINT32 PrtSquareRoot(_In_ PRT_UINT32 n)
+{
+	PRT_UINT32 root = 0;
+	PRT_UINT32 bit = 1u << 30;
+	while (bit > n)
+	{
+		bit >>= 2;
+	}
+	while (bit != 0)
+	{
+		if (n >= root + bit)
+		{
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtSetAdmissionPolicy(
+	_Inout_ PRT_PROCESS				*process,
+	_In_ PRT_UINT32					renamedMachine,
+	_In_ PRT_ADMISSION_POLICY		*policy
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_PROGRAMDECL *program = privateProcess->program;
+	PrtAssert(policy->kind != PRT_ADMISSION_TOKEN_BUCKET || (policy->rate > 0 && policy->limit > 0), "A token bucket needs a rate and room for a token");
+	PrtAssert(policy->kind != PRT_ADMISSION_QUEUE_DELAY || policy->interval > 0, "The queue delay policy needs an interval");
+	PrtAssert(policy->kind != PRT_ADMISSION_CUSTOM || policy->admitFun != NULL, "A custom admission policy needs an admitFun");
+
+	PrtAcquireLock(&privateProcess->processLock);
+	if (privateProcess->admission == NULL)
+	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+		privateProcess->admission = (PRT_ADMISSION_POLICY *)PrtCalloc(program->nMachines, sizeof(PRT_ADMISSION_POLICY));
+		PrtSetMemoryAccount(prevAccount);
+	}
+	privateProcess->admission[program->renameMap[renamedMachine]] = *policy;
+	PrtReleaseLock(&privateProcess->processLock);
+}
+
+PRT_BOOLEAN
+PrtAdmitEvent(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_UINT32					eventIndex
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_ADMISSION_POLICY *policy = process->admission != NULL ? &process->admission[context->instanceOf] : NULL;
+	if (policy == NULL || policy->kind == PRT_ADMISSION_ALWAYS)
+	{
+		return PRT_TRUE;
+	}
+
+	PRT_ADMISSION_STATE *admission = context->admission;
+	if (admission == NULL)
+	{
+		// a bucket starts full, so that the first burst is taken.
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+		admission = (PRT_ADMISSION_STATE *)PrtCalloc(1, sizeof(PRT_ADMISSION_STATE));
+		PrtSetMemoryAccount(prevAccount);
+		admission->timesQueue = policy->kind == PRT_ADMISSION_QUEUE_DELAY;
+		admission->tokens = (PRT_UINT64)policy->limit * 1000;
+		admission->refilledAt = PrtGetProcessTime(context->process);
+		context->admission = admission;
+	}
+
+	PRT_UINT32 queueLength = context->eventQueue.size + context->batchCount;
+	switch (policy->kind)
+	{
+	case PRT_ADMISSION_QUEUE_LENGTH:
+		return queueLength < policy->limit;
+	case PRT_ADMISSION_TOKEN_BUCKET:
+	{
+		// tokens are counted in thousandths, so that a rate per second fills the bucket a little every millisecond.
+		PRT_UINT64 now = PrtGetProcessTime(context->process);
+		PRT_UINT64 full = (PRT_UINT64)policy->limit * 1000;
+		PRT_UINT64 tokens = admission->tokens + (now - admission->refilledAt) * policy->rate;
+		admission->tokens = tokens < full ? tokens : full;
+		admission->refilledAt = now;
+		if (admission->tokens < 1000)
+		{
+			return PRT_FALSE;
+		}
+		admission->tokens -= 1000;
+		return PRT_TRUE;
+	}
+	case PRT_ADMISSION_QUEUE_DELAY:
+	{
+		// an empty queue has no delay to speak of, whatever the last event dequeued waited.
+		if (!admission->shedding || queueLength == 0)
+		{
+			return PRT_TRUE;
+		}
+		PRT_UINT64 now = PrtGetProcessTime(context->process);
+		if (now < admission->shedNext)
+		{
+			return PRT_TRUE;
+		}
+		admission->shedCount++;
+		admission->shedNext = now + policy->interval / PrtSquareRoot(admission->shedCount + 1);
+		return PRT_FALSE;
+	}
+	case PRT_ADMISSION_CUSTOM:
+		return policy->admitFun(policy->state, (PRT_MACHINEINST *)context, eventIndex, queueLength);
+	default:
+		PrtAssert(PRT_FALSE, "Invalid admission policy");
+		return PRT_TRUE;
+	}
+}
+
+void
+PrtNoteQueueDelay(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_UINT64					enqueuedAt
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_ADMISSION_POLICY *policy = &process->admission[context->instanceOf];
+	PRT_ADMISSION_STATE *admission = context->admission;
+	PRT_UINT64 now = PrtGetProcessTime(context->process);
+	if (now < enqueuedAt + policy->limit)
+	{
+		admission->aboveSince = 0;
+		admission->shedding = PRT_FALSE;
+		admission->shedCount = 0;
+	}
+	else if (admission->aboveSince == 0)
+	{
+		admission->aboveSince = now;
+	}
+	else if (!admission->shedding && now >= admission->aboveSince + policy->interval)
+	{
+		admission->shedding = PRT_TRUE;
+		admission->shedNext = now;
+	}
+}
@@ -0,0 +1,537 @@
+#include "PrtExecution.h"
+
+/* Set in the owner of a block that is charged to a PRT_MEMORY_ACCOUNT rather than drawn from a bare PRT_ALLOCATOR */
+#define PRT_ALLOC_OWNER_ACCOUNT ((size_t)1)
+
+/* An account that went over its quota can report again once its usage is a quarter below the quota */
+#define PRT_QUOTA_REARM_DIVISOR 4
+
+/** Every block handed out by PrtMalloc is preceded by this header, so it can be returned to the allocator that produced it. */
+typedef struct PRT_ALLOC_HEADER
+{
+	size_t	owner;	/* the PRT_ALLOCATOR, or the PRT_MEMORY_ACCOUNT tagged with PRT_ALLOC_OWNER_ACCOUNT, of the block */
+	size_t	size;	/* the size requested by the caller */
+} PRT_ALLOC_HEADER;
+
+static void * PRT_CALL_CONV PrtDefaultAlloc(_Inout_ void *state, _In_ size_t size)
+{
+	void *ptr = malloc(size);
+	PrtAssert(ptr != NULL, "Memory allocation error");
+	return ptr;
+}
+
+static void * PRT_CALL_CONV PrtDefaultRealloc(_Inout_ void *state, _Inout_ void *ptr, _In_ size_t oldSize, _In_ size_t newSize)
+{
+	ptr = realloc(ptr, newSize);
+	PrtAssert(ptr != NULL, "Memory allocation error");
+	return ptr;
+}
+
+static void PRT_CALL_CONV PrtDefaultFree(_Inout_ void *state, _Inout_ void *ptr, _In_ size_t size)
+{
+	free(ptr);
+}
+
+/* The allocator used when a thread has not set one, backed by the system heap */
+static PRT_ALLOCATOR PrtDefaultAllocator = { &PrtDefaultAlloc, &PrtDefaultRealloc, &PrtDefaultFree, NULL };
+
+/* The allocator used by PrtMalloc on this thread; NULL means PrtDefaultAllocator */
+static PRT_THREAD_LOCAL PRT_ALLOCATOR *prtCurrentAllocator = NULL;
+
+/* The account of the machine or process the runtime is working for on this thread; overrides prtCurrentAllocator */
+static PRT_THREAD_LOCAL PRT_MEMORY_ACCOUNT *prtCurrentAccount = NULL;
+
+PRT_ALLOCATOR * PRT_CALL_CONV PrtSetAllocator(_In_ PRT_ALLOCATOR *allocator)
+{
+	PRT_ALLOCATOR *previous = prtCurrentAllocator;
+	prtCurrentAllocator = allocator;
+	return previous;
+}
+
+PRT_MEMORY_ACCOUNT *
+PrtSetMemoryAccount(
+	_In_ PRT_MEMORY_ACCOUNT *account
+)
+{
+	PRT_MEMORY_ACCOUNT *previous = prtCurrentAccount;
+	prtCurrentAccount = account;
+	return previous;
+}
+
+static void PrtChargeAccount(_Inout_ PRT_MEMORY_ACCOUNT *account, _In_ size_t bytes)
+{
+	for (; account != NULL; account = account->parent)
+	{
+		size_t used = PrtAtomicAdd(&account->used, bytes);
+		if (account->quota != 0 && used > account->quota && !account->overQuota)
+		{
+			account->overQuota = PRT_TRUE;
+			account->exceeded = PRT_TRUE;
+		}
+	}
+}
+
+static void PrtCreditAccount(_Inout_ PRT_MEMORY_ACCOUNT *account, _In_ size_t bytes)
+{
+	for (; account != NULL; account = account->parent)
+	{
+		size_t used = PrtAtomicAdd(&account->used, (size_t)0 - bytes);
+		// usage hovering around the quota must not report it over and over, so rearm only well below it.
+		if (account->overQuota && used <= account->quota - account->quota / PRT_QUOTA_REARM_DIVISOR)
+		{
+			account->overQuota = PRT_FALSE;
+		}
+	}
+}
+
+static PRT_ALLOCATOR *PrtGetBlockAllocator(_In_ PRT_ALLOC_HEADER *header, _Out_ PRT_MEMORY_ACCOUNT **account)
+{
+	if (header->owner & PRT_ALLOC_OWNER_ACCOUNT)
+	{
+		*account = (PRT_MEMORY_ACCOUNT *)(header->owner & ~PRT_ALLOC_OWNER_ACCOUNT);
+		return (*account)->allocator != NULL ? (*account)->allocator : &PrtDefaultAllocator;
+	}
+	*account = NULL;
+	return (PRT_ALLOCATOR *)header->owner;
+}
+
+void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
+{
+	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+	PRT_MEMORY_ACCOUNT *account = prtCurrentAccount;
+	PRT_ALLOCATOR *allocator = account != NULL ? account->allocator : prtCurrentAllocator;
+	if (allocator == NULL)
+	{
+		allocator = &PrtDefaultAllocator;
+	}
+	PRT_ALLOC_HEADER *header = (PRT_ALLOC_HEADER *)allocator->allocFun(allocator->state, sizeof(PRT_ALLOC_HEADER) + size);
+	PrtAssert(header != NULL, "Memory allocation error");
+	if (account != NULL && account->tracked)
+	{
+		PrtChargeAccount(account, sizeof(PRT_ALLOC_HEADER) + size);
+		header->owner = (size_t)account | PRT_ALLOC_OWNER_ACCOUNT;
+	}
+	else
+	{
+		header->owner = (size_t)allocator;
+	}
+	header->size = size;
+	return header + 1;
+}
+
+void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
+{
+	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+	PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
+	PrtAssert(nmemb <= ((size_t)-1 - sizeof(PRT_ALLOC_HEADER)) / size, "Memory allocation error");
+
+	void *ptr = PrtMalloc(nmemb * size);
+	memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+void * PRT_CALL_CONV PrtRealloc(_Inout_ void *ptr, _In_ size_t size)
+{
+	PrtAssert(ptr != NULL, "Memory must be non-null to avoid platform-specific behavior");
+	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+
+	PRT_ALLOC_HEADER *header = (PRT_ALLOC_HEADER *)ptr - 1;
+	PRT_MEMORY_ACCOUNT *account;
+	PRT_ALLOCATOR *allocator = PrtGetBlockAllocator(header, &account);
+	size_t owner = header->owner;
+	size_t oldSize = header->size;
+	PRT_ALLOC_HEADER *newHeader;
+	if (allocator->reallocFun != NULL)
+	{
+		newHeader = (PRT_ALLOC_HEADER *)allocator->reallocFun(allocator->state, header, sizeof(PRT_ALLOC_HEADER) + oldSize, sizeof(PRT_ALLOC_HEADER) + size);
+		PrtAssert(newHeader != NULL, "Memory allocation error");
+	}
+	else
+	{
+		newHeader = (PRT_ALLOC_HEADER *)allocator->allocFun(allocator->state, sizeof(PRT_ALLOC_HEADER) + size);
+		PrtAssert(newHeader != NULL, "Memory allocation error");
+		memcpy(newHeader + 1, header + 1, oldSize < size ? oldSize : size);
+		allocator->freeFun(allocator->state, header, sizeof(PRT_ALLOC_HEADER) + oldSize);
+	}
+	if (account != NULL)
+	{
+		if (size > oldSize)
+		{
+			PrtChargeAccount(account, size - oldSize);
+		}
+		else
+		{
+			PrtCreditAccount(account, oldSize - size);
+		}
+	}
+	newHeader->owner = owner;
+	newHeader->size = size;
+	return newHeader + 1;
+}
+
+void PRT_CALL_CONV PrtFree(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	PRT_ALLOC_HEADER *header = (PRT_ALLOC_HEADER *)ptr - 1;
+	PRT_MEMORY_ACCOUNT *account;
+	PRT_ALLOCATOR *allocator = PrtGetBlockAllocator(header, &account);
+	if (account != NULL)
+	{
+		PrtCreditAccount(account, sizeof(PRT_ALLOC_HEADER) + header->size);
+	}
+	allocator->freeFun(allocator->state, header, sizeof(PRT_ALLOC_HEADER) + header->size);
+}
+
+/*********************************************************************************
+
+Thread-caching arena
+
+Blocks of up to PRT_ARENA_MAX_BLOCK bytes are rounded up to a power of two and carved
+out of large chunks. Every thread keeps a few free blocks of each size class for the
+arenas it uses recently, and only takes the arena lock to exchange batches of blocks
+with the arena's shared free lists. Larger blocks come from the system heap and are
+linked into the arena so that PrtFreeArenaAllocator can release them. The chunks of an
+arena made for a NUMA node are placed on that node.
+
+A thread that makes room for another arena, or calls PrtFlushArenaCaches, hands the
+cached blocks back to their arena. Live arenas are found by id in a registry, so that
+the blocks of an arena freed meanwhile are dropped rather than handed back.
+
+*********************************************************************************/
+
+#define PRT_ARENA_MIN_BLOCK_SHIFT 4
+#define PRT_ARENA_NUM_CLASSES 8
+#define PRT_ARENA_MAX_BLOCK (1 << (PRT_ARENA_MIN_BLOCK_SHIFT + PRT_ARENA_NUM_CLASSES - 1))
+#define PRT_ARENA_CHUNK_SIZE (256 * 1024)
+#define PRT_ARENA_CACHE_SLOTS 4
+#define PRT_ARENA_CACHE_MAX 64
+#define PRT_ARENA_BATCH 32
+
+typedef struct PRT_ARENA_BLOCK
+{
+	struct PRT_ARENA_BLOCK *next;
+} PRT_ARENA_BLOCK;
+
+typedef struct PRT_ARENA_CHUNK
+{
+	struct PRT_ARENA_CHUNK *next;
+	PRT_UINT64				padding;	/* keeps the blocks that follow 16-byte aligned */
+} PRT_ARENA_CHUNK;
+
+typedef struct PRT_ARENA_LARGE
+{
+	struct PRT_ARENA_LARGE *prev;
+	struct PRT_ARENA_LARGE *next;
+} PRT_ARENA_LARGE;
+
+typedef struct PRT_ARENA
+{
+	PRT_ALLOCATOR		allocator;		/* must be first, PrtFreeArenaAllocator casts back */
+	PRT_UINT32			id;				/* never reused, identifies the arena in thread caches */
+	PRT_UINT32			node;			/* NUMA node the chunks are placed on, PRT_NUMA_NODE_ANY for the system heap */
+	struct PRT_ARENA	*nextArena;		/* in the registry; guarded by prtArenaRegistryLock */
+	PRT_LOCK			lock;			/* protects every field below */
+	PRT_ARENA_BLOCK		*freeLists[PRT_ARENA_NUM_CLASSES];
+	PRT_ARENA_CHUNK		*chunks;
+	char				*bump;
+	char				*bumpEnd;
+	PRT_ARENA_LARGE		*large;
+	size_t				size;			/* bytes held from the system in chunks and large blocks */
+} PRT_ARENA;
+
+typedef struct PRT_ARENA_CACHE
+{
+	PRT_UINT32			arenaId;
+	PRT_ARENA_BLOCK		*freeLists[PRT_ARENA_NUM_CLASSES];
+	PRT_UINT32			counts[PRT_ARENA_NUM_CLASSES];
+} PRT_ARENA_CACHE;
+
+static volatile PRT_UINT32 prtArenaCount = 0;
+
+/* The live arenas, and a spin lock for them that is taken before any arena lock */
+static PRT_ARENA *prtArenas = NULL;
+static volatile PRT_UINT32 prtArenaRegistryLock = 0;
+
+static PRT_THREAD_LOCAL PRT_ARENA_CACHE prtArenaCaches[PRT_ARENA_CACHE_SLOTS];
+static PRT_THREAD_LOCAL PRT_UINT32 prtArenaNextVictim = 0;
+
+static PRT_UINT32 PrtArenaSizeClass(_In_ size_t size)
+{
+	PRT_UINT32 sizeClass = 0;
+	size_t blockSize = 1 << PRT_ARENA_MIN_BLOCK_SHIFT;
+	while (blockSize < size)
+	{
+		blockSize <<= 1;
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+static void PrtLockArenaRegistry(void)
+{
+	while (PrtAtomicCompareExchange(&prtArenaRegistryLock, 0, 1) != 0)
+	{
+		PrtYieldThread();
+	}
+}
+
+static void PrtUnlockArenaRegistry(void)
+{
+	PrtAtomicCompareExchange(&prtArenaRegistryLock, 1, 0);
+}
+
+// Hands the blocks of cache back to the shared free lists of its arena, unless the arena was freed, and empties cache.
+static void PrtArenaFlushCache(_Inout_ PRT_ARENA_CACHE *cache)
+{
+	if (cache->arenaId == 0)
+	{
+		return;
+	}
+	PrtLockArenaRegistry();
+	PRT_ARENA *arena = prtArenas;
+	while (arena != NULL && arena->id != cache->arenaId)
+	{
+		arena = arena->nextArena;
+	}
+	if (arena != NULL)
+	{
+		PrtAcquireLock(&arena->lock);
+		for (PRT_UINT32 i = 0; i < PRT_ARENA_NUM_CLASSES; i++)
+		{
+			while (cache->freeLists[i] != NULL)
+			{
+				PRT_ARENA_BLOCK *block = cache->freeLists[i];
+				cache->freeLists[i] = block->next;
+				block->next = arena->freeLists[i];
+				arena->freeLists[i] = block;
+			}
+		}
+		PrtReleaseLock(&arena->lock);
+	}
+	PrtUnlockArenaRegistry();
+	memset(cache, 0, sizeof(PRT_ARENA_CACHE));
+}
+
+static PRT_ARENA_CACHE *PrtArenaGetCache(_In_ PRT_ARENA *arena)
+{
+	PRT_ARENA_CACHE *cache = NULL;
+	for (PRT_UINT32 i = 0; i < PRT_ARENA_CACHE_SLOTS; i++)
+	{
+		if (prtArenaCaches[i].arenaId == arena->id)
+		{
+			return &prtArenaCaches[i];
+		}
+		if (cache == NULL && prtArenaCaches[i].arenaId == 0)
+		{
+			cache = &prtArenaCaches[i];
+		}
+	}
+	if (cache == NULL)
+	{
+		cache = &prtArenaCaches[prtArenaNextVictim];
+		prtArenaNextVictim = (prtArenaNextVictim + 1) % PRT_ARENA_CACHE_SLOTS;
+		PrtArenaFlushCache(cache);
+	}
+	cache->arenaId = arena->id;
+	return cache;
+}
+
+static void PrtArenaRefill(_Inout_ PRT_ARENA *arena, _Inout_ PRT_ARENA_CACHE *cache, _In_ PRT_UINT32 sizeClass)
+{
+	size_t blockSize = (size_t)1 << (PRT_ARENA_MIN_BLOCK_SHIFT + sizeClass);
+	PrtAcquireLock(&arena->lock);
+	for (PRT_UINT32 i = 0; i < PRT_ARENA_BATCH; i++)
+	{
+		PRT_ARENA_BLOCK *block = arena->freeLists[sizeClass];
+		if (block != NULL)
+		{
+			arena->freeLists[sizeClass] = block->next;
+		}
+		else
+		{
+			if (arena->bump + blockSize > arena->bumpEnd)
+			{
+				PRT_ARENA_CHUNK *chunk = (PRT_ARENA_CHUNK *)(arena->node == PRT_NUMA_NODE_ANY
+					? malloc(PRT_ARENA_CHUNK_SIZE)
+					: PrtAllocNodeMemory(PRT_ARENA_CHUNK_SIZE, arena->node));
+				PrtAssert(chunk != NULL, "Memory allocation error");
+				chunk->next = arena->chunks;
+				arena->chunks = chunk;
+				arena->size += PRT_ARENA_CHUNK_SIZE;
+				arena->bump = (char *)(chunk + 1);
+				arena->bumpEnd = (char *)chunk + PRT_ARENA_CHUNK_SIZE;
+			}
+			block = (PRT_ARENA_BLOCK *)arena->bump;
+			arena->bump += blockSize;
+		}
+		block->next = cache->freeLists[sizeClass];
+		cache->freeLists[sizeClass] = block;
+		cache->counts[sizeClass]++;
+	}
+	PrtReleaseLock(&arena->lock);
+}
+
+static void * PRT_CALL_CONV PrtArenaAlloc(_Inout_ void *state, _In_ size_t size)
+{
+	PRT_ARENA *arena = (PRT_ARENA *)state;
+	if (size > PRT_ARENA_MAX_BLOCK)
+	{
+		PRT_ARENA_LARGE *large = (PRT_ARENA_LARGE *)malloc(sizeof(PRT_ARENA_LARGE) + size);
+		PrtAssert(large != NULL, "Memory allocation error");
+		PrtAcquireLock(&arena->lock);
+		large->prev = NULL;
+		large->next = arena->large;
+		if (arena->large != NULL)
+		{
+			arena->large->prev = large;
+		}
+		arena->large = large;
+		arena->size += size;
+		PrtReleaseLock(&arena->lock);
+		return large + 1;
+	}
+
+	PRT_UINT32 sizeClass = PrtArenaSizeClass(size);
+	PRT_ARENA_CACHE *cache = PrtArenaGetCache(arena);
+	if (cache->freeLists[sizeClass] == NULL)
+	{
+		PrtArenaRefill(arena, cache, sizeClass);
+	}
+	PRT_ARENA_BLOCK *block = cache->freeLists[sizeClass];
+	cache->freeLists[sizeClass] = block->next;
+	cache->counts[sizeClass]--;
+	return block;
+}
+
+static void PRT_CALL_CONV PrtArenaFree(_Inout_ void *state, _Inout_ void *ptr, _In_ size_t size)
+{
+	PRT_ARENA *arena = (PRT_ARENA *)state;
+	if (size > PRT_ARENA_MAX_BLOCK)
+	{
+		PRT_ARENA_LARGE *large = (PRT_ARENA_LARGE *)ptr - 1;
+		PrtAcquireLock(&arena->lock);
+		if (large->prev != NULL)
+		{
+			large->prev->next = large->next;
+		}
+		else
+		{
+			arena->large = large->next;
+		}
+		if (large->next != NULL)
+		{
+			large->next->prev = large->prev;
+		}
+		arena->size -= size;
+		PrtReleaseLock(&arena->lock);
+		free(large);
+		return;
+	}
+
+	PRT_UINT32 sizeClass = PrtArenaSizeClass(size);
+	PRT_ARENA_CACHE *cache = PrtArenaGetCache(arena);
+	PRT_ARENA_BLOCK *block = (PRT_ARENA_BLOCK *)ptr;
+	block->next = cache->freeLists[sizeClass];
+	cache->freeLists[sizeClass] = block;
+	cache->counts[sizeClass]++;
+
+	if (cache->counts[sizeClass] > PRT_ARENA_CACHE_MAX)
+	{
+		// hand half of the cached blocks back so that other threads can reuse them.
+		PrtAcquireLock(&arena->lock);
+		while (cache->counts[sizeClass] > PRT_ARENA_CACHE_MAX / 2)
+		{
+			block = cache->freeLists[sizeClass];
+			cache->freeLists[sizeClass] = block->next;
+			cache->counts[sizeClass]--;
+			block->next = arena->freeLists[sizeClass];
+			arena->freeLists[sizeClass] = block;
+		}
+		PrtReleaseLock(&arena->lock);
+	}
+}
+
+PRT_ALLOCATOR * PRT_CALL_CONV PrtMkArenaAllocator(void)
+{
+	return PrtMkNodeArenaAllocator(PRT_NUMA_NODE_ANY);
+}
+
+PRT_ALLOCATOR * PRT_CALL_CONV PrtMkNodeArenaAllocator(_In_ PRT_UINT32 node)
+{
+	PRT_ARENA *arena = (PRT_ARENA *)calloc(1, sizeof(PRT_ARENA));
+	PrtAssert(arena != NULL, "Memory allocation error");
+	arena->allocator.allocFun = &PrtArenaAlloc;
+	arena->allocator.reallocFun = NULL;
+	arena->allocator.freeFun = &PrtArenaFree;
+	arena->allocator.state = arena;
+	arena->id = PrtAtomicIncrement(&prtArenaCount);
+	arena->node = node;
+	PrtInitLock(&arena->lock);
+	PrtLockArenaRegistry();
+	arena->nextArena = prtArenas;
+	prtArenas = arena;
+	PrtUnlockArenaRegistry();
+	return &arena->allocator;
+}
+
+void PRT_CALL_CONV PrtFlushArenaCaches(void)
+{
+	for (PRT_UINT32 i = 0; i < PRT_ARENA_CACHE_SLOTS; i++)
+	{
+		PrtArenaFlushCache(&prtArenaCaches[i]);
+	}
+}
+
+size_t PRT_CALL_CONV PrtGetArenaAllocatorSize(_In_ PRT_ALLOCATOR *allocator)
+{
+	PRT_ARENA *arena = (PRT_ARENA *)allocator->state;
+	PrtAcquireLock(&arena->lock);
+	size_t size = arena->size;
+	PrtReleaseLock(&arena->lock);
+	return size;
+}
+
+void PRT_CALL_CONV PrtFreeArenaAllocator(_Inout_ PRT_ALLOCATOR *allocator)
+{
+	PRT_ARENA *arena = (PRT_ARENA *)allocator->state;
+	// once out of the registry, the blocks other threads still cache for the arena are dropped instead of handed back.
+	PrtLockArenaRegistry();
+	PRT_ARENA **link = &prtArenas;
+	while (*link != arena)
+	{
+		link = &(*link)->nextArena;
+	}
+	*link = arena->nextArena;
+	PrtUnlockArenaRegistry();
+	for (PRT_UINT32 i = 0; i < PRT_ARENA_CACHE_SLOTS; i++)
+	{
+		if (prtArenaCaches[i].arenaId == arena->id)
+		{
+			memset(&prtArenaCaches[i], 0, sizeof(PRT_ARENA_CACHE));
+		}
+	}
+	while (arena->chunks != NULL)
+	{
+		PRT_ARENA_CHUNK *chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		if (arena->node == PRT_NUMA_NODE_ANY)
+		{
+			free(chunk);
+		}
+		else
+		{
+			PrtFreeNodeMemory(chunk, PRT_ARENA_CHUNK_SIZE);
+		}
+	}
+	while (arena->large != NULL)
+	{
+		PRT_ARENA_LARGE *large = arena->large;
+		arena->large = large->next;
+		free(large);
+	}
+	PrtDestroyLock(&arena->lock);
+	free(arena);
+}
@@ -0,0 +1,295 @@
+#include "PrtExecution.h"
+
+//
+// A call suspends its machine the way a blocking call does, and sends the request only once the step of the call has
+// ended and the caller has let go of its stateMachineLock, so that the reply, a timeout or the halt of the responder
+// always finds the caller suspended, even when the task-neutral scheduler runs the responder on the sending thread.
+// The token of a call is the id of the caller in its high half and the number of the call in its low half, so a reply
+// finds its caller without a table, and a reply to a call that is over does not match the call the caller is in now.
+//
+
+typedef struct PRT_MACHINE_CALL
+{
+	PRT_UINT64				token;
+	PRT_MACHINEINST_PRIV	*callee;
+	PRT_UINT32				eventIndex;
+	PRT_VALUE				*payload;	/* of the request, until it is sent */
+	PRT_BOOLEAN				sent;
+	PRT_BOOLEAN				done;		/* result and reply are set; under the stateMachineLock of the caller */
+	PRT_CALL_RESULT			result;
+	PRT_VALUE				*reply;		/* a null value unless the call was replied to */
+} PRT_MACHINE_CALL;
+
+// Ends call with result; the caller holds the stateMachineLock of context, which this releases.
+static void PrtFinishCall(
+	_Inout_ PRT_MACHINEINST_PRIV *context,
+	_Inout_ PRT_MACHINE_CALL *call,
+	_In_ PRT_CALL_RESULT result,
+	_In_ PRT_VALUE *reply)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PrtCancelTimer(&process->timers, &context->callTimer);
+	if (reply == NULL)
+	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+		reply = PrtMkNullValue();
+		PrtSetMemoryAccount(prevAccount);
+	}
+	call->done = PRT_TRUE;
+	call->result = result;
+	call->reply = reply;
+	if (process->recorder != NULL)
+	{
+		PrtRecordResume(context, reply);
+	}
+
+	// as for an event that unblocks a receive, the function is called again at the call.
+	context->nextOperation = EntryOperation;
+	PrtReleaseLock(&context->stateMachineLock);
+	PrtScheduleWork(context);
+}
+
+// Ends the call of context named by token with result, if context is still suspended in it; otherwise frees reply.
+static void PrtEndCall(
+	_Inout_ PRT_MACHINEINST_PRIV *context,
+	_In_ PRT_UINT64 token,
+	_In_ PRT_CALL_RESULT result,
+	_In_ PRT_VALUE *reply)
+{
+	PrtAcquireLock(&context->stateMachineLock);
+	PRT_MACHINE_CALL *call = context->call;
+	if ((PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) || call == NULL || call->token != token || call->done)
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		if (reply != NULL)
+		{
+			PrtFreeValue(reply);
+		}
+		return;
+	}
+	PrtFinishCall(context, call, result, reply);
+}
+
+PRT_CALL_RESULT
+PrtCallMachine(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+	_In_ PRT_UINT16					callIndex,
+	_Inout_ PRT_MACHINEINST_PRIV	*receiver,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload,
+	_In_ PRT_UINT64					timeout,
+	_Out_ PRT_VALUE					**reply
+)
+{
+	PRT_MACHINE_CALL *call = context->call;
+	if (call != NULL)
+	{
+		// called again at the call, now that it is over.
+		PrtFreeValue(payload);
+		PrtAcquireLock(&context->stateMachineLock);
+		PrtAssert(call->done, "A machine suspended in a call runs again only once the call is over");
+		context->call = NULL;
+		PrtReleaseLock(&context->stateMachineLock);
+
+		// how the call ended depends on other machines and the clock, so a replay takes the recorded answer.
+		PRT_CALL_RESULT result = PRT_CALL_REPLIED;
+		if (!PrtRecordDecision(context, call->result == PRT_CALL_REPLIED))
+		{
+			result = PrtRecordDecision(context, call->result == PRT_CALL_TIMEOUT) ? PRT_CALL_TIMEOUT : PRT_CALL_HALTED;
+		}
+		if (result == PRT_CALL_REPLIED)
+		{
+			*reply = call->reply;
+		}
+		else
+		{
+			PrtFreeValue(call->reply);
+		}
+		PrtFree(call);
+		return result;
+	}
+
+	PrtAssert(receiver != context, "A machine cannot call itself");
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	call = (PRT_MACHINE_CALL *)PrtMalloc(sizeof(PRT_MACHINE_CALL));
+	PrtSetMemoryAccount(prevAccount);
+	context->callsMade++;
+	call->token = ((PRT_UINT64)context->id->valueUnion.mid->machineId << 32) | context->callsMade;
+	call->callee = receiver;
+	call->eventIndex = PrtPrimGetEvent(event);
+	call->payload = payload;
+	call->sent = PRT_FALSE;
+	call->done = PRT_FALSE;
+	call->result = PRT_CALL_PENDING;
+	call->reply = NULL;
+	process->hasCalls = PRT_TRUE;
+
+	funStackInfo->returnTo = callIndex;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtAssert(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_RUNNING, "Machine must be running");
+	context->call = call;
+
+	// a replay ends the call where the recording says it ended, so it arms no timer of its own.
+	if (timeout != 0 && process->replayer == NULL)
+	{
+		PrtArmTimer(&process->timers, &context->callTimer, PrtGetProcessTime(context->process) + timeout);
+	}
+	PrtPushFrame(context, funStackInfo);
+	return PRT_CALL_PENDING;
+}
+
+PRT_BOOLEAN
+PrtSendCallRequest(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	// only the thread that runs the machine touches the request, and the call is not freed before the machine runs again.
+	PRT_MACHINE_CALL *call = context->call;
+	if (call->sent)
+	{
+		return PRT_FALSE;
+	}
+	call->sent = PRT_TRUE;
+	PRT_MACHINESTATE state;
+	PrtGetMachineState((PRT_MACHINEINST *)context, &state);
+	PRT_VALUE *event = PrtMkEventValue(call->eventIndex);
+	PRT_VALUE *payload = call->payload;
+	call->payload = NULL;
+	PRT_MACHINEINST_PRIV *callee = call->callee;
+	PRT_UINT64 token = call->token;
+	PrtSendRequest(&state, callee, event, payload, token);
+	PrtFreeValue(event);
+
+	// a responder that had halted dropped the request, and PrtFailCallsTo may have run before the call began.
+	if (((PRT_PROCESS_PRIV *)context->process)->replayer == NULL && (PrtAtomicLoad(&callee->runState) & PRT_RUNSTATE_HALTED))
+	{
+		PrtEndCall(context, token, PRT_CALL_HALTED, NULL);
+		return PRT_TRUE;
+	}
+	return PRT_FALSE;
+}
+
+PRT_UINT64
+PrtGetCallToken(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	return context->callToken;
+}
+
+void
+PrtReply(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_UINT64					token,
+	_In_ PRT_VALUE					*payload
+)
+{
+	// a replay resumes the caller where the recording says the reply came, with the reply recorded then.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_UINT32 callerId = (PRT_UINT32)(token >> 32);
+	if (process->replayer != NULL || callerId == 0 || callerId > process->numMachines)
+	{
+		PrtFreeValue(payload);
+		return;
+	}
+	PrtEndCall((PRT_MACHINEINST_PRIV *)process->machines[callerId - 1], token, PRT_CALL_REPLIED, payload);
+}
+
+void
+PrtCallTimerFired(
+	_Inout_ void					*owner,
+	_In_ PRT_UINT32					generation
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)owner;
+	PrtAcquireLock(&context->stateMachineLock);
+
+	// the call may have ended, or a later one started, since the timer was collected.
+	PRT_MACHINE_CALL *call = context->call;
+	if ((PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) || call == NULL || call->done || context->callTimer.generation != generation)
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		return;
+	}
+	PrtFinishCall(context, call, PRT_CALL_TIMEOUT, NULL);
+}
+
+void
+PrtFailCallsTo(
+	_In_ PRT_MACHINEINST_PRIV		*responder
+)
+{
+	// the callers are ended outside the processLock, since ending a call may run the caller under the task-neutral scheduler.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)responder->process;
+	PrtAcquireLock(&process->processLock);
+	PRT_UINT32 numMachines = process->numMachines;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+	PRT_MACHINEINST **machines = (PRT_MACHINEINST **)PrtMalloc(numMachines * sizeof(PRT_MACHINEINST *));
+	PrtSetMemoryAccount(prevAccount);
+	for (PRT_UINT32 i = 0; i < numMachines; i++)
+	{
+		machines[i] = process->machines[i];
+	}
+	PrtReleaseLock(&process->processLock);
+
+	for (PRT_UINT32 i = 0; i < numMachines; i++)
+	{
+		PRT_MACHINEINST_PRIV *caller = (PRT_MACHINEINST_PRIV *)machines[i];
+		PrtAcquireLock(&caller->stateMachineLock);
+		PRT_MACHINE_CALL *call = caller->call;
+		if (call != NULL && call->callee == responder && !call->done)
+		{
+			PrtFinishCall(caller, call, PRT_CALL_HALTED, NULL);
+		}
+		else
+		{
+			PrtReleaseLock(&caller->stateMachineLock);
+		}
+	}
+	PrtFree(machines);
+}
+
+PRT_BOOLEAN
+PrtReplayCallResult(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_VALUE					*reply
+)
+{
+	PrtAcquireLock(&context->stateMachineLock);
+	PRT_MACHINE_CALL *call = context->call;
+	if (call == NULL || call->done || (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED))
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		PrtFreeValue(reply);
+		return PRT_FALSE;
+	}
+
+	// the decisions the machine made when it resumed say how the call ended.
+	PrtFinishCall(context, call, PRT_CALL_REPLIED, reply);
+	return PRT_TRUE;
+}
+
+void
+PrtDropCall(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	PRT_MACHINE_CALL *call = context->call;
+	if (call == NULL)
+	{
+		return;
+	}
+	context->call = NULL;
+	PrtCancelTimer(&((PRT_PROCESS_PRIV *)context->process)->timers, &context->callTimer);
+	if (call->payload != NULL)
+	{
+		PrtFreeValue(call->payload);
+	}
+	if (call->reply != NULL)
+	{
+		PrtFreeValue(call->reply);
+	}
+	PrtFree(call);
+}
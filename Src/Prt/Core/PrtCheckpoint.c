@@ -0,0 +1,610 @@
+#include "PrtExecution.h"
+
+//
+// A checkpoint file is a header followed by one record per machine, in machine id order:
+//
+//   header:   magic, version, process guid, number of events and machine decls of the program, number of machines
+//   machine:  decl index, renamed name, halted flag; then, unless halted,
+//             current state, next operation, exit reason, event value, destination state,
+//             state stack frames with their inherited sets, the inherited sets,
+//             variables, recvMap, pending trigger and payload, and the queued events.
+//   event:    trigger, payload, sender, and the milliseconds it had left to live (0 if it never expires).
+//   trailer:  the 32-bit FNV-1a hash of all the bytes before it.
+//
+// Numbers are varints and values use the portable encoding of PrtSerializeValue. A file may be truncated or corrupt,
+// so every read is bounded by its size and every index is checked against the program before it is used.
+//
+#define PRT_CHECKPOINT_MAGIC 0x504B4350 /* "PCKP" */
+
+//
+// The serialized form is written out whenever it grows past this many bytes
+//
+#define PRT_CHECKPOINT_FLUSH_SIZE (1 << 20)
+
+//
+// Appended to the path of a checkpoint to name the file it is written to first
+//
+#define PRT_CHECKPOINT_TEMP_SUFFIX ".tmp"
+
+//
+// The hash in the trailer starts from this value
+//
+#define PRT_CHECKPOINT_HASH_BASIS 2166136261u
+
+// any one byte that differs changes the hash, so a file damaged in one place is always caught.
+static PRT_UINT32 PrtHashCheckpoint(_In_ PRT_UINT32 hash, _In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 count)
+{
+	for (PRT_UINT32 i = 0; i < count; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static PRT_BOOLEAN PrtFlushCheckpoint(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ FILE *file, _Inout_ PRT_UINT32 *hash)
+{
+	PRT_BOOLEAN ok = buffer->size == 0 || fwrite(buffer->bytes, 1, buffer->size, file) == buffer->size;
+	*hash = PrtHashCheckpoint(*hash, buffer->bytes, buffer->size);
+	buffer->size = 0;
+	return ok;
+}
+
+static void PrtWriteEvent(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_PROGRAMDECL *program, _In_ PRT_EVENT *event, _In_ PRT_UINT64 now)
+{
+	PrtSerializeValue(buffer, event->trigger, PRT_SERIALIZE_PORTABLE);
+	PrtSerializeValue(buffer, event->payload, PRT_SERIALIZE_PORTABLE);
+
+	// the names in the sender state point into the program, so they are written as the index of the sender's decl.
+	PRT_UINT32 senderDecl = 0;
+	for (PRT_UINT32 i = 0; event->state.machineName != NULL && i < program->nMachines; i++)
+	{
+		if (program->machines[i]->name == event->state.machineName)
+		{
+			senderDecl = i + 1;
+			break;
+		}
+	}
+	PrtWriteVarUInt32(buffer, senderDecl);
+	if (senderDecl != 0)
+	{
+		PrtWriteVarUInt32(buffer, (PRT_UINT32)event->state.machineId);
+		PrtWriteVarUInt32(buffer, (PRT_UINT32)event->state.stateId);
+	}
+
+	// the deadline is on the clock of this process, so what is left of the time to live is written; an event already
+	// expired keeps a millisecond, and expires as soon as it comes up in the restored process.
+	PrtWriteVarUInt32(buffer, event->deadline == 0 ? 0 : event->deadline > now ? (PRT_UINT32)(event->deadline - now) : 1);
+}
+
+// an event value indexes the events of the program wherever it is used, so a value with one that does not is rejected.
+static PRT_BOOLEAN PrtValueFitsProgram(_In_ PRT_VALUE *value, _In_ PRT_PROGRAMDECL *program)
+{
+	switch (value->discriminator)
+	{
+	case PRT_VALUE_KIND_EVENT:
+		return value->valueUnion.ev < program->nEvents;
+	case PRT_VALUE_KIND_TUPLE:
+		for (PRT_UINT32 i = 0; i < value->valueUnion.tuple->size; i++)
+		{
+			if (!PrtValueFitsProgram(value->valueUnion.tuple->values[i], program))
+			{
+				return PRT_FALSE;
+			}
+		}
+		return PRT_TRUE;
+	case PRT_VALUE_KIND_SEQ:
+		for (PRT_UINT32 i = 0; i < value->valueUnion.seq->size; i++)
+		{
+			if (!PrtValueFitsProgram(value->valueUnion.seq->values[i], program))
+			{
+				return PRT_FALSE;
+			}
+		}
+		return PRT_TRUE;
+	case PRT_VALUE_KIND_MAP:
+		for (PRT_MAPNODE *next = value->valueUnion.map->first; next != NULL; next = next->insertNext)
+		{
+			if (!PrtValueFitsProgram(next->key, program) || !PrtValueFitsProgram(next->value, program))
+			{
+				return PRT_FALSE;
+			}
+		}
+		return PRT_TRUE;
+	default:
+		return PRT_TRUE;
+	}
+}
+
+PRT_VALUE *
+PrtReadProgramValue(
+	_In_ const PRT_UINT8			*bytes,
+	_In_ PRT_UINT32					size,
+	_Inout_ PRT_UINT32				*position,
+	_In_ PRT_PROGRAMDECL			*program
+)
+{
+	PRT_VALUE *value = PrtTryDeserializeValue(bytes, size, position, PRT_SERIALIZE_PORTABLE);
+	if (value != NULL && !PrtValueFitsProgram(value, program))
+	{
+		PrtFreeValue(value);
+		return NULL;
+	}
+	return value;
+}
+
+static PRT_BOOLEAN PrtReadEvent(
+	_In_ const PRT_UINT8 *bytes,
+	_In_ PRT_UINT32 size,
+	_Inout_ PRT_UINT32 *position,
+	_In_ PRT_PROGRAMDECL *program,
+	_Out_ PRT_EVENT *event,
+	_In_ PRT_UINT64 now
+)
+{
+	PRT_UINT32 senderDecl = 0;
+	PRT_UINT32 machineId = 0;
+	PRT_UINT32 stateId = 0;
+	PRT_UINT32 timeToLive = 0;
+	event->trigger = PrtReadProgramValue(bytes, size, position, program);
+	event->payload = event->trigger == NULL ? NULL : PrtReadProgramValue(bytes, size, position, program);
+	event->shared = NULL;
+	PRT_BOOLEAN ok = event->payload != NULL &&
+		event->trigger->discriminator == PRT_VALUE_KIND_EVENT &&
+		PrtInhabitsType(event->payload, program->events[PrtPrimGetEvent(event->trigger)]->type) &&
+		PrtTryReadVarUInt32(bytes, size, position, &senderDecl) && senderDecl <= program->nMachines &&
+		(senderDecl == 0 ||
+			(PrtTryReadVarUInt32(bytes, size, position, &machineId) &&
+			PrtTryReadVarUInt32(bytes, size, position, &stateId) &&
+			stateId < program->machines[senderDecl - 1]->nStates)) &&
+		PrtTryReadVarUInt32(bytes, size, position, &timeToLive);
+	if (!ok)
+	{
+		if (event->trigger != NULL)
+		{
+			PrtFreeValue(event->trigger);
+		}
+		if (event->payload != NULL)
+		{
+			PrtFreeValue(event->payload);
+		}
+		event->trigger = NULL;
+		event->payload = NULL;
+		return PRT_FALSE;
+	}
+	if (senderDecl == 0)
+	{
+		event->state.machineId = 0;
+		event->state.machineName = NULL;
+		event->state.stateId = 0;
+		event->state.stateName = NULL;
+	}
+	else
+	{
+		PRT_MACHINEDECL *mdecl = program->machines[senderDecl - 1];
+		event->state.machineId = (int)machineId;
+		event->state.machineName = mdecl->name;
+		event->state.stateId = (int)stateId;
+		event->state.stateName = mdecl->states[stateId].name;
+	}
+	event->deadline = timeToLive == 0 ? 0 : now + timeToLive;
+	return PRT_TRUE;
+}
+
+static void PrtWriteMachine(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT64 now)
+{
+	PRT_PROGRAMDECL *program = context->process->program;
+	PRT_UINT32 packBytes = PrtGetPackSize(context) * sizeof(PRT_UINT32);
+
+	PrtWriteVarUInt32(buffer, context->instanceOf);
+	PrtWriteVarUInt32(buffer, context->renamedName);
+	PRT_UINT8 isHalted = (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) ? 1 : 0;
+	PrtWriteBytes(buffer, &isHalted, 1);
+	if (isHalted)
+	{
+		return;
+	}
+
+	PRT_UINT8 operation[2] = { (PRT_UINT8)context->nextOperation, (PRT_UINT8)context->exitReason };
+	PrtWriteVarUInt32(buffer, context->currentState);
+	PrtWriteBytes(buffer, operation, sizeof(operation));
+	PrtWriteVarUInt32(buffer, context->eventValue);
+	PrtWriteVarUInt32(buffer, context->destStateIndex);
+
+	PrtWriteVarUInt32(buffer, context->callStack->length);
+	for (PRT_UINT16 i = 0; i < context->callStack->length; i++)
+	{
+		PRT_STATESTACK_INFO *info = &context->callStack->stateStack[i];
+		PrtWriteVarUInt32(buffer, info->stateIndex);
+		PrtWriteBytes(buffer, info->inheritedDeferredSetCompact, packBytes);
+		PrtWriteBytes(buffer, info->inheritedActionSetCompact, packBytes);
+	}
+	PrtWriteBytes(buffer, context->inheritedDeferredSetCompact, packBytes);
+	PrtWriteBytes(buffer, context->inheritedActionSetCompact, packBytes);
+
+	PrtSerializeMachineVars(buffer, context, PRT_SERIALIZE_PORTABLE);
+
+	PRT_UINT8 hasTriggerPayload = (context->currentTrigger != NULL ? 1 : 0) | (context->currentPayload != NULL ? 2 : 0);
+	PrtWriteBytes(buffer, &hasTriggerPayload, 1);
+	if (context->currentTrigger != NULL)
+	{
+		PrtSerializeValue(buffer, context->currentTrigger, PRT_SERIALIZE_PORTABLE);
+	}
+	if (context->currentPayload != NULL)
+	{
+		PrtSerializeValue(buffer, context->currentPayload, PRT_SERIALIZE_PORTABLE);
+	}
+
+	PRT_EVENTQUEUE *queue = &context->eventQueue;
+	PrtWriteVarUInt32(buffer, queue->size);
+	for (PRT_UINT32 i = 0; i < queue->size; i++)
+	{
+		PrtWriteEvent(buffer, program, &queue->events[(queue->headIndex + i) % queue->eventsSize], now);
+	}
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtCheckpointProcess(
+	_In_ PRT_PROCESS *process,
+	_In_ const char *path
+)
+{
+	// the checkpoint goes to a file of its own, which replaces the one at path only once all of it is on disk.
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+	size_t pathLength = strlen(path);
+	char *tempPath = (char *)PrtMalloc((PRT_UINT32)pathLength + sizeof(PRT_CHECKPOINT_TEMP_SUFFIX));
+	memcpy(tempPath, path, pathLength);
+	memcpy(tempPath + pathLength, PRT_CHECKPOINT_TEMP_SUFFIX, sizeof(PRT_CHECKPOINT_TEMP_SUFFIX));
+	FILE *file = fopen(tempPath, "wb");
+	if (file == NULL)
+	{
+		PrtFree(tempPath);
+		PrtSetMemoryAccount(prevAccount);
+		return PRT_FALSE;
+	}
+
+	PRT_BYTE_BUFFER buffer;
+	buffer.bytes = NULL;
+	buffer.size = 0;
+	buffer.capacity = 0;
+	PRT_BOOLEAN ok = PRT_TRUE;
+	PRT_MACHINEINST_PRIV **missed = NULL;
+	PRT_UINT32 numMissed = 0;
+	PRT_UINT64 now = PrtGetProcessTime(process);
+	PRT_UINT32 hash = PRT_CHECKPOINT_HASH_BASIS;
+
+	PrtAcquireLock(&privateProcess->processLock);
+	PRT_UINT32 magic = PRT_CHECKPOINT_MAGIC;
+	PRT_UINT32 version = PRT_CHECKPOINT_VERSION;
+	PrtWriteBytes(&buffer, &magic, sizeof(PRT_UINT32));
+	PrtWriteBytes(&buffer, &version, sizeof(PRT_UINT32));
+	PrtWriteBytes(&buffer, &privateProcess->guid, sizeof(PRT_GUID));
+	PrtWriteVarUInt32(&buffer, privateProcess->program->nEvents);
+	PrtWriteVarUInt32(&buffer, privateProcess->program->nMachines);
+	PrtWriteVarUInt32(&buffer, privateProcess->numMachines);
+
+	for (PRT_UINT32 i = 0; ok && i < privateProcess->numMachines; i++)
+	{
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)privateProcess->machines[i];
+		PrtAcquireLock(&context->stateMachineLock);
+		PrtThawMachine(context);
+
+		// a machine in the middle of a step, or waiting in a receive, has raw pointers into its locals on the fun stack.
+		// claiming the machine keeps other threads from starting a step while it is written.
+		PRT_BOOLEAN isHalted = (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) != 0;
+		PRT_BOOLEAN claimed = !isHalted && PrtClaimMachine(context, PRT_FALSE);
+		if (!isHalted && (!claimed || context->receive != NULL || context->funStack->length != 0))
+		{
+			ok = PRT_FALSE;
+		}
+		else
+		{
+			// the events a machine took from its queue and has not handled yet are written back in the queue.
+			if (claimed && context->batchCount != 0)
+			{
+				PrtReturnDequeueBatch(context);
+			}
+			PrtWriteMachine(&buffer, context, now);
+		}
+		if (claimed && !PrtReleaseMachine(context))
+		{
+			// a sender found the machine claimed and left its work to us; it is run once the process lock is dropped.
+			PrtUpdateRunState(context, PRT_RUNSTATE_RUNNING | PRT_RUNSTATE_HASWORK, 0);
+			if (missed == NULL)
+			{
+				missed = (PRT_MACHINEINST_PRIV **)PrtCalloc(privateProcess->numMachines, sizeof(PRT_MACHINEINST_PRIV *));
+			}
+			missed[numMissed++] = context;
+		}
+		PrtReleaseLock(&context->stateMachineLock);
+
+		if (ok && buffer.size >= PRT_CHECKPOINT_FLUSH_SIZE)
+		{
+			ok = PrtFlushCheckpoint(&buffer, file, &hash);
+		}
+	}
+	PrtReleaseLock(&privateProcess->processLock);
+
+	for (PRT_UINT32 i = 0; i < numMissed; i++)
+	{
+		PrtScheduleWork(missed[i]);
+	}
+	PrtFree(missed);
+
+	ok = ok && PrtFlushCheckpoint(&buffer, file, &hash);
+	ok = ok && fwrite(&hash, sizeof(PRT_UINT32), 1, file) == 1;
+	if (ok)
+	{
+		ok = PrtReplaceFile(file, tempPath, path);
+	}
+	else
+	{
+		fclose(file);
+	}
+	if (!ok)
+	{
+		remove(tempPath);
+	}
+	PrtFree(tempPath);
+	PrtFree(buffer.bytes);
+	PrtSetMemoryAccount(prevAccount);
+	return ok;
+}
+
+static PRT_BOOLEAN PrtReadMachine(
+	_Inout_ PRT_PROCESS_PRIV *process,
+	_In_ PRT_UINT32 index,
+	_In_ const PRT_UINT8 *bytes,
+	_In_ PRT_UINT32 size,
+	_Inout_ PRT_UINT32 *position
+)
+{
+	PRT_PROGRAMDECL *program = process->program;
+	PRT_UINT32 instanceOf;
+	PRT_UINT32 renamedName;
+	if (!PrtTryReadVarUInt32(bytes, size, position, &instanceOf) || instanceOf >= program->nMachines ||
+		!PrtTryReadVarUInt32(bytes, size, position, &renamedName))
+	{
+		return PRT_FALSE;
+	}
+
+	// the machine is in the process from here on, so PrtStopProcess frees whatever was read if the rest is malformed.
+	// it counts as halted, which PrtCleanupMachine skips, until it has its id.
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)PrtCalloc(1, sizeof(PRT_MACHINEINST_PRIV));
+	context->process = (PRT_PROCESS *)process;
+	context->instanceOf = instanceOf;
+	context->funs = process->funTables[context->instanceOf];
+	context->renamedName = renamedName;
+	PrtInitLock(&context->stateMachineLock);
+	context->callStack = (PRT_STATESTACK *)PrtMalloc(sizeof(PRT_STATESTACK));
+	context->callStack->length = 0;
+	context->funStack = (PRT_FUNSTACK *)PrtMalloc(sizeof(PRT_FUNSTACK));
+	context->funStack->length = 0;
+	context->memory.allocator = process->allocator;
+	context->memory.parent = &process->memory;
+	context->memory.tracked = process->memory.tracked;
+	context->memory.quota = process->machineQuota;
+	context->memory.used = 0;
+	context->memory.overQuota = PRT_FALSE;
+	context->memory.exceeded = PRT_FALSE;
+	context->lastOperation = ReturnStatement;
+	context->receive = NULL;
+	PrtInitTimer(&context->receiveTimer, &PrtReceiveTimerFired, context);
+	PrtInitTimer(&context->callTimer, &PrtCallTimerFired, context);
+	context->hibernatedState = NULL;
+	context->idleSince = 0;
+	context->homeNode = PRT_NUMA_NODE_ANY;
+	context->runState = PRT_RUNSTATE_HALTED;
+	process->machines[index] = (PRT_MACHINEINST *)context;
+	process->numMachines++;
+
+	PRT_UINT8 isHalted;
+	if (!PrtTryReadBytes(bytes, size, position, &isHalted, 1) || isHalted > 1)
+	{
+		return PRT_FALSE;
+	}
+	if (isHalted)
+	{
+		// a halted machine only holds its place, so that the machines after it keep their ids.
+		return PRT_TRUE;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_MACHINEDECL *mdecl = program->machines[context->instanceOf];
+	PRT_UINT32 packSize = PrtGetPackSize(context);
+	PRT_UINT32 packBytes = packSize * sizeof(PRT_UINT32);
+
+	PRT_MACHINEID id;
+	id.machineId = index + 1;
+	id.processId = process->guid;
+	context->id = PrtMkMachineValue(id);
+	context->runState = 0;
+	PrtSeedMachineChoices(context);
+
+	PRT_BOOLEAN ok = PRT_FALSE;
+	PRT_UINT8 operation[2];
+	PRT_UINT32 stackLength;
+	if (!PrtTryReadVarUInt32(bytes, size, position, &context->currentState) || context->currentState >= mdecl->nStates ||
+		!PrtTryReadBytes(bytes, size, position, operation, sizeof(operation)) ||
+		operation[0] > ReceiveOperation || operation[1] > OnUnhandledEvent ||
+		!PrtTryReadVarUInt32(bytes, size, position, &context->eventValue) || context->eventValue >= program->nEvents ||
+		!PrtTryReadVarUInt32(bytes, size, position, &context->destStateIndex) || context->destStateIndex >= mdecl->nStates ||
+		!PrtTryReadVarUInt32(bytes, size, position, &stackLength) || stackLength > PRT_MAX_STATESTACK_DEPTH)
+	{
+		goto Done;
+	}
+	context->nextOperation = (PRT_NEXTOPERATION)operation[0];
+	context->exitReason = (PRT_EXITREASON)operation[1];
+
+	for (PRT_UINT32 i = 0; i < stackLength; i++)
+	{
+		PRT_STATESTACK_INFO *info = &context->callStack->stateStack[i];
+		if (!PrtTryReadVarUInt32(bytes, size, position, &info->stateIndex) || info->stateIndex >= mdecl->nStates)
+		{
+			goto Done;
+		}
+		info->inheritedDeferredSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+		info->inheritedActionSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+		context->callStack->length++;
+		if (!PrtTryReadBytes(bytes, size, position, info->inheritedDeferredSetCompact, packBytes) ||
+			!PrtTryReadBytes(bytes, size, position, info->inheritedActionSetCompact, packBytes))
+		{
+			goto Done;
+		}
+	}
+	context->inheritedDeferredSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+	context->inheritedActionSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+	if (!PrtTryReadBytes(bytes, size, position, context->inheritedDeferredSetCompact, packBytes) ||
+		!PrtTryReadBytes(bytes, size, position, context->inheritedActionSetCompact, packBytes))
+	{
+		goto Done;
+	}
+	context->currentDeferredSetCompact = (PRT_UINT32 *)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	context->currentActionSetCompact = (PRT_UINT32 *)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	PrtUpdateCurrentActionsSet(context);
+	PrtUpdateCurrentDeferredSet(context);
+
+	if (!PrtTryDeserializeMachineVars(bytes, size, position, context, PRT_SERIALIZE_PORTABLE))
+	{
+		goto Done;
+	}
+	for (PRT_UINT32 i = 0; i < mdecl->nVars; i++)
+	{
+		PRT_VALUE *var = context->varValues[i];
+		if (var != NULL && (!PrtInhabitsType(var, mdecl->vars[i].type) || !PrtValueFitsProgram(var, program)))
+		{
+			goto Done;
+		}
+	}
+	if (context->recvMap != NULL && !PrtValueFitsProgram(context->recvMap, program))
+	{
+		goto Done;
+	}
+
+	PRT_UINT8 hasTriggerPayload;
+	if (!PrtTryReadBytes(bytes, size, position, &hasTriggerPayload, 1) || hasTriggerPayload > 3)
+	{
+		goto Done;
+	}
+	if ((hasTriggerPayload & 1) &&
+		((context->currentTrigger = PrtReadProgramValue(bytes, size, position, program)) == NULL ||
+		context->currentTrigger->discriminator != PRT_VALUE_KIND_EVENT))
+	{
+		goto Done;
+	}
+	if ((hasTriggerPayload & 2) && (context->currentPayload = PrtReadProgramValue(bytes, size, position, program)) == NULL)
+	{
+		goto Done;
+	}
+
+	// the queue is sized for what it holds, rather than grown one doubling at a time, and an empty queue has no storage.
+	// every event takes a few bytes, so a queue longer than what is left of the file is malformed.
+	PRT_UINT32 queueSize;
+	if (!PrtTryReadVarUInt32(bytes, size, position, &queueSize) || queueSize > size - *position ||
+		(mdecl->maxQueueSize != 0xffffffff && queueSize > mdecl->maxQueueSize))
+	{
+		goto Done;
+	}
+	PRT_UINT64 now = PrtGetProcessTime((PRT_PROCESS *)process);
+	PRT_UINT32 eventsSize = queueSize == 0 ? 0 : PRT_QUEUE_LEN_DEFAULT;
+	while (eventsSize != 0 && eventsSize <= queueSize)
+	{
+		eventsSize *= 2;
+	}
+	if (mdecl->maxQueueSize != 0xffffffff && eventsSize > mdecl->maxQueueSize)
+	{
+		eventsSize = mdecl->maxQueueSize;
+	}
+	context->eventQueue.eventsSize = eventsSize;
+	context->eventQueue.events = eventsSize == 0 ? NULL : (PRT_EVENT *)PrtCalloc(eventsSize, sizeof(PRT_EVENT));
+	context->eventQueue.headIndex = 0;
+	for (PRT_UINT32 i = 0; i < queueSize; i++)
+	{
+		if (!PrtReadEvent(bytes, size, position, program, &context->eventQueue.events[i], now))
+		{
+			goto Done;
+		}
+		context->eventQueue.size++;
+	}
+	context->eventQueue.tailIndex = eventsSize == 0 ? 0 : queueSize % eventsSize;
+	ok = PRT_TRUE;
+
+Done:
+	PrtSetMemoryAccount(prevAccount);
+	return ok;
+}
+
+PRT_API PRT_PROCESS * PRT_CALL_CONV
+PrtRestoreProcess(
+	_In_ const char *path,
+	_In_ PRT_PROGRAMDECL *program,
+	_In_ PRT_ERROR_FUN errorFun,
+	_In_ PRT_LOG_FUN logFun,
+	_In_ PRT_ALLOCATOR *allocator
+)
+{
+	PRT_UINT32 fileSize;
+	const PRT_UINT8 *bytes = PrtMapFile(path, &fileSize);
+	if (bytes == NULL)
+	{
+		return NULL;
+	}
+
+	// the records are read only up to the trailer, and only from a file whose hash matches it.
+	PRT_UINT32 size = fileSize < sizeof(PRT_UINT32) ? 0 : fileSize - sizeof(PRT_UINT32);
+	PRT_UINT32 hash = 0;
+	if (fileSize >= sizeof(PRT_UINT32))
+	{
+		memcpy(&hash, bytes + size, sizeof(PRT_UINT32));
+	}
+	PRT_UINT32 position = 0;
+	PRT_UINT32 magic = 0;
+	PRT_UINT32 version = 0;
+	PRT_UINT32 nEvents = 0;
+	PRT_UINT32 nMachines = 0;
+	PRT_UINT32 numMachines = 0;
+	PRT_GUID guid;
+	if (fileSize < sizeof(PRT_UINT32) || hash != PrtHashCheckpoint(PRT_CHECKPOINT_HASH_BASIS, bytes, size) ||
+		!PrtTryReadBytes(bytes, size, &position, &magic, sizeof(PRT_UINT32)) || magic != PRT_CHECKPOINT_MAGIC ||
+		!PrtTryReadBytes(bytes, size, &position, &version, sizeof(PRT_UINT32)) || version != PRT_CHECKPOINT_VERSION ||
+		!PrtTryReadBytes(bytes, size, &position, &guid, sizeof(PRT_GUID)) ||
+		!PrtTryReadVarUInt32(bytes, size, &position, &nEvents) || nEvents != program->nEvents ||
+		!PrtTryReadVarUInt32(bytes, size, &position, &nMachines) || nMachines != program->nMachines ||
+		!PrtTryReadVarUInt32(bytes, size, &position, &numMachines) || numMachines > size - position)
+	{
+		PrtUnmapFile(bytes, fileSize);
+		return NULL;
+	}
+
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)PrtStartProcessEx(guid, program, errorFun, logFun, allocator);
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+	if (numMachines > 0)
+	{
+		process->machines = (PRT_MACHINEINST **)PrtCalloc(numMachines, sizeof(PRT_MACHINEINST *));
+		process->machineCount = numMachines;
+	}
+	PRT_BOOLEAN ok = PRT_TRUE;
+	for (PRT_UINT32 i = 0; ok && i < numMachines; i++)
+	{
+		ok = PrtReadMachine(process, i, bytes, size, &position);
+	}
+	ok = ok && position == size;
+	PrtUnmapFile(bytes, fileSize);
+	PrtSetMemoryAccount(prevAccount);
+	if (!ok)
+	{
+		PrtStopProcess((PRT_PROCESS *)process);
+		return NULL;
+	}
+
+	// pick up where the checkpointed process left off.
+	for (PRT_UINT32 i = 0; i < numMachines; i++)
+	{
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)process->machines[i];
+		if (!(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) && (context->eventQueue.size > 0 || context->nextOperation != DequeueOperation))
+		{
+			PrtRunStateMachine(context);
+		}
+	}
+	return (PRT_PROCESS *)process;
+}
@@ -39,6 +39,20 @@ PRT_ASSERT_FUN _PrtAssert = &PrtAssertDefaultFn;
 /* Initialize the function to default print fucntion*/
 PRT_PRINT_FUN PrtPrintf = &PrtPrintfDefaultFn;
 
+PRT_VALUE * PRT_CALL_CONV PrtGetGlobalVar(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 varIndex)
+{
+	PRT_VALUE *value = context->varValues[varIndex];
+	if (value == NULL)
+	{
+		// variables get their default value on first use, charged to the machine that owns them.
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+		value = PrtMkDefaultValue(context->process->program->machines[context->instanceOf]->vars[varIndex].type);
+		context->varValues[varIndex] = value;
+		PrtSetMemoryAccount(prevAccount);
+	}
+	return value;
+}
+
 void PRT_CALL_CONV PrtSetGlobalVarLinear(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 varIndex, _In_ PRT_FUN_PARAM_STATUS status, _Inout_ PRT_VALUE **value)
 {
 	PrtAssert(status != PRT_FUN_PARAM_CLONE, "status is not valid");
@@ -57,6 +71,7 @@ void PRT_CALL_CONV PrtSetGlobalVarLinear(_Inout_ PRT_MACHINEINST_PRIV *context,
 	}
 	else 
 	{
+		oldValue = PrtGetGlobalVar(context, varIndex);
 		PrtAssert(PrtIsValidValue(oldValue), "old value is not valid");
 		context->varValues[varIndex] = *value;
 		*value = oldValue;
@@ -123,7 +138,7 @@ void PRT_CALL_CONV PrtSetLocalVarEx(_Inout_ PRT_VALUE **locals, _In_ PRT_UINT32
 // on a realtime OS (like NuttX) where the caller creates a special Thread for running all the state machines
 // in a given process which goes to sleep when there is nothing to do.  This thread is automatically
 // woken up using a semaphore when new work is created via PrtMkMachinePrivate or PrtSendPrivate using this method.
-static void PrtScheduleWork(PRT_MACHINEINST_PRIV *context)
+void PrtScheduleWork(_Inout_ PRT_MACHINEINST_PRIV *context)
 {
     PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV*)context->process;
     switch (privateProcess->schedulingPolicy)
@@ -135,12 +150,7 @@ static void PrtScheduleWork(PRT_MACHINEINST_PRIV *context)
             break;
         case PRT_SCHEDULINGPOLICY_COOPERATIVE:
             {
-                PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
-                if (info->threadsWaiting > 0)
-                {
-                    // signal the PrtRunProcess method that there is work to do.
-                    PrtReleaseSemaphore(info->workAvailable);
-                }
+                PrtSignalWork(privateProcess);
             }
             break;
         default:
@@ -149,6 +159,28 @@ static void PrtScheduleWork(PRT_MACHINEINST_PRIV *context)
     }
 }
 
+void PrtSignalWork(_Inout_ PRT_PROCESS_PRIV *process)
+{
+    PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)process->schedulerInfo;
+
+    // a thread between PrtStepProcess and PrtWaitForWork is not counted yet, so it finds the work marked
+    // instead; the count is read atomically after the compare-and-swap, so the mark is ordered before it.
+    PrtAtomicCompareExchange(&info->workPending, 0, 1);
+    if (PrtAtomicLoad(&info->threadsWaiting) > 0)
+    {
+        // signal the PrtRunProcess method that there is work to do.
+        PrtReleaseSemaphore(info->workAvailable);
+    }
+}
+
+// The stacks live as long as the machine itself, even after it halts, so like the machine they are charged to its home node or process.
+static void PrtAllocMachineStacks(PRT_MACHINEINST_PRIV *context)
+{
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(context->memory.parent);
+	context->callStack = (PRT_STATESTACK *)PrtMalloc(sizeof(PRT_STATESTACK));
+	context->funStack = (PRT_FUNSTACK *)PrtMalloc(sizeof(PRT_FUNSTACK));
+	PrtSetMemoryAccount(prevAccount);
+}
 
 PRT_MACHINEINST_PRIV *
 PrtMkMachinePrivate(
@@ -160,20 +192,27 @@ _In_  PRT_VALUE					*payload
 {
 	PRT_UINT32 packSize;
 	PRT_UINT32 nVars;
-	PRT_UINT8 eQSize;
 	PRT_MACHINEINST_PRIV *context;
 	PRT_UINT32 i;
 
-	PrtLockMutex(process->processLock);
+	//
+	// A machine of a NUMA-aware process is charged to its home node, whose allocator places the machine there
+	//
+	PRT_UINT32 homeNode = PrtChooseHomeNode(process);
+	PRT_MEMORY_ACCOUNT *homeMemory = homeNode == PRT_NUMA_NODE_ANY ? &process->memory : &process->numaNodes[homeNode].memory;
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(homeMemory);
+	PrtAcquireLock(&process->processLock);
 
 
 	nVars = process->program->machines[instanceOf]->nVars;
-	eQSize = PRT_QUEUE_LEN_DEFAULT;
 
 	//
 	// Allocate memory for state machine context
 	//
 	context = (PRT_MACHINEINST_PRIV*)PrtMalloc(sizeof(PRT_MACHINEINST_PRIV));
+	context->homeNode = homeNode;
+	PrtSetMemoryAccount(&process->memory);
 
 	//assign the renamed name
 	context->renamedName = renamedName;
@@ -203,32 +242,39 @@ _In_  PRT_VALUE					*payload
 	machines[numMachines] = (PRT_MACHINEINST *)context;
 	process->numMachines++;
 
+	//
+	// From here on, memory of the machine is charged to the machine
+	//
+	context->memory.allocator = homeMemory->allocator;
+	context->memory.parent = homeMemory;
+	context->memory.tracked = process->memory.tracked;
+	context->memory.quota = process->machineQuota;
+	context->memory.used = 0;
+	context->memory.overQuota = PRT_FALSE;
+	context->memory.exceeded = PRT_FALSE;
+	PrtSetMemoryAccount(&context->memory);
+
 	//
 	// Initialize Machine Identity
 	//
 	context->process = (PRT_PROCESS *)process;
 	context->instanceOf = instanceOf;
+	context->funs = process->funTables[instanceOf];
 	PRT_MACHINEID id;
 	id.machineId = process->numMachines; // index begins with 1 since 0 is reserved
 	id.processId = process->guid;
 	context->id = PrtMkMachineValue(id);
+	PrtSeedMachineChoices(context);
 
 	//
-	// Initialize the map used in PrtDist, map from sender to the last seqnumber received
+	// The map used in PrtDist, from sender to the last seqnumber received, is created by the first remote send
 	//
-	PRT_TYPE *domType = PrtMkPrimitiveType(PRT_KIND_MACHINE);
-	PRT_TYPE *codType = PrtMkPrimitiveType(PRT_KIND_INT);
-	PRT_TYPE *recvMapType = PrtMkMapType(domType, codType);
-	context->recvMap = PrtMkDefaultValue(recvMapType);
-	PrtFreeType(domType);
-	PrtFreeType(codType);
-	PrtFreeType(recvMapType);
+	context->recvMap = NULL;
 
 	// Initialize Machine Internal Variables
 	//
 	context->currentState = process->program->machines[context->instanceOf]->initStateIndex;
-	context->isRunning = PRT_FALSE;
-	context->isHalted = PRT_FALSE; 
+	context->runState = 0;
     context->nextOperation = EntryOperation;
 	context->lastOperation = ReturnStatement;
 	context->exitReason = NotExit;
@@ -239,31 +285,51 @@ _In_  PRT_VALUE					*payload
 	context->currentPayload = PrtCloneValue(payload);
 
 	//
-	// Allocate memory for local variables and initialize them
+	// Allocate memory for local variables; each one is initialized by PrtGetGlobalVar when first used
 	//
 	context->varValues = NULL;
 	if (nVars > 0)
 	{
 		context->varValues = PrtCalloc(nVars, sizeof(PRT_VALUE*));
-		for (i = 0; i < nVars; i++)
-		{
-			context->varValues[i] = PrtMkDefaultValue(process->program->machines[instanceOf]->vars[i].type);
-		}
 	}
 
 	context->receive = NULL;
+	PrtInitTimer(&context->receiveTimer, &PrtReceiveTimerFired, context);
+	context->receiveDeadline = 0;
+	context->receiveHasDeadline = PRT_FALSE;
+	context->receiveTimedOut = PRT_FALSE;
+	context->receiveCases = NULL;
+	context->receiveWaiting = PRT_FALSE;
+	context->receiveMatch = PRT_QUEUE_NO_MATCH;
+	context->blockingJob = NULL;
+	context->fdWatches = 0;
+	context->expiredEvents = 0;
+	context->admission = NULL;
+	context->call = NULL;
+	PrtInitTimer(&context->callTimer, &PrtCallTimerFired, context);
+	context->callsMade = 0;
+	context->callToken = 0;
+	context->batch = NULL;
+	context->batchNext = 0;
+	context->batchCount = 0;
+	context->batchDeferredSet = 0;
+	context->deferredSetVersion = 0;
 
 	//
 	// Initialize various stacks
 	//
-	context->callStack.length = 0;
-	context->funStack.length = 0;
+	PrtAllocMachineStacks(context);
+	context->callStack->length = 0;
+	context->funStack->length = 0;
+	context->idleSince = 0;
+	context->hibernatedState = NULL;
+	context->enqueueCount = 0;
 
 	//
-	// Initialize event queue
+	// Initialize event queue; its storage is allocated by the first send
 	//
-	context->eventQueue.eventsSize = eQSize;
-	context->eventQueue.events = (PRT_EVENT*)PrtCalloc(eQSize, sizeof(PRT_EVENT));
+	context->eventQueue.eventsSize = 0;
+	context->eventQueue.events = NULL;
 	context->eventQueue.headIndex = 0;
 	context->eventQueue.tailIndex = 0;
 	context->eventQueue.size = 0;
@@ -289,20 +355,25 @@ _In_  PRT_VALUE					*payload
 	//
 	//Initialize state machine lock
 	//
-	context->stateMachineLock = PrtCreateMutex();
+	PrtInitLock(&context->stateMachineLock);
+
+	if (process->recorder != NULL)
+	{
+		PrtRecordCreate(context, payload);
+	}
+	PrtReleaseLock(&process->processLock);
 
 	//
-	//Log
+	//Log, after releasing the process lock since the log handler may take it
 	//
 	PrtLog(PRT_STEP_CREATE, NULL, context, NULL, NULL);
 
-	PrtUnlockMutex(process->processLock);
-
 	//
 	// Run the state machine according to the scheduling policy.
 	//
     PrtScheduleWork(context);
 
+	PrtSetMemoryAccount(prevAccount);
 	return context;
 }
 
@@ -322,12 +393,39 @@ _Inout_ PRT_MACHINEINST_PRIV		*context
 	return context->currentPayload;
 }
 
-void
-PrtSendPrivate(
+// Gives up the payload of an event that is not queued after all, or was dropped from the queue.
+static void
+PrtDropEventPayload(
+_In_ PRT_VALUE					*payload,
+_Inout_ PRT_SHARED_PAYLOAD		*shared
+)
+{
+	if (shared != NULL)
+	{
+		PrtReleaseSharedPayload(shared);
+	}
+	else if (payload != NULL)
+	{
+		PrtFreeValue(payload);
+	}
+}
+
+// Adds an event to the queue of context, whose stateMachineLock the caller holds; payload is the value of shared, if that
+// is set, and the event is the request of the call callToken names, if that is not 0. An event that may be refused is
+// turned away, rather than reported as an error, if there is no room for it or the admission policy of the machine
+// sheds it. Sets *error to the error to report once the lock is released, and *schedule if the machine has work to do.
+static PRT_SEND_STATUS
+PrtAddEvent(
 _In_ PRT_MACHINESTATE           *state,
 _Inout_ PRT_MACHINEINST_PRIV	*context,
 _In_ PRT_VALUE					*event,
-_In_ PRT_VALUE					*payload
+_In_ PRT_VALUE					*payload,
+_Inout_ PRT_SHARED_PAYLOAD		*shared,
+_In_ PRT_UINT32					timeToLive,
+_In_ PRT_UINT64					callToken,
+_In_ PRT_BOOLEAN				mayRefuse,
+_Inout_ PRT_STATUS				*error,
+_Inout_ PRT_BOOLEAN				*schedule
 )
 {
 	PRT_EVENTQUEUE *queue;
@@ -336,42 +434,73 @@ _In_ PRT_VALUE					*payload
 	PRT_UINT32 maxQueueSize;
 	PRT_UINT32 eventIndex;
 
-	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
-	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)), "Payload must be member of event payload type");
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_UINT64 deadline = timeToLive == 0 ? 0 : PrtGetProcessTime(context->process) + timeToLive;
+	eventIndex = PrtPrimGetEvent(event);
+	eventMaxInstances = context->process->program->events[eventIndex]->eventMaxInstances;
+	maxQueueSize = context->process->program->machines[context->instanceOf]->maxQueueSize;
+	queue = &context->eventQueue;
 
-	PrtLockMutex(context->stateMachineLock);
+	if (mayRefuse && !(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED))
+	{
+		// a refused event is not recorded, since a replay enqueues every recorded one; so these checks come first.
+		PRT_SEND_STATUS status = PRT_SEND_ACCEPTED;
+		if ((eventMaxInstances != 0xffffffff && PrtIsEventMaxInstanceExceeded(queue, eventIndex, eventMaxInstances)) ||
+			(maxQueueSize != 0xffffffff && queue->size >= maxQueueSize))
+		{
+			status = PRT_SEND_OVERFLOW;
+		}
+		else if (!PrtAdmitEvent(context, eventIndex))
+		{
+			status = PRT_SEND_SHED;
+		}
+		if (status != PRT_SEND_ACCEPTED)
+		{
+			PrtDropEventPayload(payload, shared);
+			return status;
+		}
+	}
 
-	if (context->isHalted)
+	if (process->recorder != NULL)
 	{
-		// drop the event silently
-		PrtUnlockMutex(context->stateMachineLock);
-		// which means we must free the payload now, since we are not storing it in the queue.
-		PrtFreeValue(payload);
-		return;
+		PrtRecordSend(state, context, event, payload, timeToLive);
 	}
 
-	eventIndex = PrtPrimGetEvent(event);
-	eventMaxInstances = context->process->program->events[eventIndex]->eventMaxInstances;
-	maxQueueSize = context->process->program->machines[context->instanceOf]->maxQueueSize;
+	if (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED)
+	{
+		// drop the event silently, which means we must free the payload now, since we are not storing it in the queue.
+		PrtDropEventPayload(payload, shared);
+		return PRT_SEND_ACCEPTED;
+	}
 
-	queue = &context->eventQueue;
+	PrtThawMachine(context);
 
 	// check if maximum allowed instances of event are already present in queue
 	if (eventMaxInstances != 0xffffffff && PrtIsEventMaxInstanceExceeded(queue, eventIndex, eventMaxInstances))
 	{
-		PrtUnlockMutex(context->stateMachineLock);
-		PrtHandleError(PRT_STATUS_EVENT_OVERFLOW, context);
-		return;
+		if (shared != NULL)
+		{
+			PrtReleaseSharedPayload(shared);
+		}
+		*error = PRT_STATUS_EVENT_OVERFLOW;
+		return PRT_SEND_OVERFLOW;
 	}
 
-	// if queue is full, resize the queue if possible
+	// the queue belongs to the receiver, so it grows on the receiver's heap.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+
+	// if queue is full (or has no storage yet), resize the queue if possible
 	if (queue->eventsSize == queue->size)
 	{
 		if (maxQueueSize != 0xffffffff && queue->size == maxQueueSize)
 		{
-			PrtUnlockMutex(context->stateMachineLock);
-			PrtHandleError(PRT_STATUS_QUEUE_OVERFLOW, context);
-			return;
+			PrtSetMemoryAccount(prevAccount);
+			if (shared != NULL)
+			{
+				PrtReleaseSharedPayload(shared);
+			}
+			*error = PRT_STATUS_QUEUE_OVERFLOW;
+			return PRT_SEND_OVERFLOW;
 		}
 		PrtResizeEventQueue(context);
 	}
@@ -383,6 +512,11 @@ _In_ PRT_VALUE					*payload
 	//
 	queue->events[tail].trigger = PrtCloneValue(event);
 	queue->events[tail].payload = payload;
+	queue->events[tail].shared = shared;
+	queue->events[tail].deadline = deadline;
+	queue->events[tail].enqueuedAt = context->admission != NULL && context->admission->timesQueue ? PrtGetProcessTime(context->process) : 0;
+	queue->events[tail].callToken = callToken;
+	PrtSetMemoryAccount(prevAccount);
 	if (state != NULL) {
 		queue->events[tail].state = *state;
 	}
@@ -403,27 +537,194 @@ _In_ PRT_VALUE					*payload
 	// Check if this event unblocks a blocking "receive" operation.  
     if (context->receive != NULL)
     {
-        if (PrtIsEventReceivable(context, PrtPrimGetEvent(event)))
+        if (PrtIsEventReceivable(context, eventIndex))
         {
+            // the first case event to come while the machine waits is taken from where it is, without a scan of the queue.
+            if (context->receiveWaiting && context->receiveMatch == PRT_QUEUE_NO_MATCH)
+            {
+                context->receiveMatch = queue->size - 1;
+            }
             // receive is now unblocked, so tell the next call to PrtStepStateMachine to pick
             // up in the DoEntry state where it will re-initialize the call stack so the
             // Receive can continue where it left off.
             context->nextOperation = EntryOperation;
-            PrtUnlockMutex(context->stateMachineLock);
-            PrtScheduleWork(context);
-        }
-        else
-        {
-            // No point scheduling work if the receive is still blocked.
-            PrtUnlockMutex(context->stateMachineLock);
+            *schedule = PRT_TRUE;
         }
+        // No point scheduling work if the receive is still blocked.
     }
     else 
     {
-        PrtUnlockMutex(context->stateMachineLock);
-        PrtScheduleWork(context);
+        *schedule = PRT_TRUE;
     }
-	return;
+	return PRT_SEND_ACCEPTED;
+}
+
+// Adds an event to the queue of context and schedules the machine, as PrtAddEvent does, after any sends to context
+// the step running on this thread holds back.
+static PRT_SEND_STATUS
+PrtEnqueueEvent(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_In_ PRT_VALUE					*payload,
+_Inout_ PRT_SHARED_PAYLOAD		*shared,
+_In_ PRT_UINT32					timeToLive,
+_In_ PRT_UINT64					callToken,
+_In_ PRT_BOOLEAN				mayRefuse
+)
+{
+	PrtFlushOutboxTo(context);
+	PRT_STATUS error = PRT_STATUS_SUCCESS;
+	PRT_BOOLEAN schedule = PRT_FALSE;
+	PrtAcquireLock(&context->stateMachineLock);
+	PRT_SEND_STATUS status = PrtAddEvent(state, context, event, payload, shared, timeToLive, callToken, mayRefuse, &error, &schedule);
+	PrtReleaseLock(&context->stateMachineLock);
+	if (error != PRT_STATUS_SUCCESS)
+	{
+		PrtHandleError(error, context);
+	}
+	if (schedule)
+	{
+		PrtScheduleWork(context);
+	}
+	return status;
+}
+
+void
+PrtEnqueueSends(
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_Inout_ PRT_OUTBOX_SEND			**sends,
+_In_ PRT_UINT32					count
+)
+{
+	PRT_BOOLEAN schedule = PRT_FALSE;
+	PrtAcquireLock(&context->stateMachineLock);
+	for (PRT_UINT32 i = 0; i < count; i++)
+	{
+		PRT_STATUS error = PRT_STATUS_SUCCESS;
+		PRT_VALUE *event = PrtMkEventValue(sends[i]->eventIndex);
+		PrtAddEvent(&sends[i]->state, context, event, sends[i]->payload, NULL, sends[i]->timeToLive, 0, PRT_FALSE, &error, &schedule);
+		PrtFreeValue(event);
+		if (error != PRT_STATUS_SUCCESS)
+		{
+			// as for a single send, the error handler runs without the lock, and the sends after it still go.
+			PrtReleaseLock(&context->stateMachineLock);
+			PrtHandleError(error, context);
+			PrtAcquireLock(&context->stateMachineLock);
+		}
+	}
+	PrtReleaseLock(&context->stateMachineLock);
+	if (schedule)
+	{
+		PrtScheduleWork(context);
+	}
+}
+
+void
+PrtSendPrivate(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_In_ PRT_VALUE					*payload
+)
+{
+	PRT_UINT32 timeToLive = context->process->program->events[PrtPrimGetEvent(event)]->timeToLive;
+	PrtSendPrivateWithTimeToLive(state, context, event, payload, timeToLive);
+}
+
+void
+PrtSendPrivateWithTimeToLive(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_In_ PRT_VALUE					*payload,
+_In_ PRT_UINT32					timeToLive
+)
+{
+	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
+	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)), "Payload must be member of event payload type");
+
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	if (process->replayer != NULL && !PrtReplaySend(state, context, event, payload, timeToLive))
+	{
+		return;
+	}
+	if (PrtBufferSend(state, context, event, payload, timeToLive))
+	{
+		return;
+	}
+	PrtEnqueueEvent(state, context, event, payload, NULL, timeToLive, 0, PRT_FALSE);
+}
+
+PRT_SEND_STATUS
+PrtTrySendPrivate(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_In_ PRT_VALUE					*payload
+)
+{
+	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
+	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)), "Payload must be member of event payload type");
+
+	// a replay takes every event the recording has, and refuses none.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_UINT32 timeToLive = process->program->events[PrtPrimGetEvent(event)]->timeToLive;
+	if (process->replayer != NULL)
+	{
+		if (PrtReplaySend(state, context, event, payload, timeToLive))
+		{
+			PrtEnqueueEvent(state, context, event, payload, NULL, timeToLive, 0, PRT_FALSE);
+		}
+		return PRT_SEND_ACCEPTED;
+	}
+	return PrtEnqueueEvent(state, context, event, payload, NULL, timeToLive, 0, PRT_TRUE);
+}
+
+void
+PrtSendRequest(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_In_ PRT_VALUE					*payload,
+_In_ PRT_UINT64					callToken
+)
+{
+	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
+	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)), "Payload must be member of event payload type");
+
+	// a replay takes the reply from the recording, so the token of a request it holds back is not needed.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_UINT32 timeToLive = process->program->events[PrtPrimGetEvent(event)]->timeToLive;
+	if (process->replayer != NULL && !PrtReplaySend(state, context, event, payload, timeToLive))
+	{
+		return;
+	}
+	PrtEnqueueEvent(state, context, event, payload, NULL, timeToLive, callToken, PRT_FALSE);
+}
+
+void
+PrtSendShared(
+_In_ PRT_MACHINESTATE           *state,
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_In_ PRT_VALUE					*event,
+_Inout_ PRT_SHARED_PAYLOAD		*shared
+)
+{
+	PRT_UINT32 timeToLive = context->process->program->events[PrtPrimGetEvent(event)]->timeToLive;
+	PrtEnqueueEvent(state, context, event, shared->value, shared, timeToLive, 0, PRT_FALSE);
+}
+
+void
+PrtReleaseSharedPayload(
+_Inout_ PRT_SHARED_PAYLOAD		*shared
+)
+{
+	if (PrtAtomicAdd(&shared->refs, (size_t)0 - 1) == 0)
+	{
+		PrtFreeValue(shared->value);
+		PrtFree(shared);
+	}
 }
 
 void
@@ -436,25 +737,38 @@ _In_ PRT_VALUE					*payload
 )
 {
 	// Check if the enqueued event is in order
-	PrtLockMutex(context->stateMachineLock);
+	PrtAcquireLock(&context->stateMachineLock);
 
-	if (context->isHalted)
+	if (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED)
 	{
-		PrtUnlockMutex(context->stateMachineLock);
+		PrtReleaseLock(&context->stateMachineLock);
 		return;
 	}
 
-	if (PrtMapExists(context->recvMap, source) && PrtMapGet(context->recvMap, source)->valueUnion.nt >= seqNum)
+	PrtThawMachine(context);
+	if (context->recvMap != NULL && PrtMapExists(context->recvMap, source) && PrtMapGet(context->recvMap, source)->valueUnion.nt >= seqNum)
 	{
-		PrtUnlockMutex(context->stateMachineLock);
+		PrtReleaseLock(&context->stateMachineLock);
 		// Drop the event
 		return;
 	}
 	else
 	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+		if (context->recvMap == NULL)
+		{
+			PRT_TYPE *domType = PrtMkPrimitiveType(PRT_KIND_MACHINE);
+			PRT_TYPE *codType = PrtMkPrimitiveType(PRT_KIND_INT);
+			PRT_TYPE *recvMapType = PrtMkMapType(domType, codType);
+			context->recvMap = PrtMkDefaultValue(recvMapType);
+			PrtFreeType(domType);
+			PrtFreeType(codType);
+			PrtFreeType(recvMapType);
+		}
 		PrtMapUpdate(context->recvMap, source, PrtMkIntValue((PRT_INT32)seqNum));
+		PrtSetMemoryAccount(prevAccount);
 	}
-	PrtUnlockMutex(context->stateMachineLock);
+	PrtReleaseLock(&context->stateMachineLock);
 
 	// get the name of the sender machine.
 	PRT_MACHINEINST_PRIV* senderMachine = (PRT_MACHINEINST_PRIV*)PrtGetMachine(context->process, source);
@@ -478,16 +792,113 @@ FORCEINLINE
 PRT_FUNDECL *
 GetFunDeclFromIndex(_In_ PRT_MACHINEINST_PRIV	*context, _In_ PRT_UINT32 funIndex)
 {
-	PRT_UINT32 isMachineLocal = funIndex % 2;
-	PRT_UINT32 arrayIndex = funIndex / 2;
-	if (isMachineLocal)
+	return context->funs[funIndex].decl;
+}
+
+FORCEINLINE
+PRT_SM_FUN
+GetFunFromIndex(_In_ PRT_MACHINEINST_PRIV	*context, _In_ PRT_UINT32 funIndex)
+{
+	return context->funs[funIndex].implementation;
+}
+
+static PRT_UINT16 *PrtIndexFunReceives(_In_ PRT_PROGRAMDECL *program, _In_ PRT_FUNDECL *funDecl)
+{
+	if (funDecl->nReceives == 0)
 	{
-		return &context->process->program->machines[context->instanceOf]->funs[arrayIndex];
+		return NULL;
 	}
-	else
+	PRT_UINT16 *rows = (PRT_UINT16 *)PrtCalloc(funDecl->nReceives * program->nEvents, sizeof(PRT_UINT16));
+	for (PRT_UINT32 r = 0; r < funDecl->nReceives; r++)
 	{
-		return context->process->program->globalFuns[arrayIndex];
+		PRT_RECEIVEDECL *receive = &funDecl->receives[r];
+		PrtAssert(receive->nCases < 0xFFFF, "Too many cases in a receive");
+		for (PRT_UINT32 j = 0; j < receive->nCases; j++)
+		{
+			PRT_UINT16 *caseOf = &rows[r * program->nEvents + receive->cases[j].triggerEventIndex];
+			// the first case for a trigger wins, as it did when the cases were searched in order.
+			if (*caseOf == 0)
+			{
+				*caseOf = (PRT_UINT16)(j + 1);
+			}
+		}
 	}
+	return rows;
+}
+
+void
+PrtIndexFunctions(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	PRT_PROGRAMDECL *program = process->program;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+	process->machineFunBase = (PRT_UINT32 *)PrtCalloc(program->nMachines == 0 ? 1 : program->nMachines, sizeof(PRT_UINT32));
+	PRT_UINT32 nFuns = program->nGlobalFuns;
+	for (PRT_UINT32 m = 0; m < program->nMachines; m++)
+	{
+		process->machineFunBase[m] = nFuns;
+		nFuns += program->machines[m]->nFuns;
+	}
+	process->receiveCases = (PRT_UINT16 **)PrtCalloc(nFuns == 0 ? 1 : nFuns, sizeof(PRT_UINT16 *));
+	for (PRT_UINT32 g = 0; g < program->nGlobalFuns; g++)
+	{
+		process->receiveCases[g] = PrtIndexFunReceives(program, program->globalFuns[g]);
+	}
+	for (PRT_UINT32 m = 0; m < program->nMachines; m++)
+	{
+		for (PRT_UINT32 f = 0; f < program->machines[m]->nFuns; f++)
+		{
+			process->receiveCases[process->machineFunBase[m] + f] = PrtIndexFunReceives(program, &program->machines[m]->funs[f]);
+		}
+	}
+
+	// the global functions take the even indices and those of the machine type the odd ones.
+	process->funTables = (PRT_FUNENTRY **)PrtCalloc(program->nMachines == 0 ? 1 : program->nMachines, sizeof(PRT_FUNENTRY *));
+	for (PRT_UINT32 m = 0; m < program->nMachines; m++)
+	{
+		PRT_MACHINEDECL *machineDecl = program->machines[m];
+		PRT_UINT32 nEntries = 2 * (program->nGlobalFuns > machineDecl->nFuns ? program->nGlobalFuns : machineDecl->nFuns);
+		PRT_FUNENTRY *table = (PRT_FUNENTRY *)PrtCalloc(nEntries == 0 ? 1 : nEntries, sizeof(PRT_FUNENTRY));
+		for (PRT_UINT32 g = 0; g < program->nGlobalFuns; g++)
+		{
+			table[2 * g].decl = program->globalFuns[g];
+			table[2 * g].implementation = program->globalFuns[g]->implementation;
+			table[2 * g].receiveCases = process->receiveCases[g];
+		}
+		for (PRT_UINT32 f = 0; f < machineDecl->nFuns; f++)
+		{
+			table[2 * f + 1].decl = &machineDecl->funs[f];
+			table[2 * f + 1].implementation = machineDecl->funs[f].implementation;
+			table[2 * f + 1].receiveCases = process->receiveCases[process->machineFunBase[m] + f];
+		}
+		process->funTables[m] = table;
+	}
+	PrtSetMemoryAccount(prevAccount);
+}
+
+void
+PrtFreeFunctionIndex(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	PRT_PROGRAMDECL *program = process->program;
+	PRT_UINT32 nFuns = program->nMachines == 0 ? program->nGlobalFuns :
+		process->machineFunBase[program->nMachines - 1] + program->machines[program->nMachines - 1]->nFuns;
+	for (PRT_UINT32 f = 0; f < nFuns; f++)
+	{
+		PrtFree(process->receiveCases[f]);
+	}
+	for (PRT_UINT32 m = 0; m < program->nMachines; m++)
+	{
+		PrtFree(process->funTables[m]);
+	}
+	PrtFree(process->funTables);
+	PrtFree(process->receiveCases);
+	PrtFree(process->machineFunBase);
+	process->funTables = NULL;
+	process->receiveCases = NULL;
+	process->machineFunBase = NULL;
 }
 
 void
@@ -564,19 +975,12 @@ PrtRaise(
 	...
 )
 {
-	PrtAssert(!PrtIsSpecialEvent(event), "Raised event must not be null");
-	PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
-	PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
-	context->lastOperation = RaiseStatement;
-	context->currentTrigger = PrtCloneValue(event);
 	PRT_VALUE *payload = NULL;
-	if (numArgs == 0)
-	{
-		payload = PrtMkNullValue();
-	}
-	else
+	if (numArgs > 0)
 	{
-		PRT_VALUE **args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		// a single argument is the payload itself, so only tuples need an array.
+		PRT_VALUE *arg0 = NULL;
+		PRT_VALUE **args = numArgs > 1 ? PrtCalloc(numArgs, sizeof(PRT_VALUE*)) : &arg0;
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -610,10 +1014,30 @@ PrtRaise(
 		{
 			PRT_TYPE *payloadType = PrtGetPayloadType(context, event); 
 			payload = MakeTupleFromArray(payloadType, args);
+			PrtFree(args);
 		}
-		PrtFree(args);
+	}
+	PrtRaiseWithPayload(context, event, payload);
+}
+
+void
+PrtRaiseWithPayload(
+	_Inout_ PRT_MACHINEINST_PRIV		*context,
+	_In_ PRT_VALUE						*event,
+	_In_ PRT_VALUE						*payload
+)
+{
+	PrtAssert(!PrtIsSpecialEvent(event), "Raised event must not be null");
+	PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
+	PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
+	if (payload == NULL)
+	{
+		payload = PrtMkNullValue();
 	}
 	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)), "Payload must be member of event payload type");
+	context->lastOperation = RaiseStatement;
+	// the event is handled from eventValue, so the trigger is not cloned just to be freed again.
+	context->eventValue = PrtPrimGetEvent(event);
 	context->currentPayload = payload;
 
 	PRT_MACHINESTATE state;
@@ -621,53 +1045,151 @@ PrtRaise(
 	PrtLog(PRT_STEP_RAISE, &state, context, event, payload);
 }
 
-PRT_BOOLEAN
-PrtReceive(
-_Inout_ PRT_MACHINEINST_PRIV	*context,
-_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
-_In_ PRT_UINT16					receiveIndex
+// Receives with a deadline if hasDeadline. Returns with the stateMachineLock held if the machine is blocked.
+static PRT_RECEIVE_RESULT
+PrtReceiveUntil(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+	_In_ PRT_UINT16					receiveIndex,
+	_In_ PRT_BOOLEAN				hasDeadline,
+	_In_ PRT_UINT64					deadline
 )
 {
 	PRT_UINT32 funIndex = funStackInfo->funIndex;
 	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
-	for (PRT_UINT32 i = 0; i < funDecl->nReceives; i++)
+	PRT_UINT32 position = 0;
+	while (position < funDecl->nReceives && funDecl->receives[position].receiveIndex != receiveIndex)
 	{
-		if (funDecl->receives[i].receiveIndex == receiveIndex)
-		{
-			context->receive = &funDecl->receives[i];
-			break;
-		}
+		position++;
 	}
-	PrtAssert(context->receive != NULL, "receiveIndex must correspond to a valid receive");
+	PrtAssert(position < funDecl->nReceives, "receiveIndex must correspond to a valid receive");
 	funStackInfo->returnTo = receiveIndex;
-	PrtLockMutex(context->stateMachineLock);
-	PrtAssert(context->isRunning, "Machine must be running");
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtAssert(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_RUNNING, "Machine must be running");
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	context->receive = &funDecl->receives[position];
+	context->receiveCases = context->funs[funIndex].receiveCases + position * process->program->nEvents;
 	if (PrtDequeueEvent(context, funStackInfo))
 	{
-		PrtUnlockMutex(context->stateMachineLock);
-		return PRT_TRUE;
+		if (context->receiveHasDeadline)
+		{
+			PrtCancelTimer(&process->timers, &context->receiveTimer);
+			context->receiveHasDeadline = PRT_FALSE;
+			context->receiveTimedOut = PRT_FALSE;
+		}
+		PrtReleaseLock(&context->stateMachineLock);
+		return PRT_RECEIVE_CASE;
 	}
-	else
+	if (hasDeadline)
 	{
-		PrtPushFrame(context, funStackInfo);
-		return PRT_FALSE;
+		// whether the deadline passed depends on the clock, so a replay takes the recorded answer.
+		PRT_BOOLEAN timedOut = context->receiveTimedOut || deadline <= PrtGetProcessTime(context->process);
+		if (PrtRecordDecision(context, timedOut))
+		{
+			if (context->receiveHasDeadline)
+			{
+				PrtCancelTimer(&process->timers, &context->receiveTimer);
+			}
+			context->receiveHasDeadline = PRT_FALSE;
+			context->receiveTimedOut = PRT_FALSE;
+			context->receiveWaiting = PRT_FALSE;
+			context->receive = NULL;
+			PrtReleaseLock(&context->stateMachineLock);
+			return PRT_RECEIVE_TIMEOUT;
+		}
+		if (!context->receiveHasDeadline)
+		{
+			// a replay ends the wait where the recording says the timer fired, so it arms no timer of its own.
+			context->receiveHasDeadline = PRT_TRUE;
+			context->receiveDeadline = deadline;
+			if (process->replayer == NULL)
+			{
+				PrtArmTimer(&process->timers, &context->receiveTimer, deadline);
+			}
+		}
 	}
+	context->receiveWaiting = PRT_TRUE;
+	context->receiveMatch = PRT_QUEUE_NO_MATCH;
+	PrtPushFrame(context, funStackInfo);
+	return PRT_RECEIVE_BLOCKED;
+}
+
+PRT_BOOLEAN
+PrtReceive(
+_Inout_ PRT_MACHINEINST_PRIV	*context,
+_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+_In_ PRT_UINT16					receiveIndex
+)
+{
+	return PrtReceiveUntil(context, funStackInfo, receiveIndex, PRT_FALSE, 0) == PRT_RECEIVE_CASE;
+}
+
+PRT_RECEIVE_RESULT
+PrtReceiveWithDeadline(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+	_In_ PRT_UINT16					receiveIndex,
+	_In_ PRT_UINT64					deadline
+)
+{
+	return PrtReceiveUntil(context, funStackInfo, receiveIndex, PRT_TRUE, deadline);
+}
+
+PRT_RECEIVE_RESULT
+PrtReceiveWithTimeout(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+	_In_ PRT_UINT16					receiveIndex,
+	_In_ PRT_UINT64					timeout
+)
+{
+	// a machine called again at the receive it is waiting in keeps the deadline it had.
+	PRT_UINT64 deadline = context->receiveHasDeadline ? context->receiveDeadline : PrtGetProcessTime(context->process) + timeout;
+	return PrtReceiveUntil(context, funStackInfo, receiveIndex, PRT_TRUE, deadline);
+}
+
+void
+PrtReceiveTimerFired(
+	_Inout_ void					*owner,
+	_In_ PRT_UINT32					generation
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)owner;
+	PrtAcquireLock(&context->stateMachineLock);
+
+	// the receive may have ended, or a later one started, since the timer was collected.
+	if ((PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) || context->receive == NULL ||
+		context->receiveTimer.generation != generation || context->receiveTimedOut)
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		return;
+	}
+	context->receiveTimedOut = PRT_TRUE;
+	if (((PRT_PROCESS_PRIV *)context->process)->recorder != NULL)
+	{
+		PrtRecordTimeout(context);
+	}
+
+	// as for an event that unblocks the receive, the function is called again at the receive.
+	context->nextOperation = EntryOperation;
+	PrtReleaseLock(&context->stateMachineLock);
+	PrtScheduleWork(context);
 }
 
 PRT_FUNSTACK_INFO *
 PrtTopOfFunStack(
 _In_ PRT_MACHINEINST_PRIV	*context)
 {
-	PrtAssert(0 < context->funStack.length, "Illegal fun stack access");
-	return &context->funStack.funs[0];
+	PrtAssert(0 < context->funStack->length, "Illegal fun stack access");
+	return &context->funStack->funs[0];
 }
 
 PRT_FUNSTACK_INFO *
 PrtBottomOfFunStack(
 _In_ PRT_MACHINEINST_PRIV	*context)
 {
-	PrtAssert(0 < context->funStack.length, "Illegal fun stack access");
-	return &context->funStack.funs[context->funStack.length - 1];
+	PrtAssert(0 < context->funStack->length, "Illegal fun stack access");
+	return &context->funStack->funs[context->funStack->length - 1];
 }
 
 static void 
@@ -694,10 +1216,10 @@ PrtPushNewEventHandlerFrame(
 )
 {
 	PrtAssert(payloadStatus != PRT_FUN_PARAM_CLONE, "Incorrect payload status value");
-	PRT_UINT16 length = context->funStack.length;
+	PRT_UINT16 length = context->funStack->length;
 	PrtAssert(length < PRT_MAX_FUNSTACK_DEPTH, "Fun stack overflow");
-	context->funStack.length = length + 1;
-	context->funStack.funs[length].funIndex = funIndex;
+	context->funStack->length = length + 1;
+	context->funStack->funs[length].funIndex = funIndex;
 	PRT_BOOLEAN freeLocals = PRT_FALSE;
 	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
 	PRT_VALUE ***refArgs = NULL;
@@ -753,11 +1275,11 @@ PrtPushNewEventHandlerFrame(
 			count++;
 		}
 	}
-	context->funStack.funs[length].locals = locals;
-	context->funStack.funs[length].freeLocals = freeLocals;
-	context->funStack.funs[length].refArgs = refArgs;
-	context->funStack.funs[length].returnTo = 0xFFFF;
-	context->funStack.funs[length].rcase = NULL;
+	context->funStack->funs[length].locals = locals;
+	context->funStack->funs[length].freeLocals = freeLocals;
+	context->funStack->funs[length].refArgs = refArgs;
+	context->funStack->funs[length].returnTo = 0xFFFF;
+	context->funStack->funs[length].rcase = NULL;
 }
 
 void
@@ -768,10 +1290,10 @@ PrtPushNewFrame(
 	...
 )
 {
-	PRT_UINT16 length = context->funStack.length;
+	PRT_UINT16 length = context->funStack->length;
 	PrtAssert(length < PRT_MAX_FUNSTACK_DEPTH, "Fun stack overflow");
-	context->funStack.length = length + 1;
-	context->funStack.funs[length].funIndex = funIndex;
+	context->funStack->length = length + 1;
+	context->funStack->funs[length].funIndex = funIndex;
 	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
 	PRT_VALUE **locals = NULL;
 	PRT_VALUE ***refArgs = NULL;
@@ -846,11 +1368,11 @@ PrtPushNewFrame(
 			count++;
 		}
 	}
-	context->funStack.funs[length].locals = locals;
-	context->funStack.funs[length].freeLocals = freeLocals;
-	context->funStack.funs[length].refArgs = refArgs;
-	context->funStack.funs[length].returnTo = 0xFFFF;
-	context->funStack.funs[length].rcase = NULL;
+	context->funStack->funs[length].locals = locals;
+	context->funStack->funs[length].freeLocals = freeLocals;
+	context->funStack->funs[length].refArgs = refArgs;
+	context->funStack->funs[length].returnTo = 0xFFFF;
+	context->funStack->funs[length].rcase = NULL;
 }
 
 void
@@ -859,15 +1381,15 @@ _Inout_ PRT_MACHINEINST_PRIV	*context,
 _In_ PRT_FUNSTACK_INFO			*funStackInfo
 )
 {
-	PRT_UINT16 length = context->funStack.length;
+	PRT_UINT16 length = context->funStack->length;
 	PrtAssert(length < PRT_MAX_FUNSTACK_DEPTH, "Fun stack overflow");
-	context->funStack.length = length + 1;
-	context->funStack.funs[length].funIndex = funStackInfo->funIndex;
-	context->funStack.funs[length].locals = funStackInfo->locals;
-	context->funStack.funs[length].refArgs = funStackInfo->refArgs;
-	context->funStack.funs[length].freeLocals = funStackInfo->freeLocals;
-	context->funStack.funs[length].returnTo = funStackInfo->returnTo;
-	context->funStack.funs[length].rcase = funStackInfo->rcase;
+	context->funStack->length = length + 1;
+	context->funStack->funs[length].funIndex = funStackInfo->funIndex;
+	context->funStack->funs[length].locals = funStackInfo->locals;
+	context->funStack->funs[length].refArgs = funStackInfo->refArgs;
+	context->funStack->funs[length].freeLocals = funStackInfo->freeLocals;
+	context->funStack->funs[length].returnTo = funStackInfo->returnTo;
+	context->funStack->funs[length].rcase = funStackInfo->rcase;
 }
 
 void
@@ -876,16 +1398,16 @@ _Inout_ PRT_MACHINEINST_PRIV	*context,
 _Inout_ PRT_FUNSTACK_INFO *funStackInfo
 )
 {
-	PRT_UINT16 length = context->funStack.length;
+	PRT_UINT16 length = context->funStack->length;
 	PrtAssert(0 < length, "Fun stack underflow");
 	PRT_UINT16 top = length - 1;
-	funStackInfo->funIndex = context->funStack.funs[top].funIndex;
-	funStackInfo->locals = context->funStack.funs[top].locals;
-	funStackInfo->refArgs = context->funStack.funs[top].refArgs;
-	funStackInfo->freeLocals = context->funStack.funs[top].freeLocals;
-	funStackInfo->returnTo = context->funStack.funs[top].returnTo;
-	funStackInfo->rcase = context->funStack.funs[top].rcase;
-	context->funStack.length = top;
+	funStackInfo->funIndex = context->funStack->funs[top].funIndex;
+	funStackInfo->locals = context->funStack->funs[top].locals;
+	funStackInfo->refArgs = context->funStack->funs[top].refArgs;
+	funStackInfo->freeLocals = context->funStack->funs[top].freeLocals;
+	funStackInfo->returnTo = context->funStack->funs[top].returnTo;
+	funStackInfo->rcase = context->funStack->funs[top].rcase;
+	context->funStack->length = top;
 }
 
 void
@@ -905,17 +1427,17 @@ _In_	PRT_UINT32				stateIndex
 	PrtGetMachineState((PRT_MACHINEINST*)context, &state);
 
 	packSize = PrtGetPackSize(context);
-	length = context->callStack.length;
+	length = context->callStack->length;
 	currDef = PrtGetDeferredPacked(context, context->currentState);
 	currActions = PrtGetActionsPacked(context, context->currentState);
 	currTransitions = PrtGetTransitionsPacked(context, context->currentState);
 
 	PrtAssert(length < PRT_MAX_STATESTACK_DEPTH, "State stack overflow");
 
-	context->callStack.stateStack[length].stateIndex = context->currentState;
-	context->callStack.stateStack[length].inheritedDeferredSetCompact = PrtClonePackedSet(context->inheritedDeferredSetCompact, packSize);
-	context->callStack.stateStack[length].inheritedActionSetCompact = PrtClonePackedSet(context->inheritedActionSetCompact, packSize);
-	context->callStack.length = length + 1;
+	context->callStack->stateStack[length].stateIndex = context->currentState;
+	context->callStack->stateStack[length].inheritedDeferredSetCompact = PrtClonePackedSet(context->inheritedDeferredSetCompact, packSize);
+	context->callStack->stateStack[length].inheritedActionSetCompact = PrtClonePackedSet(context->inheritedActionSetCompact, packSize);
+	context->callStack->length = length + 1;
 
 	// Update the defered set inherited by state-machine
 	// D = (D + d) - a - e
@@ -962,7 +1484,7 @@ _In_ PRT_BOOLEAN				isPopStatement
 
 	i = 0;
 	packSize = PrtGetPackSize(context);
-	length = context->callStack.length;
+	length = context->callStack->length;
 
 	PRT_MACHINESTATE state;
 	PrtGetMachineState((PRT_MACHINEINST*)context, &state);
@@ -987,8 +1509,8 @@ _In_ PRT_BOOLEAN				isPopStatement
 		return isHalted;
 	}
 
-	context->callStack.length = length - 1;
-	poppedState = context->callStack.stateStack[length - 1];
+	context->callStack->length = length - 1;
+	poppedState = context->callStack->stateStack[length - 1];
 	context->currentState = poppedState.stateIndex;
 
 	for (i = 0; i < packSize; i++)
@@ -1027,8 +1549,14 @@ _In_ PRT_MACHINEINST_PRIV			*context
 	PrtGetMachineState((PRT_MACHINEINST*)context, &state);
 	PrtLog(PRT_STEP_EXIT, &state, context, NULL, NULL);
 	PRT_UINT32 exitFunIndex = context->process->program->machines[context->instanceOf]->states[context->currentState].exitFunIndex;
+	PRT_SM_FUN exitFun = PrtGetExitFunction(context);
+	if (exitFun == NULL)
+	{
+		// an empty function would only give the payload back, so there is no frame to set up.
+		return;
+	}
 	PrtPushNewEventHandlerFrame(context, exitFunIndex, PRT_FUN_PARAM_SWAP, NULL);
-	PrtGetExitFunction(context)((PRT_MACHINEINST *)context);
+	exitFun((PRT_MACHINEINST *)context);
 }
 
 FORCEINLINE
@@ -1042,9 +1570,13 @@ PrtRunTransitionFunction(
 	context->lastOperation = ReturnStatement; 
 	PRT_UINT32 transFunIndex = stateDecl->transitions[transIndex].transFunIndex;
 	PRT_DBG_ASSERT(transFunIndex != PRT_SPECIAL_ACTION_PUSH_OR_IGN, "Must be valid function index");
+	PRT_SM_FUN transFun = GetFunFromIndex(context, transFunIndex);
+	if (transFun == NULL)
+	{
+		return;
+	}
 	PrtPushNewEventHandlerFrame(context, transFunIndex, PRT_FUN_PARAM_SWAP, NULL);
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, transFunIndex);
-	funDecl->implementation((PRT_MACHINEINST *)context);
+	transFun((PRT_MACHINEINST *)context);
 }
 
 static PRT_BOOLEAN
@@ -1056,8 +1588,16 @@ PrtStepStateMachine(
 	PRT_DODECL *currActionDecl;
 	PRT_UINT32 eventValue;
 	PRT_BOOLEAN hasMoreWork = PRT_FALSE;
+	PRT_UINT32 raisesInStep = 0;
 
-    PrtAssert(context->isRunning, "The caller should have set context->isRunning to TRUE");
+    PrtAssert(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_RUNNING, "The caller should have claimed the machine");
+	PRT_MACHINEINST_PRIV *prevStepping = PrtSetSteppingMachine(context);
+	PRT_OUTBOX outbox;
+	PRT_OUTBOX *prevOutbox = PrtOpenOutbox(context, &outbox);
+	if (((PRT_PROCESS_PRIV *)context->process)->recorder != NULL)
+	{
+		PrtRecordStep(context);
+	}
 
 	switch (context->nextOperation)
 	{
@@ -1076,18 +1616,23 @@ DoEntry:
 	PrtUpdateCurrentDeferredSet(context);
 
 	context->lastOperation = ReturnStatement;
-	if (context->funStack.length == 0)
+	if (context->funStack->length == 0)
 	{
 		PRT_MACHINESTATE state;
 		PrtGetMachineState((PRT_MACHINEINST*)context, &state);
 		PRT_STATEDECL* currentState = PrtGetCurrentStateDecl(context);
 		PrtLog(PRT_STEP_ENTRY, &state, context, NULL, NULL);
 		PRT_UINT32 entryFunIndex = currentState->entryFunIndex;
+		if (GetFunFromIndex(context, entryFunIndex) == NULL)
+		{
+			// an empty function would only consume the payload.
+			PrtFreeTriggerPayload(context);
+			goto CheckLastOperation;
+		}
 		PrtPushNewEventHandlerFrame(context, entryFunIndex, PRT_FUN_PARAM_MOVE, NULL);
 	}
 	PRT_UINT32 funIndex = PrtBottomOfFunStack(context)->funIndex;
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
-	funDecl->implementation((PRT_MACHINEINST *)context);
+	GetFunFromIndex(context, funIndex)((PRT_MACHINEINST *)context);
 	goto CheckLastOperation;
 
 DoAction:
@@ -1105,25 +1650,29 @@ DoAction:
 	}
 	else
 	{
-		if (context->funStack.length == 0)
+		if (context->funStack->length == 0)
 		{
 			PRT_MACHINESTATE state;
 			PrtGetMachineState((PRT_MACHINEINST*)context, &state);
 			PrtLog(PRT_STEP_DO, &state, context, NULL, NULL);
+			if (GetFunFromIndex(context, doFunIndex) == NULL)
+			{
+				PrtFreeTriggerPayload(context);
+				goto CheckLastOperation;
+			}
 			PrtPushNewEventHandlerFrame(context, doFunIndex, PRT_FUN_PARAM_MOVE, NULL);
 		}
 		funIndex = PrtBottomOfFunStack(context)->funIndex;
-		funDecl = GetFunDeclFromIndex(context, funIndex);
-		funDecl->implementation((PRT_MACHINEINST *)context);
+		GetFunFromIndex(context, funIndex)((PRT_MACHINEINST *)context);
 	}
 	goto CheckLastOperation;
 
 CheckLastOperation:
-	if (context->receive != NULL)
+	if (context->receive != NULL || context->blockingJob != NULL || context->call != NULL)
 	{
-		// We are at a blocking "receive"; so, wait for PrtSendPrivate to unblock us.
+		// We are at a blocking "receive", in a blocking call or in a call; so, wait for PrtSendPrivate, a helper or a reply to unblock us.
 		context->nextOperation = ReceiveOperation;
-		lockHeld = PRT_TRUE; // tricky case, the lock was grabbed in PrtRecive().
+		lockHeld = PRT_TRUE; // tricky case, the lock was grabbed in PrtRecive(), PrtCallBlocking() or PrtCallMachine().
 		goto Finish;
 	}
 	switch (context->lastOperation)
@@ -1139,6 +1688,11 @@ CheckLastOperation:
 		goto CheckLastOperation;
 
 	case RaiseStatement:
+		// raise chains are handled within the step, up to a bound so that a machine raising forever still yields.
+		if (raisesInStep++ < PRT_MAX_RAISES_PER_STEP)
+		{
+			goto DoHandleEvent;
+		}
 		context->nextOperation = HandleEventOperation;
 		hasMoreWork = PRT_TRUE;
 		goto Finish;
@@ -1197,19 +1751,27 @@ CheckLastOperation:
 
 DoDequeue:
 	PrtAssert(!lockHeld, "Lock should not be held at this point");
+	if (PrtTakeBatchedEvent(context))
+	{
+		goto DoHandleEvent;
+	}
 	lockHeld = PRT_TRUE;
-	PrtLockMutex(context->stateMachineLock);
+	PrtAcquireLock(&context->stateMachineLock);
 
 	PrtAssert(context->receive == NULL, "Machine must not be blocked at a receive");
 	if (PrtDequeueEvent(context, NULL))
 	{
 		lockHeld = PRT_FALSE;
-		PrtUnlockMutex(context->stateMachineLock);
+		PrtReleaseLock(&context->stateMachineLock);
 		goto DoHandleEvent;
 	}
 	else
 	{
 		context->nextOperation = DequeueOperation;
+		if (((PRT_PROCESS_PRIV *)context->process)->idlePeriod != PRT_HIBERNATE_NEVER)
+		{
+			context->idleSince = PrtGetMonotonicTime();
+		}
 		goto Finish;
 	}
 
@@ -1250,7 +1812,7 @@ DoHandleEvent:
 	}
 
 DoReceive:
-	PrtAssert(context->receive != NULL, "Must be blocked at a receive");
+	PrtAssert(context->receive != NULL || context->blockingJob != NULL || context->call != NULL, "Must be blocked at a receive, in a blocking call or in a call");
 	// This is a no-op because we are still blocked on receive until PrtSendPrivate notices
 	// we receive the unblocking event.  We do this instead of checking for receive != null
 	// so that we can be sure to unlock the stateMachineLock once and only once.
@@ -1259,35 +1821,168 @@ DoReceive:
 Finish:
 	if (lockHeld)
 	{
-		PrtUnlockMutex(context->stateMachineLock);
+		PrtReleaseLock(&context->stateMachineLock);
 	}
 
+	// the request is sent while the machine still counts as stepping, so that it is recorded as the machine's send, and
+	// after the sends the handler made before the call.
+	hasMoreWork |= PrtCloseOutbox(context, &outbox, prevOutbox);
+	if (context->call != NULL)
+	{
+		hasMoreWork |= PrtSendCallRequest(context);
+	}
+	PrtSetSteppingMachine(prevStepping);
 	return hasMoreWork;
 }
 
+PRT_BOOLEAN
+PrtClaimMachine(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_BOOLEAN				markWork
+)
+{
+	PRT_UINT32 state = PrtAtomicLoad(&context->runState);
+	for (;;)
+	{
+		PRT_UINT32 desired;
+		if (state & (PRT_RUNSTATE_HALTED | PRT_RUNSTATE_HIBERNATED))
+		{
+			return PRT_FALSE;
+		}
+		else if (!(state & PRT_RUNSTATE_RUNNING))
+		{
+			desired = PRT_RUNSTATE_RUNNING;
+		}
+		else if (markWork && !(state & PRT_RUNSTATE_HASWORK))
+		{
+			desired = state | PRT_RUNSTATE_HASWORK;
+		}
+		else
+		{
+			return PRT_FALSE;
+		}
+
+		PRT_UINT32 prev = PrtAtomicCompareExchange(&context->runState, state, desired);
+		if (prev == state)
+		{
+			return desired == PRT_RUNSTATE_RUNNING;
+		}
+		state = prev;
+	}
+}
+
+PRT_BOOLEAN
+PrtReleaseMachine(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	PRT_UINT32 state = PrtAtomicLoad(&context->runState);
+	for (;;)
+	{
+		PrtAssert(state & PRT_RUNSTATE_RUNNING, "Machine must be claimed");
+		// a halted machine has no more work, whatever was scheduled for it.
+		PRT_BOOLEAN release = (state & PRT_RUNSTATE_HALTED) || !(state & PRT_RUNSTATE_HASWORK);
+		PRT_UINT32 desired = release ? (state & PRT_RUNSTATE_HALTED) : PRT_RUNSTATE_RUNNING;
+		PRT_UINT32 prev = PrtAtomicCompareExchange(&context->runState, state, desired);
+		if (prev == state)
+		{
+			return release;
+		}
+		state = prev;
+	}
+}
+
+void PrtUpdateRunState(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 clearBits, _In_ PRT_UINT32 setBits)
+{
+	PRT_UINT32 state = PrtAtomicLoad(&context->runState);
+	PRT_UINT32 prev;
+	while ((prev = PrtAtomicCompareExchange(&context->runState, state, (state & ~clearBits) | setBits)) != state)
+	{
+		state = prev;
+	}
+}
+
 void
 PrtRunStateMachine(
 	_Inout_ PRT_MACHINEINST_PRIV	*context
 )
 {
-	// protecting against re-entry using isRunning boolean.
-	PrtLockMutex(context->stateMachineLock);
-	if (context->isHalted || context->isRunning)
+	// a machine already being run by another thread is left for that thread, which is told to look for this work.
+	if (!PrtClaimMachine(context, PRT_TRUE))
 	{
-		PrtUnlockMutex(context->stateMachineLock);
 		return;
 	}
-	context->isRunning = PRT_TRUE;
-	PrtUnlockMutex(context->stateMachineLock);
 
-	// This function now just wraps the new PrtStepStateMachine method
-	while (PrtStepStateMachine(context)) {
-		;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	do {
+		PRT_BOOLEAN hasMoreWork;
+		do {
+			hasMoreWork = PrtStepStateMachine(context);
+		} while (!PrtEnforceMemoryQuota(context) && hasMoreWork);
+	} while (!PrtReleaseMachine(context));
+	PrtSetMemoryAccount(prevAccount);
+
+	PrtHibernateIdleSweep(context);
+}
+
+PRT_BOOLEAN
+PrtStepMachine(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	if (!PrtClaimMachine(context, PRT_FALSE))
+	{
+		return PRT_FALSE;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_BOOLEAN hasMoreWork = PrtStepStateMachine(context);
+	PrtEnforceMemoryQuota(context);
+	PrtSetMemoryAccount(prevAccount);
+
+	// work scheduled while this thread was stepping the machine is left for the next step.
+	while (!PrtReleaseMachine(context))
+	{
+		hasMoreWork = PRT_TRUE;
 	}
+	PrtHibernateIdleSweep(context);
+	return hasMoreWork;
+}
+
+/* A worker of a NUMA-aware process that keeps finding work on its own node also steps the other nodes once in this many passes */
+#define PRT_NUMA_STEAL_PERIOD 16
+
+static PRT_THREAD_LOCAL PRT_UINT32 prtNumaPasses = 0;
+
+// Steps every machine of process that is homed on node, or is not if homeOnly is PRT_FALSE.
+// Returns with the process lock held if the process is terminating.
+static PRT_BOOLEAN PrtStepMachines(
+	_Inout_ PRT_PROCESS_PRIV	*process,
+	_In_ PRT_UINT32				machineCount,
+	_In_ PRT_UINT32				node,
+	_In_ PRT_BOOLEAN			homeOnly,
+	_Out_ PRT_BOOLEAN			*terminating
+)
+{
+	PRT_BOOLEAN hasMoreWork = PRT_FALSE;
+	*terminating = PRT_FALSE;
+	for (int i = machineCount - 1; i >= 0; i--)
+	{
+		PrtAcquireLock(&process->processLock);
+		*terminating = process->terminating;
+		if (*terminating)
+		{
+			break;
+		}
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV*)process->machines[i];
+		PrtReleaseLock(&process->processLock);
 
-	PrtLockMutex(context->stateMachineLock);
-	context->isRunning = PRT_FALSE;
-	PrtUnlockMutex(context->stateMachineLock);
+		if (context != NULL && (node == PRT_NUMA_NODE_ANY || (context->homeNode == node) == homeOnly))
+		{
+			hasMoreWork |= PrtStepMachine(context);
+		}
+	}
+	return hasMoreWork;
 }
 
 PRT_API PRT_STEP_RESULT
@@ -1298,55 +1993,39 @@ PrtStepProcess(PRT_PROCESS *process
 	PRT_COOPERATIVE_SCHEDULER* info;
 	PRT_UINT32 machineCount;
 
-    PrtLockMutex(privateProcess->processLock);
+    PrtAcquireLock(&privateProcess->processLock);
 	info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
-	info->threadsWaiting++;
+	PrtAtomicIncrement(&info->threadsWaiting);
 	machineCount = privateProcess->machineCount;
-	PrtUnlockMutex(privateProcess->processLock);
+	PrtReleaseLock(&privateProcess->processLock);
 
-	PRT_BOOLEAN terminating = PRT_FALSE;
-	PRT_BOOLEAN hasMoreWork = PRT_FALSE;
-    // Run all state machines belonging to this process.
-	for (int i = machineCount - 1; i >= 0; i--)
-	{
-		PrtLockMutex(privateProcess->processLock);
-		terminating = privateProcess->terminating;
-		if (terminating)
-		{
-			break;
-		}
-		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV*)privateProcess->machines[i];
-		PrtUnlockMutex(privateProcess->processLock);
+	// this pass looks at every machine, so it takes care of work marked before it starts.
+	PrtAtomicCompareExchange(&info->workPending, 1, 0);
 
-		if (context != NULL)
-		{
-			// protecting against re-entry using isRunning boolean.
-			PrtLockMutex(context->stateMachineLock);
-			if (context->isHalted || context->isRunning)
-			{
-				PrtUnlockMutex(context->stateMachineLock);
-			}
-			else
-			{
-				context->isRunning = PRT_TRUE;
-				PrtUnlockMutex(context->stateMachineLock);
-				hasMoreWork |= PrtStepStateMachine(context);
+	// Receives whose deadline has passed are ended first, so that the machines they wake are run in this pass.
+	PrtFireTimers(process);
 
-				PrtLockMutex(context->stateMachineLock);
-				context->isRunning = PRT_FALSE;
-				PrtUnlockMutex(context->stateMachineLock);
-			}
-		}
+	// Run the state machines homed on this thread's node first, so that their memory stays local to the thread.
+	// The others are run when those are idle, and now and then regardless so that a node without workers is not starved.
+	PRT_UINT32 node = PRT_NUMA_NODE_ANY;
+	if (privateProcess->numaNodes != NULL)
+	{
+		node = privateProcess->numaTopology.currentNodeFun(privateProcess->numaTopology.state);
+	}
+	PRT_BOOLEAN terminating;
+	PRT_BOOLEAN hasMoreWork = PrtStepMachines(privateProcess, machineCount, node, PRT_TRUE, &terminating);
+	if (!terminating && node != PRT_NUMA_NODE_ANY && (!hasMoreWork || ++prtNumaPasses % PRT_NUMA_STEAL_PERIOD == 0))
+	{
+		hasMoreWork |= PrtStepMachines(privateProcess, machineCount, node, PRT_FALSE, &terminating);
 	}
 	
 	if (!terminating)
 	{
-		PrtLockMutex(privateProcess->processLock);
+		PrtAcquireLock(&privateProcess->processLock);
 	}
 	hasMoreWork |= machineCount < privateProcess->machineCount;
-	info->threadsWaiting--;
-	PRT_UINT32 threadsWaiting = info->threadsWaiting;
-	PrtUnlockMutex(privateProcess->processLock);
+	PRT_UINT32 threadsWaiting = PrtAtomicDecrement(&info->threadsWaiting);
+	PrtReleaseLock(&privateProcess->processLock);
 
 	if (terminating && threadsWaiting == 0)
 	{
@@ -1396,6 +2075,21 @@ _In_ PRT_UINT32					eventIndex
 	}
 }
 
+// The payload of an event taken from the queue of context, for the machine to own: its own copy if the payload is shared.
+static PRT_VALUE *
+PrtTakeEventPayload(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_EVENT *e)
+{
+	if (e->shared == NULL)
+	{
+		return e->payload;
+	}
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_VALUE *payload = PrtCloneValue(e->payload);
+	PrtSetMemoryAccount(prevAccount);
+	PrtReleaseSharedPayload(e->shared);
+	return payload;
+}
+
 static void
 RemoveElementFromQueue(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 i)
 {
@@ -1413,13 +2107,207 @@ RemoveElementFromQueue(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 i)
 		queue->events[index] = queue->events[prev];
 	}
 
-	//
-	// Adjust the queue size
-	//
-	queue->headIndex = (queue->headIndex + 1) % queueLength;
-	queue->size--;
-
-	PRT_DBG_ASSERT(queue->size <= queueLength, "Check Failed");
+	//
+	// Adjust the queue size
+	//
+	queue->headIndex = (queue->headIndex + 1) % queueLength;
+	queue->size--;
+
+	PRT_DBG_ASSERT(queue->size <= queueLength, "Check Failed");
+}
+
+// Lets the event at position in the queue of context go if it has outlived its deadline: it is dropped, or becomes the
+// expiry event of the process where it is. Returns whether it went, in which case the caller looks at position again.
+static PRT_BOOLEAN
+PrtExpireEvent(_Inout_ PRT_MACHINEINST_PRIV *context, _In_ PRT_UINT32 position)
+{
+	PRT_EVENTQUEUE *queue = &context->eventQueue;
+	PRT_EVENT *e = &queue->events[(queue->headIndex + position) % queue->eventsSize];
+	if (e->deadline == 0)
+	{
+		return PRT_FALSE;
+	}
+
+	// whether the deadline passed depends on the clock, so a replay takes the recorded answer.
+	if (!PrtRecordDecision(context, e->deadline <= PrtGetProcessTime(context->process)))
+	{
+		return PRT_FALSE;
+	}
+	context->expiredEvents++;
+	PrtDropEventPayload(e->payload, e->shared);
+	PRT_UINT32 expiryEvent = ((PRT_PROCESS_PRIV *)context->process)->expiryEvent;
+	if (expiryEvent == PRT_SPECIAL_EVENT_NULL)
+	{
+		PrtFreeValue(e->trigger);
+		RemoveElementFromQueue(context, position);
+		return PRT_TRUE;
+	}
+
+	// the expiry event tells the machine which event it missed, and is not itself expired.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	e->payload = PrtMkIntValue((PRT_INT32)PrtPrimGetEvent(e->trigger));
+	PrtFreeValue(e->trigger);
+	e->trigger = PrtMkEventValue(expiryEvent);
+	PrtSetMemoryAccount(prevAccount);
+	e->shared = NULL;
+	e->deadline = 0;
+	return PRT_TRUE;
+}
+
+// Takes the first event in the queue that the receive of context has a case for, or else its default case, if any.
+static PRT_BOOLEAN
+PrtDequeueReceivedEvent(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*frame
+)
+{
+	PRT_EVENTQUEUE *queue = &context->eventQueue;
+	PRT_UINT32 position = PRT_QUEUE_NO_MATCH;
+	PRT_UINT32 i = 0;
+	if (context->receiveWaiting)
+	{
+		// the queue held no case event when the machine blocked, and PrtSendPrivate noted the first one to come since.
+		i = context->receiveMatch;
+		context->receiveWaiting = PRT_FALSE;
+	}
+	while (i < queue->size)
+	{
+		PRT_VALUE *trigger = queue->events[(queue->headIndex + i) % queue->eventsSize].trigger;
+		if (!PrtIsEventReceivable(context, PrtPrimGetEvent(trigger)))
+		{
+			i++;
+		}
+		else if (!PrtExpireEvent(context, i))
+		{
+			position = i;
+			break;
+		}
+	}
+
+	PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
+	PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
+	PRT_UINT32 caseIndex;
+	if (position != PRT_QUEUE_NO_MATCH)
+	{
+		PRT_EVENT e = queue->events[(queue->headIndex + position) % queue->eventsSize];
+		if (e.enqueuedAt != 0)
+		{
+			PrtNoteQueueDelay(context, e.enqueuedAt);
+		}
+		context->currentTrigger = e.trigger;
+		context->currentPayload = PrtTakeEventPayload(context, &e);
+		context->callToken = e.callToken;
+		RemoveElementFromQueue(context, position);
+		PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, context->currentPayload);
+		caseIndex = context->receiveCases[PrtPrimGetEvent(e.trigger)];
+	}
+	else
+	{
+		caseIndex = context->receiveCases[PRT_SPECIAL_EVENT_NULL];
+		if (caseIndex == 0)
+		{
+			return PRT_FALSE;
+		}
+		context->currentTrigger = PrtMkEventValue(PRT_SPECIAL_EVENT_NULL);
+		context->currentPayload = PrtMkNullValue();
+		context->callToken = 0;
+	}
+
+	PRT_CASEDECL *rcase = &context->receive->cases[caseIndex - 1];
+	frame->rcase = rcase;
+	PrtPushNewEventHandlerFrame(context, rcase->funIndex, PRT_FUN_PARAM_MOVE, frame->locals);
+	context->receive = NULL;
+	return PRT_TRUE;
+}
+
+// Takes the run of events at the head of the queue of context, behind the one it just took from there, that the machine
+// would take next without looking at its queue again. Events with a deadline or an instance bound, and the events of
+// bounded queues and of queues whose delay the admission policy measures, are taken one at a time, so that the checks
+// that count or time the queue see every event the machine has not handled.
+static void
+PrtFillDequeueBatch(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	// a recording has a dequeue for each event, and a replay looks at the queue where the recording did.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_EVENTQUEUE *queue = &context->eventQueue;
+	if (queue->size == 0 || process->recorder != NULL || process->replayer != NULL ||
+		process->program->machines[context->instanceOf]->maxQueueSize != 0xffffffff ||
+		(context->admission != NULL && context->admission->timesQueue))
+	{
+		return;
+	}
+
+	PRT_UINT32 count = 0;
+	while (count < PRT_MAX_DEQUEUE_BATCH && queue->size > 0)
+	{
+		PRT_EVENT *e = &queue->events[queue->headIndex];
+		PRT_UINT32 triggerIndex = PrtPrimGetEvent(e->trigger);
+		if (e->deadline != 0 || process->program->events[triggerIndex]->eventMaxInstances != 0xffffffff ||
+			PrtIsEventDeferred(triggerIndex, context->currentDeferredSetCompact))
+		{
+			break;
+		}
+		if (context->batch == NULL)
+		{
+			PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+			context->batch = (PRT_EVENT *)PrtMalloc(PRT_MAX_DEQUEUE_BATCH * sizeof(PRT_EVENT));
+			PrtSetMemoryAccount(prevAccount);
+		}
+		context->batch[count++] = *e;
+		RemoveElementFromQueue(context, 0);
+	}
+	context->batchNext = 0;
+	context->batchCount = count;
+	context->batchDeferredSet = context->deferredSetVersion;
+}
+
+PRT_BOOLEAN
+PrtTakeBatchedEvent(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	// a machine that has worked out its deferred set again may defer the rest, or take an event it deferred before them.
+	if (context->batchCount == 0 || context->batchDeferredSet != context->deferredSetVersion ||
+		((PRT_PROCESS_PRIV *)context->process)->recorder != NULL)
+	{
+		return PRT_FALSE;
+	}
+	PRT_EVENT e = context->batch[context->batchNext++];
+	context->batchCount--;
+	PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
+	PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
+	context->currentTrigger = e.trigger;
+	context->currentPayload = PrtTakeEventPayload(context, &e);
+	context->callToken = e.callToken;
+	PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, context->currentPayload);
+	return PRT_TRUE;
+}
+
+void
+PrtReturnDequeueBatch(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	// the batch was taken from the head, and senders only add at the tail, so the queue is as it was before.
+	PRT_EVENTQUEUE *queue = &context->eventQueue;
+	if (queue->eventsSize - queue->size < context->batchCount)
+	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+		while (queue->eventsSize - queue->size < context->batchCount)
+		{
+			PrtResizeEventQueue(context);
+		}
+		PrtSetMemoryAccount(prevAccount);
+	}
+	for (PRT_UINT32 i = context->batchCount; i > 0; i--)
+	{
+		queue->headIndex = (queue->headIndex + queue->eventsSize - 1) % queue->eventsSize;
+		queue->events[queue->headIndex] = context->batch[context->batchNext + i - 1];
+		queue->size++;
+	}
+	context->batchCount = 0;
 }
 
 PRT_BOOLEAN
@@ -1429,97 +2317,70 @@ PrtDequeueEvent(
 )
 {
 	PRT_EVENTQUEUE *queue = &context->eventQueue;
-	PRT_UINT32 queueLength = queue->eventsSize;
-	PRT_UINT32 head = queue->headIndex;
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
 
-	PRT_DBG_ASSERT(queue->size <= queueLength, "Check Failed");
+	PRT_DBG_ASSERT(queue->size <= queue->eventsSize, "Check Failed");
+	if (process->recorder != NULL)
+	{
+		PrtRecordDequeue(context);
+	}
+	else if (process->replayer != NULL)
+	{
+		PrtReplayDequeue(context);
+	}
+	if (context->batchCount != 0)
+	{
+		PrtReturnDequeueBatch(context);
+	}
 
-	for (PRT_UINT32 i = 0; i < queue->size; i++) {
-		PRT_UINT32 index = (head + i) % queueLength;
-		PRT_EVENT e = queue->events[index];
+	if (context->receive != NULL)
+	{
+		return PrtDequeueReceivedEvent(context, frame);
+	}
+
+	// an expired event is let go as it comes up, and the event behind it looked at in its place.
+	PRT_UINT32 i = 0;
+	while (i < queue->size) {
+		PRT_EVENT e = queue->events[(queue->headIndex + i) % queue->eventsSize];
 		PRT_UINT32 triggerIndex = PrtPrimGetEvent(e.trigger);
-		if (context->receive == NULL)
+		if (PrtIsEventDeferred(triggerIndex, context->currentDeferredSetCompact))
 		{
-			if (!PrtIsEventDeferred(triggerIndex, context->currentDeferredSetCompact))
-			{
-				PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
-				PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
-				context->currentTrigger = e.trigger;
-				context->currentPayload = e.payload;
-				RemoveElementFromQueue(context, i);
-				PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, e.payload);
-				return PRT_TRUE;
-			}
+			i++;
 		}
-		else
+		else if (!PrtExpireEvent(context, i))
 		{
-			if (PrtIsEventReceivable(context, triggerIndex))
+			PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
+			PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
+			if (e.enqueuedAt != 0)
 			{
-				PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
-				PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
-				context->currentTrigger = e.trigger;
-				context->currentPayload = e.payload;
-				RemoveElementFromQueue(context, i);
-
-				PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, e.payload);
-				for (PRT_UINT32 j = 0; j < context->receive->nCases; j++)
-				{
-					PRT_CASEDECL *rcase = &context->receive->cases[j];
-					if (triggerIndex == rcase->triggerEventIndex)
-					{
-						frame->rcase = rcase;
-						PrtPushNewEventHandlerFrame(context, rcase->funIndex, PRT_FUN_PARAM_MOVE, frame->locals);
-						break;
-					}
-				}
-				context->receive = NULL;
-				return PRT_TRUE;
+				PrtNoteQueueDelay(context, e.enqueuedAt);
+			}
+			context->currentTrigger = e.trigger;
+			context->currentPayload = PrtTakeEventPayload(context, &e);
+			context->callToken = e.callToken;
+			RemoveElementFromQueue(context, i);
+			if (i == 0)
+			{
+				PrtFillDequeueBatch(context);
 			}
+			PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, context->currentPayload);
+			return PRT_TRUE;
 		}
 	}
 
-	if (context->receive == NULL)
+	if (PrtStateHasDefaultTransitionOrAction(context))
 	{
-		if (PrtStateHasDefaultTransitionOrAction(context))
-		{
-			PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
-			PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
-			context->currentTrigger = PrtMkEventValue(PRT_SPECIAL_EVENT_NULL);
-			context->currentPayload = PrtMkNullValue();
-			return PRT_TRUE;
-		}
-		else
-		{
-			PrtFreeTriggerPayload(context);
-			return PRT_FALSE;
-		}
+		PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
+		PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
+		context->currentTrigger = PrtMkEventValue(PRT_SPECIAL_EVENT_NULL);
+		context->currentPayload = PrtMkNullValue();
+		context->callToken = 0;
+		return PRT_TRUE;
 	}
 	else
 	{
-		PRT_BOOLEAN hasDefaultCase = (context->process->program->eventSets[context->receive->caseSetIndex].packedEvents[0] & 0x1) == 1;
-		if (hasDefaultCase)
-		{
-			PrtAssert(context->currentTrigger == NULL, "currentTrigger must be null");
-			PrtAssert(context->currentPayload == NULL, "currentPayload must be null");
-			context->currentTrigger = PrtMkEventValue(PRT_SPECIAL_EVENT_NULL);
-			context->currentPayload = PrtMkNullValue();
-			for (PRT_UINT32 j = 0; j < context->receive->nCases; j++)
-			{
-				PRT_CASEDECL *rcase = &context->receive->cases[j];
-				if (PRT_SPECIAL_EVENT_NULL == rcase->triggerEventIndex)
-				{
-					frame->rcase = rcase;
-					PrtPushNewEventHandlerFrame(context, rcase->funIndex, PRT_FUN_PARAM_MOVE, frame->locals);
-					break;
-				}
-			}
-			context->receive = NULL;
-			return PRT_TRUE;
-		}
-		else
-		{
-			return PRT_FALSE;
-		}
+		PrtFreeTriggerPayload(context);
+		return PRT_FALSE;
 	}
 }
 
@@ -1562,10 +2423,9 @@ _Inout_ PRT_MACHINEINST_PRIV	*context,
 _In_ PRT_UINT32					funIndex
 )
 {
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
-	PRT_SM_FUN fun = funDecl->implementation;
+	PRT_SM_FUN fun = GetFunFromIndex(context, funIndex);
 	PRT_VALUE *returnValue = fun((PRT_MACHINEINST *)context);
-	if (context->receive != NULL)
+	if (context->receive != NULL || context->blockingJob != NULL || context->call != NULL)
 	{
 		frame->returnTo = funCallIndex;
 		PrtPushFrame(context, frame);
@@ -1628,8 +2488,7 @@ _In_ PRT_MACHINEINST_PRIV		*context,
 _In_ PRT_UINT32 funIndex
 )
 {
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, funIndex);
-	return funDecl->implementation;
+	return GetFunFromIndex(context, funIndex);
 }
 
 FORCEINLINE
@@ -1639,8 +2498,7 @@ _In_ PRT_MACHINEINST_PRIV		*context
 )
 {
 	PRT_UINT32 entryFunIndex = context->process->program->machines[context->instanceOf]->states[context->currentState].entryFunIndex;
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, entryFunIndex);
-	return funDecl->implementation;
+	return GetFunFromIndex(context, entryFunIndex);
 }
 
 FORCEINLINE
@@ -1650,8 +2508,7 @@ _In_ PRT_MACHINEINST_PRIV		*context
 )
 {
 	PRT_UINT32 exitFunIndex = context->process->program->machines[context->instanceOf]->states[context->currentState].exitFunIndex;
-	PRT_FUNDECL *funDecl = GetFunDeclFromIndex(context, exitFunIndex);
-	return funDecl->implementation;
+	return GetFunFromIndex(context, exitFunIndex);
 }
 
 FORCEINLINE
@@ -1663,7 +2520,7 @@ _In_ PRT_UINT32					currEvent
 {
 	PRT_BOOLEAN isActionInstalled = PRT_FALSE;
 	PRT_UINT32 ui, nActions;
-	PRT_STATESTACK currStack;
+	PRT_STATESTACK *currStack;
 	PRT_STATEDECL *stateTable;
 	PRT_UINT32 topOfStackState;
 	PRT_STATEDECL *stateDecl;
@@ -1693,9 +2550,9 @@ _In_ PRT_UINT32					currEvent
 	//
 	currStack = context->callStack;
 	stateTable = context->process->program->machines[context->instanceOf]->states;
-	for (i = currStack.length - 1; i >= 0; i--)
+	for (i = currStack->length - 1; i >= 0; i--)
 	{
-		topOfStackState = currStack.stateStack[i].stateIndex;
+		topOfStackState = currStack->stateStack[i].stateIndex;
 		isActionInstalled = PrtIsActionInstalled(currEvent, PrtGetActionsPacked(context, topOfStackState));
 		if (isActionInstalled)
 		{
@@ -1992,6 +2849,7 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 	//
 	// D = (D + d) - a - e
 	//
+	context->deferredSetVersion++;
 	for (i = 0; i < packSize; i++)
 	{
 		context->currentDeferredSetCompact[i] = context->inheritedDeferredSetCompact[i] | currDefSetPacked[i]; // D + d
@@ -2007,7 +2865,8 @@ _Inout_ PRT_MACHINEINST_PRIV *context
 {
 	PRT_UINT32 maxEventQueueSize = context->process->program->machines[context->instanceOf]->maxQueueSize;
 	PRT_UINT32 currEventQueueSize = context->eventQueue.eventsSize;
-	PRT_UINT32 newQueueSize = (maxEventQueueSize != 0xffffffff && currEventQueueSize * 2 > maxEventQueueSize) ? maxEventQueueSize : currEventQueueSize * 2;
+	PRT_UINT32 newQueueSize = currEventQueueSize == 0 ? PRT_QUEUE_LEN_DEFAULT : currEventQueueSize * 2;
+	newQueueSize = (maxEventQueueSize != 0xffffffff && newQueueSize > maxEventQueueSize) ? maxEventQueueSize : newQueueSize;
 	PRT_EVENT* oldQueue = context->eventQueue.events;
 	PRT_UINT32 oldHead = context->eventQueue.headIndex;
 	PRT_UINT32 oldTail = context->eventQueue.tailIndex;
@@ -2058,6 +2917,13 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 	PrtGetMachineState((PRT_MACHINEINST*)context, &state);
 	PrtLog(PRT_STEP_HALT, &state, context, NULL, NULL);
 	PrtCleanupMachine(context);
+
+	// a replay ends the calls to the machine where the recording says they ended.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	if (process->hasCalls && process->replayer == NULL)
+	{
+		PrtFailCallsTo(context);
+	}
 }
 
 void
@@ -2065,13 +2931,36 @@ PrtCleanupMachine(
 _Inout_ PRT_MACHINEINST_PRIV			*context
 )
 {
-	PrtLockMutex(context->stateMachineLock);
-	if (context->isHalted)
+	PrtAcquireLock(&context->stateMachineLock);
+	if (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED)
 	{
-		PrtUnlockMutex(context->stateMachineLock);
+		PrtReleaseLock(&context->stateMachineLock);
 		return;
 	}
-	context->isHalted = PRT_TRUE;
+	PrtThawMachine(context);
+	PrtUpdateRunState(context, 0, PRT_RUNSTATE_HALTED);
+	if (context->receiveHasDeadline)
+	{
+		PrtCancelTimer(&((PRT_PROCESS_PRIV *)context->process)->timers, &context->receiveTimer);
+		context->receiveHasDeadline = PRT_FALSE;
+	}
+	PrtDropBlockingJob(context);
+	PrtDropCall(context);
+	PrtDropFdWatches(context);
+	if (context->admission != NULL)
+	{
+		PrtFree(context->admission);
+		context->admission = NULL;
+	}
+	for (PRT_UINT32 i = 0; i < context->batchCount; i++)
+	{
+		PRT_EVENT *e = &context->batch[context->batchNext + i];
+		PrtDropEventPayload(e->payload, e->shared);
+		PrtFreeValue(e->trigger);
+	}
+	context->batchCount = 0;
+	PrtFree(context->batch);
+	context->batch = NULL;
 
 	if (context->eventQueue.events != NULL)
 	{
@@ -2081,10 +2970,7 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 
 		while (count < context->eventQueue.size && head < context->eventQueue.eventsSize)
 		{
-			if (queue[head].payload != NULL)
-			{
-				PrtFreeValue(queue[head].payload);
-			}
+			PrtDropEventPayload(queue[head].payload, queue[head].shared);
 			if (queue[head].trigger != NULL) {
 				PrtFreeValue(queue[head].trigger);
 			}
@@ -2094,10 +2980,7 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 		head = 0;
 		while (count < context->eventQueue.size)
 		{
-			if (queue[head].payload != NULL)
-			{
-				PrtFreeValue(queue[head].payload);
-			}
+			PrtDropEventPayload(queue[head].payload, queue[head].shared);
 			if (queue[head].trigger != NULL) {
 				PrtFreeValue(queue[head].trigger);
 			}
@@ -2108,9 +2991,9 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 		PrtFree(context->eventQueue.events);
 	}
 
-	for (PRT_INT32 i = 0; i < context->callStack.length; i++)
+	for (PRT_INT32 i = 0; i < context->callStack->length; i++)
 	{
-		PRT_STATESTACK_INFO *info = &context->callStack.stateStack[i];
+		PRT_STATESTACK_INFO *info = &context->callStack->stateStack[i];
 		if (info->inheritedActionSetCompact != NULL)
 		{
 			PrtFree(info->inheritedActionSetCompact);
@@ -2121,9 +3004,9 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 		}
 	}
 
-	for (PRT_INT32 i = 0; i < context->funStack.length; i++)
+	for (PRT_INT32 i = 0; i < context->funStack->length; i++)
 	{
-		PRT_FUNSTACK_INFO *info = &context->funStack.funs[i];
+		PRT_FUNSTACK_INFO *info = &context->funStack->funs[i];
 		PrtFreeLocals(context, info);
 	}
 
@@ -2153,7 +3036,10 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 		PRT_MACHINEDECL *mdecl = context->process->program->machines[context->instanceOf];
 
 		for (i = 0; i < mdecl->nVars; i++) {
-			PrtFreeValue(context->varValues[i]);
+			if (context->varValues[i] != NULL)
+			{
+				PrtFreeValue(context->varValues[i]);
+			}
 		}
 		PrtFree(context->varValues);
 	}
@@ -2167,7 +3053,300 @@ _Inout_ PRT_MACHINEINST_PRIV			*context
 		PrtFreeValue(context->recvMap);
 	}
 
-	PrtUnlockMutex(context->stateMachineLock);
+	PrtReleaseLock(&context->stateMachineLock);
+}
+
+static void PrtSerializeOptionalValue(PRT_BYTE_BUFFER *buffer, PRT_VALUE *value, PRT_SERIALIZE_MODE mode)
+{
+	PRT_UINT8 present = value != NULL ? 1 : 0;
+	PrtWriteBytes(buffer, &present, 1);
+	if (present)
+	{
+		PrtSerializeValue(buffer, value, mode);
+	}
+}
+
+static PRT_BOOLEAN PrtTryDeserializeOptionalValue(const PRT_UINT8 *bytes, PRT_UINT32 size, PRT_UINT32 *position, PRT_SERIALIZE_MODE mode, PRT_VALUE **value)
+{
+	PRT_UINT8 present;
+	*value = NULL;
+	if (!PrtTryReadBytes(bytes, size, position, &present, 1) || present > 1)
+	{
+		return PRT_FALSE;
+	}
+	if (present)
+	{
+		*value = PrtTryDeserializeValue(bytes, size, position, mode);
+	}
+	return !present || *value != NULL;
+}
+
+void
+PrtSerializeMachineVars(
+_Inout_ PRT_BYTE_BUFFER					*buffer,
+_In_ PRT_MACHINEINST_PRIV				*context,
+_In_ PRT_SERIALIZE_MODE					mode
+)
+{
+	PRT_UINT32 nVars = context->process->program->machines[context->instanceOf]->nVars;
+	for (PRT_UINT32 i = 0; i < nVars; i++)
+	{
+		PrtSerializeOptionalValue(buffer, context->varValues[i], mode);
+	}
+	PrtSerializeOptionalValue(buffer, context->recvMap, mode);
+}
+
+PRT_BOOLEAN
+PrtTryDeserializeMachineVars(
+_In_ const PRT_UINT8					*bytes,
+_In_ PRT_UINT32							size,
+_Inout_ PRT_UINT32						*position,
+_Inout_ PRT_MACHINEINST_PRIV			*context,
+_In_ PRT_SERIALIZE_MODE					mode
+)
+{
+	PRT_UINT32 nVars = context->process->program->machines[context->instanceOf]->nVars;
+	context->varValues = NULL;
+	context->recvMap = NULL;
+	if (nVars > 0)
+	{
+		context->varValues = (PRT_VALUE **)PrtCalloc(nVars, sizeof(PRT_VALUE *));
+		for (PRT_UINT32 i = 0; i < nVars; i++)
+		{
+			if (!PrtTryDeserializeOptionalValue(bytes, size, position, mode, &context->varValues[i]))
+			{
+				return PRT_FALSE;
+			}
+		}
+	}
+	return PrtTryDeserializeOptionalValue(bytes, size, position, mode, &context->recvMap);
+}
+
+void
+PrtDeserializeMachineVars(
+_In_ const PRT_UINT8					*bytes,
+_Inout_ PRT_UINT32						*position,
+_Inout_ PRT_MACHINEINST_PRIV			*context,
+_In_ PRT_SERIALIZE_MODE					mode
+)
+{
+	PRT_BOOLEAN ok = PrtTryDeserializeMachineVars(bytes, 0xFFFFFFFF, position, context, mode);
+	PrtAssert(ok, "Invalid machine variables encoding");
+}
+
+PRT_BOOLEAN
+PrtHibernateMachine(
+_Inout_ PRT_MACHINEINST_PRIV			*context
+)
+{
+	if (context->hibernatedState != NULL ||
+		context->nextOperation != DequeueOperation || context->receive != NULL ||
+		context->funStack->length != 0 || context->eventQueue.size != 0 || context->batchCount != 0)
+	{
+		return PRT_FALSE;
+	}
+
+	// keep threads from stepping the machine while it is being taken apart.
+	if (!PrtClaimMachine(context, PRT_FALSE))
+	{
+		return PRT_FALSE;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_MACHINEDECL *mdecl = context->process->program->machines[context->instanceOf];
+	PRT_UINT32 packBytes = PrtGetPackSize(context) * sizeof(PRT_UINT32);
+	PRT_BYTE_BUFFER buffer;
+	buffer.bytes = NULL;
+	buffer.size = 0;
+	buffer.capacity = 0;
+
+	//
+	// The current action and deferred sets are recomputed on thaw, so only the inherited sets are kept
+	//
+	PrtWriteBytes(&buffer, &context->callStack->length, sizeof(PRT_UINT16));
+	for (PRT_UINT16 i = 0; i < context->callStack->length; i++)
+	{
+		PRT_STATESTACK_INFO *info = &context->callStack->stateStack[i];
+		PrtWriteBytes(&buffer, &info->stateIndex, sizeof(PRT_UINT32));
+		PrtWriteBytes(&buffer, info->inheritedDeferredSetCompact, packBytes);
+		PrtWriteBytes(&buffer, info->inheritedActionSetCompact, packBytes);
+		PrtFree(info->inheritedDeferredSetCompact);
+		PrtFree(info->inheritedActionSetCompact);
+	}
+	PrtWriteBytes(&buffer, context->inheritedDeferredSetCompact, packBytes);
+	PrtWriteBytes(&buffer, context->inheritedActionSetCompact, packBytes);
+
+	PrtSerializeMachineVars(&buffer, context, PRT_SERIALIZE_LOCAL);
+	for (PRT_UINT32 i = 0; i < mdecl->nVars; i++)
+	{
+		if (context->varValues[i] != NULL)
+		{
+			PrtFreeValue(context->varValues[i]);
+		}
+	}
+	if (context->recvMap != NULL)
+	{
+		PrtFreeValue(context->recvMap);
+	}
+
+	PRT_UINT8 hasTriggerPayload = (context->currentTrigger != NULL ? 1 : 0) | (context->currentPayload != NULL ? 2 : 0);
+	PrtWriteBytes(&buffer, &hasTriggerPayload, 1);
+	if (context->currentTrigger != NULL)
+	{
+		PrtSerializeValue(&buffer, context->currentTrigger, PRT_SERIALIZE_LOCAL);
+	}
+	if (context->currentPayload != NULL)
+	{
+		PrtSerializeValue(&buffer, context->currentPayload, PRT_SERIALIZE_LOCAL);
+	}
+	PrtFreeTriggerPayload(context);
+
+	PrtFree(context->varValues);
+	PrtFree(context->inheritedDeferredSetCompact);
+	PrtFree(context->currentDeferredSetCompact);
+	PrtFree(context->inheritedActionSetCompact);
+	PrtFree(context->currentActionSetCompact);
+	PrtFree(context->callStack);
+	PrtFree(context->funStack);
+	PrtFree(context->eventQueue.events);
+	PrtFree(context->batch);
+	context->varValues = NULL;
+	context->recvMap = NULL;
+	context->inheritedDeferredSetCompact = NULL;
+	context->currentDeferredSetCompact = NULL;
+	context->inheritedActionSetCompact = NULL;
+	context->currentActionSetCompact = NULL;
+	context->callStack = NULL;
+	context->funStack = NULL;
+	context->eventQueue.events = NULL;
+	context->eventQueue.eventsSize = 0;
+	context->eventQueue.headIndex = 0;
+	context->eventQueue.tailIndex = 0;
+	context->batch = NULL;
+
+	context->hibernatedState = buffer.size < buffer.capacity ? (PRT_UINT8 *)PrtRealloc(buffer.bytes, buffer.size) : buffer.bytes;
+	PrtSetMemoryAccount(prevAccount);
+
+	// senders need the stateMachineLock to enqueue, so work marked meanwhile is only a spurious schedule.
+	PrtUpdateRunState(context, PRT_RUNSTATE_RUNNING | PRT_RUNSTATE_HASWORK, PRT_RUNSTATE_HIBERNATED);
+	return PRT_TRUE;
+}
+
+void
+PrtThawMachine(
+_Inout_ PRT_MACHINEINST_PRIV			*context
+)
+{
+	if (context->hibernatedState == NULL)
+	{
+		return;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+	PRT_UINT32 packSize = PrtGetPackSize(context);
+	PRT_UINT32 packBytes = packSize * sizeof(PRT_UINT32);
+	PRT_UINT8 *bytes = context->hibernatedState;
+	PRT_UINT32 position = 0;
+
+	PrtAllocMachineStacks(context);
+	context->funStack->length = 0;
+	PrtReadBytes(bytes, &position, &context->callStack->length, sizeof(PRT_UINT16));
+	for (PRT_UINT16 i = 0; i < context->callStack->length; i++)
+	{
+		PRT_STATESTACK_INFO *info = &context->callStack->stateStack[i];
+		PrtReadBytes(bytes, &position, &info->stateIndex, sizeof(PRT_UINT32));
+		info->inheritedDeferredSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+		PrtReadBytes(bytes, &position, info->inheritedDeferredSetCompact, packBytes);
+		info->inheritedActionSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+		PrtReadBytes(bytes, &position, info->inheritedActionSetCompact, packBytes);
+	}
+	context->inheritedDeferredSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+	PrtReadBytes(bytes, &position, context->inheritedDeferredSetCompact, packBytes);
+	context->inheritedActionSetCompact = (PRT_UINT32 *)PrtMalloc(packBytes);
+	PrtReadBytes(bytes, &position, context->inheritedActionSetCompact, packBytes);
+	context->currentDeferredSetCompact = (PRT_UINT32 *)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	context->currentActionSetCompact = (PRT_UINT32 *)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	PrtUpdateCurrentActionsSet(context);
+	PrtUpdateCurrentDeferredSet(context);
+
+	PrtDeserializeMachineVars(bytes, &position, context, PRT_SERIALIZE_LOCAL);
+
+	PRT_UINT8 hasTriggerPayload;
+	PrtReadBytes(bytes, &position, &hasTriggerPayload, 1);
+	context->currentTrigger = (hasTriggerPayload & 1) ? PrtDeserializeValue(bytes, &position, PRT_SERIALIZE_LOCAL) : NULL;
+	context->currentPayload = (hasTriggerPayload & 2) ? PrtDeserializeValue(bytes, &position, PRT_SERIALIZE_LOCAL) : NULL;
+
+	context->eventQueue.size = 0;
+
+	PrtFree(context->hibernatedState);
+	context->hibernatedState = NULL;
+	PrtSetMemoryAccount(prevAccount);
+
+	// the machine may be claimed again, and whoever claims it sees all of the above.
+	PrtUpdateRunState(context, PRT_RUNSTATE_HIBERNATED, 0);
+}
+
+//
+// Number of other machines looked at each time a machine finishes running
+//
+#define PRT_HIBERNATE_SWEEP_LEN 2
+
+void
+PrtHibernateIdleSweep(
+_Inout_ PRT_MACHINEINST_PRIV			*context
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	if (process->idlePeriod == PRT_HIBERNATE_NEVER)
+	{
+		return;
+	}
+
+	PRT_UINT64 now = PrtGetMonotonicTime();
+	PRT_MACHINEINST_PRIV *next = context;
+	for (PRT_UINT32 i = 0; i <= PRT_HIBERNATE_SWEEP_LEN; i++)
+	{
+		if (i > 0)
+		{
+			PrtAcquireLock(&process->processLock);
+			if (process->hibernateCursor >= process->numMachines)
+			{
+				process->hibernateCursor = 0;
+			}
+			next = (PRT_MACHINEINST_PRIV *)process->machines[process->hibernateCursor++];
+			PrtReleaseLock(&process->processLock);
+		}
+
+		PrtAcquireLock(&next->stateMachineLock);
+		if (now - next->idleSince >= process->idlePeriod)
+		{
+			PrtHibernateMachine(next);
+		}
+		PrtReleaseLock(&next->stateMachineLock);
+	}
+}
+
+PRT_BOOLEAN
+PrtEnforceMemoryQuota(
+_Inout_ PRT_MACHINEINST_PRIV			*context
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	if (!context->memory.exceeded && !process->memory.exceeded)
+	{
+		return PRT_FALSE;
+	}
+
+	// the machine that is running when its process crosses the quota takes the blame for it.
+	context->memory.exceeded = PRT_FALSE;
+	process->memory.exceeded = PRT_FALSE;
+	PrtHandleError(PRT_STATUS_MEMORY_QUOTA, context);
+	if (process->quotaPolicy == PRT_QUOTAPOLICY_HALT && !(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED))
+	{
+		PrtHaltMachine(context);
+		return PRT_TRUE;
+	}
+	return (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED) != 0;
 }
 
 void
@@ -2247,3 +3426,65 @@ _In_ PRT_VALUE *id
 		return;
 	PrtHandleError(PRT_STATUS_ILLEGAL_SEND, (PRT_MACHINEINST_PRIV *)context);
 }
+
+/*********************************************************************************
+
+Nondeterministic choice
+
+Choices are drawn from PCG32 generators: a 64-bit linear congruential state whose
+output is scrambled by a xorshift and a random rotation. Every machine has its own
+stream, selected by an increment derived from its id, so what a machine chooses
+depends only on the seed of its process and on how many choices it made before.
+
+*********************************************************************************/
+
+#define PRT_PCG_MULTIPLIER 6364136223846793005ULL
+
+static PRT_UINT32 PrtNextPcg(_Inout_ PRT_UINT64 *state, _In_ PRT_UINT64 stream)
+{
+	PRT_UINT64 old = *state;
+	*state = old * PRT_PCG_MULTIPLIER + stream;
+	PRT_UINT32 xorShifted = (PRT_UINT32)(((old >> 18) ^ old) >> 27);
+	PRT_UINT32 rotation = (PRT_UINT32)(old >> 59);
+	return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+}
+
+static void PrtSeedPcg(_Out_ PRT_UINT64 *state, _In_ PRT_UINT64 stream, _In_ PRT_UINT64 seed)
+{
+	*state = 0;
+	PrtNextPcg(state, stream);
+	*state += seed;
+	PrtNextPcg(state, stream);
+}
+
+void
+PrtSeedMachineChoices(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	context->choiceStream = ((PRT_UINT64)context->id->valueUnion.mid->machineId << 1) | 1;
+	PrtSeedPcg(&context->choiceState, context->choiceStream, ((PRT_PROCESS_PRIV *)context->process)->choiceSeed);
+}
+
+PRT_BOOLEAN
+PrtChooseForMachine(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	return (PrtNextPcg(&context->choiceState, context->choiceStream) >> 31) ? PRT_TRUE : PRT_FALSE;
+}
+
+/* The generator of PrtChoose on this thread; a zero stream means it has not been seeded yet */
+static PRT_THREAD_LOCAL PRT_UINT64 prtChoiceState = 0;
+static PRT_THREAD_LOCAL PRT_UINT64 prtChoiceStream = 0;
+
+PRT_BOOLEAN PRT_CALL_CONV PrtChoose()
+{
+	if (prtChoiceStream == 0)
+	{
+		// threads live at distinct addresses, so each one gets its own stream.
+		prtChoiceStream = ((PRT_UINT64)(size_t)&prtChoiceState << 1) | 1;
+		PrtSeedPcg(&prtChoiceState, prtChoiceStream, PrtGetMonotonicTime());
+	}
+	return (PrtNextPcg(&prtChoiceState, prtChoiceStream) >> 31) ? PRT_TRUE : PRT_FALSE;
+}
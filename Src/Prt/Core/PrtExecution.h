@@ -19,30 +19,193 @@ extern "C"{
 
 #define PRT_MAX_EVENTSTACK_DEPTH 10
 
+	//
+	// Raised events a machine handles in one step before it lets other machines run
+	//
+#define PRT_MAX_RAISES_PER_STEP 16
+
+	//
+	// Events a machine takes from the head of its queue in one hold of its lock, to handle in the steps that follow
+	//
+#define PRT_MAX_DEQUEUE_BATCH 8
+
+	//
+	// Sends a step holds back while its process buffers sends, before it delivers them; see PrtSetSendBuffering
+	//
+#define PRT_OUTBOX_SIZE 16
+
 	//
 	// Initial length of the event queue for each machine
 	//
 #define PRT_QUEUE_LEN_DEFAULT 64
 
+	//
+	// Position in the event queue that holds no event
+	//
+#define PRT_QUEUE_NO_MATCH 0xFFFFFFFF
+
+	//
+	// Threads of the helper pool of a process unless PrtSetHelperThreads says otherwise
+	//
+#define PRT_HELPER_THREADS_DEFAULT 4
+
+	//
+	// Bits of the run state of a machine; a machine with none of them set is idle
+	//
+#define PRT_RUNSTATE_RUNNING 0x1	/* a thread has claimed the machine and is stepping it */
+#define PRT_RUNSTATE_HASWORK 0x2	/* work was scheduled while the machine was claimed */
+#define PRT_RUNSTATE_HALTED 0x4	/* the machine has halted and is never claimed again */
+#define PRT_RUNSTATE_HIBERNATED 0x8	/* the machine is hibernated and is not claimed until it is thawed */
+
     typedef struct PRT_COOPERATIVE_SCHEDULER
     {
         PRT_SEMAPHORE           workAvailable;      /* semaphore to signal blocked PrtRunProcess threads */
-        PRT_UINT32              threadsWaiting;     /* number of PrtRunProcess threads waiting for work */
+        volatile PRT_UINT32     threadsWaiting;     /* number of PrtRunProcess threads waiting for work, changed atomically under the processLock */
         PRT_SEMAPHORE           allThreadsStopped;  /* all PrtRunProcess threads have terminated */
+        volatile PRT_UINT32     workPending;        /* 1 if work was scheduled since a thread last looked for it */
     } PRT_COOPERATIVE_SCHEDULER;
 
+	/** Memory charged to a machine or a process; see PrtSetMemoryQuotas. */
+	typedef struct PRT_MEMORY_ACCOUNT {
+		PRT_ALLOCATOR				*allocator;	/* allocator of the owning process, NULL for the default allocator */
+		struct PRT_MEMORY_ACCOUNT	*parent;	/* the process account of a machine account, NULL for a process account */
+		PRT_BOOLEAN					tracked;	/* blocks are charged to this account only once quotas are set */
+		size_t						quota;		/* bytes allowed, 0 for no limit */
+		volatile size_t				used;		/* bytes currently charged, including allocation headers */
+		volatile PRT_BOOLEAN		overQuota;	/* used went over quota and has not fallen well below it since */
+		volatile PRT_BOOLEAN		exceeded;	/* used went over quota since the last time this was reported */
+	} PRT_MEMORY_ACCOUNT;
+
+	/** A NUMA node of a process; see PrtSetNumaTopology. */
+	typedef struct PRT_NUMA_NODE {
+		PRT_ALLOCATOR				*allocator;	/* arena whose chunks are placed on the node */
+		PRT_MEMORY_ACCOUNT			memory;		/* memory of the machines homed on the node, charged on to the process */
+	} PRT_NUMA_NODE;
+
+	//
+	// Slots of the millisecond level of the timer wheel of a process, and of each coarser level above it, whose slots
+	// span a whole turn of the level below; powers of two. The top level reaches about 18 hours ahead.
+	//
+#define PRT_TIMER_WHEEL_SLOTS 256
+#define PRT_TIMER_LEVEL_SLOTS 64
+#define PRT_TIMER_LEVELS 3
+
+	/* Returned by PrtGetTimerDelay when no timer is armed */
+#define PRT_TIMER_NONE 0xFFFFFFFF
+
+	/* The wakeAt of a timer wheel whose waiters sleep until they are woken */
+#define PRT_TIMER_WAKE_NEVER 0xFFFFFFFFFFFFFFFF
+
+	/** Called without any lock held when a timer fires, with the generation the timer had when it was armed.
+	* The timer may have been cancelled or armed again since, so the owner checks the generation under its own lock.
+	*/
+	typedef void(*PRT_TIMER_FUN)(_Inout_ void *owner, _In_ PRT_UINT32 generation);
+
+	/** Called under the lock of a timer wheel when a timer is armed ahead of the time its waiters sleep until. */
+	typedef void(*PRT_TIMER_WAKE_FUN)(_Inout_ void *state);
+
+	/** A timer embedded in its owner; see PrtArmTimer. */
+	typedef struct PRT_TIMER {
+		struct PRT_TIMER			*next;		/* in the slot of the timer, while it is armed */
+		struct PRT_TIMER			*prev;
+		struct PRT_TIMER			**slot;		/* the head of the list the timer is in */
+		PRT_UINT64					deadline;	/* on the clock of the process */
+		PRT_UINT32					generation;	/* changed each time the timer is armed or cancelled */
+		PRT_BOOLEAN					armed;
+		PRT_TIMER_FUN				fire;
+		void						*owner;
+	} PRT_TIMER;
+
+	/** The timers of a process, hashed into slots by deadline: a level of one-millisecond slots for the timers due
+	* within a turn of it, and coarser levels for those further away, whose slots are spread over the finer levels
+	* as the cursor comes to them.
+	*/
+	typedef struct PRT_TIMER_WHEEL {
+		PRT_LOCK					lock;		/* taken after any stateMachineLock, and never held while a timer fires */
+		PRT_TIMER					*slots[PRT_TIMER_WHEEL_SLOTS];
+		PRT_TIMER					*levels[PRT_TIMER_LEVELS][PRT_TIMER_LEVEL_SLOTS];
+		PRT_UINT64					cursor;		/* every timer with a deadline up to here has fired */
+		PRT_UINT32					armed;
+		PRT_UINT32					near;		/* armed timers in slots */
+		PRT_UINT64					wakeAt;		/* the time threads waiting for the next timer sleep until */
+		PRT_TIMER_WAKE_FUN			wake;		/* wakes them, NULL if nothing waits on the wheel */
+		void						*wakeState;
+	} PRT_TIMER_WHEEL;
+
+	/** A timer that sends an event to a machine; see PrtMkEventTimer. */
+	struct PRT_EVENT_TIMER {
+		PRT_LOCK					lock;		/* taken before the lock of the timer wheel */
+		PRT_TIMER					timer;
+		struct PRT_PROCESS_PRIV		*process;
+		PRT_MACHINEINST				*machine;
+		PRT_UINT32					eventIndex;
+		PRT_VALUE					*payload;	/* of the event, while the timer is started and has not fired */
+		PRT_UINT32					refs;		/* one for the host, and one while the timer is armed or firing */
+		PRT_BOOLEAN					freed;		/* the host has freed the timer; guarded by the processLock */
+		struct PRT_EVENT_TIMER		*next;		/* in eventTimers of the process, until the host frees the timer */
+		struct PRT_EVENT_TIMER		*prev;
+	};
+
+	/** Machines of one type that keys are routed to; see PrtMkMachineGroup. */
+	struct PRT_MACHINE_GROUP {
+		PRT_LOCK					lock;			/* guards members, nMembers and size; taken after the processLock */
+		struct PRT_PROCESS_PRIV		*process;
+		PRT_UINT32					renamedMachine;
+		PRT_VALUE					*payload;		/* the payload members are made with */
+		PRT_MACHINEINST				**members;
+		PRT_UINT32					nMembers;		/* members made so far, including those left out by a shrink */
+		PRT_UINT32					size;			/* members keys are routed to, the first size of members */
+		struct PRT_MACHINE_GROUP	*next;			/* in groups of the process, until the host frees the group */
+		struct PRT_MACHINE_GROUP	*prev;
+	};
+
+	/** A function as a machine of one type calls it, resolved when the process starts; see PrtIndexFunctions. */
+	typedef struct PRT_FUNENTRY {
+		PRT_SM_FUN				implementation;	/* of decl, NULL if the body is empty */
+		PRT_FUNDECL				*decl;
+		PRT_UINT16				*receiveCases;	/* the entry of the function in receiveCases of the process */
+	} PRT_FUNENTRY;
+
 	typedef struct PRT_PROCESS_PRIV {
 		PRT_GUID				guid;
 		PRT_PROGRAMDECL			*program;
 		PRT_ERROR_FUN	        errorHandler;
 		PRT_LOG_FUN				logHandler;
-		PRT_RECURSIVE_MUTEX		processLock;
+		PRT_LOCK				processLock;		/* not recursive; taken before any stateMachineLock when both are held */
 		PRT_UINT32				numMachines;
 		PRT_UINT32				machineCount;
 		PRT_MACHINEINST			**machines;
         PRT_BOOLEAN             terminating;        /* PrtStopProcess has been called */
         PRT_SCHEDULINGPOLICY    schedulingPolicy;
         void*                   schedulerInfo;      /* for example, this could be PRT_COOPERATIVE_SCHEDULER */
+        PRT_ALLOCATOR           *allocator;         /* memory of this process is drawn from here, NULL for the default allocator */
+        PRT_MEMORY_ACCOUNT      memory;             /* memory charged to all machines of this process */
+        size_t                  machineQuota;       /* quota given to machines created from now on */
+        PRT_QUOTAPOLICY         quotaPolicy;
+        PRT_UINT32              idlePeriod;         /* milliseconds a machine must be idle before it is hibernated */
+        PRT_UINT32              hibernateCursor;    /* index of the next machine to visit when sweeping for idle machines */
+        struct PRT_RECORDER     *recorder;          /* NULL unless PrtStartRecording was called */
+        struct PRT_REPLAYER     *replayer;          /* set only while PrtReplayProcess runs */
+        PRT_NUMA_TOPOLOGY       numaTopology;
+        PRT_NUMA_NODE           *numaNodes;         /* one per node of numaTopology, NULL unless PrtSetNumaTopology was called */
+        PRT_UINT64              choiceSeed;         /* the choice stream of every machine is derived from this and the machine id */
+        PRT_CLOCK               clock;              /* the time of receive deadlines; see PrtSetClock */
+        PRT_TIMER_WHEEL         timers;
+        PRT_UINT32              *machineFunBase;    /* where the functions of each machine start in receiveCases, after the global functions */
+        PRT_UINT16              **receiveCases;     /* per function, NULL if it has no receives; see PrtIndexFunctions */
+        PRT_FUNENTRY            **funTables;        /* per machine type, indexed by the function indices the compiler emits */
+        PRT_UINT32              helperThreads;      /* threads the helper pool starts with; see PrtSetHelperThreads */
+        struct PRT_HELPER_POOL  *helpers;           /* NULL until the first blocking job of the process */
+        struct PRT_IO_LOOP      *io;                /* NULL until a machine of the process first watches a file descriptor */
+        PRT_SEMAPHORE           timerWake;          /* wakes the timer thread; NULL until it is started */
+        PRT_THREAD              timerThread;
+        volatile PRT_BOOLEAN    timerThreadStopping;
+        PRT_EVENT_TIMER         *eventTimers;       /* guarded by processLock */
+        PRT_MACHINE_GROUP       *groups;            /* guarded by processLock */
+        PRT_UINT32              expiryEvent;        /* sent in place of expired events, PRT_SPECIAL_EVENT_NULL to drop them */
+        PRT_ADMISSION_POLICY    *admission;         /* per machine decl, NULL until PrtSetAdmissionPolicy is called */
+        volatile PRT_BOOLEAN    hasCalls;           /* a machine of the process has called another; see PrtCallMachine */
+        PRT_BOOLEAN             bufferSends;        /* see PrtSetSendBuffering */
 
 	} PRT_PROCESS_PRIV;
 
@@ -72,13 +235,36 @@ extern "C"{
 		OnUnhandledEvent
 	} PRT_EXITREASON;
 
+	/** A payload held by the queues of all the receivers of a broadcast; immutable until the last of them lets go. */
+	typedef struct PRT_SHARED_PAYLOAD
+	{
+		PRT_VALUE			*value;
+		volatile size_t		refs;	/* receivers yet to dequeue or drop the event */
+	} PRT_SHARED_PAYLOAD;
+
 	typedef struct PRT_EVENT
 	{
 		PRT_VALUE *trigger;
-		PRT_VALUE *payload;
+		PRT_VALUE *payload;				/* the value of shared, if set */
+		PRT_SHARED_PAYLOAD *shared;		/* set if the payload is shared with other queues; see PrtBroadcast */
 		PRT_MACHINESTATE state;
+		PRT_UINT64 deadline;			/* the process time the event expires at, 0 if it never does */
+		PRT_UINT64 enqueuedAt;			/* the process time the event was queued at, if its receiver times its queue */
+		PRT_UINT64 callToken;			/* the call the event is the request of, 0 if it is not one; see PrtCallMachine */
 	} PRT_EVENT;
 
+	/** What a machine knows of the load on it, for the admission policy of its type; see PrtTrySend. */
+	typedef struct PRT_ADMISSION_STATE
+	{
+		PRT_BOOLEAN	timesQueue;		/* events are stamped with the time they are queued at */
+		PRT_UINT64	tokens;			/* token bucket: thousandths of a token */
+		PRT_UINT64	refilledAt;		/* token bucket: when tokens was last topped up */
+		PRT_UINT64	aboveSince;		/* queue delay: when dequeued events started to wait longer than the target, or 0 */
+		PRT_BOOLEAN	shedding;		/* queue delay: they have waited longer than the target for an interval */
+		PRT_UINT64	shedNext;		/* queue delay: while shedding, when the next event is shed */
+		PRT_UINT32	shedCount;		/* queue delay: events shed since shedding started */
+	} PRT_ADMISSION_STATE;
+
 	typedef struct PRT_EVENTQUEUE
 	{
 		PRT_UINT32		 eventsSize;
@@ -127,18 +313,18 @@ extern "C"{
 		PRT_PROCESS		    *process;
 		PRT_UINT32			instanceOf;
 		PRT_VALUE			*id;
-		PRT_VALUE           *recvMap;
-		PRT_VALUE			**varValues;
-		PRT_RECURSIVE_MUTEX stateMachineLock;
-		PRT_BOOLEAN			isRunning;
+		PRT_FUNENTRY		*funs;				/* funTables[instanceOf] of the process */
+		PRT_VALUE           *recvMap;			/* NULL until the first PrtEnqueueInOrder */
+		PRT_VALUE			**varValues;		/* a NULL entry has not been used yet; see PrtGetGlobalVar */
+		PRT_LOCK			stateMachineLock;	/* not recursive; never held while running handlers */
+		volatile PRT_UINT32	runState;			/* PRT_RUNSTATE_ bits, only changed by compare-and-swap and read by PrtAtomicLoad */
         PRT_NEXTOPERATION   nextOperation;
 		PRT_EXITREASON		exitReason;
 		PRT_UINT32			eventValue;
-		PRT_BOOLEAN			isHalted;
 		PRT_UINT32			currentState;
 		PRT_RECEIVEDECL		*receive;
-		PRT_STATESTACK		callStack;
-		PRT_FUNSTACK		funStack;
+		PRT_STATESTACK		*callStack;
+		PRT_FUNSTACK		*funStack;
 		PRT_UINT32			destStateIndex;
 		PRT_VALUE			*currentTrigger;
 		PRT_VALUE			*currentPayload;
@@ -149,8 +335,60 @@ extern "C"{
 		PRT_UINT32          *inheritedActionSetCompact;
 		PRT_UINT32          *currentActionSetCompact;
 		PRT_UINT32			renamedName;
+		PRT_MEMORY_ACCOUNT	memory;
+		PRT_UINT64			idleSince;			/* when the machine last found its queue empty */
+		PRT_UINT8			*hibernatedState;	/* the serialized machine while it is hibernated, otherwise NULL */
+		PRT_UINT32			enqueueCount;		/* events sent to the machine while its process is recorded */
+		PRT_UINT32			homeNode;			/* NUMA node the machine's memory is placed on, PRT_NUMA_NODE_ANY if the process has none */
+		PRT_UINT64			choiceState;		/* state of the generator of nondeterministic choices of the machine */
+		PRT_UINT64			choiceStream;		/* odd increment that selects the stream of the machine, from its id */
+		PRT_TIMER			receiveTimer;		/* fires at the deadline of the receive the machine waits in */
+		PRT_UINT64			receiveDeadline;	/* valid while receiveHasDeadline */
+		PRT_BOOLEAN			receiveHasDeadline;	/* the machine waits in a receive with a deadline */
+		PRT_BOOLEAN			receiveTimedOut;	/* the deadline of the receive passed before a case event came */
+		PRT_UINT16			*receiveCases;		/* the case of receive each event selects, 1-based, 0 if none */
+		PRT_BOOLEAN			receiveWaiting;		/* blocked in receive, with no case event in the queue when it blocked */
+		PRT_UINT32			receiveMatch;		/* while receiveWaiting: queue position of the first case event since, or PRT_QUEUE_NO_MATCH */
+		struct PRT_BLOCKING_JOB	*blockingJob;	/* the job the machine is suspended in; see PrtCallBlocking */
+		PRT_UINT32			fdWatches;		/* file descriptors the machine watches; see PrtWatchFd */
+		PRT_UINT32			expiredEvents;		/* events that outlived their time to live in the queue */
+		PRT_ADMISSION_STATE	*admission;			/* NULL until the first PrtTrySend under an admission policy */
+		struct PRT_MACHINE_CALL	*call;			/* the call the machine is suspended in; see PrtCallMachine */
+		PRT_TIMER			callTimer;			/* fires at the deadline of the call the machine is suspended in */
+		PRT_UINT32			callsMade;			/* numbers the calls of the machine, for their tokens */
+		PRT_UINT64			callToken;			/* the token of the request the machine last dequeued, 0 if it was no request */
+		PRT_EVENT			*batch;				/* events taken from the head of the queue and not handled yet; see PrtDequeueEvent */
+		PRT_UINT32			batchNext;			/* the next event of batch to handle */
+		PRT_UINT32			batchCount;			/* the events of batch left to handle */
+		PRT_UINT32			batchDeferredSet;	/* deferredSetVersion when the batch was taken */
+		PRT_UINT32			deferredSetVersion;	/* counts the times the deferred set was worked out */
 	} PRT_MACHINEINST_PRIV;
 
+	/** A send held back until the step that made it ends; see PrtOpenOutbox. */
+	typedef struct PRT_OUTBOX_SEND
+	{
+		PRT_MACHINEINST_PRIV	*receiver;		/* NULL once delivered */
+		PRT_UINT32				eventIndex;
+		PRT_VALUE				*payload;		/* built on the heap of receiver, as for any send */
+		PRT_UINT32				timeToLive;
+		PRT_MACHINESTATE		state;			/* of the sender when it sent */
+	} PRT_OUTBOX_SEND;
+
+	/** The sends of one step of a machine, on the stack of the thread that runs it. */
+	typedef struct PRT_OUTBOX
+	{
+		PRT_MACHINEINST_PRIV	*sender;
+		PRT_UINT32				count;
+		PRT_OUTBOX_SEND			sends[PRT_OUTBOX_SIZE];
+	} PRT_OUTBOX;
+
+	/** Gets a global variable. Variables are created with their default value on first use.
+	* @param[in,out] context The context that owns the variable.
+	* @param[in] varIndex The index of the variable.
+	* @returns The value of the variable, still owned by the machine.
+	*/
+	PRT_API PRT_VALUE * PRT_CALL_CONV PrtGetGlobalVar(_Inout_ PRT_MACHINEINST_PRIV * context, _In_ PRT_UINT32 varIndex);
+
 	/** Sets a global variable to variable
 	* @param[in,out] context The context to modify.
 	* @param[in] varIndex The index of the variable to modify.
@@ -209,6 +447,72 @@ extern "C"{
 		_In_ PRT_VALUE					*payload
 		);
 
+	/** Enqueues an event that expires timeToLive milliseconds from now, or never if that is 0, rather than when the
+	* declaration of the event says. PrtSendPrivate uses the time to live of the declaration.
+	*/
+	void
+		PrtSendPrivateWithTimeToLive(
+		_In_ PRT_MACHINESTATE           *state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT32					timeToLive
+		);
+
+	/** Enqueues an event unless the queue of context is full or the admission policy of its type sheds the event, in
+	* which case the payload is freed. Never reports an error.
+	*/
+	PRT_SEND_STATUS
+		PrtTrySendPrivate(
+		_In_ PRT_MACHINESTATE           *state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload
+		);
+
+	/** Decides whether context takes an event sent with PrtTrySend, by the admission policy of its type, and updates what
+	* it knows of its load; the caller holds its stateMachineLock.
+	*/
+	PRT_BOOLEAN
+		PrtAdmitEvent(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_UINT32					eventIndex
+		);
+
+	/** Tells a machine that times its queue how long an event it dequeued waited; the caller holds its stateMachineLock. */
+	void
+		PrtNoteQueueDelay(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_UINT64					enqueuedAt
+		);
+
+	/** Enqueues an event whose payload is shared, and type checked already, for the receivers of a broadcast.
+	* The queue entry takes one of the refs of shared, given back once the machine dequeues or drops the event.
+	*/
+	void
+		PrtSendShared(
+		_In_ PRT_MACHINESTATE           *state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_Inout_ PRT_SHARED_PAYLOAD		*shared
+		);
+
+	/** Enqueues the request of a call, with the token PrtGetCallToken hands to the receiver when it dequeues it. */
+	void
+		PrtSendRequest(
+		_In_ PRT_MACHINESTATE           *state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT64					callToken
+		);
+
+	/** Lets go of a shared payload, and frees it if nothing else holds it. */
+	void
+		PrtReleaseSharedPayload(
+		_Inout_ PRT_SHARED_PAYLOAD		*shared
+		);
+
 	PRT_API void PRT_CALL_CONV
 		PrtGoto(
 			_Inout_ PRT_MACHINEINST_PRIV		*context,
@@ -225,6 +529,19 @@ extern "C"{
 		...
 		);
 
+	/** Raises event with a payload that is already built. The raised event is handled as soon as the handler returns,
+	* in the same step, without going through the queue.
+	* @param[in,out] context The machine raising the event.
+	* @param[in] event The event to raise (not owned).
+	* @param[in] payload The payload (owned by the machine from now on), or NULL for the null payload.
+	*/
+	PRT_API void PRT_CALL_CONV
+		PrtRaiseWithPayload(
+		_Inout_ PRT_MACHINEINST_PRIV		*context,
+		_In_ PRT_VALUE						*event,
+		_In_ PRT_VALUE						*payload
+		);
+
 	void
 		PrtPushState(
 		_Inout_ PRT_MACHINEINST_PRIV	*context,
@@ -267,6 +584,10 @@ extern "C"{
 		_In_ PRT_UINT32					eventIndex
 		);
 
+	/** Takes the next event the machine handles from its queue; the caller holds the stateMachineLock. When that event
+	* is at the head of the queue, the run of events behind it that could be handled without looking at the queue again
+	* is taken with it, up to PRT_MAX_DEQUEUE_BATCH, and handed out by the steps that follow without the lock.
+	*/
 	PRT_BOOLEAN
 		PrtDequeueEvent(
 		_Inout_ PRT_MACHINEINST_PRIV	*context,
@@ -420,6 +741,23 @@ extern "C"{
 		_Inout_ PRT_MACHINEINST_PRIV			*context
 		);
 
+	/** Hands the next event of the batch of context to the step, unless the machine is to look at its queue again; the
+	* caller does not hold the stateMachineLock.
+	* @returns PRT_TRUE if the machine has an event to handle.
+	*/
+	PRT_BOOLEAN
+		PrtTakeBatchedEvent(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Puts the events of the batch of context back at the head of its queue, in their order, for the machine to look
+	* at its queue again; the caller holds the stateMachineLock.
+	*/
+	void
+		PrtReturnDequeueBatch(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
 	void
 		PrtResizeEventQueue(
 		_Inout_ PRT_MACHINEINST_PRIV *context
@@ -435,6 +773,141 @@ extern "C"{
 		_Inout_ PRT_MACHINEINST_PRIV			*context
 		);
 
+	/** Makes PrtMalloc on the calling thread draw from the allocator of account, charging account if it is tracked.
+	* @param[in] account The account to charge, or NULL to go back to the allocator set by PrtSetAllocator.
+	* @returns The account that was previously set; pass it back to restore it.
+	*/
+	PRT_MEMORY_ACCOUNT *
+		PrtSetMemoryAccount(
+		_In_ PRT_MEMORY_ACCOUNT *account
+		);
+
+	/** Appends the variables and recvMap of a machine to buffer. A variable that was never used, or a recvMap that
+	* was never created, takes a single byte and is still absent when read back.
+	* @see PrtDeserializeMachineVars
+	*/
+	void
+		PrtSerializeMachineVars(
+		_Inout_ PRT_BYTE_BUFFER					*buffer,
+		_In_ PRT_MACHINEINST_PRIV				*context,
+		_In_ PRT_SERIALIZE_MODE					mode
+		);
+
+	/** Allocates varValues and rebuilds the variables and recvMap written by PrtSerializeMachineVars. */
+	void
+		PrtDeserializeMachineVars(
+		_In_ const PRT_UINT8					*bytes,
+		_Inout_ PRT_UINT32						*position,
+		_Inout_ PRT_MACHINEINST_PRIV			*context,
+		_In_ PRT_SERIALIZE_MODE					mode
+		);
+
+	/** Like PrtDeserializeMachineVars, for size bytes of data that may be truncated or corrupt.
+	* @returns PRT_FALSE if the data does not hold the variables, with what was read left in varValues and recvMap.
+	*/
+	PRT_BOOLEAN
+		PrtTryDeserializeMachineVars(
+		_In_ const PRT_UINT8					*bytes,
+		_In_ PRT_UINT32							size,
+		_Inout_ PRT_UINT32						*position,
+		_Inout_ PRT_MACHINEINST_PRIV			*context,
+		_In_ PRT_SERIALIZE_MODE					mode
+		);
+
+	/** Reads a value written with PRT_SERIALIZE_PORTABLE from size bytes that may be truncated or corrupt.
+	* @returns The value, or NULL if the bytes do not hold one or it has an event that program does not declare.
+	*/
+	PRT_VALUE *
+		PrtReadProgramValue(
+		_In_ const PRT_UINT8					*bytes,
+		_In_ PRT_UINT32							size,
+		_Inout_ PRT_UINT32						*position,
+		_In_ PRT_PROGRAMDECL					*program
+		);
+
+	/** Serializes the variables, state stack and packed sets of an idle machine into hibernatedState and frees them,
+	* along with its stacks and event queue. The caller must hold the stateMachineLock.
+	* @returns PRT_TRUE if context was hibernated, PRT_FALSE if it is not idle or was already hibernated.
+	* @see PrtThawMachine
+	*/
+	PRT_BOOLEAN
+		PrtHibernateMachine(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Rebuilds a hibernated machine from hibernatedState. Does nothing if context is not hibernated.
+	* The caller must hold the stateMachineLock.
+	*/
+	void
+		PrtThawMachine(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Claims context for the calling thread to step, unless it has halted, is hibernated, or another thread has claimed it.
+	* @param[in] markWork If context is claimed by another thread, whether to tell that thread to look for more work
+	* before it releases context.
+	* @returns PRT_TRUE if the calling thread claimed context and must release it with PrtReleaseMachine.
+	*/
+	PRT_BOOLEAN
+		PrtClaimMachine(
+		_Inout_ PRT_MACHINEINST_PRIV			*context,
+		_In_ PRT_BOOLEAN						markWork
+		);
+
+	/** Releases a machine claimed by PrtClaimMachine, unless work was scheduled for it meanwhile.
+	* @returns PRT_TRUE if context was released, PRT_FALSE if it is still claimed because it has more work.
+	*/
+	PRT_BOOLEAN
+		PrtReleaseMachine(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Atomically clears clearBits and then sets setBits in the run-state word of context. */
+	void
+		PrtUpdateRunState(
+		_Inout_ PRT_MACHINEINST_PRIV			*context,
+		_In_ PRT_UINT32							clearBits,
+		_In_ PRT_UINT32							setBits
+		);
+
+	/** Claims context and runs one step of it, for schedulers that interleave the machines of a process.
+	* @returns PRT_TRUE if context has more work, PRT_FALSE if it is idle or could not be claimed.
+	*/
+	PRT_BOOLEAN
+		PrtStepMachine(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Runs context according to the scheduling policy of its process. */
+	void
+		PrtScheduleWork(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Tells the threads of a cooperative process that there is work to look for, waking one if any is waiting. */
+	void
+		PrtSignalWork(
+		_Inout_ PRT_PROCESS_PRIV				*process
+		);
+
+	/** Hibernates context if the process has a hibernation policy and context has been idle for long enough,
+	* then visits a few more machines of the process in round-robin order and does the same for them.
+	* Must not be called while context is running.
+	*/
+	void
+		PrtHibernateIdleSweep(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
+	/** Reports, and handles according to the quota policy, a quota that was exceeded while context was running.
+	* Must be called between steps of context.
+	* @returns PRT_TRUE if context was halted.
+	*/
+	PRT_BOOLEAN
+		PrtEnforceMemoryQuota(
+		_Inout_ PRT_MACHINEINST_PRIV			*context
+		);
+
 	PRT_API void
 		PrtHandleError(
 		_In_ PRT_STATUS ex,
@@ -546,6 +1019,118 @@ extern "C"{
 		_In_ PRT_UINT16					receiveIndex
 		);
 
+	/** How a receive with a deadline ended */
+	typedef enum PRT_RECEIVE_RESULT
+	{
+		PRT_RECEIVE_BLOCKED = 0,	/**< No case event is queued: return, and the function is called again when one comes or the deadline passes */
+		PRT_RECEIVE_CASE = 1,		/**< A case event was dequeued and the frame of its case function pushed, as when PrtReceive returns PRT_TRUE */
+		PRT_RECEIVE_TIMEOUT = 2		/**< The deadline passed first; the receive is over and no case function runs */
+	} PRT_RECEIVE_RESULT;
+
+	/** Receives like PrtReceive, but gives up at an absolute deadline on the clock of the process. The wait is driven by
+	* the timer wheel of the process, which the cooperative scheduler or the timer thread advances; see PrtFireTimers.
+	* @param[in,out] context The machine receiving.
+	* @param[in,out] funStackInfo The frame of the function at the receive.
+	* @param[in] receiveIndex The receive in the function.
+	* @param[in] deadline When to give up; a deadline that has passed gives up unless a case event is already queued.
+	* @see PrtGetProcessTime
+	*/
+	PRT_API PRT_RECEIVE_RESULT
+		PrtReceiveWithDeadline(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+		_In_ PRT_UINT16					receiveIndex,
+		_In_ PRT_UINT64					deadline
+		);
+
+	/** Receives like PrtReceiveWithDeadline, with the deadline timeout milliseconds after the receive starts.
+	* The function is called again at the receive when the machine is unblocked, and the deadline stays where it was.
+	*/
+	PRT_API PRT_RECEIVE_RESULT
+		PrtReceiveWithTimeout(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+		_In_ PRT_UINT16					receiveIndex,
+		_In_ PRT_UINT64					timeout
+		);
+
+	/** Calls a blocking foreign function without blocking the thread that runs the machine. The first time, fun is handed
+	* to a helper thread of the process together with arg, and the machine is suspended like a machine blocked in a receive:
+	* the caller returns, and the function is called again at callIndex once fun has returned, on a thread of the
+	* scheduling policy of the process. The call made then hands over what fun returned.
+	* @param[in,out] context The machine calling.
+	* @param[in,out] funStackInfo The frame of the function at the call.
+	* @param[in] callIndex Where the function resumes, as for the receiveIndex of a receive.
+	* @param[in] fun The blocking function, which must not touch the machine.
+	* @param[in,out] arg Passed to fun; owned by fun until it returns.
+	* @param[out] result What fun returned, or a null value if it returned NULL; set only when this returns PRT_TRUE.
+	* @returns PRT_TRUE if the call is done, PRT_FALSE if the machine is suspended and the caller must return at once.
+	* @see PrtPostBlocking
+	*/
+	PRT_API PRT_BOOLEAN
+		PrtCallBlocking(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+		_In_ PRT_UINT16					callIndex,
+		_In_ PRT_BLOCKING_FUN			fun,
+		_Inout_ void					*arg,
+		_Out_ PRT_VALUE					**result
+		);
+
+	/** How a call to another machine ended */
+	typedef enum PRT_CALL_RESULT
+	{
+		PRT_CALL_PENDING = 0,	/**< The request goes out when the step ends: return, and the function is called again at the call once it is over */
+		PRT_CALL_REPLIED = 1,	/**< The responder replied, and reply holds what it replied with */
+		PRT_CALL_TIMEOUT = 2,	/**< No reply came before the timeout */
+		PRT_CALL_HALTED = 3		/**< The responder halted, or had halted already, without replying */
+	} PRT_CALL_RESULT;
+
+	/** Sends a request to another machine and suspends the caller until the reply comes. The request carries a token
+	* that the responder reads with PrtGetCallToken and hands back to PrtReply, which gives the reply straight to the
+	* suspended caller, so it never goes through the queue of the caller. A reply that comes after the call is over
+	* is dropped. The call made again when the machine is resumed hands over how the call ended.
+	* @param[in,out] context The machine calling.
+	* @param[in,out] funStackInfo The frame of the function at the call.
+	* @param[in] callIndex Where the function resumes, as for the receiveIndex of a receive.
+	* @param[in,out] receiver The responder.
+	* @param[in] event The request event.
+	* @param[in] payload The payload of the request, owned by the call from now on; freed unsent when the machine is resumed.
+	* @param[in] timeout Milliseconds on the clock of the process to wait for the reply, 0 to wait as long as the responder runs.
+	* @param[out] reply What the responder replied with; set only when this returns PRT_CALL_REPLIED.
+	*/
+	PRT_API PRT_CALL_RESULT
+		PrtCallMachine(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+		_In_ PRT_UINT16					callIndex,
+		_Inout_ PRT_MACHINEINST_PRIV	*receiver,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT64					timeout,
+		_Out_ PRT_VALUE					**reply
+		);
+
+	/** Gets the token of the call whose request context dequeued last, to reply to it with PrtReply.
+	* @returns The token, or 0 if the event was not sent with PrtCallMachine.
+	*/
+	PRT_API PRT_UINT64
+		PrtGetCallToken(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Replies to a call. The reply is dropped if the call is over, or if token is 0.
+	* @param[in,out] context The responder.
+	* @param[in] token The token of the call, from PrtGetCallToken.
+	* @param[in] payload The reply, owned by the caller from now on.
+	*/
+	PRT_API void
+		PrtReply(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_UINT64					token,
+		_In_ PRT_VALUE					*payload
+		);
+
 	PRT_API void
 		PrtRunStateMachine(
 		_Inout_ PRT_MACHINEINST_PRIV	    *context
@@ -559,6 +1144,345 @@ extern "C"{
 		_In_ PRT_VALUE					*payload
 		);
 
+	/** Sets the machine whose step the calling thread is running, NULL when it leaves the step.
+	* @returns The machine the thread was stepping before, for steps nested by the task-neutral scheduler.
+	*/
+	PRT_MACHINEINST_PRIV *
+		PrtSetSteppingMachine(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Records that a machine was made by the host rather than by another machine; the caller holds the processLock. */
+	void
+		PrtRecordCreate(
+		_In_ PRT_MACHINEINST_PRIV		*context,
+		_In_ PRT_VALUE					*payload
+		);
+
+	/** Records that a scheduler is starting a step of context. */
+	void
+		PrtRecordStep(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Records an event sent to context with the time to live it was sent with; the caller holds its stateMachineLock. */
+	void
+		PrtRecordSend(
+		_In_ PRT_MACHINESTATE			*state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT32					timeToLive
+		);
+
+	/** Records that context is looking at its queue; the caller holds its stateMachineLock. */
+	void
+		PrtRecordDequeue(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Makes a decision of context that depends on something other than its inputs, such as the clock, reproducible:
+	* records it, or during a replay returns the recorded decision instead. Only the thread running context may call this.
+	* @returns The decision to act on.
+	*/
+	PRT_BOOLEAN
+		PrtRecordDecision(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_BOOLEAN				decision
+		);
+
+	/** Records that the receive deadline of context passed; the caller holds its stateMachineLock. */
+	void
+		PrtRecordTimeout(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Records the result of the blocking call, or the reply to the call, context is suspended in; the caller holds its stateMachineLock. */
+	void
+		PrtRecordResume(
+		_In_ PRT_MACHINEINST_PRIV		*context,
+		_In_ PRT_VALUE					*result
+		);
+
+	/** Decides whether an event sent to context during a replay reaches its queue now, in the recorded order.
+	* @returns PRT_TRUE if the send goes ahead, PRT_FALSE if the replay took the event and payload to send later.
+	*/
+	PRT_BOOLEAN
+		PrtReplaySend(
+		_In_ PRT_MACHINESTATE			*state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT32					timeToLive
+		);
+
+	/** Checks that context looks at its queue with the events it had when this was recorded; the caller holds its stateMachineLock. */
+	void
+		PrtReplayDequeue(
+		_In_ PRT_MACHINEINST_PRIV		*context
+		);
+
+	/** Frees the recorder of a process being stopped. */
+	void
+		PrtFreeRecorder(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Chooses the home node of a machine the calling thread is making in process.
+	* @returns A node of the process topology, or PRT_NUMA_NODE_ANY if the process is not NUMA-aware.
+	*/
+	PRT_UINT32
+		PrtChooseHomeNode(
+		_In_ PRT_PROCESS_PRIV			*process
+		);
+
+	/** Starts the choice stream of context over, from the choice seed of its process and the id of context. */
+	void
+		PrtSeedMachineChoices(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Makes the next nondeterministic choice of context; only the thread running context may call this. */
+	PRT_BOOLEAN
+		PrtChooseForMachine(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Frees the NUMA nodes of a process being stopped, once every machine homed on them has been freed. */
+	void
+		PrtFreeNumaNodes(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Makes wheel empty, with every deadline up to now in the past. wake, if not NULL, is called with wakeState when
+	* a timer is armed ahead of the time PrtGetTimerDelay last told a waiter to sleep until.
+	*/
+	void
+		PrtInitTimerWheel(
+		_Out_ PRT_TIMER_WHEEL			*wheel,
+		_In_ PRT_UINT64					now,
+		_In_ PRT_TIMER_WAKE_FUN			wake,
+		_In_ void						*wakeState
+		);
+
+	/** Frees what wheel holds; no timer may be armed. */
+	void
+		PrtDestroyTimerWheel(
+		_Inout_ PRT_TIMER_WHEEL			*wheel
+		);
+
+	/** Prepares a timer that calls fire with owner; the timer is not armed. */
+	void
+		PrtInitTimer(
+		_Out_ PRT_TIMER					*timer,
+		_In_ PRT_TIMER_FUN				fire,
+		_In_ void						*owner
+		);
+
+	/** Arms timer to fire at deadline, or moves it there if it is armed. Takes O(1).
+	* @returns The generation the timer fires with.
+	*/
+	PRT_UINT32
+		PrtArmTimer(
+		_Inout_ PRT_TIMER_WHEEL			*wheel,
+		_Inout_ PRT_TIMER				*timer,
+		_In_ PRT_UINT64					deadline
+		);
+
+	/** Disarms timer if it is armed, and makes a firing that is already under way stale. Takes O(1).
+	* @returns PRT_TRUE if the timer was armed; PRT_FALSE if it was not, or has been taken out to fire.
+	*/
+	PRT_BOOLEAN
+		PrtCancelTimer(
+		_Inout_ PRT_TIMER_WHEEL			*wheel,
+		_Inout_ PRT_TIMER				*timer
+		);
+
+	/** Fires every timer of wheel whose deadline is at or before now, on the calling thread.
+	* @returns The number of timers fired.
+	*/
+	PRT_UINT32
+		PrtAdvanceTimerWheel(
+		_Inout_ PRT_TIMER_WHEEL			*wheel,
+		_In_ PRT_UINT64					now
+		);
+
+	/** Finds how long a thread waiting for work may sleep before a timer of wheel might be due, and takes it that
+	* the caller sleeps that long, so that arming an earlier timer wakes it.
+	* @returns Milliseconds from now, possibly early for a timer on a coarser level than the first, or PRT_TIMER_NONE.
+	*/
+	PRT_UINT32
+		PrtGetTimerDelay(
+		_Inout_ PRT_TIMER_WHEEL			*wheel,
+		_In_ PRT_UINT64					now
+		);
+
+	/** Frees the event timers the host has not freed, once the threads of a process being stopped have stopped. */
+	void
+		PrtFreeEventTimers(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Frees the machine groups the host has not freed, once the threads of a process being stopped have stopped. */
+	void
+		PrtFreeMachineGroups(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Resolves every function of the program of process for every machine type, so that a machine finds the
+	* function a function index names with one load rather than by decoding the index against the program. Entry i of
+	* funTables[m] is the function i names in a machine of type m: global function i / 2 if i is even, and function
+	* i / 2 of the machine type if i is odd.
+	*
+	* Also indexes the cases of every receive, so that a machine blocked in a receive finds the case an event selects
+	* without walking the cases. Row r of receiveCases[f] holds, for every event of the program, the 1-based index of
+	* the case it selects in the r-th receive of function f, or 0 if it selects none.
+	*/
+	void
+		PrtIndexFunctions(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Frees what PrtIndexFunctions made. */
+	void
+		PrtFreeFunctionIndex(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Lets every job handed to the helpers of a process being stopped run to the end, then stops the helpers.
+	* Results that come in from now on are dropped. Called once the scheduler threads have stopped, before any machine is cleaned up.
+	*/
+	void
+		PrtStopHelpers(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Lets go of the blocking job of a machine being cleaned up; the caller holds its stateMachineLock.
+	* A job still running is freed by its helper when it is done.
+	*/
+	void
+		PrtDropBlockingJob(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Stops the thread that watches the file descriptors of a process being stopped, and frees what it used.
+	* Called once the scheduler threads have stopped, before any machine is cleaned up.
+	*/
+	void
+		PrtStopIoLoop(
+		_Inout_ PRT_PROCESS_PRIV		*process
+		);
+
+	/** Stops watching the file descriptors of a machine being cleaned up. */
+	void
+		PrtDropFdWatches(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Resumes the machine suspended in a blocking call during a replay, with the result the recording has for it.
+	* @returns PRT_TRUE if context was suspended in a blocking call; otherwise result is freed.
+	*/
+	PRT_BOOLEAN
+		PrtReplayResume(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*result
+		);
+
+	/** Sends the request of the call context suspended in during the step that just ended, now that it no longer
+	* holds its stateMachineLock, so that a reply finds it suspended.
+	* @returns PRT_TRUE if the responder had halted, so that the call is over and context has work again.
+	*/
+	PRT_BOOLEAN
+		PrtSendCallRequest(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Lets go of the call of a machine being cleaned up; the caller holds its stateMachineLock. */
+	void
+		PrtDropCall(
+		_Inout_ PRT_MACHINEINST_PRIV	*context
+		);
+
+	/** Ends the calls waiting on a machine that has halted, as calls to a halted responder. */
+	void
+		PrtFailCallsTo(
+		_In_ PRT_MACHINEINST_PRIV		*responder
+		);
+
+	/** Resumes the machine suspended in a call during a replay, with the reply the recording has for it.
+	* @returns PRT_TRUE if context was suspended in a call; otherwise reply is freed.
+	*/
+	PRT_BOOLEAN
+		PrtReplayCallResult(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*reply
+		);
+
+	/** Fires the call timer of a machine; see PRT_TIMER_FUN. */
+	void
+		PrtCallTimerFired(
+		_Inout_ void					*owner,
+		_In_ PRT_UINT32					generation
+		);
+
+	/** Fires the receive timer of a machine; see PRT_TIMER_FUN. */
+	void
+		PrtReceiveTimerFired(
+		_Inout_ void					*owner,
+		_In_ PRT_UINT32					generation
+		);
+
+	/** Makes outbox collect the sends of the step of context about to run, if its process buffers sends, until
+	* PrtCloseOutbox; the steps of other machines that run inline in the meantime collect theirs in outboxes of their own.
+	* @returns The outbox of the step this one runs within, to be passed to PrtCloseOutbox.
+	*/
+	PRT_OUTBOX *
+		PrtOpenOutbox(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Out_ PRT_OUTBOX				*outbox
+		);
+
+	/** Delivers the sends outbox collected, grouped by receiver, and gives the thread back the outbox of the step this
+	* one ran within. Called while context still counts as stepping, with none of its locks held.
+	* @returns PRT_TRUE if context sent events to itself, so that it has work again.
+	*/
+	PRT_BOOLEAN
+		PrtCloseOutbox(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_OUTBOX				*outbox,
+		_In_ PRT_OUTBOX					*previous
+		);
+
+	/** Holds back a send made in a step whose outbox collects sends, delivering the sends held so far if it is full.
+	* @returns PRT_TRUE if the send was held back, and payload belongs to the outbox.
+	*/
+	PRT_BOOLEAN
+		PrtBufferSend(
+		_In_ PRT_MACHINESTATE			*state,
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_In_ PRT_VALUE					*event,
+		_In_ PRT_VALUE					*payload,
+		_In_ PRT_UINT32					timeToLive
+		);
+
+	/** Delivers the sends the outbox of the step running on this thread holds for receiver, before a send to it that
+	* does not go through the outbox.
+	*/
+	void
+		PrtFlushOutboxTo(
+		_Inout_ PRT_MACHINEINST_PRIV	*receiver
+		);
+
+	/** Adds sends held back in an outbox, all to context, to its queue in one hold of its stateMachineLock, and
+	* schedules it once.
+	*/
+	void
+		PrtEnqueueSends(
+		_Inout_ PRT_MACHINEINST_PRIV	*context,
+		_Inout_ PRT_OUTBOX_SEND			**sends,
+		_In_ PRT_UINT32					count
+		);
+
 #ifdef __cplusplus
 }
 #endif
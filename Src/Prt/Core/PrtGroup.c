@@ -0,0 +1,189 @@
+#include "PrtExecution.h"
+
+//
+// A machine group routes each key to one of its members with jump consistent hashing (Lamping and Veach), which
+// needs no table and, when the group grows from n to n + 1 members, moves only the keys that go to the new member.
+// The members a group shrinks away from are kept, so that growing back gives each key the machine it had before.
+//
+
+// Spreads the bits of a value hash over 64 bits, so that keys with nearby hashes go to unrelated members.
+static PRT_UINT64 PrtMixGroupKey(_In_ PRT_UINT32 hash)
+{
+	PRT_UINT64 key = hash + 0x9E3779B97F4A7C15ULL;
+	key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+	return key ^ (key >> 31);
+}
+
+static PRT_UINT32 PrtJumpHash(_In_ PRT_UINT64 key, _In_ PRT_UINT32 buckets)
+{
+	PRT_INT64 bucket = -1;
+	PRT_INT64 next = 0;
+	while (next < (PRT_INT64)buckets)
+	{
+		bucket = next;
+		key = key * 2862933555777941757ULL + 1;
+		next = (PRT_INT64)((bucket + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+	return (PRT_UINT32)bucket;
+}
+
+static void PrtUnlinkMachineGroup(_Inout_ PRT_MACHINE_GROUP *group)
+{
+	PRT_PROCESS_PRIV *process = group->process;
+	if (group->prev != NULL)
+	{
+		group->prev->next = group->next;
+	}
+	else
+	{
+		process->groups = group->next;
+	}
+	if (group->next != NULL)
+	{
+		group->next->prev = group->prev;
+	}
+}
+
+PRT_API PRT_MACHINE_GROUP * PRT_CALL_CONV
+PrtMkMachineGroup(
+	_Inout_ PRT_PROCESS				*process,
+	_In_ PRT_UINT32					renamedMachine,
+	_In_ PRT_UINT32					size,
+	_In_ PRT_VALUE					*payload
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(size > 0, "A machine group needs at least one member");
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+	PRT_MACHINE_GROUP *group = (PRT_MACHINE_GROUP *)PrtMalloc(sizeof(PRT_MACHINE_GROUP));
+	group->payload = payload != NULL ? PrtCloneValue(payload) : PrtMkNullValue();
+	PrtSetMemoryAccount(prevAccount);
+	PrtInitLock(&group->lock);
+	group->process = privateProcess;
+	group->renamedMachine = renamedMachine;
+	group->members = NULL;
+	group->size = 0;
+	group->nMembers = 0;
+	group->prev = NULL;
+
+	PrtAcquireLock(&privateProcess->processLock);
+	group->next = privateProcess->groups;
+	if (group->next != NULL)
+	{
+		group->next->prev = group;
+	}
+	privateProcess->groups = group;
+	PrtReleaseLock(&privateProcess->processLock);
+
+	PrtResizeMachineGroup(group, size);
+	return group;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtResizeMachineGroup(
+	_Inout_ PRT_MACHINE_GROUP		*group,
+	_In_ PRT_UINT32					size
+)
+{
+	PrtAssert(size > 0, "A machine group needs at least one member");
+	PRT_PROCESS_PRIV *process = group->process;
+	PRT_UINT32 nMembers = group->nMembers;
+	PRT_MACHINEINST **members = group->members;
+	if (size > nMembers)
+	{
+		// the members are made before the lock is taken, since making a machine takes the processLock.
+		PRT_UINT32 instanceOf = process->program->renameMap[group->renamedMachine];
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+		members = (PRT_MACHINEINST **)PrtCalloc(size, sizeof(PRT_MACHINEINST *));
+		for (PRT_UINT32 i = nMembers; i < size; i++)
+		{
+			members[i] = (PRT_MACHINEINST *)PrtMkMachinePrivate(process, group->renamedMachine, instanceOf, group->payload);
+		}
+		PrtSetMemoryAccount(prevAccount);
+	}
+
+	PrtAcquireLock(&group->lock);
+	PRT_MACHINEINST **oldMembers = NULL;
+	if (members != group->members)
+	{
+		for (PRT_UINT32 i = 0; i < nMembers; i++)
+		{
+			members[i] = group->members[i];
+		}
+		oldMembers = group->members;
+		group->members = members;
+		group->nMembers = size;
+	}
+	group->size = size;
+	PrtReleaseLock(&group->lock);
+	PrtFree(oldMembers);
+}
+
+PRT_API PRT_UINT32 PRT_CALL_CONV
+PrtGetMachineGroupSize(
+	_In_ PRT_MACHINE_GROUP			*group
+)
+{
+	PrtAcquireLock(&group->lock);
+	PRT_UINT32 size = group->size;
+	PrtReleaseLock(&group->lock);
+	return size;
+}
+
+PRT_API PRT_MACHINEINST * PRT_CALL_CONV
+PrtGetGroupMember(
+	_In_ PRT_MACHINE_GROUP			*group,
+	_In_ PRT_VALUE					*key
+)
+{
+	PRT_UINT64 mixed = PrtMixGroupKey(PrtGetHashCodeValue(key));
+	PrtAcquireLock(&group->lock);
+	PRT_MACHINEINST *member = group->members[PrtJumpHash(mixed, group->size)];
+	PrtReleaseLock(&group->lock);
+	return member;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtSendToGroup(
+	_In_ PRT_MACHINESTATE			*senderState,
+	_In_ PRT_MACHINE_GROUP			*group,
+	_In_ PRT_VALUE					*key,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload
+)
+{
+	PRT_MACHINEINST_PRIV *member = (PRT_MACHINEINST_PRIV *)PrtGetGroupMember(group, key);
+
+	// as for PrtSend, the payload is owned by the receiver from now on, so it is copied to the receiver's heap.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&member->memory);
+	PRT_VALUE *copy = payload != NULL ? PrtCloneValue(payload) : PrtMkNullValue();
+	PrtSendPrivate(senderState, member, event, copy);
+	PrtSetMemoryAccount(prevAccount);
+}
+
+PRT_API void PRT_CALL_CONV
+PrtFreeMachineGroup(
+	_Inout_ PRT_MACHINE_GROUP		*group
+)
+{
+	PRT_PROCESS_PRIV *process = group->process;
+	PrtAcquireLock(&process->processLock);
+	PrtUnlinkMachineGroup(group);
+	PrtReleaseLock(&process->processLock);
+	PrtFreeValue(group->payload);
+	PrtDestroyLock(&group->lock);
+	PrtFree(group->members);
+	PrtFree(group);
+}
+
+void
+PrtFreeMachineGroups(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	while (process->groups != NULL)
+	{
+		PrtFreeMachineGroup(process->groups);
+	}
+}
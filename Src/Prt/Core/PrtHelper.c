@@ -0,0 +1,376 @@
+#include "PrtExecution.h"
+
+//
+// The helper pool of a process runs blocking foreign functions on threads of its own, so that the threads that run
+// machines never wait for I/O. A job either posts its result to a machine as an event (PrtPostBlocking), or resumes
+// the machine suspended in it (PrtCallBlocking) the way a receive resumes when its case event comes. Either way the
+// helper only schedules the machine; it runs on a thread of the scheduling policy of the process. Every job handed
+// to the pool runs, including those still queued when the process stops, whose results are then dropped.
+//
+
+/* The eventIndex of a job that resumes its machine rather than posting to it */
+#define PRT_BLOCKING_RESUME 0xFFFFFFFF
+
+typedef struct PRT_BLOCKING_JOB
+{
+	struct PRT_BLOCKING_JOB	*next;			/* in the queue of the pool */
+	PRT_BLOCKING_FUN		fun;
+	void					*arg;
+	PRT_MACHINEINST_PRIV	*context;		/* the machine the result goes to */
+	PRT_UINT32				eventIndex;		/* the event that posts the result, or PRT_BLOCKING_RESUME */
+	PRT_BOOLEAN				withHelper;		/* a helper runs the job, and frees it if the machine halts first */
+	PRT_BOOLEAN				done;			/* of a resuming job: result is set; under the stateMachineLock of context */
+	PRT_VALUE				*result;
+} PRT_BLOCKING_JOB;
+
+typedef struct PRT_HELPER_POOL
+{
+	PRT_LOCK				lock;			/* taken after any stateMachineLock */
+	PRT_SEMAPHORE			jobsAvailable;
+	PRT_BLOCKING_JOB		*head;
+	PRT_BLOCKING_JOB		*tail;
+	PRT_UINT32				idle;			/* helpers waiting on jobsAvailable */
+	PRT_UINT32				wakeups;		/* releases of jobsAvailable that no helper has taken yet */
+	PRT_BOOLEAN				stopping;
+	PRT_UINT32				nThreads;
+	PRT_THREAD				*threads;
+} PRT_HELPER_POOL;
+
+static void PRT_CALL_CONV PrtHelperThread(_Inout_ void *param);
+
+static PRT_HELPER_POOL *PrtGetHelpers(_Inout_ PRT_PROCESS_PRIV *process)
+{
+	PrtAcquireLock(&process->processLock);
+	PRT_HELPER_POOL *pool = process->helpers;
+	if (pool == NULL)
+	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+		pool = (PRT_HELPER_POOL *)PrtMalloc(sizeof(PRT_HELPER_POOL));
+		PrtInitLock(&pool->lock);
+		pool->jobsAvailable = PrtCreateSemaphore(0, 32767);
+		pool->head = NULL;
+		pool->tail = NULL;
+		pool->idle = 0;
+		pool->wakeups = 0;
+		pool->stopping = PRT_FALSE;
+		pool->nThreads = process->helperThreads;
+		pool->threads = (PRT_THREAD *)PrtCalloc(pool->nThreads, sizeof(PRT_THREAD));
+		PrtSetMemoryAccount(prevAccount);
+		for (PRT_UINT32 i = 0; i < pool->nThreads; i++)
+		{
+			pool->threads[i] = PrtCreateThread(&PrtHelperThread, pool);
+		}
+		process->helpers = pool;
+	}
+	PrtReleaseLock(&process->processLock);
+	return pool;
+}
+
+static PRT_BLOCKING_JOB *PrtMkBlockingJob(
+	_In_ PRT_MACHINEINST_PRIV *context,
+	_In_ PRT_BLOCKING_FUN fun,
+	_Inout_ void *arg,
+	_In_ PRT_UINT32 eventIndex)
+{
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&((PRT_PROCESS_PRIV *)context->process)->memory);
+	PRT_BLOCKING_JOB *job = (PRT_BLOCKING_JOB *)PrtMalloc(sizeof(PRT_BLOCKING_JOB));
+	PrtSetMemoryAccount(prevAccount);
+	job->next = NULL;
+	job->fun = fun;
+	job->arg = arg;
+	job->context = context;
+	job->eventIndex = eventIndex;
+	job->withHelper = PRT_FALSE;
+	job->done = PRT_FALSE;
+	job->result = NULL;
+	return job;
+}
+
+static void PrtSubmitJob(_Inout_ PRT_HELPER_POOL *pool, _Inout_ PRT_BLOCKING_JOB *job)
+{
+	job->withHelper = PRT_TRUE;
+	PrtAcquireLock(&pool->lock);
+	if (pool->tail != NULL)
+	{
+		pool->tail->next = job;
+	}
+	else
+	{
+		pool->head = job;
+	}
+	pool->tail = job;
+
+	// one release per waiting helper is enough, so the count of the semaphore stays small however many jobs queue up.
+	if (pool->idle > pool->wakeups)
+	{
+		pool->wakeups++;
+		PrtReleaseSemaphore(pool->jobsAvailable);
+	}
+	PrtReleaseLock(&pool->lock);
+}
+
+// The result is charged to the machine it goes to, as the payload of an event sent to it would be.
+static PRT_VALUE *PrtRunJob(_Inout_ PRT_BLOCKING_JOB *job)
+{
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&job->context->memory);
+	PRT_VALUE *result = job->fun(job->arg);
+	if (result == NULL)
+	{
+		result = PrtMkNullValue();
+	}
+	PrtSetMemoryAccount(prevAccount);
+	return result;
+}
+
+// Hands result to the machine suspended in job; the caller holds its stateMachineLock, which this releases.
+static void PrtResumeMachine(
+	_Inout_ PRT_MACHINEINST_PRIV *context,
+	_Inout_ PRT_BLOCKING_JOB *job,
+	_In_ PRT_VALUE *result,
+	_In_ PRT_BOOLEAN schedule)
+{
+	job->result = result;
+	job->done = PRT_TRUE;
+	if (((PRT_PROCESS_PRIV *)context->process)->recorder != NULL)
+	{
+		PrtRecordResume(context, result);
+	}
+	if (!schedule)
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		return;
+	}
+
+	// as for an event that unblocks a receive, the function is called again at the call.
+	context->nextOperation = EntryOperation;
+	PrtReleaseLock(&context->stateMachineLock);
+	PrtScheduleWork(context);
+}
+
+static void PrtCompleteJob(_Inout_ PRT_BLOCKING_JOB *job, _In_ PRT_VALUE *result, _In_ PRT_BOOLEAN stopping)
+{
+	PRT_MACHINEINST_PRIV *context = job->context;
+	if (job->eventIndex != PRT_BLOCKING_RESUME)
+	{
+		if (stopping)
+		{
+			PrtFreeValue(result);
+		}
+		else
+		{
+			PRT_VALUE *event = PrtMkEventValue(job->eventIndex);
+			PrtSendPrivate(NULL, context, event, result);
+			PrtFreeValue(event);
+		}
+		PrtFree(job);
+		return;
+	}
+
+	PrtAcquireLock(&context->stateMachineLock);
+	if (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED)
+	{
+		// the machine let go of the job when it halted.
+		PrtReleaseLock(&context->stateMachineLock);
+		PrtFreeValue(result);
+		PrtFree(job);
+		return;
+	}
+
+	// while the process stops, the machine keeps the result only for PrtCleanupMachine to free it.
+	PrtResumeMachine(context, job, result, !stopping);
+}
+
+static void PRT_CALL_CONV PrtHelperThread(_Inout_ void *param)
+{
+	PRT_HELPER_POOL *pool = (PRT_HELPER_POOL *)param;
+	PrtAcquireLock(&pool->lock);
+	for (;;)
+	{
+		PRT_BLOCKING_JOB *job = pool->head;
+		if (job == NULL)
+		{
+			if (pool->stopping)
+			{
+				break;
+			}
+			pool->idle++;
+			PrtReleaseLock(&pool->lock);
+			PrtWaitSemaphore(pool->jobsAvailable, -1);
+			PrtAcquireLock(&pool->lock);
+			pool->idle--;
+			pool->wakeups--;
+			continue;
+		}
+		pool->head = job->next;
+		if (pool->head == NULL)
+		{
+			pool->tail = NULL;
+		}
+		PrtReleaseLock(&pool->lock);
+
+		PRT_VALUE *result = PrtRunJob(job);
+
+		PrtAcquireLock(&pool->lock);
+		PRT_BOOLEAN stopping = pool->stopping;
+		PrtReleaseLock(&pool->lock);
+		PrtCompleteJob(job, result, stopping);
+		PrtAcquireLock(&pool->lock);
+	}
+	PrtReleaseLock(&pool->lock);
+	PrtFlushArenaCaches();
+}
+
+void
+PrtStopHelpers(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	PRT_HELPER_POOL *pool = process->helpers;
+	if (pool == NULL)
+	{
+		return;
+	}
+	PrtAcquireLock(&pool->lock);
+	pool->stopping = PRT_TRUE;
+	for (PRT_UINT32 i = 0; i < pool->nThreads; i++)
+	{
+		pool->wakeups++;
+		PrtReleaseSemaphore(pool->jobsAvailable);
+	}
+	PrtReleaseLock(&pool->lock);
+
+	for (PRT_UINT32 i = 0; i < pool->nThreads; i++)
+	{
+		PrtJoinThread(pool->threads[i]);
+	}
+	PrtAssert(pool->head == NULL, "Helpers stop only once every job has run");
+	PrtDestroySemaphore(pool->jobsAvailable);
+	PrtDestroyLock(&pool->lock);
+	PrtFree(pool->threads);
+	PrtFree(pool);
+	process->helpers = NULL;
+}
+
+void
+PrtDropBlockingJob(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	PRT_BLOCKING_JOB *job = context->blockingJob;
+	if (job == NULL)
+	{
+		return;
+	}
+	context->blockingJob = NULL;
+	if (job->done)
+	{
+		PrtFreeValue(job->result);
+		PrtFree(job);
+	}
+	else if (!job->withHelper)
+	{
+		PrtFree(job);
+	}
+}
+
+PRT_BOOLEAN
+PrtReplayResume(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_VALUE					*result
+)
+{
+	PrtAcquireLock(&context->stateMachineLock);
+	PRT_BLOCKING_JOB *job = context->blockingJob;
+	if (job == NULL || job->done || (PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_HALTED))
+	{
+		PrtReleaseLock(&context->stateMachineLock);
+		PrtFreeValue(result);
+		return PRT_FALSE;
+	}
+	PrtResumeMachine(context, job, result, PRT_TRUE);
+	return PRT_TRUE;
+}
+
+PRT_BOOLEAN
+PrtCallBlocking(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_FUNSTACK_INFO		*funStackInfo,
+	_In_ PRT_UINT16					callIndex,
+	_In_ PRT_BLOCKING_FUN			fun,
+	_Inout_ void					*arg,
+	_Out_ PRT_VALUE					**result
+)
+{
+	PRT_BLOCKING_JOB *job = context->blockingJob;
+	if (job != NULL)
+	{
+		// called again at the call, now that the job is done.
+		PrtAcquireLock(&context->stateMachineLock);
+		PrtAssert(job->done, "A machine suspended in a blocking call runs again only once the call is done");
+		context->blockingJob = NULL;
+		PrtReleaseLock(&context->stateMachineLock);
+		*result = job->result;
+		PrtFree(job);
+		return PRT_TRUE;
+	}
+
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	job = PrtMkBlockingJob(context, fun, arg, PRT_BLOCKING_RESUME);
+	PRT_HELPER_POOL *pool = NULL;
+	if (process->replayer == NULL)
+	{
+		pool = PrtGetHelpers(process);
+	}
+	else
+	{
+		// a replay runs the function for what else it does, and resumes the machine with the recorded result.
+		PrtFreeValue(PrtRunJob(job));
+	}
+
+	funStackInfo->returnTo = callIndex;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtAssert(PrtAtomicLoad(&context->runState) & PRT_RUNSTATE_RUNNING, "Machine must be running");
+	context->blockingJob = job;
+	if (pool != NULL)
+	{
+		PrtSubmitJob(pool, job);
+	}
+	PrtPushFrame(context, funStackInfo);
+	return PRT_FALSE;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtSetHelperThreads(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_UINT32 count
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(count > 0, "A process needs at least one helper thread");
+	PrtAcquireLock(&privateProcess->processLock);
+	PrtAssert(privateProcess->helpers == NULL, "The helper threads are set before the first blocking job");
+	privateProcess->helperThreads = count;
+	PrtReleaseLock(&privateProcess->processLock);
+}
+
+PRT_API void PRT_CALL_CONV
+PrtPostBlocking(
+	_Inout_ PRT_MACHINEINST *machine,
+	_In_ PRT_BLOCKING_FUN fun,
+	_Inout_ void *arg,
+	_In_ PRT_UINT32 eventIndex
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)machine;
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PrtAssert(eventIndex < process->program->nEvents && eventIndex != PRT_SPECIAL_EVENT_NULL, "Blocking jobs post a valid event");
+	PRT_BLOCKING_JOB *job = PrtMkBlockingJob(context, fun, arg, eventIndex);
+	if (process->replayer != NULL)
+	{
+		// the recording has the event the job sent, as one sent by the host.
+		PrtFreeValue(PrtRunJob(job));
+		PrtFree(job);
+		return;
+	}
+	PrtSubmitJob(PrtGetHelpers(process), job);
+}
@@ -0,0 +1,250 @@
+#include "PrtExecution.h"
+
+//
+// The I/O loop of a process watches the file descriptors of its machines on one thread of its own, and sends a machine
+// an event when one of its descriptors is ready. Descriptors are watched once (PrtPollerWatch), so a descriptor found
+// ready is not reported again until its machine watches it again, and the loop never sends an event the machine did not
+// ask for. A watch is known by its fd and a generation that changes whenever the descriptor changes hands, so that the
+// readiness of a descriptor already given up is dropped rather than sent to its next machine.
+//
+
+/* Descriptors the loop takes from the poller at a time */
+#define PRT_IO_BATCH 64
+
+typedef struct PRT_FD_WATCH
+{
+	PRT_MACHINEINST_PRIV	*context;		/* the machine the descriptor is watched for, or NULL */
+	PRT_UINT32				eventIndex;
+	PRT_UINT32				generation;		/* the high half of the key of the watch */
+} PRT_FD_WATCH;
+
+typedef struct PRT_IO_LOOP
+{
+	PRT_LOCK				lock;			/* taken after any stateMachineLock */
+	PRT_POLLER				poller;
+	PRT_FD_WATCH			*watches;		/* indexed by fd */
+	PRT_UINT32				nWatches;
+	PRT_THREAD				thread;
+	volatile PRT_UINT32		stopping;		/* set once by compare-and-swap, read by PrtAtomicLoad */
+} PRT_IO_LOOP;
+
+static void PRT_CALL_CONV PrtIoThread(_Inout_ void *param);
+
+// Returns the loop of the process, started now if need be, or NULL if the configuration cannot watch descriptors.
+static PRT_IO_LOOP *PrtGetIoLoop(_Inout_ PRT_PROCESS_PRIV *process)
+{
+	PrtAcquireLock(&process->processLock);
+	PRT_IO_LOOP *io = process->io;
+	if (io == NULL)
+	{
+		PRT_POLLER poller = PrtCreatePoller();
+		if (poller != NULL)
+		{
+			PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+			io = (PRT_IO_LOOP *)PrtMalloc(sizeof(PRT_IO_LOOP));
+			io->nWatches = PRT_IO_BATCH;
+			io->watches = (PRT_FD_WATCH *)PrtCalloc(io->nWatches, sizeof(PRT_FD_WATCH));
+			PrtSetMemoryAccount(prevAccount);
+			PrtInitLock(&io->lock);
+			io->poller = poller;
+			io->stopping = PRT_FALSE;
+			io->thread = PrtCreateThread(&PrtIoThread, io);
+			process->io = io;
+		}
+	}
+	PrtReleaseLock(&process->processLock);
+	return io;
+}
+
+static PRT_UINT64 PrtFdWatchKey(_In_ PRT_IO_LOOP *io, _In_ PRT_INT32 fd)
+{
+	return ((PRT_UINT64)io->watches[fd].generation << 32) | (PRT_UINT32)fd;
+}
+
+// Forgets the watch on fd; the caller holds the lock of the loop.
+static void PrtClearFdWatch(_Inout_ PRT_IO_LOOP *io, _In_ PRT_INT32 fd)
+{
+	PRT_FD_WATCH *watch = &io->watches[fd];
+	PrtPollerUnwatch(io->poller, fd);
+	watch->context->fdWatches--;
+	watch->context = NULL;
+	watch->generation++;
+}
+
+static void PRT_CALL_CONV PrtIoThread(_Inout_ void *param)
+{
+	PRT_IO_LOOP *io = (PRT_IO_LOOP *)param;
+	PRT_POLL_EVENT ready[PRT_IO_BATCH];
+	while (!PrtAtomicLoad(&io->stopping))
+	{
+		PRT_UINT32 count = PrtPollerWait(io->poller, -1, ready, PRT_IO_BATCH);
+		for (PRT_UINT32 i = 0; i < count && !PrtAtomicLoad(&io->stopping); i++)
+		{
+			PRT_INT32 fd = (PRT_INT32)(PRT_UINT32)ready[i].key;
+			PrtAcquireLock(&io->lock);
+			if ((PRT_UINT32)fd >= io->nWatches || io->watches[fd].context == NULL || PrtFdWatchKey(io, fd) != ready[i].key)
+			{
+				// given up after the poller found it ready.
+				PrtReleaseLock(&io->lock);
+				continue;
+			}
+			PRT_MACHINEINST_PRIV *context = io->watches[fd].context;
+			PRT_UINT32 eventIndex = io->watches[fd].eventIndex;
+			PrtReleaseLock(&io->lock);
+
+			// the machine is freed only once the loop has stopped; a machine that halted meanwhile drops the event.
+			PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&context->memory);
+			PRT_VALUE *event = PrtMkEventValue(eventIndex);
+			PRT_VALUE *payload = PrtMkIntValue((PRT_INT32)ready[i].ready);
+			PrtSetMemoryAccount(prevAccount);
+			PrtSendPrivate(NULL, context, event, payload);
+			PrtFreeValue(event);
+		}
+	}
+	PrtFlushArenaCaches();
+}
+
+void
+PrtStopIoLoop(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	PRT_IO_LOOP *io = process->io;
+	if (io == NULL)
+	{
+		return;
+	}
+	PrtAtomicCompareExchange(&io->stopping, PRT_FALSE, PRT_TRUE);
+	PrtPollerWake(io->poller);
+	PrtJoinThread(io->thread);
+
+	// the machines are cleaned up after this, and give up their descriptors with the poller.
+	for (PRT_UINT32 fd = 0; fd < io->nWatches; fd++)
+	{
+		if (io->watches[fd].context != NULL)
+		{
+			io->watches[fd].context->fdWatches--;
+		}
+	}
+	PrtDestroyPoller(io->poller);
+	PrtDestroyLock(&io->lock);
+	PrtFree(io->watches);
+	PrtFree(io);
+	process->io = NULL;
+}
+
+void
+PrtDropFdWatches(
+	_Inout_ PRT_MACHINEINST_PRIV	*context
+)
+{
+	if (context->fdWatches == 0)
+	{
+		return;
+	}
+	PRT_IO_LOOP *io = ((PRT_PROCESS_PRIV *)context->process)->io;
+	if (io == NULL)
+	{
+		return;
+	}
+	PrtAcquireLock(&io->lock);
+	for (PRT_UINT32 fd = 0; fd < io->nWatches && context->fdWatches > 0; fd++)
+	{
+		if (io->watches[fd].context == context)
+		{
+			PrtClearFdWatch(io, (PRT_INT32)fd);
+		}
+	}
+	PrtReleaseLock(&io->lock);
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtWatchFd(
+	_Inout_ PRT_MACHINEINST *machine,
+	_In_ PRT_INT32 fd,
+	_In_ PRT_UINT32 interest,
+	_In_ PRT_UINT32 eventIndex
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)machine;
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PrtAssert(fd >= 0, "Watched file descriptors must be valid");
+	PrtAssert(eventIndex < process->program->nEvents && eventIndex != PRT_SPECIAL_EVENT_NULL, "Watched file descriptors send a valid event");
+	PrtAssert((interest & ~(PRT_POLL_READ | PRT_POLL_WRITE)) == 0, "File descriptors are watched for reading or writing");
+	PRT_VALUE *event = PrtMkEventValue(eventIndex);
+	PRT_VALUE *sample = PrtMkIntValue(0);
+	PrtAssert(PrtInhabitsType(sample, PrtGetPayloadType(context, event)), "The event of a watched file descriptor must take an int payload");
+	PrtFreeValue(sample);
+	PrtFreeValue(event);
+	if (process->replayer != NULL)
+	{
+		// the recording has the events the descriptor sent, as ones sent by the host.
+		return PRT_TRUE;
+	}
+	PRT_IO_LOOP *io = PrtGetIoLoop(process);
+	if (io == NULL)
+	{
+		return PRT_FALSE;
+	}
+
+	PrtAcquireLock(&io->lock);
+	if ((PRT_UINT32)fd >= io->nWatches)
+	{
+		PRT_UINT32 nWatches = io->nWatches;
+		while (nWatches <= (PRT_UINT32)fd)
+		{
+			nWatches *= 2;
+		}
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+		io->watches = (PRT_FD_WATCH *)PrtRealloc(io->watches, nWatches * sizeof(PRT_FD_WATCH));
+		PrtSetMemoryAccount(prevAccount);
+		for (PRT_UINT32 i = io->nWatches; i < nWatches; i++)
+		{
+			io->watches[i].context = NULL;
+			io->watches[i].eventIndex = 0;
+			io->watches[i].generation = 0;
+		}
+		io->nWatches = nWatches;
+	}
+
+	PRT_FD_WATCH *watch = &io->watches[fd];
+	PrtAssert(watch->context == NULL || watch->context == context, "A file descriptor is watched for one machine at a time");
+	PRT_BOOLEAN isNew = watch->context == NULL;
+	watch->eventIndex = eventIndex;
+	if (!PrtPollerWatch(io->poller, fd, interest | PRT_POLL_HUP, PrtFdWatchKey(io, fd)))
+	{
+		if (!isNew)
+		{
+			PrtClearFdWatch(io, fd);
+		}
+		PrtReleaseLock(&io->lock);
+		return PRT_FALSE;
+	}
+	if (isNew)
+	{
+		watch->context = context;
+		context->fdWatches++;
+	}
+	PrtReleaseLock(&io->lock);
+	return PRT_TRUE;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtUnwatchFd(
+	_Inout_ PRT_MACHINEINST *machine,
+	_In_ PRT_INT32 fd
+)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)machine;
+	if (context->fdWatches == 0)
+	{
+		return;
+	}
+	PRT_IO_LOOP *io = ((PRT_PROCESS_PRIV *)context->process)->io;
+	PrtAcquireLock(&io->lock);
+	if (fd >= 0 && (PRT_UINT32)fd < io->nWatches && io->watches[fd].context == context)
+	{
+		PrtClearFdWatch(io, fd);
+	}
+	PrtReleaseLock(&io->lock);
+}
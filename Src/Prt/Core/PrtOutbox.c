@@ -0,0 +1,145 @@
+#include "PrtExecution.h"
+
+//
+// While its process buffers sends, a step of a machine collects the sends its handlers make in an outbox on the stack
+// of the thread that runs it, instead of taking the lock of a receiver and scheduling it at every send. When the step
+// ends, or the outbox fills up, the sends are delivered receiver by receiver, each in the order it was made, so every
+// receiver is locked and scheduled once for all the events it gets. Under the task-neutral scheduler this also keeps
+// a receiver from running on the sending thread before the handler that sent to it has finished. Sends that cannot
+// wait, such as those of PrtTrySend, PrtBroadcast and requests, go at once, after the sends the outbox holds for the
+// same receiver, so each receiver still gets the events of a step in the order they were sent.
+//
+
+static PRT_THREAD_LOCAL PRT_OUTBOX *prtOutbox = NULL;
+
+void
+PrtSetSendBuffering(
+	_Inout_ PRT_PROCESS				*process,
+	_In_ PRT_BOOLEAN				buffer
+)
+{
+	((PRT_PROCESS_PRIV *)process)->bufferSends = buffer;
+}
+
+// Delivers the sends of outbox, those to the same receiver together, and empties it.
+static PRT_BOOLEAN PrtFlushOutbox(_Inout_ PRT_OUTBOX *outbox)
+{
+	PRT_OUTBOX_SEND *group[PRT_OUTBOX_SIZE];
+	PRT_BOOLEAN toSender = PRT_FALSE;
+	for (PRT_UINT32 i = 0; i < outbox->count; i++)
+	{
+		PRT_MACHINEINST_PRIV *receiver = outbox->sends[i].receiver;
+		if (receiver == NULL)
+		{
+			continue;
+		}
+		PRT_UINT32 count = 0;
+		for (PRT_UINT32 j = i; j < outbox->count; j++)
+		{
+			if (outbox->sends[j].receiver == receiver)
+			{
+				group[count++] = &outbox->sends[j];
+				outbox->sends[j].receiver = NULL;
+			}
+		}
+		PrtEnqueueSends(receiver, group, count);
+		toSender = toSender || receiver == outbox->sender;
+	}
+	outbox->count = 0;
+	return toSender;
+}
+
+PRT_OUTBOX *
+PrtOpenOutbox(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Out_ PRT_OUTBOX				*outbox
+)
+{
+	// a recording has each send where it was made, so a process that is recorded or replayed sends at once.
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	PRT_OUTBOX *previous = prtOutbox;
+	outbox->sender = context;
+	outbox->count = 0;
+	prtOutbox = process->bufferSends && process->recorder == NULL && process->replayer == NULL ? outbox : NULL;
+	return previous;
+}
+
+PRT_BOOLEAN
+PrtCloseOutbox(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_Inout_ PRT_OUTBOX				*outbox,
+	_In_ PRT_OUTBOX					*previous
+)
+{
+	// receivers that run inline while the sends are delivered do not add to the outbox of the step that ran this one.
+	prtOutbox = previous;
+	return outbox->count != 0 && PrtFlushOutbox(outbox);
+}
+
+void
+PrtFlushOutboxTo(
+	_Inout_ PRT_MACHINEINST_PRIV	*receiver
+)
+{
+	PRT_OUTBOX *outbox = prtOutbox;
+	if (outbox == NULL)
+	{
+		return;
+	}
+	PRT_OUTBOX_SEND *group[PRT_OUTBOX_SIZE];
+	PRT_UINT32 count = 0;
+	for (PRT_UINT32 i = 0; i < outbox->count; i++)
+	{
+		if (outbox->sends[i].receiver == receiver)
+		{
+			group[count++] = &outbox->sends[i];
+		}
+	}
+	if (count == 0)
+	{
+		return;
+	}
+
+	prtOutbox = NULL;
+	PrtEnqueueSends(receiver, group, count);
+	prtOutbox = outbox;
+	PRT_UINT32 kept = 0;
+	for (PRT_UINT32 i = 0; i < outbox->count; i++)
+	{
+		if (outbox->sends[i].receiver != receiver)
+		{
+			outbox->sends[kept++] = outbox->sends[i];
+		}
+	}
+	outbox->count = kept;
+}
+
+PRT_BOOLEAN
+PrtBufferSend(
+	_In_ PRT_MACHINESTATE			*state,
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload,
+	_In_ PRT_UINT32					timeToLive
+)
+{
+	// events the runtime sends on behalf of the host, with no sender state, are not the handler's to hold back.
+	PRT_OUTBOX *outbox = prtOutbox;
+	if (outbox == NULL || state == NULL)
+	{
+		return PRT_FALSE;
+	}
+	if (outbox->count == PRT_OUTBOX_SIZE)
+	{
+		prtOutbox = NULL;
+		PrtFlushOutbox(outbox);
+		prtOutbox = outbox;
+	}
+	PRT_OUTBOX_SEND *send = &outbox->sends[outbox->count++];
+	send->receiver = context;
+	send->eventIndex = PrtPrimGetEvent(event);
+	send->payload = payload;
+	send->timeToLive = timeToLive;
+	send->state = *state;
+	return PRT_TRUE;
+}
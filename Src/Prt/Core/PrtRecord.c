@@ -0,0 +1,788 @@
+#include "PrtExecution.h"
+
+//
+// A recording is a sequence of records, each a kind byte followed by varints:
+//
+//   CREATE   machine id, renamed name, decl index, payload    the host made a machine
+//   STEP     machine id                                       a scheduler started a step of the machine
+//   SEND     receiver id, sender id, event                    a machine sent an event
+//   INJECT   receiver id, event, payload, time to live        the host sent an event
+//   DEQUEUE  machine id, events sent to it so far             the machine looked at its queue
+//   CHOICE   machine id, value                                the machine made a nondeterministic choice or a decision
+//   TIMEOUT  machine id                                       the deadline of the receive the machine waits in passed
+//   RESUME   machine id, result                               the blocking call or the call the machine is suspended in ended
+//
+// Records are appended under one lock, into a buffer charged to the recorder's own account. Once the buffer holds the limit
+// set by PrtSetRecordingLimit it is handed to the flush function and starts over, or, without one, recording stops at the
+// last record that fit. SEND, INJECT, DEQUEUE, TIMEOUT and RESUME are appended while the machine's stateMachineLock
+// is held, so for each queue the recording has its enqueues and dequeues in the order they happened. Payloads use
+// the portable encoding of PrtSerializeValue; events and payloads sent by machines are made again by the replay.
+//
+typedef enum PRT_RECORD_KIND
+{
+	PRT_RECORD_CREATE,
+	PRT_RECORD_STEP,
+	PRT_RECORD_SEND,
+	PRT_RECORD_INJECT,
+	PRT_RECORD_DEQUEUE,
+	PRT_RECORD_CHOICE,
+	PRT_RECORD_TIMEOUT,
+	PRT_RECORD_RESUME
+} PRT_RECORD_KIND;
+
+/* Marks a step that did not look at its queue */
+#define PRT_REPLAY_NO_DEQUEUE 0xffffffff
+
+/* The most machines a recording may name; a larger machine id is taken to be corrupt */
+#define PRT_REPLAY_MAX_MACHINES (1 << 20)
+
+typedef struct PRT_RECORDER
+{
+	PRT_LOCK				lock;		/* orders the records of all threads */
+	PRT_MEMORY_ACCOUNT		memory;		/* what the buffer holds, kept apart from the memory of the process */
+	PRT_BYTE_BUFFER			buffer;
+	PRT_UINT32				recordStart;	/* where in buffer the record being appended begins */
+	PRT_UINT32				limit;		/* the bytes buffer may hold before it is flushed */
+	PRT_RECORDING_FUN		flushFun;	/* takes the buffer once it is full; NULL to stop recording there */
+	void					*flushState;
+	PRT_BOOLEAN				stopped;	/* the buffer filled with no flushFun, so later records are dropped */
+} PRT_RECORDER;
+
+/** An event the replay made before its recorded turn, waiting for the events recorded before it to reach the queue */
+typedef struct PRT_REPLAY_HELD
+{
+	PRT_UINT32				sender;
+	PRT_BOOLEAN				hasState;
+	PRT_MACHINESTATE		state;
+	PRT_VALUE				*event;
+	PRT_VALUE				*payload;
+	PRT_UINT32				timeToLive;
+	struct PRT_REPLAY_HELD	*next;
+} PRT_REPLAY_HELD;
+
+/** What the recording says happened to one machine, and how far the replay has got with it */
+typedef struct PRT_REPLAY_MACHINE
+{
+	PRT_UINT32				*sends;		/* sender id and event of each enqueue, in queue order */
+	PRT_UINT32				nSends;
+	PRT_UINT32				delivered;	/* enqueues replayed so far */
+	PRT_UINT32				*dequeues;	/* the number of enqueues the machine had seen each time it looked at its queue */
+	PRT_UINT32				nDequeues;
+	PRT_UINT32				dequeued;
+	PRT_UINT32				*steps;		/* for each step, the index in dequeues of its first look, or PRT_REPLAY_NO_DEQUEUE */
+	PRT_UINT32				nSteps;
+	PRT_UINT32				stepsDue;	/* steps the replay has reached in the recording */
+	PRT_UINT32				stepsRun;
+	PRT_UINT32				*choices;
+	PRT_UINT32				nChoices;
+	PRT_UINT32				chosen;
+	PRT_REPLAY_HELD			*held;
+} PRT_REPLAY_MACHINE;
+
+/** A record the replay acts on in recording order: a step, or something the host did */
+typedef struct PRT_REPLAY_ENTRY
+{
+	PRT_RECORD_KIND			kind;
+	PRT_UINT32				machine;
+	PRT_UINT32				arg1;		/* renamed name of CREATE, event of INJECT */
+	PRT_UINT32				arg2;		/* decl index of CREATE, time to live of INJECT */
+	PRT_VALUE				*payload;	/* of CREATE and INJECT, or the result of RESUME */
+} PRT_REPLAY_ENTRY;
+
+typedef struct PRT_REPLAYER
+{
+	PRT_REPLAY_MACHINE		*machines;	/* indexed by machine id; entry 0 is unused */
+	PRT_UINT32				nMachines;
+	PRT_REPLAY_ENTRY		*entries;
+	PRT_UINT32				nEntries;
+	PRT_BOOLEAN				diverged;	/* the replay did something the recording does not have */
+} PRT_REPLAYER;
+
+/* The machine whose step this thread is running, NULL outside of steps */
+static PRT_THREAD_LOCAL PRT_MACHINEINST_PRIV *prtSteppingMachine = NULL;
+
+PRT_MACHINEINST_PRIV *
+PrtSetSteppingMachine(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	PRT_MACHINEINST_PRIV *previous = prtSteppingMachine;
+	prtSteppingMachine = context;
+	return previous;
+}
+
+static PRT_UINT32 PrtGetMachineIndex(_In_ PRT_MACHINEINST_PRIV *context)
+{
+	return context->id->valueUnion.mid->machineId;
+}
+
+//
+// Recording
+//
+
+// Locks the recorder and starts a record; returns the account to give back to PrtEndRecord.
+static PRT_MEMORY_ACCOUNT *PrtBeginRecord(_Inout_ PRT_RECORDER *recorder, _In_ PRT_RECORD_KIND kind, _In_ PRT_UINT32 machine)
+{
+	PrtAcquireLock(&recorder->lock);
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&recorder->memory);
+	PRT_UINT8 kindByte = (PRT_UINT8)kind;
+	recorder->recordStart = recorder->buffer.size;
+	PrtWriteBytes(&recorder->buffer, &kindByte, 1);
+	PrtWriteVarUInt32(&recorder->buffer, machine);
+	return prevAccount;
+}
+
+// Finishes the record PrtBeginRecord started, flushing the buffer if it is full, and unlocks the recorder.
+static void PrtEndRecord(_Inout_ PRT_RECORDER *recorder, _In_ PRT_MEMORY_ACCOUNT *prevAccount)
+{
+	PRT_BYTE_BUFFER *buffer = &recorder->buffer;
+	if (recorder->stopped)
+	{
+		buffer->size = recorder->recordStart;
+	}
+	else if (recorder->flushFun != NULL && buffer->size >= recorder->limit)
+	{
+		recorder->flushFun(recorder->flushState, buffer->bytes, buffer->size);
+		buffer->size = 0;
+	}
+	else if (recorder->flushFun == NULL && buffer->size > recorder->limit)
+	{
+		// the record that does not fit is dropped whole, so the recording still parses and replays up to here.
+		buffer->size = recorder->recordStart;
+		recorder->stopped = PRT_TRUE;
+	}
+	PrtSetMemoryAccount(prevAccount);
+	PrtReleaseLock(&recorder->lock);
+}
+
+PRT_API void PRT_CALL_CONV
+PrtStartRecording(
+	_Inout_ PRT_PROCESS *process
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(privateProcess->numMachines == 0, "Recording must start before the process makes its first machine");
+	if (privateProcess->recorder != NULL)
+	{
+		return;
+	}
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+	PRT_RECORDER *recorder = (PRT_RECORDER *)PrtMalloc(sizeof(PRT_RECORDER));
+	PrtInitLock(&recorder->lock);
+	recorder->memory.allocator = privateProcess->allocator;
+	recorder->memory.parent = NULL;
+	recorder->memory.tracked = PRT_TRUE;
+	recorder->memory.quota = 0;
+	recorder->memory.used = 0;
+	recorder->memory.overQuota = PRT_FALSE;
+	recorder->memory.exceeded = PRT_FALSE;
+	recorder->buffer.bytes = NULL;
+	recorder->buffer.size = 0;
+	recorder->buffer.capacity = 0;
+	recorder->recordStart = 0;
+	recorder->limit = PRT_RECORDING_DEFAULT_LIMIT;
+	recorder->flushFun = NULL;
+	recorder->flushState = NULL;
+	recorder->stopped = PRT_FALSE;
+	privateProcess->recorder = recorder;
+	PrtSetMemoryAccount(prevAccount);
+}
+
+PRT_API void PRT_CALL_CONV
+PrtSetRecordingLimit(
+	_Inout_ PRT_PROCESS *process,
+	_In_ PRT_UINT32 limit,
+	_In_ PRT_RECORDING_FUN flushFun,
+	_In_ void *flushState
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)process)->recorder;
+	PrtAssert(recorder != NULL, "The process is not being recorded");
+	PrtAssert(limit > 0, "A recording needs room for at least one byte");
+	PrtAcquireLock(&recorder->lock);
+	recorder->limit = limit;
+	recorder->flushFun = flushFun;
+	recorder->flushState = flushState;
+	PrtReleaseLock(&recorder->lock);
+}
+
+PRT_API PRT_UINT8 * PRT_CALL_CONV
+PrtGetRecording(
+	_In_ PRT_PROCESS *process,
+	_Out_ PRT_UINT32 *size
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)process)->recorder;
+	*size = 0;
+	if (recorder == NULL)
+	{
+		return NULL;
+	}
+
+	// the copy belongs to the caller, and may outlive the process.
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(NULL);
+	PrtAcquireLock(&recorder->lock);
+	PRT_UINT8 *copy = (PRT_UINT8 *)PrtMalloc(recorder->buffer.size == 0 ? 1 : recorder->buffer.size);
+	memcpy(copy, recorder->buffer.bytes, recorder->buffer.size);
+	*size = recorder->buffer.size;
+	PrtReleaseLock(&recorder->lock);
+	PrtSetMemoryAccount(prevAccount);
+	return copy;
+}
+
+void
+PrtFreeRecorder(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	PRT_RECORDER *recorder = process->recorder;
+	if (recorder != NULL)
+	{
+		// the flush function gets the end of the recording, so the chunks it was given add up to all of it.
+		if (recorder->flushFun != NULL && recorder->buffer.size > 0)
+		{
+			recorder->flushFun(recorder->flushState, recorder->buffer.bytes, recorder->buffer.size);
+		}
+		PrtDestroyLock(&recorder->lock);
+		PrtFree(recorder->buffer.bytes);
+		PrtFree(recorder);
+		process->recorder = NULL;
+	}
+}
+
+void
+PrtRecordCreate(
+	_In_ PRT_MACHINEINST_PRIV		*context,
+	_In_ PRT_VALUE					*payload
+)
+{
+	// a machine made by another machine is made again when the replay runs that machine.
+	if (prtSteppingMachine != NULL)
+	{
+		return;
+	}
+
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtBeginRecord(recorder, PRT_RECORD_CREATE, PrtGetMachineIndex(context));
+	PrtWriteVarUInt32(&recorder->buffer, context->renamedName);
+	PrtWriteVarUInt32(&recorder->buffer, context->instanceOf);
+	PrtSerializeValue(&recorder->buffer, payload, PRT_SERIALIZE_PORTABLE);
+	PrtEndRecord(recorder, prevAccount);
+}
+
+void
+PrtRecordStep(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PrtEndRecord(recorder, PrtBeginRecord(recorder, PRT_RECORD_STEP, PrtGetMachineIndex(context)));
+}
+
+void
+PrtRecordSend(
+	_In_ PRT_MACHINESTATE			*state,
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload,
+	_In_ PRT_UINT32					timeToLive
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PRT_BYTE_BUFFER *buffer = &recorder->buffer;
+	PRT_MEMORY_ACCOUNT *prevAccount;
+	if (prtSteppingMachine != NULL)
+	{
+		prevAccount = PrtBeginRecord(recorder, PRT_RECORD_SEND, PrtGetMachineIndex(context));
+		PrtWriteVarUInt32(buffer, state != NULL ? (PRT_UINT32)state->machineId : 0);
+		PrtWriteVarUInt32(buffer, PrtPrimGetEvent(event));
+	}
+	else
+	{
+		prevAccount = PrtBeginRecord(recorder, PRT_RECORD_INJECT, PrtGetMachineIndex(context));
+		PrtWriteVarUInt32(buffer, PrtPrimGetEvent(event));
+		PrtSerializeValue(buffer, payload, PRT_SERIALIZE_PORTABLE);
+		PrtWriteVarUInt32(buffer, timeToLive);
+	}
+	context->enqueueCount++;
+	PrtEndRecord(recorder, prevAccount);
+}
+
+void
+PrtRecordDequeue(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtBeginRecord(recorder, PRT_RECORD_DEQUEUE, PrtGetMachineIndex(context));
+	PrtWriteVarUInt32(&recorder->buffer, context->enqueueCount);
+	PrtEndRecord(recorder, prevAccount);
+}
+
+PRT_BOOLEAN
+PrtRecordDecision(
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_BOOLEAN				decision
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)context->process;
+	if (process->replayer != NULL)
+	{
+		PRT_REPLAYER *replayer = process->replayer;
+		PRT_UINT32 id = PrtGetMachineIndex(context);
+		PRT_REPLAY_MACHINE *machine = id < replayer->nMachines ? &replayer->machines[id] : NULL;
+		if (machine != NULL && machine->chosen < machine->nChoices)
+		{
+			return machine->choices[machine->chosen++] ? PRT_TRUE : PRT_FALSE;
+		}
+		replayer->diverged = PRT_TRUE;
+	}
+	else if (process->recorder != NULL)
+	{
+		PRT_MEMORY_ACCOUNT *prevAccount = PrtBeginRecord(process->recorder, PRT_RECORD_CHOICE, PrtGetMachineIndex(context));
+		PrtWriteVarUInt32(&process->recorder->buffer, decision ? 1 : 0);
+		PrtEndRecord(process->recorder, prevAccount);
+	}
+	return decision;
+}
+
+void
+PrtRecordTimeout(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PrtEndRecord(recorder, PrtBeginRecord(recorder, PRT_RECORD_TIMEOUT, PrtGetMachineIndex(context)));
+}
+
+void
+PrtRecordResume(
+	_In_ PRT_MACHINEINST_PRIV		*context,
+	_In_ PRT_VALUE					*result
+)
+{
+	PRT_RECORDER *recorder = ((PRT_PROCESS_PRIV *)context->process)->recorder;
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtBeginRecord(recorder, PRT_RECORD_RESUME, PrtGetMachineIndex(context));
+	PrtSerializeValue(&recorder->buffer, result, PRT_SERIALIZE_PORTABLE);
+	PrtEndRecord(recorder, prevAccount);
+}
+
+PRT_VALUE * PRT_CALL_CONV PrtMkNondetBoolValue()
+{
+	PRT_MACHINEINST_PRIV *context = prtSteppingMachine;
+	if (context == NULL)
+	{
+		return PrtMkBoolValue(PrtChoose());
+	}
+	return PrtMkBoolValue(PrtRecordDecision(context, PrtChooseForMachine(context)));
+}
+
+//
+// Replay
+//
+
+static void PrtAppendUInt32(_Inout_ PRT_UINT32 **array, _Inout_ PRT_UINT32 *count, _In_ PRT_UINT32 value)
+{
+	// the capacity is the next power of two, so the array is grown when count reaches one.
+	PRT_UINT32 n = *count;
+	if (n == 0 || (n & (n - 1)) == 0)
+	{
+		*array = (PRT_UINT32 *)(n == 0 ? PrtMalloc(sizeof(PRT_UINT32)) : PrtRealloc(*array, 2 * n * sizeof(PRT_UINT32)));
+	}
+	(*array)[n] = value;
+	*count = n + 1;
+}
+
+static PRT_REPLAY_MACHINE *PrtGetReplayMachine(_Inout_ PRT_REPLAYER *replayer, _In_ PRT_UINT32 id)
+{
+	if (id >= replayer->nMachines)
+	{
+		PRT_UINT32 nMachines = replayer->nMachines == 0 ? 16 : replayer->nMachines;
+		while (nMachines <= id)
+		{
+			nMachines *= 2;
+		}
+		replayer->machines = (PRT_REPLAY_MACHINE *)(replayer->machines == NULL
+			? PrtMalloc(nMachines * sizeof(PRT_REPLAY_MACHINE))
+			: PrtRealloc(replayer->machines, nMachines * sizeof(PRT_REPLAY_MACHINE)));
+		memset(&replayer->machines[replayer->nMachines], 0, (nMachines - replayer->nMachines) * sizeof(PRT_REPLAY_MACHINE));
+		replayer->nMachines = nMachines;
+	}
+	return &replayer->machines[id];
+}
+
+static void PrtAppendReplayEntry(_Inout_ PRT_REPLAYER *replayer, _In_ PRT_REPLAY_ENTRY *entry)
+{
+	PRT_UINT32 n = replayer->nEntries;
+	if (n == 0 || (n & (n - 1)) == 0)
+	{
+		replayer->entries = (PRT_REPLAY_ENTRY *)(n == 0
+			? PrtMalloc(sizeof(PRT_REPLAY_ENTRY))
+			: PrtRealloc(replayer->entries, 2 * n * sizeof(PRT_REPLAY_ENTRY)));
+	}
+	replayer->entries[n] = *entry;
+	replayer->nEntries = n + 1;
+}
+
+// Reads the records of a recording that may be truncated or corrupt. Returns PRT_FALSE at the first record that does
+// not parse or does not fit the program, with what was read so far left in replayer.
+static PRT_BOOLEAN PrtParseRecording(
+	_Inout_ PRT_REPLAYER *replayer,
+	_In_ PRT_PROGRAMDECL *program,
+	_In_ const PRT_UINT8 *recording,
+	_In_ PRT_UINT32 size
+)
+{
+	PRT_UINT32 position = 0;
+	while (position < size)
+	{
+		PRT_REPLAY_ENTRY entry;
+		PRT_UINT8 kind = recording[position++];
+		entry.arg1 = 0;
+		entry.arg2 = 0;
+		entry.payload = NULL;
+		if (kind > PRT_RECORD_RESUME || !PrtTryReadVarUInt32(recording, size, &position, &entry.machine) ||
+			entry.machine == 0 || entry.machine >= PRT_REPLAY_MAX_MACHINES)
+		{
+			return PRT_FALSE;
+		}
+		entry.kind = (PRT_RECORD_KIND)kind;
+		PRT_REPLAY_MACHINE *machine = PrtGetReplayMachine(replayer, entry.machine);
+		PRT_UINT32 value;
+		switch (entry.kind)
+		{
+		case PRT_RECORD_CREATE:
+			if (!PrtTryReadVarUInt32(recording, size, &position, &entry.arg1) ||
+				!PrtTryReadVarUInt32(recording, size, &position, &entry.arg2) || entry.arg2 >= program->nMachines ||
+				(entry.payload = PrtReadProgramValue(recording, size, &position, program)) == NULL)
+			{
+				return PRT_FALSE;
+			}
+			PrtAppendReplayEntry(replayer, &entry);
+			break;
+		case PRT_RECORD_STEP:
+			PrtAppendUInt32(&machine->steps, &machine->nSteps, PRT_REPLAY_NO_DEQUEUE);
+			PrtAppendReplayEntry(replayer, &entry);
+			break;
+		case PRT_RECORD_SEND:
+			if (!PrtTryReadVarUInt32(recording, size, &position, &value) || value >= PRT_REPLAY_MAX_MACHINES)
+			{
+				return PRT_FALSE;
+			}
+			PrtAppendUInt32(&machine->sends, &machine->nSends, value);
+			if (!PrtTryReadVarUInt32(recording, size, &position, &value) || value >= program->nEvents)
+			{
+				return PRT_FALSE;
+			}
+			PrtAppendUInt32(&machine->sends, &machine->nSends, value);
+			break;
+		case PRT_RECORD_INJECT:
+			if (!PrtTryReadVarUInt32(recording, size, &position, &entry.arg1) || entry.arg1 >= program->nEvents)
+			{
+				return PRT_FALSE;
+			}
+			entry.payload = PrtReadProgramValue(recording, size, &position, program);
+			if (entry.payload == NULL || !PrtInhabitsType(entry.payload, program->events[entry.arg1]->type) ||
+				!PrtTryReadVarUInt32(recording, size, &position, &entry.arg2))
+			{
+				if (entry.payload != NULL)
+				{
+					PrtFreeValue(entry.payload);
+				}
+				return PRT_FALSE;
+			}
+			PrtAppendUInt32(&machine->sends, &machine->nSends, 0);
+			PrtAppendUInt32(&machine->sends, &machine->nSends, entry.arg1);
+			PrtAppendReplayEntry(replayer, &entry);
+			break;
+		case PRT_RECORD_DEQUEUE:
+			if (!PrtTryReadVarUInt32(recording, size, &position, &value))
+			{
+				return PRT_FALSE;
+			}
+			if (machine->nSteps > 0 && machine->steps[machine->nSteps - 1] == PRT_REPLAY_NO_DEQUEUE)
+			{
+				machine->steps[machine->nSteps - 1] = machine->nDequeues;
+			}
+			PrtAppendUInt32(&machine->dequeues, &machine->nDequeues, value);
+			break;
+		case PRT_RECORD_CHOICE:
+			if (!PrtTryReadVarUInt32(recording, size, &position, &value) || value > 1)
+			{
+				return PRT_FALSE;
+			}
+			PrtAppendUInt32(&machine->choices, &machine->nChoices, value);
+			break;
+		case PRT_RECORD_TIMEOUT:
+			PrtAppendReplayEntry(replayer, &entry);
+			break;
+		case PRT_RECORD_RESUME:
+			if ((entry.payload = PrtReadProgramValue(recording, size, &position, program)) == NULL)
+			{
+				return PRT_FALSE;
+			}
+			PrtAppendReplayEntry(replayer, &entry);
+			break;
+		}
+	}
+	return PRT_TRUE;
+}
+
+// The enqueue of event by sender is next in the queue of machine, and every dequeue recorded before it has been replayed.
+static PRT_BOOLEAN PrtIsSendDue(_In_ PRT_REPLAY_MACHINE *machine, _In_ PRT_UINT32 sender, _In_ PRT_UINT32 event)
+{
+	PRT_UINT32 next = machine->delivered;
+	return 2 * next < machine->nSends && machine->sends[2 * next] == sender && machine->sends[2 * next + 1] == event &&
+		(machine->dequeued == machine->nDequeues || machine->dequeues[machine->dequeued] > next);
+}
+
+PRT_BOOLEAN
+PrtReplaySend(
+	_In_ PRT_MACHINESTATE			*state,
+	_Inout_ PRT_MACHINEINST_PRIV	*context,
+	_In_ PRT_VALUE					*event,
+	_In_ PRT_VALUE					*payload,
+	_In_ PRT_UINT32					timeToLive
+)
+{
+	PRT_REPLAYER *replayer = ((PRT_PROCESS_PRIV *)context->process)->replayer;
+	PRT_UINT32 id = PrtGetMachineIndex(context);
+	PRT_UINT32 sender = state != NULL ? (PRT_UINT32)state->machineId : 0;
+	if (id >= replayer->nMachines)
+	{
+		replayer->diverged = PRT_TRUE;
+		return PRT_TRUE;
+	}
+
+	PRT_REPLAY_MACHINE *machine = &replayer->machines[id];
+	if (PrtIsSendDue(machine, sender, PrtPrimGetEvent(event)))
+	{
+		machine->delivered++;
+		return PRT_TRUE;
+	}
+
+	PRT_REPLAY_HELD *held = (PRT_REPLAY_HELD *)PrtMalloc(sizeof(PRT_REPLAY_HELD));
+	held->sender = sender;
+	held->hasState = state != NULL;
+	if (state != NULL)
+	{
+		held->state = *state;
+	}
+	held->event = PrtCloneValue(event);
+	held->payload = payload;
+	held->timeToLive = timeToLive;
+	held->next = NULL;
+	PRT_REPLAY_HELD **tail = &machine->held;
+	while (*tail != NULL)
+	{
+		tail = &(*tail)->next;
+	}
+	*tail = held;
+	return PRT_FALSE;
+}
+
+void
+PrtReplayDequeue(
+	_In_ PRT_MACHINEINST_PRIV		*context
+)
+{
+	PRT_REPLAYER *replayer = ((PRT_PROCESS_PRIV *)context->process)->replayer;
+	PRT_UINT32 id = PrtGetMachineIndex(context);
+	PRT_REPLAY_MACHINE *machine = id < replayer->nMachines ? &replayer->machines[id] : NULL;
+	if (machine == NULL || machine->dequeued == machine->nDequeues || machine->dequeues[machine->dequeued] != machine->delivered)
+	{
+		replayer->diverged = PRT_TRUE;
+	}
+	if (machine != NULL && machine->dequeued < machine->nDequeues)
+	{
+		machine->dequeued++;
+	}
+}
+
+static PRT_MACHINEINST_PRIV *PrtGetReplayedMachine(_In_ PRT_PROCESS_PRIV *process, _In_ PRT_UINT32 id)
+{
+	return id >= 1 && id <= process->numMachines ? (PRT_MACHINEINST_PRIV *)process->machines[id - 1] : NULL;
+}
+
+// Sends the held events of a machine whose turn has come. Returns whether any was sent.
+static PRT_BOOLEAN PrtReplayHeldSends(_Inout_ PRT_PROCESS_PRIV *process, _Inout_ PRT_REPLAY_MACHINE *machine, _In_ PRT_UINT32 id)
+{
+	PRT_BOOLEAN progress = PRT_FALSE;
+	PRT_REPLAY_HELD **link = &machine->held;
+	while (*link != NULL)
+	{
+		PRT_REPLAY_HELD *held = *link;
+		if (!PrtIsSendDue(machine, held->sender, PrtPrimGetEvent(held->event)))
+		{
+			link = &held->next;
+			continue;
+		}
+		*link = held->next;
+		PrtSendPrivateWithTimeToLive(held->hasState ? &held->state : NULL, PrtGetReplayedMachine(process, id), held->event, held->payload, held->timeToLive);
+		PrtFreeValue(held->event);
+		PrtFree(held);
+		progress = PRT_TRUE;
+
+		// an earlier held event may be next now.
+		link = &machine->held;
+	}
+	return progress;
+}
+
+// Runs every step whose turn has come, and sends every held event whose turn has come, until neither is left.
+static void PrtReplayReadyWork(_Inout_ PRT_PROCESS_PRIV *process, _Inout_ PRT_REPLAYER *replayer)
+{
+	PRT_BOOLEAN progress;
+	do {
+		progress = PRT_FALSE;
+		for (PRT_UINT32 id = 1; id < replayer->nMachines; id++)
+		{
+			PRT_REPLAY_MACHINE *machine = &replayer->machines[id];
+			PRT_MACHINEINST_PRIV *context = PrtGetReplayedMachine(process, id);
+			if (context == NULL)
+			{
+				continue;
+			}
+			if (machine->held != NULL && PrtReplayHeldSends(process, machine, id))
+			{
+				progress = PRT_TRUE;
+			}
+
+			// a step that looks at the queue waits until the queue has the events it had when it was recorded.
+			while (machine->stepsRun < machine->stepsDue)
+			{
+				PRT_UINT32 firstDequeue = machine->steps[machine->stepsRun];
+				if (firstDequeue != PRT_REPLAY_NO_DEQUEUE && machine->delivered < machine->dequeues[firstDequeue])
+				{
+					break;
+				}
+				machine->stepsRun++;
+				PrtStepMachine(context);
+				progress = PRT_TRUE;
+			}
+		}
+	} while (progress);
+}
+
+static void PrtFreeReplayer(_Inout_ PRT_REPLAYER *replayer)
+{
+	for (PRT_UINT32 id = 0; id < replayer->nMachines; id++)
+	{
+		PRT_REPLAY_MACHINE *machine = &replayer->machines[id];
+		while (machine->held != NULL)
+		{
+			PRT_REPLAY_HELD *held = machine->held;
+			machine->held = held->next;
+			PrtFreeValue(held->event);
+			PrtFreeValue(held->payload);
+			PrtFree(held);
+		}
+		PrtFree(machine->sends);
+		PrtFree(machine->dequeues);
+		PrtFree(machine->steps);
+		PrtFree(machine->choices);
+	}
+	for (PRT_UINT32 i = 0; i < replayer->nEntries; i++)
+	{
+		if (replayer->entries[i].payload != NULL)
+		{
+			PrtFreeValue(replayer->entries[i].payload);
+		}
+	}
+	PrtFree(replayer->machines);
+	PrtFree(replayer->entries);
+	PrtFree(replayer);
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtReplayProcess(
+	_Inout_ PRT_PROCESS *process,
+	_In_ const PRT_UINT8 *recording,
+	_In_ PRT_UINT32 size
+)
+{
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtAssert(privateProcess->numMachines == 0 && privateProcess->recorder == NULL, "A recording is replayed into a fresh process");
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&privateProcess->memory);
+	PRT_REPLAYER *replayer = (PRT_REPLAYER *)PrtCalloc(1, sizeof(PRT_REPLAYER));
+	if (!PrtParseRecording(replayer, privateProcess->program, recording, size))
+	{
+		PrtFreeReplayer(replayer);
+		PrtSetMemoryAccount(prevAccount);
+		return PRT_FALSE;
+	}
+	privateProcess->replayer = replayer;
+
+	for (PRT_UINT32 i = 0; i < replayer->nEntries; i++)
+	{
+		PRT_REPLAY_ENTRY *entry = &replayer->entries[i];
+		switch (entry->kind)
+		{
+		case PRT_RECORD_CREATE:
+		{
+			PRT_MACHINEINST_PRIV *context = PrtMkMachinePrivate(privateProcess, entry->arg1, entry->arg2, entry->payload);
+			replayer->diverged |= PrtGetMachineIndex(context) != entry->machine;
+			break;
+		}
+		case PRT_RECORD_INJECT:
+		{
+			PRT_MACHINEINST_PRIV *context = PrtGetReplayedMachine(privateProcess, entry->machine);
+			if (context == NULL)
+			{
+				replayer->diverged = PRT_TRUE;
+				break;
+			}
+			PRT_VALUE *event = PrtMkEventValue(entry->arg1);
+			PrtSendPrivateWithTimeToLive(NULL, context, event, entry->payload, entry->arg2);
+			PrtFreeValue(event);
+			entry->payload = NULL;
+			break;
+		}
+		case PRT_RECORD_TIMEOUT:
+		{
+			// the machine is unblocked as the timer did it, and runs when its next recorded step comes.
+			PRT_MACHINEINST_PRIV *context = PrtGetReplayedMachine(privateProcess, entry->machine);
+			if (context == NULL || context->receive == NULL || !context->receiveHasDeadline)
+			{
+				replayer->diverged = PRT_TRUE;
+				break;
+			}
+			PrtReceiveTimerFired(context, context->receiveTimer.generation);
+			break;
+		}
+		case PRT_RECORD_RESUME:
+		{
+			// the machine gets the result the helper returned, or the reply it got, when this was recorded.
+			PRT_MACHINEINST_PRIV *context = PrtGetReplayedMachine(privateProcess, entry->machine);
+			if (context == NULL)
+			{
+				replayer->diverged = PRT_TRUE;
+				break;
+			}
+			replayer->diverged |= context->call != NULL ? !PrtReplayCallResult(context, entry->payload) : !PrtReplayResume(context, entry->payload);
+			entry->payload = NULL;
+			break;
+		}
+		default:
+			replayer->machines[entry->machine].stepsDue++;
+			break;
+		}
+		PrtReplayReadyWork(privateProcess, replayer);
+	}
+
+	// every recorded step must have run, and every event must have reached its queue.
+	PRT_BOOLEAN reproduced = !replayer->diverged;
+	for (PRT_UINT32 id = 0; id < replayer->nMachines; id++)
+	{
+		PRT_REPLAY_MACHINE *machine = &replayer->machines[id];
+		reproduced = reproduced && machine->stepsRun == machine->nSteps && 2 * machine->delivered == machine->nSends &&
+			machine->dequeued == machine->nDequeues && machine->chosen == machine->nChoices && machine->held == NULL;
+	}
+	privateProcess->replayer = NULL;
+	PrtFreeReplayer(replayer);
+	PrtSetMemoryAccount(prevAccount);
+	return reproduced;
+}
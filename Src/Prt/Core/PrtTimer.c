@@ -0,0 +1,484 @@
+#include "PrtExecution.h"
+
+//
+// The timer wheel of a process hashes each armed timer into a slot by its deadline, so arming and cancelling link and
+// unlink a node. Timers due within a turn of the millisecond slots go in the slot of their deadline; those further
+// away go in a slot of a coarser level, one per 256 milliseconds, 16 seconds or 17 minutes, and each time the cursor
+// comes to a coarser slot its timers are spread over the finer levels. Timers further away than the top level reaches
+// wait in its last slot and are spread again. Timers fire in batches, outside the lock of the wheel, so that their
+// owners can take their own locks.
+//
+#define PRT_TIMER_WHEEL_MASK (PRT_TIMER_WHEEL_SLOTS - 1)
+#define PRT_TIMER_LEVEL_MASK (PRT_TIMER_LEVEL_SLOTS - 1)
+#define PRT_TIMER_WHEEL_BITS 8
+#define PRT_TIMER_LEVEL_BITS 6
+
+/* Milliseconds ahead of the first slot still to be visited that the top level reaches */
+#define PRT_TIMER_REACH ((PRT_UINT64)1 << (PRT_TIMER_WHEEL_BITS + PRT_TIMER_LEVELS * PRT_TIMER_LEVEL_BITS))
+
+/* Timers collected under the lock of the wheel before it is released to fire them */
+#define PRT_TIMER_BATCH 32
+
+typedef struct PRT_TIMER_FIRING
+{
+	PRT_TIMER_FUN	fire;
+	void			*owner;
+	PRT_UINT32		generation;
+} PRT_TIMER_FIRING;
+
+void
+PrtInitTimerWheel(
+	_Out_ PRT_TIMER_WHEEL			*wheel,
+	_In_ PRT_UINT64					now,
+	_In_ PRT_TIMER_WAKE_FUN			wake,
+	_In_ void						*wakeState
+)
+{
+	PrtInitLock(&wheel->lock);
+	for (PRT_UINT32 i = 0; i < PRT_TIMER_WHEEL_SLOTS; i++)
+	{
+		wheel->slots[i] = NULL;
+	}
+	for (PRT_UINT32 level = 0; level < PRT_TIMER_LEVELS; level++)
+	{
+		for (PRT_UINT32 i = 0; i < PRT_TIMER_LEVEL_SLOTS; i++)
+		{
+			wheel->levels[level][i] = NULL;
+		}
+	}
+	wheel->cursor = now;
+	wheel->armed = 0;
+	wheel->near = 0;
+	wheel->wakeAt = PRT_TIMER_WAKE_NEVER;
+	wheel->wake = wake;
+	wheel->wakeState = wakeState;
+}
+
+void
+PrtDestroyTimerWheel(
+	_Inout_ PRT_TIMER_WHEEL			*wheel
+)
+{
+	PrtAssert(wheel->armed == 0, "Timers must be cancelled before their wheel is destroyed");
+	PrtDestroyLock(&wheel->lock);
+}
+
+void
+PrtInitTimer(
+	_Out_ PRT_TIMER					*timer,
+	_In_ PRT_TIMER_FUN				fire,
+	_In_ void						*owner
+)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->slot = NULL;
+	timer->deadline = 0;
+	timer->generation = 0;
+	timer->armed = PRT_FALSE;
+	timer->fire = fire;
+	timer->owner = owner;
+}
+
+// Links timer into the slot for its deadline, as seen from first, the earliest time whose slot is still to be visited.
+static void PrtLinkTimer(_Inout_ PRT_TIMER_WHEEL *wheel, _Inout_ PRT_TIMER *timer, _In_ PRT_UINT64 first)
+{
+	PRT_UINT64 due = timer->deadline > first ? timer->deadline : first;
+	PRT_UINT64 ahead = due - first;
+	PRT_TIMER **slot;
+	if (ahead < PRT_TIMER_WHEEL_SLOTS)
+	{
+		slot = &wheel->slots[due & PRT_TIMER_WHEEL_MASK];
+		wheel->near++;
+	}
+	else
+	{
+		if (ahead >= PRT_TIMER_REACH)
+		{
+			due = first + PRT_TIMER_REACH - 1;
+			ahead = PRT_TIMER_REACH - 1;
+		}
+		PRT_UINT32 level = 0;
+		PRT_UINT32 shift = PRT_TIMER_WHEEL_BITS;
+		while (ahead >= (PRT_UINT64)1 << (shift + PRT_TIMER_LEVEL_BITS))
+		{
+			level++;
+			shift += PRT_TIMER_LEVEL_BITS;
+		}
+		slot = &wheel->levels[level][(due >> shift) & PRT_TIMER_LEVEL_MASK];
+	}
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (timer->next != NULL)
+	{
+		timer->next->prev = timer;
+	}
+	*slot = timer;
+}
+
+static void PrtUnlinkTimer(_Inout_ PRT_TIMER_WHEEL *wheel, _Inout_ PRT_TIMER *timer)
+{
+	if (timer->prev != NULL)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		*timer->slot = timer->next;
+	}
+	if (timer->next != NULL)
+	{
+		timer->next->prev = timer->prev;
+	}
+	if (timer->slot >= &wheel->slots[0] && timer->slot < &wheel->slots[PRT_TIMER_WHEEL_SLOTS])
+	{
+		wheel->near--;
+	}
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->slot = NULL;
+}
+
+// Spreads the coarser slots the cursor comes to at time over the finer levels; time is at the start of a turn of the
+// millisecond slots, and its slot is still to be visited.
+static void PrtCascadeTimers(_Inout_ PRT_TIMER_WHEEL *wheel, _In_ PRT_UINT64 time)
+{
+	PRT_UINT32 shift = PRT_TIMER_WHEEL_BITS;
+	for (PRT_UINT32 level = 0; level < PRT_TIMER_LEVELS; level++)
+	{
+		PRT_UINT32 index = (PRT_UINT32)((time >> shift) & PRT_TIMER_LEVEL_MASK);
+		PRT_TIMER *timer = wheel->levels[level][index];
+		wheel->levels[level][index] = NULL;
+		while (timer != NULL)
+		{
+			PRT_TIMER *next = timer->next;
+			PrtLinkTimer(wheel, timer, time);
+			timer = next;
+		}
+
+		// a level goes on to the one above only at the start of its own turn.
+		if (index != 0)
+		{
+			break;
+		}
+		shift += PRT_TIMER_LEVEL_BITS;
+	}
+}
+
+PRT_UINT32
+PrtArmTimer(
+	_Inout_ PRT_TIMER_WHEEL			*wheel,
+	_Inout_ PRT_TIMER				*timer,
+	_In_ PRT_UINT64					deadline
+)
+{
+	PrtAcquireLock(&wheel->lock);
+	if (timer->armed)
+	{
+		PrtUnlinkTimer(wheel, timer);
+		wheel->armed--;
+	}
+
+	// a deadline the cursor has passed goes in the next slot the cursor visits.
+	timer->deadline = deadline;
+	PrtLinkTimer(wheel, timer, wheel->cursor + 1);
+	timer->generation++;
+	timer->armed = PRT_TRUE;
+	wheel->armed++;
+	PRT_UINT32 generation = timer->generation;
+	if (deadline < wheel->wakeAt && wheel->wake != NULL)
+	{
+		wheel->wakeAt = deadline;
+		wheel->wake(wheel->wakeState);
+	}
+	PrtReleaseLock(&wheel->lock);
+	return generation;
+}
+
+PRT_BOOLEAN
+PrtCancelTimer(
+	_Inout_ PRT_TIMER_WHEEL			*wheel,
+	_Inout_ PRT_TIMER				*timer
+)
+{
+	PrtAcquireLock(&wheel->lock);
+	PRT_BOOLEAN armed = timer->armed;
+	if (armed)
+	{
+		PrtUnlinkTimer(wheel, timer);
+		timer->armed = PRT_FALSE;
+		wheel->armed--;
+	}
+	timer->generation++;
+	PrtReleaseLock(&wheel->lock);
+	return armed;
+}
+
+PRT_UINT32
+PrtAdvanceTimerWheel(
+	_Inout_ PRT_TIMER_WHEEL			*wheel,
+	_In_ PRT_UINT64					now
+)
+{
+	PRT_UINT32 fired = 0;
+	PRT_TIMER_FIRING batch[PRT_TIMER_BATCH];
+	PRT_UINT32 count;
+	do
+	{
+		count = 0;
+		PrtAcquireLock(&wheel->lock);
+		while (wheel->armed > 0 && wheel->cursor < now && count < PRT_TIMER_BATCH)
+		{
+			// with the millisecond slots empty the cursor skips to the end of their turn, where it spreads the next coarser slot.
+			if (wheel->near == 0)
+			{
+				PRT_UINT64 turnEnd = wheel->cursor | PRT_TIMER_WHEEL_MASK;
+				if (turnEnd > wheel->cursor)
+				{
+					wheel->cursor = turnEnd < now ? turnEnd : now;
+					continue;
+				}
+			}
+
+			PRT_UINT64 time = wheel->cursor + 1;
+			if ((time & PRT_TIMER_WHEEL_MASK) == 0)
+			{
+				PrtCascadeTimers(wheel, time);
+			}
+
+			// every timer in the slot of time is due at time; a slot is passed only once they are all out, so a full
+			// batch is picked up again here without spreading the coarser slots twice.
+			PRT_TIMER **slot = &wheel->slots[time & PRT_TIMER_WHEEL_MASK];
+			while (*slot != NULL && count < PRT_TIMER_BATCH)
+			{
+				PRT_TIMER *timer = *slot;
+				batch[count].fire = timer->fire;
+				batch[count].owner = timer->owner;
+				batch[count].generation = timer->generation;
+				count++;
+				PrtUnlinkTimer(wheel, timer);
+				timer->armed = PRT_FALSE;
+				wheel->armed--;
+			}
+			if (*slot == NULL)
+			{
+				wheel->cursor = time;
+			}
+		}
+		if (wheel->armed == 0 && wheel->cursor < now)
+		{
+			wheel->cursor = now;
+		}
+		PrtReleaseLock(&wheel->lock);
+
+		for (PRT_UINT32 i = 0; i < count; i++)
+		{
+			batch[i].fire(batch[i].owner, batch[i].generation);
+		}
+		fired += count;
+	} while (count == PRT_TIMER_BATCH);
+	return fired;
+}
+
+PRT_UINT32
+PrtGetTimerDelay(
+	_Inout_ PRT_TIMER_WHEEL			*wheel,
+	_In_ PRT_UINT64					now
+)
+{
+	PRT_UINT32 delay = PRT_TIMER_NONE;
+	PrtAcquireLock(&wheel->lock);
+	if (wheel->armed > 0)
+	{
+		// the timers of the coarser levels are due no sooner than the end of the turn of the millisecond slots.
+		PRT_UINT64 due = (wheel->cursor | PRT_TIMER_WHEEL_MASK) + 1;
+		for (PRT_UINT32 i = 1; wheel->near > 0 && i <= PRT_TIMER_WHEEL_SLOTS; i++)
+		{
+			if (wheel->slots[(wheel->cursor + i) & PRT_TIMER_WHEEL_MASK] != NULL)
+			{
+				due = wheel->cursor + i;
+				break;
+			}
+		}
+		delay = due > now ? (PRT_UINT32)(due - now) : 0;
+	}
+	wheel->wakeAt = delay == PRT_TIMER_NONE ? PRT_TIMER_WAKE_NEVER : now + delay;
+	PrtReleaseLock(&wheel->lock);
+	return delay;
+}
+
+//
+// An event timer is a timer of the wheel whose firing sends an event to a machine. The wheel holds a reference to it
+// from the time it is armed until it is cancelled or has fired, so a timer the host frees while it is being fired
+// is freed by the firing thread. A payload is freed with no lock held and may be a foreign value that frees the timer
+// it was started with, so nothing touches the timer after dropping its payload but a free that still holds a reference.
+//
+
+static void PrtReleaseEventTimer(_Inout_ PRT_EVENT_TIMER *timer)
+{
+	PrtAcquireLock(&timer->lock);
+	PRT_BOOLEAN last = --timer->refs == 0;
+	PrtReleaseLock(&timer->lock);
+	if (last)
+	{
+		PrtDestroyLock(&timer->lock);
+		PrtFree(timer);
+	}
+}
+
+static void PrtEventTimerFired(_Inout_ void *owner, _In_ PRT_UINT32 generation)
+{
+	PRT_EVENT_TIMER *timer = (PRT_EVENT_TIMER *)owner;
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)timer->machine;
+	PRT_UINT32 eventIndex = timer->eventIndex;
+	PrtAcquireLock(&timer->lock);
+	PRT_VALUE *payload = NULL;
+	if (timer->timer.generation == generation)
+	{
+		payload = timer->payload;
+		timer->payload = NULL;
+	}
+	PrtReleaseLock(&timer->lock);
+
+	if (payload != NULL)
+	{
+		PRT_VALUE *event = PrtMkEventValue(eventIndex);
+		PrtSendPrivate(NULL, context, event, payload);
+		PrtFreeValue(event);
+	}
+	PrtReleaseEventTimer(timer);
+}
+
+PRT_API PRT_EVENT_TIMER * PRT_CALL_CONV
+PrtMkEventTimer(
+	_Inout_ PRT_MACHINEINST			*machine,
+	_In_ PRT_UINT32					eventIndex
+)
+{
+	PRT_PROCESS_PRIV *process = (PRT_PROCESS_PRIV *)machine->process;
+	PrtAssert(eventIndex < process->program->nEvents, "Invalid event index");
+	PRT_MEMORY_ACCOUNT *prevAccount = PrtSetMemoryAccount(&process->memory);
+	PRT_EVENT_TIMER *timer = (PRT_EVENT_TIMER *)PrtMalloc(sizeof(PRT_EVENT_TIMER));
+	PrtSetMemoryAccount(prevAccount);
+	PrtInitLock(&timer->lock);
+	PrtInitTimer(&timer->timer, &PrtEventTimerFired, timer);
+	timer->process = process;
+	timer->machine = machine;
+	timer->eventIndex = eventIndex;
+	timer->payload = NULL;
+	timer->refs = 1;
+	timer->freed = PRT_FALSE;
+	timer->prev = NULL;
+
+	PrtAcquireLock(&process->processLock);
+	timer->next = process->eventTimers;
+	if (timer->next != NULL)
+	{
+		timer->next->prev = timer;
+	}
+	process->eventTimers = timer;
+	PrtReleaseLock(&process->processLock);
+	return timer;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtStartEventTimer(
+	_Inout_ PRT_EVENT_TIMER			*timer,
+	_In_ PRT_UINT32					delay,
+	_In_ PRT_VALUE					*payload
+)
+{
+	PRT_PROCESS_PRIV *process = timer->process;
+	PRT_UINT64 deadline = PrtGetProcessTime((PRT_PROCESS *)process) + delay;
+	if (payload == NULL)
+	{
+		payload = PrtMkNullValue();
+	}
+
+	PrtAcquireLock(&timer->lock);
+	PRT_VALUE *dropped = timer->payload;
+	timer->payload = payload;
+	// a timer taken out of the wheel to fire is still referenced by its firing, which finds it stale.
+	if (!PrtCancelTimer(&process->timers, &timer->timer))
+	{
+		timer->refs++;
+	}
+	PrtArmTimer(&process->timers, &timer->timer, deadline);
+	PrtReleaseLock(&timer->lock);
+
+	// freed outside the lock: a foreign payload may free the timer it refers to.
+	if (dropped != NULL)
+	{
+		PrtFreeValue(dropped);
+	}
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtCancelEventTimer(
+	_Inout_ PRT_EVENT_TIMER			*timer
+)
+{
+	PrtAcquireLock(&timer->lock);
+	PRT_VALUE *dropped = timer->payload;
+	timer->payload = NULL;
+	if (PrtCancelTimer(&timer->process->timers, &timer->timer))
+	{
+		timer->refs--;
+	}
+	PrtReleaseLock(&timer->lock);
+
+	if (dropped == NULL)
+	{
+		return PRT_FALSE;
+	}
+	PrtFreeValue(dropped);
+	return PRT_TRUE;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtFreeEventTimer(
+	_Inout_ PRT_EVENT_TIMER			*timer
+)
+{
+	PRT_PROCESS_PRIV *process = timer->process;
+	PrtAcquireLock(&process->processLock);
+
+	// freeing the payload below may free the timer again, which then finds it already unlinked and leaves it to this call.
+	if (timer->freed)
+	{
+		PrtReleaseLock(&process->processLock);
+		return;
+	}
+	timer->freed = PRT_TRUE;
+	if (timer->prev != NULL)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		process->eventTimers = timer->next;
+	}
+	if (timer->next != NULL)
+	{
+		timer->next->prev = timer->prev;
+	}
+	timer->next = NULL;
+	timer->prev = NULL;
+	PrtReleaseLock(&process->processLock);
+
+	// the reference of the host keeps the timer alive through the cancel, whatever its payload does.
+	PrtCancelEventTimer(timer);
+	PrtReleaseEventTimer(timer);
+}
+
+void
+PrtFreeEventTimers(
+	_Inout_ PRT_PROCESS_PRIV		*process
+)
+{
+	while (process->eventTimers != NULL)
+	{
+		PrtFreeEventTimer(process->eventTimers);
+	}
+}
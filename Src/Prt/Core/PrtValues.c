@@ -1658,7 +1658,401 @@ PRT_BOOLEAN PRT_CALL_CONV PrtIsValidValue(_In_ PRT_VALUE *value)
 	}
 }
 
-PRT_VALUE * PRT_CALL_CONV PrtMkNondetBoolValue()
+void PRT_CALL_CONV PrtWriteBytes(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ const void *bytes, _In_ PRT_UINT32 count)
 {
-	return PrtMkBoolValue(PrtChoose());
-}
\ No newline at end of file
+	if (count == 0)
+	{
+		return;
+	}
+	if (buffer->size + count > buffer->capacity)
+	{
+		PRT_UINT32 capacity = buffer->capacity == 0 ? 64 : buffer->capacity;
+		while (capacity < buffer->size + count)
+		{
+			capacity *= 2;
+		}
+		buffer->bytes = buffer->bytes == NULL ? (PRT_UINT8 *)PrtMalloc(capacity) : (PRT_UINT8 *)PrtRealloc(buffer->bytes, capacity);
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->bytes + buffer->size, bytes, count);
+	buffer->size += count;
+}
+
+void PRT_CALL_CONV PrtReadBytes(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position, _Out_ void *dest, _In_ PRT_UINT32 count)
+{
+	memcpy(dest, bytes + *position, count);
+	*position += count;
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtTryReadBytes(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _Out_ void *dest, _In_ PRT_UINT32 count)
+{
+	if (*position > size || count > size - *position)
+	{
+		return PRT_FALSE;
+	}
+	PrtReadBytes(bytes, position, dest, count);
+	return PRT_TRUE;
+}
+
+void PRT_CALL_CONV PrtWriteVarUInt32(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_UINT32 value)
+{
+	PRT_UINT8 bytes[5];
+	PRT_UINT32 count = 0;
+	while (value >= 0x80)
+	{
+		bytes[count++] = (PRT_UINT8)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[count++] = (PRT_UINT8)value;
+	PrtWriteBytes(buffer, bytes, count);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtReadVarUInt32(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position)
+{
+	PRT_UINT32 value = 0;
+	PRT_UINT32 shift = 0;
+	PRT_UINT8 next;
+	do
+	{
+		next = bytes[(*position)++];
+		value |= (PRT_UINT32)(next & 0x7F) << shift;
+		shift += 7;
+	} while (next & 0x80);
+	return value;
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtTryReadVarUInt32(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _Out_ PRT_UINT32 *value)
+{
+	// a number takes at most five bytes, the last with no more than the top four bits.
+	*value = 0;
+	for (PRT_UINT32 shift = 0; shift < 35; shift += 7)
+	{
+		if (*position >= size)
+		{
+			return PRT_FALSE;
+		}
+		PRT_UINT8 next = bytes[(*position)++];
+		if (shift == 28 && next > 0x0F)
+		{
+			return PRT_FALSE;
+		}
+		*value |= (PRT_UINT32)(next & 0x7F) << shift;
+		if (!(next & 0x80))
+		{
+			return PRT_TRUE;
+		}
+	}
+	return PRT_FALSE;
+}
+
+void PRT_CALL_CONV PrtSerializeValue(_Inout_ PRT_BYTE_BUFFER *buffer, _In_ PRT_VALUE *value, _In_ PRT_SERIALIZE_MODE mode)
+{
+	PrtAssert(PrtIsValidValue(value), "Invalid value expression.");
+
+	PRT_UINT8 kind = (PRT_UINT8)value->discriminator;
+	PrtWriteBytes(buffer, &kind, 1);
+	switch (value->discriminator)
+	{
+	case PRT_VALUE_KIND_NULL:
+		break;
+	case PRT_VALUE_KIND_BOOL:
+	{
+		PRT_UINT8 bl = (PRT_UINT8)value->valueUnion.bl;
+		PrtWriteBytes(buffer, &bl, 1);
+		break;
+	}
+	case PRT_VALUE_KIND_INT:
+	{
+		// zig-zag encoding keeps small negative numbers small.
+		PRT_INT32 nt = value->valueUnion.nt;
+		PrtWriteVarUInt32(buffer, ((PRT_UINT32)nt << 1) ^ (PRT_UINT32)(nt >> 31));
+		break;
+	}
+	case PRT_VALUE_KIND_EVENT:
+		PrtWriteVarUInt32(buffer, value->valueUnion.ev);
+		break;
+	case PRT_VALUE_KIND_MID:
+		PrtWriteBytes(buffer, &value->valueUnion.mid->processId, sizeof(PRT_GUID));
+		PrtWriteVarUInt32(buffer, value->valueUnion.mid->machineId);
+		break;
+	case PRT_VALUE_KIND_FORGN:
+	{
+		PRT_FORGNVALUE *fVal = value->valueUnion.frgn;
+		PrtWriteVarUInt32(buffer, fVal->typeTag);
+		if (mode == PRT_SERIALIZE_PORTABLE)
+		{
+			// the length goes first, so that a reader can tell an encoding that does not fit before it calls deserializeFun.
+			PrtAssert(prtForeignTypeDecls[fVal->typeTag].serializeFun != NULL, "Foreign type cannot be serialized");
+			PRT_UINT32 start = buffer->size;
+			PRT_UINT32 length = 0;
+			PrtWriteBytes(buffer, &length, sizeof(PRT_UINT32));
+			prtForeignTypeDecls[fVal->typeTag].serializeFun(fVal->value, buffer);
+			length = buffer->size - start - sizeof(PRT_UINT32);
+			memcpy(buffer->bytes + start, &length, sizeof(PRT_UINT32));
+		}
+		else
+		{
+			PRT_UINT64 clone = prtForeignTypeDecls[fVal->typeTag].cloneFun(fVal->value);
+			PrtWriteBytes(buffer, &clone, sizeof(PRT_UINT64));
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_TUPLE:
+	{
+		PRT_TUPVALUE *tVal = value->valueUnion.tuple;
+		PrtWriteVarUInt32(buffer, tVal->size);
+		for (PRT_UINT32 i = 0; i < tVal->size; i++)
+		{
+			PrtSerializeValue(buffer, tVal->values[i], mode);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_SEQ:
+	{
+		PRT_SEQVALUE *sVal = value->valueUnion.seq;
+		PrtWriteVarUInt32(buffer, sVal->size);
+		for (PRT_UINT32 i = 0; i < sVal->size; i++)
+		{
+			PrtSerializeValue(buffer, sVal->values[i], mode);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_MAP:
+	{
+		PRT_MAPVALUE *mVal = value->valueUnion.map;
+		PrtWriteVarUInt32(buffer, mVal->size);
+		for (PRT_MAPNODE *next = mVal->first; next != NULL; next = next->insertNext)
+		{
+			PrtSerializeValue(buffer, next->key, mode);
+			PrtSerializeValue(buffer, next->value, mode);
+		}
+		break;
+	}
+	default:
+		PrtAssert(PRT_FALSE, "PrtSerializeValue: Invalid value");
+		break;
+	}
+}
+
+//
+// Values nest no deeper than this in an encoding PrtTryDeserializeValue accepts
+//
+#define PRT_MAX_DESERIALIZE_DEPTH 256
+
+static PRT_VALUE *PrtTryDeserializeValueAt(
+	_In_ const PRT_UINT8 *bytes,
+	_In_ PRT_UINT32 size,
+	_Inout_ PRT_UINT32 *position,
+	_In_ PRT_SERIALIZE_MODE mode,
+	_In_ PRT_UINT32 depth);
+
+// Rebuilds count values into values, or frees the ones it made and returns PRT_FALSE.
+static PRT_BOOLEAN PrtTryDeserializeValues(
+	_In_ const PRT_UINT8 *bytes,
+	_In_ PRT_UINT32 size,
+	_Inout_ PRT_UINT32 *position,
+	_In_ PRT_SERIALIZE_MODE mode,
+	_In_ PRT_UINT32 depth,
+	_Out_ PRT_VALUE **values,
+	_In_ PRT_UINT32 count)
+{
+	for (PRT_UINT32 i = 0; i < count; i++)
+	{
+		values[i] = PrtTryDeserializeValueAt(bytes, size, position, mode, depth);
+		if (values[i] == NULL)
+		{
+			for (PRT_UINT32 j = 0; j < i; j++)
+			{
+				PrtFreeValue(values[j]);
+			}
+			return PRT_FALSE;
+		}
+	}
+	return PRT_TRUE;
+}
+
+static PRT_VALUE *PrtTryDeserializeValueAt(
+	_In_ const PRT_UINT8 *bytes,
+	_In_ PRT_UINT32 size,
+	_Inout_ PRT_UINT32 *position,
+	_In_ PRT_SERIALIZE_MODE mode,
+	_In_ PRT_UINT32 depth)
+{
+	// every element of a tuple, seq or map takes at least a byte, so a count larger than what is left is malformed.
+	PRT_UINT8 kind;
+	PRT_UINT32 count;
+	if (depth == PRT_MAX_DESERIALIZE_DEPTH || !PrtTryReadBytes(bytes, size, position, &kind, 1))
+	{
+		return NULL;
+	}
+	switch ((PRT_VALUE_KIND)kind)
+	{
+	case PRT_VALUE_KIND_NULL:
+		return PrtMkNullValue();
+	case PRT_VALUE_KIND_BOOL:
+	{
+		PRT_UINT8 bl;
+		if (!PrtTryReadBytes(bytes, size, position, &bl, 1) || bl > 1)
+		{
+			return NULL;
+		}
+		return PrtMkBoolValue((PRT_BOOLEAN)bl);
+	}
+	case PRT_VALUE_KIND_INT:
+	{
+		PRT_UINT32 zz;
+		if (!PrtTryReadVarUInt32(bytes, size, position, &zz))
+		{
+			return NULL;
+		}
+		return PrtMkIntValue((PRT_INT32)((zz >> 1) ^ (0U - (zz & 1))));
+	}
+	case PRT_VALUE_KIND_EVENT:
+	{
+		PRT_UINT32 ev;
+		if (!PrtTryReadVarUInt32(bytes, size, position, &ev))
+		{
+			return NULL;
+		}
+		return PrtMkEventValue(ev);
+	}
+	case PRT_VALUE_KIND_MID:
+	{
+		PRT_MACHINEID id;
+		if (!PrtTryReadBytes(bytes, size, position, &id.processId, sizeof(PRT_GUID)) ||
+			!PrtTryReadVarUInt32(bytes, size, position, &id.machineId))
+		{
+			return NULL;
+		}
+		return PrtMkMachineValue(id);
+	}
+	case PRT_VALUE_KIND_FORGN:
+	{
+		PRT_UINT32 typeTag;
+		PRT_UINT64 value;
+		if (!PrtTryReadVarUInt32(bytes, size, position, &typeTag) || typeTag >= prtNumForeignTypeDecls)
+		{
+			return NULL;
+		}
+		if (mode == PRT_SERIALIZE_PORTABLE)
+		{
+			PRT_UINT32 length;
+			if (!PrtTryReadBytes(bytes, size, position, &length, sizeof(PRT_UINT32)) || length > size - *position ||
+				prtForeignTypeDecls[typeTag].deserializeFun == NULL)
+			{
+				return NULL;
+			}
+			PRT_UINT32 end = *position + length;
+			value = prtForeignTypeDecls[typeTag].deserializeFun(bytes, position);
+			if (*position != end)
+			{
+				prtForeignTypeDecls[typeTag].freeFun(value);
+				return NULL;
+			}
+		}
+		else if (!PrtTryReadBytes(bytes, size, position, &value, sizeof(PRT_UINT64)))
+		{
+			return NULL;
+		}
+		PRT_VALUE *retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_FORGNVALUE *fVal = (PRT_FORGNVALUE *)PrtMalloc(sizeof(PRT_FORGNVALUE));
+		retVal->discriminator = PRT_VALUE_KIND_FORGN;
+		retVal->valueUnion.frgn = fVal;
+		fVal->typeTag = (PRT_UINT16)typeTag;
+		fVal->value = value;
+		return retVal;
+	}
+	case PRT_VALUE_KIND_TUPLE:
+	{
+		if (!PrtTryReadVarUInt32(bytes, size, position, &count) || count > size - *position)
+		{
+			return NULL;
+		}
+		PRT_VALUE **values = (PRT_VALUE **)PrtCalloc(count, sizeof(PRT_VALUE *));
+		if (!PrtTryDeserializeValues(bytes, size, position, mode, depth + 1, values, count))
+		{
+			PrtFree(values);
+			return NULL;
+		}
+		PRT_VALUE *retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_TUPVALUE *tVal = (PRT_TUPVALUE *)PrtMalloc(sizeof(PRT_TUPVALUE));
+		retVal->discriminator = PRT_VALUE_KIND_TUPLE;
+		retVal->valueUnion.tuple = tVal;
+		tVal->size = count;
+		tVal->values = values;
+		return retVal;
+	}
+	case PRT_VALUE_KIND_SEQ:
+	{
+		if (!PrtTryReadVarUInt32(bytes, size, position, &count) || count > size - *position)
+		{
+			return NULL;
+		}
+		PRT_VALUE **values = NULL;
+		if (count > 0)
+		{
+			values = (PRT_VALUE **)PrtMalloc(count * sizeof(PRT_VALUE *));
+			if (!PrtTryDeserializeValues(bytes, size, position, mode, depth + 1, values, count))
+			{
+				PrtFree(values);
+				return NULL;
+			}
+		}
+		PRT_VALUE *retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_SEQVALUE *sVal = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
+		retVal->discriminator = PRT_VALUE_KIND_SEQ;
+		retVal->valueUnion.seq = sVal;
+		sVal->size = count;
+		sVal->capacity = count;
+		sVal->values = values;
+		return retVal;
+	}
+	case PRT_VALUE_KIND_MAP:
+	{
+		if (!PrtTryReadVarUInt32(bytes, size, position, &count) || count > (size - *position) / 2)
+		{
+			return NULL;
+		}
+		PRT_VALUE *retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_MAPVALUE *mVal = (PRT_MAPVALUE *)PrtMalloc(sizeof(PRT_MAPVALUE));
+		retVal->discriminator = PRT_VALUE_KIND_MAP;
+		retVal->valueUnion.map = mVal;
+
+		// size the table up front so that the inserts below never rehash.
+		mVal->capNum = 0;
+		while (((double)count) / ((double)PrtHashtableCapacities[mVal->capNum]) > ((double)PRT_MAXHASHLOAD))
+		{
+			mVal->capNum++;
+		}
+		mVal->buckets = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_MAPNODE *));
+		mVal->size = 0;
+		mVal->first = NULL;
+		mVal->last = NULL;
+		for (PRT_UINT32 i = 0; i < count; i++)
+		{
+			PRT_VALUE *pair[2];
+			if (!PrtTryDeserializeValues(bytes, size, position, mode, depth + 1, pair, 2))
+			{
+				PrtFreeValue(retVal);
+				return NULL;
+			}
+			PrtMapUpdateEx(retVal, pair[0], PRT_FALSE, pair[1], PRT_FALSE);
+		}
+		return retVal;
+	}
+	default:
+		return NULL;
+	}
+}
+
+PRT_VALUE * PRT_CALL_CONV PrtTryDeserializeValue(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size, _Inout_ PRT_UINT32 *position, _In_ PRT_SERIALIZE_MODE mode)
+{
+	return PrtTryDeserializeValueAt(bytes, size, position, mode, 0);
+}
+
+PRT_VALUE * PRT_CALL_CONV PrtDeserializeValue(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position, _In_ PRT_SERIALIZE_MODE mode)
+{
+	PRT_VALUE *value = PrtTryDeserializeValueAt(bytes, 0xFFFFFFFF, position, mode, 0);
+	PrtAssert(value != NULL, "PrtDeserializeValue: Invalid encoding");
+	return value;
+}
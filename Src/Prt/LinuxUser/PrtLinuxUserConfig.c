@@ -1,5 +1,17 @@
 #include "PrtLinuxUserConfig.h"
 #include "Prt.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __APPLE__
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
 
 PRT_RECURSIVE_MUTEX PRT_CALL_CONV PrtCreateMutex()
 {
@@ -31,6 +43,87 @@ void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
 	PrtAssert(result == 0, "Unable to unlock mutex");
 }
 
+#ifdef __APPLE__
+
+void PRT_CALL_CONV PrtInitLock(_Out_ PRT_LOCK *lock)
+{
+	int result = pthread_mutex_init(lock, NULL);
+	PrtAssert(result == 0, "Unable to create lock");
+}
+
+void PRT_CALL_CONV PrtDestroyLock(_Inout_ PRT_LOCK *lock)
+{
+	int result = pthread_mutex_destroy(lock);
+	PrtAssert(result == 0, "Unable to destroy lock");
+}
+
+void PRT_CALL_CONV PrtAcquireLock(_Inout_ PRT_LOCK *lock)
+{
+	int result = pthread_mutex_lock(lock);
+	PrtAssert(result == 0, "Unable to acquire lock");
+}
+
+void PRT_CALL_CONV PrtReleaseLock(_Inout_ PRT_LOCK *lock)
+{
+	int result = pthread_mutex_unlock(lock);
+	PrtAssert(result == 0, "Unable to release lock");
+}
+
+#else
+
+//
+// Number of times a thread looks at a held lock before parking on it
+//
+#define PRT_LOCK_SPIN 100
+
+void PRT_CALL_CONV PrtInitLock(_Out_ PRT_LOCK *lock)
+{
+	lock->state = 0;
+}
+
+void PRT_CALL_CONV PrtDestroyLock(_Inout_ PRT_LOCK *lock)
+{
+	PrtAssert(lock->state == 0, "Unable to destroy a held lock");
+}
+
+void PRT_CALL_CONV PrtAcquireLock(_Inout_ PRT_LOCK *lock)
+{
+	PRT_UINT32 state = 0;
+	if (__atomic_compare_exchange_n(&lock->state, &state, 1, PRT_FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		return;
+	}
+
+	// locks are held for a handful of instructions, so it is usually cheaper to wait for the holder than to park.
+	for (PRT_UINT32 i = 0; i < PRT_LOCK_SPIN && state != 2; i++)
+	{
+		if (state == 0 && __atomic_compare_exchange_n(&lock->state, &state, 1, PRT_FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			return;
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+		state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+	}
+
+	// mark the lock contended so that the holder wakes a parked thread when it releases.
+	while (__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE) != 0)
+	{
+		syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+	}
+}
+
+void PRT_CALL_CONV PrtReleaseLock(_Inout_ PRT_LOCK *lock)
+{
+	if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2)
+	{
+		syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+#endif
+
 PRT_API PRT_SEMAPHORE PRT_CALL_CONV PrtCreateSemaphore(int initialCount, int maximumCount)
 {
 #ifdef __APPLE__
@@ -69,26 +162,34 @@ PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtWaitSemaphore(_In_ PRT_SEMAPHORE semaphore,
 #ifdef __APPLE__
     	rc = dispatch_semaphore_wait(*semaphore, DISPATCH_TIME_FOREVER);
 #else
-        rc = sem_wait(semaphore);
+        while ((rc = sem_wait(semaphore)) != 0 && errno == EINTR)
+        {
+            continue;
+        }
 #endif
     }
     else
     {
 #ifdef __APPLE__
-    	rc = dispatch_semaphore_wait(*semaphore, dispatch_time(DISPATCH_TIME_NOW, maxWaitTime));
+    	rc = dispatch_semaphore_wait(*semaphore, dispatch_time(DISPATCH_TIME_NOW, maxWaitTime * NSEC_PER_MSEC));
 #else
+        // sem_timedwait takes an absolute time on the realtime clock.
         struct timespec ts;
-        ts.tv_sec = maxWaitTime / 1000; // seconds
-        maxWaitTime -= (ts.tv_sec * 1000);
-        ts.tv_nsec = maxWaitTime * 1000; // nanoseconds
-        rc = sem_timedwait(semaphore, &ts);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += maxWaitTime / 1000;
+        ts.tv_nsec += (maxWaitTime % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while ((rc = sem_timedwait(semaphore, &ts)) != 0 && errno == EINTR)
+        {
+            continue;
+        }
 #endif
     }
-#ifdef __APPLE__
     return (rc == 0) ? PRT_TRUE : PRT_FALSE;
-#else
-    return (rc > 0) ? PRT_TRUE : PRT_FALSE;
-#endif
 }
 
 PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtReleaseSemaphore(_In_ PRT_SEMAPHORE semaphore)
@@ -107,44 +208,279 @@ PRT_API void PRT_CALL_CONV PrtYieldThread()
     sched_yield();
 }
 
-void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
+/* What a thread started by PrtCreateThread runs, handed over to the thread, which frees it */
+typedef struct PRT_THREAD_START
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	void *ptr = malloc(size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+    PRT_THREAD_FUN fun;
+    void *arg;
+} PRT_THREAD_START;
+
+static void *PrtThreadStart(void *param)
+{
+    PRT_THREAD_START start = *(PRT_THREAD_START *)param;
+    free(param);
+    start.fun(start.arg);
+    return NULL;
 }
 
-void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
+PRT_API PRT_THREAD PRT_CALL_CONV PrtCreateThread(_In_ PRT_THREAD_FUN fun, _Inout_ void *arg)
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
+    PRT_THREAD_START *start = (PRT_THREAD_START *)malloc(sizeof(PRT_THREAD_START));
+    PrtAssert(start != NULL, "Unable to create thread");
+    start->fun = fun;
+    start->arg = arg;
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, &PrtThreadStart, start);
+    PrtAssert(result == 0, "Unable to create thread");
+    return thread;
+}
 
-	void *ptr = calloc(nmemb, size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ PRT_THREAD thread)
+{
+    int result = pthread_join(thread, NULL);
+    PrtAssert(result == 0, "Unable to join thread");
 }
 
-void * PRT_CALL_CONV PrtRealloc(_Inout_ void *ptr, _In_ size_t size)
+
+#ifndef __APPLE__
+/* The key the eventfd that wakes a poller is watched with */
+#define PRT_POLLER_WAKE_KEY 0xFFFFFFFFFFFFFFFF
+
+/* epoll events read by one PrtPollerWait */
+#define PRT_POLLER_BATCH 64
+
+struct PRT_POLLER_IMPL
 {
-	PrtAssert(ptr != NULL, "Memory must be non-null to avoid platform-specific behavior");
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+    int epoll;
+    int wake;   /* an eventfd, readable while a wake is pending */
+};
 
-	ptr = realloc(ptr, size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+PRT_API PRT_POLLER PRT_CALL_CONV PrtCreatePoller()
+{
+    PRT_POLLER poller = (PRT_POLLER)malloc(sizeof(struct PRT_POLLER_IMPL));
+    PrtAssert(poller != NULL, "Unable to create poller");
+    poller->epoll = epoll_create1(EPOLL_CLOEXEC);
+    poller->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    PrtAssert(poller->epoll >= 0 && poller->wake >= 0, "Unable to create poller");
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = PRT_POLLER_WAKE_KEY;
+    int result = epoll_ctl(poller->epoll, EPOLL_CTL_ADD, poller->wake, &event);
+    PrtAssert(result == 0, "Unable to create poller");
+    return poller;
 }
 
-void PRT_CALL_CONV PrtFree(void *ptr)
+PRT_API void PRT_CALL_CONV PrtDestroyPoller(_In_ PRT_POLLER poller)
 {
-	free(ptr);
+    close(poller->wake);
+    close(poller->epoll);
+    free(poller);
 }
 
-PRT_BOOLEAN PRT_CALL_CONV PrtChoose()
+PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtPollerWatch(_In_ PRT_POLLER poller, _In_ int fd, _In_ PRT_UINT32 interest, _In_ PRT_UINT64 key)
+{
+    struct epoll_event event;
+    event.events = EPOLLONESHOT;
+    event.events |= (interest & PRT_POLL_READ) ? EPOLLIN : 0;
+    event.events |= (interest & PRT_POLL_WRITE) ? EPOLLOUT : 0;
+    event.events |= (interest & PRT_POLL_HUP) ? EPOLLRDHUP : 0;
+    event.data.u64 = key;
+    if (epoll_ctl(poller->epoll, EPOLL_CTL_MOD, fd, &event) == 0)
+    {
+        return PRT_TRUE;
+    }
+    return (errno == ENOENT && epoll_ctl(poller->epoll, EPOLL_CTL_ADD, fd, &event) == 0) ? PRT_TRUE : PRT_FALSE;
+}
+
+PRT_API void PRT_CALL_CONV PrtPollerUnwatch(_In_ PRT_POLLER poller, _In_ int fd)
+{
+    // a descriptor that was closed has left the epoll set already.
+    epoll_ctl(poller->epoll, EPOLL_CTL_DEL, fd, NULL);
+}
+
+PRT_API PRT_UINT32 PRT_CALL_CONV PrtPollerWait(_In_ PRT_POLLER poller, _In_ long maxWaitTime, _Out_ PRT_POLL_EVENT *ready, _In_ PRT_UINT32 capacity)
+{
+    struct epoll_event events[PRT_POLLER_BATCH];
+    int count = epoll_wait(poller->epoll, events, capacity < PRT_POLLER_BATCH ? (int)capacity : PRT_POLLER_BATCH, maxWaitTime < 0 ? -1 : (int)maxWaitTime);
+    PRT_UINT32 filled = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].data.u64 == PRT_POLLER_WAKE_KEY)
+        {
+            // the wakes are read so that the next wait blocks again; another thread may have read them first.
+            PRT_UINT64 wakes;
+            ssize_t result = read(poller->wake, &wakes, sizeof(wakes));
+            PrtAssert(result == sizeof(wakes) || errno == EAGAIN, "Unable to read poller wake");
+            continue;
+        }
+        PRT_UINT32 flags = 0;
+        flags |= (events[i].events & EPOLLIN) ? PRT_POLL_READ : 0;
+        flags |= (events[i].events & EPOLLOUT) ? PRT_POLL_WRITE : 0;
+        flags |= (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) ? PRT_POLL_HUP : 0;
+        ready[filled].key = events[i].data.u64;
+        ready[filled].ready = flags;
+        filled++;
+    }
+    return filled;
+}
+
+PRT_API void PRT_CALL_CONV PrtPollerWake(_In_ PRT_POLLER poller)
+{
+    PRT_UINT64 one = 1;
+    ssize_t result = write(poller->wake, &one, sizeof(one));
+    PrtAssert(result == sizeof(one), "Unable to wake poller");
+}
+#else
+PRT_API PRT_POLLER PRT_CALL_CONV PrtCreatePoller()
 {
-	PRT_UINT32 value = rand();
-	if (value < RAND_MAX / 2)
-		return PRT_FALSE;
-	else
-		return PRT_TRUE;
-}
\ No newline at end of file
+    // file descriptors cannot be watched in this configuration.
+    return NULL;
+}
+
+PRT_API void PRT_CALL_CONV PrtDestroyPoller(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to destroy");
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtPollerWatch(_In_ PRT_POLLER poller, _In_ int fd, _In_ PRT_UINT32 interest, _In_ PRT_UINT64 key)
+{
+    return PRT_FALSE;
+}
+
+PRT_API void PRT_CALL_CONV PrtPollerUnwatch(_In_ PRT_POLLER poller, _In_ int fd)
+{
+}
+
+PRT_API PRT_UINT32 PRT_CALL_CONV PrtPollerWait(_In_ PRT_POLLER poller, _In_ long maxWaitTime, _Out_ PRT_POLL_EVENT *ready, _In_ PRT_UINT32 capacity)
+{
+    PrtAssert(PRT_FALSE, "No poller to wait on");
+    return 0;
+}
+
+PRT_API void PRT_CALL_CONV PrtPollerWake(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to wake");
+}
+#endif
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicIncrement(_Inout_ volatile PRT_UINT32 *target)
+{
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicDecrement(_Inout_ volatile PRT_UINT32 *target)
+{
+	return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+size_t PRT_CALL_CONV PrtAtomicAdd(_Inout_ volatile size_t *target, _In_ size_t value)
+{
+	return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicCompareExchange(_Inout_ volatile PRT_UINT32 *target, _In_ PRT_UINT32 expected, _In_ PRT_UINT32 desired)
+{
+	__atomic_compare_exchange_n(target, &expected, desired, PRT_FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return expected;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicLoad(_In_ volatile PRT_UINT32 *target)
+{
+	return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+}
+
+PRT_UINT64 PRT_CALL_CONV PrtGetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (PRT_UINT64)now.tv_sec * 1000 + (PRT_UINT64)now.tv_nsec / 1000000;
+}
+
+const PRT_UINT8 * PRT_CALL_CONV PrtMapFile(_In_ const char *path, _Out_ PRT_UINT32 *size)
+{
+	*size = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat info;
+	void *bytes = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0 && (PRT_UINT64)info.st_size <= 0xFFFFFFFF)
+	{
+		bytes = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (bytes == MAP_FAILED)
+	{
+		return NULL;
+	}
+	*size = (PRT_UINT32)info.st_size;
+	return (const PRT_UINT8 *)bytes;
+}
+
+void PRT_CALL_CONV PrtUnmapFile(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size)
+{
+	munmap((void *)bytes, size);
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtReplaceFile(_Inout_ FILE *file, _In_ const char *tempPath, _In_ const char *path)
+{
+	// rename replaces path in one step, and only after the data it will point to is on disk.
+	PRT_BOOLEAN ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+	ok = fclose(file) == 0 && ok;
+	return ok && rename(tempPath, path) == 0;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetNumaNodeCount()
+{
+#ifdef __APPLE__
+	return 1;
+#else
+	// nodes are numbered densely from 0, and the directory is missing on kernels built without NUMA.
+	PRT_UINT32 count = 0;
+	char path[64];
+	struct stat info;
+	for (;;)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u", count);
+		if (stat(path, &info) != 0)
+		{
+			break;
+		}
+		count++;
+	}
+	return count == 0 ? 1 : count;
+#endif
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetCurrentNumaNode()
+{
+#ifdef __APPLE__
+	return 0;
+#else
+	unsigned int cpu, node;
+	return syscall(SYS_getcpu, &cpu, &node, NULL) == 0 ? node : 0;
+#endif
+}
+
+void * PRT_CALL_CONV PrtAllocNodeMemory(_In_ size_t size, _In_ PRT_UINT32 node)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	PrtAssert(ptr != MAP_FAILED, "Memory allocation error");
+#ifndef __APPLE__
+	// MPOL_PREFERRED falls back to other nodes, and mbind fails harmlessly for a node that does not exist.
+	unsigned long mask[2] = { 0, 0 };
+	if (node < 8 * sizeof(mask))
+	{
+		mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+		syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask, 8 * sizeof(mask), 0);
+	}
+#endif
+	return ptr;
+}
+
+void PRT_CALL_CONV PrtFreeNodeMemory(_Inout_ void *ptr, _In_ size_t size)
+{
+	munmap(ptr, size);
+}
@@ -71,6 +71,7 @@ extern "C"{
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #ifdef __APPLE__
 #include <dispatch/dispatch.h>
 #else
@@ -118,12 +119,46 @@ extern "C"{
 	/** PRT_RECURSIVE_MUTEX identifies a recursive mutex. */
 	typedef pthread_mutex_t* PRT_RECURSIVE_MUTEX;
 
+	/** PRT_LOCK is a non-recursive lock stored inline in the structure it protects. */
+#ifdef __APPLE__
+	typedef pthread_mutex_t PRT_LOCK;
+#else
+	typedef struct PRT_LOCK
+	{
+		volatile PRT_UINT32 state;	/* 0 if unlocked, 1 if locked, 2 if locked and threads may be parked on it */
+	} PRT_LOCK;
+#endif
+
     /** PRT_SEMAPHORE identifies a platform specific semaphore object. */
 #ifdef __APPLE__
 	typedef dispatch_semaphore_t* PRT_SEMAPHORE;
 #else
     typedef sem_t* PRT_SEMAPHORE;
 #endif
+
+    /** PRT_THREAD identifies a platform specific thread. */
+    typedef pthread_t PRT_THREAD;
+
+    /** Function run by a thread started with PrtCreateThread. */
+    typedef void(PRT_CALL_CONV * PRT_THREAD_FUN)(_Inout_ void *arg);
+
+    /** PRT_POLLER identifies a platform specific set of file descriptors watched for readiness; see PrtCreatePoller. */
+    typedef struct PRT_POLLER_IMPL *PRT_POLLER;
+
+    /** Readiness of a file descriptor: it can be read without blocking, written without blocking, or was hung up on. */
+#define PRT_POLL_READ  0x1
+#define PRT_POLL_WRITE 0x2
+#define PRT_POLL_HUP   0x4
+
+    /** A file descriptor found ready by PrtPollerWait. */
+    typedef struct PRT_POLL_EVENT
+    {
+        PRT_UINT64  key;    /**< The key the descriptor was watched with.   */
+        PRT_UINT32  ready;  /**< PRT_POLL_READ, PRT_POLL_WRITE and PRT_POLL_HUP bits. */
+    } PRT_POLL_EVENT;
+
+	/** Storage class of variables that have a separate instance in every thread. */
+#define PRT_THREAD_LOCAL __thread
    
 	/** Function for Assertion will be called whenever an assertion is checked */
 	typedef void(PRT_CALL_CONV * PRT_ASSERT_FUN)(PRT_INT32, PRT_CSTRING);
@@ -173,6 +208,37 @@ extern "C"{
 	*/
 	PRT_API void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex);
 
+	/**
+	* Initializes an unlocked lock in place. Unlike a mutex, a lock is not recursive: a thread that
+	* acquires a lock it already holds deadlocks. Initializing a lock allocates nothing.
+	* @param[out] lock The lock to initialize.
+	* @see PrtDestroyLock
+	* @see PrtAcquireLock
+	* @see PrtReleaseLock
+	*/
+	PRT_API void PRT_CALL_CONV PrtInitLock(_Out_ PRT_LOCK *lock);
+
+	/**
+	* Disposes of an unlocked lock. The lock must not be used again until it is initialized again.
+	* @param[in,out] lock The lock to destroy.
+	* @see PrtInitLock
+	*/
+	PRT_API void PRT_CALL_CONV PrtDestroyLock(_Inout_ PRT_LOCK *lock);
+
+	/**
+	* Blocks until the lock is held by the calling thread, which must not already hold it.
+	* @param[in,out] lock The lock to acquire.
+	* @see PrtReleaseLock
+	*/
+	PRT_API void PRT_CALL_CONV PrtAcquireLock(_Inout_ PRT_LOCK *lock);
+
+	/**
+	* Releases a lock held by the calling thread.
+	* @param[in,out] lock The lock to release.
+	* @see PrtAcquireLock
+	*/
+	PRT_API void PRT_CALL_CONV PrtReleaseLock(_Inout_ PRT_LOCK *lock);
+
 /**
     * Creates a fresh unnamed semaphore. The semaphore must be released after wait succeeds.
     * @param[in] initialCount The initial number of semaphores available.
@@ -224,8 +290,171 @@ extern "C"{
     */
     PRT_API void PRT_CALL_CONV PrtYieldThread(void);
 
+    /**
+    * Starts a thread that calls fun with arg and then ends.
+    * @param[in] fun The function the thread runs.
+    * @param[in,out] arg Passed to fun.
+    * @return A configuration-specific value identifying the thread, to be passed to PrtJoinThread exactly once.
+    * @see PrtJoinThread
+    */
+    PRT_API PRT_THREAD PRT_CALL_CONV PrtCreateThread(_In_ PRT_THREAD_FUN fun, _Inout_ void *arg);
+
+    /**
+    * Blocks until a thread started by PrtCreateThread has ended, and releases what identifies it.
+    * @param[in] thread The thread to wait for.
+    * @see PrtCreateThread
+    */
+    PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ PRT_THREAD thread);
+
+    /**
+    * Makes an empty set of file descriptors to watch for readiness.
+    * @return The poller, or NULL if the configuration cannot watch file descriptors.
+    * @see PrtDestroyPoller
+    */
+    PRT_API PRT_POLLER PRT_CALL_CONV PrtCreatePoller(void);
+
+    /**
+    * Frees a poller; no thread may be waiting on it.
+    * @param[in] poller The poller.
+    */
+    PRT_API void PRT_CALL_CONV PrtDestroyPoller(_In_ PRT_POLLER poller);
+
+    /**
+    * Watches a file descriptor until it is next found ready for any of interest, once; a descriptor watched
+    * already is watched again with the new interest and key. A hang-up is reported whatever the interest.
+    * @param[in] poller The poller.
+    * @param[in] fd The file descriptor.
+    * @param[in] interest PRT_POLL_READ, PRT_POLL_WRITE and PRT_POLL_HUP bits.
+    * @param[in] key Reported with the descriptor by PrtPollerWait.
+    * @return PRT_FALSE if the descriptor cannot be watched.
+    */
+    PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtPollerWatch(_In_ PRT_POLLER poller, _In_ int fd, _In_ PRT_UINT32 interest, _In_ PRT_UINT64 key);
+
+    /**
+    * Stops watching a file descriptor; does nothing if it is not watched.
+    * @param[in] poller The poller.
+    * @param[in] fd The file descriptor.
+    */
+    PRT_API void PRT_CALL_CONV PrtPollerUnwatch(_In_ PRT_POLLER poller, _In_ int fd);
+
+    /**
+    * Waits until watched file descriptors are ready, PrtPollerWake is called, or maxWaitTime milliseconds pass.
+    * @param[in] poller The poller.
+    * @param[in] maxWaitTime Milliseconds to wait at most, or -1 to wait for as long as it takes.
+    * @param[out] ready Receives the descriptors found ready.
+    * @param[in] capacity The number of entries of ready.
+    * @return The number of entries of ready filled in, which may be 0.
+    */
+    PRT_API PRT_UINT32 PRT_CALL_CONV PrtPollerWait(_In_ PRT_POLLER poller, _In_ long maxWaitTime, _Out_ PRT_POLL_EVENT *ready, _In_ PRT_UINT32 capacity);
+
+    /**
+    * Makes a PrtPollerWait under way, or the next one, return.
+    * @param[in] poller The poller.
+    */
+    PRT_API void PRT_CALL_CONV PrtPollerWake(_In_ PRT_POLLER poller);
+
+	/**
+	* Atomically increments a 32-bit counter shared between threads.
+	* @param[in,out] target The counter to increment.
+	* @returns The incremented value.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtAtomicIncrement(_Inout_ volatile PRT_UINT32 *target);
+
+	/**
+	* Atomically decrements a 32-bit counter shared between threads.
+	* @param[in,out] target The counter to decrement.
+	* @returns The decremented value.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtAtomicDecrement(_Inout_ volatile PRT_UINT32 *target);
+
+	/**
+	* Atomically adds to a size shared between threads. Subtract by adding the two's complement.
+	* @param[in,out] target The size to add to.
+	* @param[in] value The amount to add.
+	* @returns The new value.
+	*/
+	PRT_API size_t PRT_CALL_CONV PrtAtomicAdd(_Inout_ volatile size_t *target, _In_ size_t value);
+
+	/**
+	* Atomically replaces a 32-bit word shared between threads, if it still holds an expected value.
+	* @param[in,out] target The word to replace.
+	* @param[in] expected The value target must hold for the replacement to happen.
+	* @param[in] desired The value to store in target.
+	* @returns The value target held before the call; the replacement happened if this is expected.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtAtomicCompareExchange(_Inout_ volatile PRT_UINT32 *target, _In_ PRT_UINT32 expected, _In_ PRT_UINT32 desired);
+
+	/**
+	* Atomically reads a 32-bit word shared between threads and changed by PrtAtomicCompareExchange.
+	* @param[in] target The word to read.
+	* @returns The value target holds.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtAtomicLoad(_In_ volatile PRT_UINT32 *target);
+
+	/**
+	* Reads a clock that only moves forward, for measuring intervals. The clock has no fixed origin.
+	* @returns The current time in milliseconds.
+	*/
+	PRT_API PRT_UINT64 PRT_CALL_CONV PrtGetMonotonicTime(void);
+
+	/**
+	* Maps a whole file into memory for reading.
+	* @param[in] path The file to map.
+	* @param[out] size Receives the size of the file in bytes.
+	* @returns The contents of the file, or NULL if it cannot be opened, is empty or is 4GB or larger.
+	* @see PrtUnmapFile
+	*/
+	PRT_API const PRT_UINT8 * PRT_CALL_CONV PrtMapFile(_In_ const char *path, _Out_ PRT_UINT32 *size);
+
+	/**
+	* Releases a file mapped by PrtMapFile.
+	* @param[in] bytes The contents returned by PrtMapFile.
+	* @param[in] size The size returned by PrtMapFile.
+	*/
+	PRT_API void PRT_CALL_CONV PrtUnmapFile(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size);
+
+	/**
+	* Makes what was written to file durable, closes it, and renames tempPath, the file it was opened on, over path.
+	* Readers of path see either its old contents or all of the new ones.
+	* @param[in] file The file, open for writing on tempPath. It is closed whether or not this succeeds.
+	* @param[in] tempPath The path file was opened on.
+	* @param[in] path The path to replace.
+	* @returns PRT_TRUE if path now has the contents of file, PRT_FALSE if they could not be flushed or renamed.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtReplaceFile(_Inout_ FILE *file, _In_ const char *tempPath, _In_ const char *path);
+
+	/**
+	* Counts the NUMA nodes of the machine. Machines without NUMA have one node.
+	* @returns The number of nodes; nodes are numbered from 0.
+	* @see PrtGetCurrentNumaNode
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtGetNumaNodeCount(void);
+
+	/**
+	* Finds the NUMA node of the processor the calling thread is running on. The thread may move to another node at any time.
+	* @returns The node, or 0 if it cannot be found.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtGetCurrentNumaNode(void);
+
+	/**
+	* Allocates whole pages that the system should place on a NUMA node. The placement is a preference:
+	* memory still comes from other nodes when the node is full or does not exist.
+	* @param[in] size The number of bytes to allocate.
+	* @param[in] node The preferred node.
+	* @returns The memory; fails eagerly if it cannot be allocated.
+	* @see PrtFreeNodeMemory
+	*/
+	PRT_API void * PRT_CALL_CONV PrtAllocNodeMemory(_In_ size_t size, _In_ PRT_UINT32 node);
+
+	/**
+	* Releases memory allocated by PrtAllocNodeMemory.
+	* @param[in] ptr The memory returned by PrtAllocNodeMemory.
+	* @param[in] size The size passed to PrtAllocNodeMemory.
+	*/
+	PRT_API void PRT_CALL_CONV PrtFreeNodeMemory(_Inout_ void *ptr, _In_ size_t size);
+
 	/**
-	* Calls system-specific implementation of malloc.
+	* Allocates memory from the calling thread's current allocator (see PrtSetAllocator).
 	* Fails eagerly if memory cannot be allocated.
 	* @param[in] size Number of bytes to allocate.
 	* @returns A pointer to a memory location
@@ -234,7 +463,7 @@ extern "C"{
 	PRT_API void * PRT_CALL_CONV PrtMalloc(_In_ size_t size);
 
 	/**
-	* Calls system-specific implementation of calloc.
+	* Allocates zeroed memory from the calling thread's current allocator (see PrtSetAllocator).
 	* Fails eagerly if memory cannot be allocated.
 	* @param[in] nmemb Number of bytes to allocate per member.
 	* @param[in] size Number of bytes to allocate per member.
@@ -244,7 +473,7 @@ extern "C"{
 	PRT_API void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size);
 
 	/**
-	* Calls system-specific implementation of realloc.
+	* Reallocates memory using the allocator that allocated ptr.
 	* Fails eagerly if memory cannot be allocated.
 	* @param[in,out] ptr A pointer to a memory block to reallocate.
 	* @param[in] size Number of bytes to reallocate per member.
@@ -254,7 +483,7 @@ extern "C"{
 	void * PRT_CALL_CONV PrtRealloc(_Inout_ void * ptr, _In_ size_t size);
 
 	/**
-	* Calls system-specific implementation of free.
+	* Returns memory to the allocator that allocated ptr; ptr may be NULL.
 	* @param[in,out] ptr A pointer to a memory block to be freed.
 	* @see PrtMalloc
 	* @see PrtCalloc
@@ -262,7 +491,8 @@ extern "C"{
 	*/
 	PRT_API void PRT_CALL_CONV PrtFree(void * ptr);
 
-	/** Nondeterministic Boolean choice
+	/** Nondeterministic Boolean choice, drawn from a generator of the calling thread that takes no lock.
+	* Machines choose from streams of their own instead; see PrtSetChoiceSeed.
 	* @returns A nondeterministic Boolean value.
 	*/
 	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtChoose();
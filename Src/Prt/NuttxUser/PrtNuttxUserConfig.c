@@ -1,6 +1,9 @@
 #include "PrtNuttxUserConfig.h"
 #include "Prt.h"
+#include <errno.h>
 #include <nuttx/kmalloc.h>
+#include <time.h>
+#include <unistd.h>
 
 PRT_RECURSIVE_MUTEX PRT_CALL_CONV PrtCreateMutex()
 {
@@ -33,6 +36,27 @@ void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
     pthread_mutex_unlock(mutex);
 }
 
+void PRT_CALL_CONV PrtInitLock(_Out_ PRT_LOCK *lock)
+{
+    int status = pthread_mutex_init(lock, NULL);
+    PrtAssert(status == 0, "Unable to create lock");
+}
+
+void PRT_CALL_CONV PrtDestroyLock(_Inout_ PRT_LOCK *lock)
+{
+    pthread_mutex_destroy(lock);
+}
+
+void PRT_CALL_CONV PrtAcquireLock(_Inout_ PRT_LOCK *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+void PRT_CALL_CONV PrtReleaseLock(_Inout_ PRT_LOCK *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
 PRT_API PRT_SEMAPHORE PRT_CALL_CONV PrtCreateSemaphore(int initialCount, int maximumCount)
 {
     sem_t* semaphore = malloc(sizeof(sem_t));
@@ -55,15 +79,27 @@ PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtWaitSemaphore(_In_ PRT_SEMAPHORE semaphore,
     int rc = 0;
     if (maxWaitTime == -1)
     {
-        rc = sem_wait(semaphore);
+        while ((rc = sem_wait(semaphore)) != OK && errno == EINTR)
+        {
+            continue;
+        }
     }
     else
     {
+        // sem_timedwait takes an absolute time on the realtime clock.
         struct timespec ts;
-        ts.tv_sec = maxWaitTime / 1000; // seconds
-        maxWaitTime -= (ts.tv_sec * 1000);
-        ts.tv_nsec = maxWaitTime * 1000; // nanoseconds
-        rc = sem_timedwait(semaphore, &ts);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += maxWaitTime / 1000;
+        ts.tv_nsec += (maxWaitTime % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while ((rc = sem_timedwait(semaphore, &ts)) != OK && errno == EINTR)
+        {
+            continue;
+        }
     }
     return (rc == OK) ? PRT_TRUE : PRT_FALSE;
 }
@@ -79,45 +115,163 @@ PRT_API void PRT_CALL_CONV PrtYieldThread()
     sched_yield();
 }
 
-void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
+/* What a thread started by PrtCreateThread runs, handed over to the thread, which frees it */
+typedef struct PRT_THREAD_START
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	void *ptr = malloc(size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+    PRT_THREAD_FUN fun;
+    void *arg;
+} PRT_THREAD_START;
+
+static void *PrtThreadStart(void *param)
+{
+    PRT_THREAD_START start = *(PRT_THREAD_START *)param;
+    free(param);
+    start.fun(start.arg);
+    return NULL;
 }
 
-void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
+PRT_API PRT_THREAD PRT_CALL_CONV PrtCreateThread(_In_ PRT_THREAD_FUN fun, _Inout_ void *arg)
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
+    PRT_THREAD_START *start = (PRT_THREAD_START *)malloc(sizeof(PRT_THREAD_START));
+    PrtAssert(start != NULL, "Unable to create thread");
+    start->fun = fun;
+    start->arg = arg;
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, &PrtThreadStart, start);
+    PrtAssert(result == 0, "Unable to create thread");
+    return thread;
+}
 
-	void *ptr = calloc(nmemb, size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
+PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ PRT_THREAD thread)
+{
+    int result = pthread_join(thread, NULL);
+    PrtAssert(result == 0, "Unable to join thread");
+}
 
-	return ptr;
+PRT_API PRT_POLLER PRT_CALL_CONV PrtCreatePoller()
+{
+    // file descriptors cannot be watched in this configuration.
+    return NULL;
+}
+
+PRT_API void PRT_CALL_CONV PrtDestroyPoller(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to destroy");
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtPollerWatch(_In_ PRT_POLLER poller, _In_ int fd, _In_ PRT_UINT32 interest, _In_ PRT_UINT64 key)
+{
+    return PRT_FALSE;
 }
 
-void * PRT_CALL_CONV PrtRealloc(_Inout_ void *ptr, _In_ size_t size)
+PRT_API void PRT_CALL_CONV PrtPollerUnwatch(_In_ PRT_POLLER poller, _In_ int fd)
 {
-	PrtAssert(ptr != NULL, "Memory must be non-null to avoid platform-specific behavior");
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+}
+
+PRT_API PRT_UINT32 PRT_CALL_CONV PrtPollerWait(_In_ PRT_POLLER poller, _In_ long maxWaitTime, _Out_ PRT_POLL_EVENT *ready, _In_ PRT_UINT32 capacity)
+{
+    PrtAssert(PRT_FALSE, "No poller to wait on");
+    return 0;
+}
 
-	ptr = realloc(ptr, size);
+PRT_API void PRT_CALL_CONV PrtPollerWake(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to wake");
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicIncrement(_Inout_ volatile PRT_UINT32 *target)
+{
+	return __sync_add_and_fetch(target, 1);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicDecrement(_Inout_ volatile PRT_UINT32 *target)
+{
+	return __sync_sub_and_fetch(target, 1);
+}
+
+size_t PRT_CALL_CONV PrtAtomicAdd(_Inout_ volatile size_t *target, _In_ size_t value)
+{
+	return __sync_add_and_fetch(target, value);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicCompareExchange(_Inout_ volatile PRT_UINT32 *target, _In_ PRT_UINT32 expected, _In_ PRT_UINT32 desired)
+{
+	return __sync_val_compare_and_swap(target, expected, desired);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicLoad(_In_ volatile PRT_UINT32 *target)
+{
+	return __sync_fetch_and_add(target, 0);
+}
+
+PRT_UINT64 PRT_CALL_CONV PrtGetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (PRT_UINT64)now.tv_sec * 1000 + (PRT_UINT64)now.tv_nsec / 1000000;
+}
+
+const PRT_UINT8 * PRT_CALL_CONV PrtMapFile(_In_ const char *path, _Out_ PRT_UINT32 *size)
+{
+	// no mmap on NuttX, so the file is read into memory instead.
+	*size = 0;
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+	PRT_UINT8 *bytes = NULL;
+	long length = 0;
+	if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0)
+	{
+		bytes = (PRT_UINT8 *)malloc((size_t)length);
+		if (bytes != NULL && fread(bytes, 1, (size_t)length, file) != (size_t)length)
+		{
+			free(bytes);
+			bytes = NULL;
+		}
+	}
+	fclose(file);
+	if (bytes != NULL)
+	{
+		*size = (PRT_UINT32)length;
+	}
+	return bytes;
+}
+
+void PRT_CALL_CONV PrtUnmapFile(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size)
+{
+	free((void *)bytes);
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtReplaceFile(_Inout_ FILE *file, _In_ const char *tempPath, _In_ const char *path)
+{
+	// rename replaces path in one step, and only after the data it will point to is on disk.
+	PRT_BOOLEAN ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+	ok = fclose(file) == 0 && ok;
+	return ok && rename(tempPath, path) == 0;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetNumaNodeCount()
+{
+	return 1;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetCurrentNumaNode()
+{
+	return 0;
+}
+
+void * PRT_CALL_CONV PrtAllocNodeMemory(_In_ size_t size, _In_ PRT_UINT32 node)
+{
+	// NuttX targets have a single memory node.
+	void *ptr = malloc(size);
 	PrtAssert(ptr != NULL, "Memory allocation error");
 	return ptr;
 }
 
-void PRT_CALL_CONV PrtFree(void *ptr)
+void PRT_CALL_CONV PrtFreeNodeMemory(_Inout_ void *ptr, _In_ size_t size)
 {
 	free(ptr);
 }
 
-PRT_BOOLEAN PRT_CALL_CONV PrtChoose()
-{
-	PRT_UINT32 value = rand();
-	if (value < MAX_RAND / 2)
-		return PRT_FALSE;
-	else
-		return PRT_TRUE;
-}
@@ -0,0 +1,232 @@
+#include "PrtTestProgram.h"
+
+/*
+* Sends Counters events with PrtTrySend under each admission policy, on a clock the test moves by hand, and checks
+* that a full queue turns an event away without an error, that each policy sheds the events it should and takes the
+* rest, and that sends between machines are never shed.
+*/
+
+static volatile PRT_UINT64 fakeNow = 0;
+
+static PRT_UINT64 PRT_CALL_CONV FakeNow(_Inout_ void *state)
+{
+	return fakeNow;
+}
+
+static PRT_CLOCK fakeClock = { &FakeNow, NULL };
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_PROCESS *StartAdmissionProcess(_In_ PRT_UINT32 data1, _In_ PRT_ADMISSION_KIND kind, _In_ PRT_UINT32 limit, _In_ PRT_UINT32 rate, _In_ PRT_UINT32 interval)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	fakeNow = 1000;
+	PrtSetClock(process, &fakeClock);
+	PRT_ADMISSION_POLICY policy = { kind, limit, rate, interval, NULL, NULL };
+	PrtSetAdmissionPolicy(process, P_MACHINE_COUNTER, &policy);
+	return process;
+}
+
+static PRT_SEND_STATUS TrySend(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 eventIndex, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(eventIndex);
+	PRT_VALUE *payload = eventIndex == P_EVENT_RESET || eventIndex == P_EVENT_HALT ? NULL : PrtMkIntValue(x);
+	PRT_SEND_STATUS status = PrtTrySend(NULL, counter, event, payload);
+	if (payload != NULL)
+	{
+		PrtFreeValue(payload);
+	}
+	PrtFreeValue(event);
+	return status;
+}
+
+static PRT_UINT32 QueueLength(_In_ PRT_MACHINEINST *counter)
+{
+	return ((PRT_MACHINEINST_PRIV *)counter)->eventQueue.size;
+}
+
+static void TestOverflowIsNotAnError(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartAdmissionProcess(1, PRT_ADMISSION_ALWAYS, 0, 0, 0);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	P_GEND_TEST_PROGRAM.machines[P_MACHINE_COUNTER]->maxQueueSize = 4;
+	P_GEND_TEST_PROGRAM.events[P_EVENT_RESET]->eventMaxInstances = 1;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_RESET, 0) == PRT_SEND_ACCEPTED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_RESET, 0) == PRT_SEND_OVERFLOW);
+	for (PRT_INT32 i = 0; i < 3; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_OVERFLOW);
+	PRT_TEST_CHECK(QueueLength(counter) == 4);
+
+	// the halt event may not be queued at all.
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_HALT, 0) == PRT_SEND_OVERFLOW);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 3);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	P_GEND_TEST_PROGRAM.machines[P_MACHINE_COUNTER]->maxQueueSize = 0xffffffff;
+	P_GEND_TEST_PROGRAM.events[P_EVENT_RESET]->eventMaxInstances = 0xffffffff;
+
+	// a machine that has halted takes and drops everything, as it does from PrtSend.
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestQueueLength(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartAdmissionProcess(2, PRT_ADMISSION_QUEUE_LENGTH, 3, 0, 0);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *target = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 0; i < 3; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+
+	// PrtSend is not subject to the policy, and neither are the sends of machines.
+	PrtTestSendAdd(counter, 1);
+	for (PRT_INT32 i = 0; i < 5; i++)
+	{
+		PrtTestSendForward(counter, target, 1);
+	}
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 4);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(target) == 5);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestTokenBucket(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartAdmissionProcess(3, PRT_ADMISSION_TOKEN_BUCKET, 5, 10, 0);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *other = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// a full bucket takes a burst; then a token comes every 100 ms.
+	for (PRT_INT32 i = 0; i < 5; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	fakeNow += 99;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	fakeNow += 1;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+
+	// the bucket holds no more than a burst, however long it fills, and each machine has a bucket of its own.
+	fakeNow += 60000;
+	for (PRT_INT32 i = 0; i < 5; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	PRT_TEST_CHECK(TrySend(other, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 11);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static PRT_BOOLEAN PRT_CALL_CONV AdmitEven(_Inout_ void *state, _In_ PRT_MACHINEINST *receiver, _In_ PRT_UINT32 eventIndex, _In_ PRT_UINT32 queueLength)
+{
+	(*(PRT_UINT32 *)state)++;
+	return eventIndex == P_EVENT_ADD && queueLength % 2 == 0;
+}
+
+static void TestCustomPolicy(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(4, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_UINT32 calls = 0;
+	PRT_ADMISSION_POLICY policy = { PRT_ADMISSION_CUSTOM, 0, 0, 0, &AdmitEven, &calls };
+	PrtSetAdmissionPolicy(process, P_MACHINE_COUNTER, &policy);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_COUNTDOWN, 0) == PRT_SEND_SHED);
+	PRT_TEST_CHECK(calls == 3);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestQueueDelay(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartAdmissionProcess(5, PRT_ADMISSION_QUEUE_DELAY, 10, 0, 100);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// a backlog that is worked off within the target sheds nothing.
+	for (PRT_INT32 i = 0; i < 20; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	fakeNow += 9;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+
+	// events that wait too long for a whole interval start the shedding.
+	for (PRT_INT32 i = 0; i < 20; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	fakeNow += 50;
+	RunUntilIdle(process);
+	for (PRT_INT32 i = 0; i < 20; i++)
+	{
+		PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	}
+	fakeNow += 100;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->admission->shedding);
+
+	// an empty queue takes everything; a queue with a standing delay has every so many events shed, ever more often.
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	fakeNow += 70;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	fakeNow += 30;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	fakeNow += 99;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	fakeNow += 1;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	fakeNow += 49;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	fakeNow += 1;
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_SHED);
+	// an event dequeued in time ends it.
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(!((PRT_MACHINEINST_PRIV *)counter)->admission->shedding);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PRT_TEST_CHECK(TrySend(counter, P_EVENT_ADD, 1) == PRT_SEND_ACCEPTED);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestOverflowIsNotAnError();
+	TestQueueLength();
+	TestTokenBucket();
+	TestCustomPolicy();
+	TestQueueDelay();
+	printf("PrtAdmissionTest passed\n");
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <pthread.h>
+#include "PrtTestProgram.h"
+
+/* An allocator that counts the blocks it hands out, so a test can see that a process returns everything. */
+typedef struct COUNTING_ALLOCATOR
+{
+	PRT_ALLOCATOR	allocator;
+	PRT_UINT32		allocs;
+	PRT_UINT32		frees;
+} COUNTING_ALLOCATOR;
+
+static void * PRT_CALL_CONV CountingAlloc(void *state, size_t size)
+{
+	((COUNTING_ALLOCATOR *)state)->allocs++;
+	return malloc(size);
+}
+
+static void PRT_CALL_CONV CountingFree(void *state, void *ptr, size_t size)
+{
+	((COUNTING_ALLOCATOR *)state)->frees++;
+	free(ptr);
+}
+
+static void TestTwoProcessesWithDifferentAllocators(void)
+{
+	COUNTING_ALLOCATOR counting = { { &CountingAlloc, NULL, &CountingFree, NULL }, 0, 0 };
+	counting.allocator.state = &counting;
+	PRT_ALLOCATOR *arena = PrtMkArenaAllocator();
+
+	PRT_PROCESS *countingProcess = PrtTestStartProcess(1, &counting.allocator);
+	PRT_PROCESS *arenaProcess = PrtTestStartProcess(2, arena);
+	PRT_MACHINEINST *countingMachine = PrtMkMachine(countingProcess, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *arenaMachine = PrtMkMachine(arenaProcess, P_MACHINE_COUNTER, 0);
+
+	PRT_UINT32 allocsBeforeSends = counting.allocs;
+	PRT_INT32 expected = 0;
+	for (PRT_INT32 i = 1; i <= 1000; i++)
+	{
+		PrtTestSendAdd(countingMachine, i);
+		PrtTestSendAdd(arenaMachine, 2 * i);
+		expected += i;
+	}
+
+	PRT_TEST_CHECK(PrtTestGetTotal(countingMachine) == expected);
+	PRT_TEST_CHECK(PrtTestGetTotal(arenaMachine) == 2 * expected);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(countingMachine) == 1000);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(arenaMachine) == 1000);
+
+	// the sends to the counting process, and nothing sent to the arena process, came from the counting allocator.
+	PRT_TEST_CHECK(counting.allocs > allocsBeforeSends);
+	PRT_TEST_CHECK(counting.allocs > counting.frees);
+
+	PrtStopProcess(countingProcess);
+	PRT_TEST_CHECK(counting.allocs == counting.frees);
+
+	PRT_UINT32 allocsAfterStop = counting.allocs;
+	PrtStopProcess(arenaProcess);
+	PrtFreeArenaAllocator(arena);
+	PRT_TEST_CHECK(counting.allocs == allocsAfterStop);
+	PRT_TEST_CHECK(PrtTestLastError == P_TEST_ERROR_NONE);
+}
+
+static void TestFreshMachineIsLazy(void)
+{
+	COUNTING_ALLOCATOR counting = { { &CountingAlloc, NULL, &CountingFree, NULL }, 0, 0 };
+	counting.allocator.state = &counting;
+	PRT_PROCESS *process = PrtTestStartProcess(3, &counting.allocator);
+
+	PRT_UINT32 allocsBeforeCreate = counting.allocs;
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PRT_TEST_CHECK(counting.allocs - allocsBeforeCreate <= 16);
+
+	// nothing has used the variables, sent to the machine or sent to it remotely yet.
+	for (PRT_UINT32 i = 0; i < 3; i++)
+	{
+		PRT_TEST_CHECK(context->varValues[i] == NULL);
+	}
+	PRT_TEST_CHECK(context->recvMap == NULL);
+	PRT_TEST_CHECK(context->eventQueue.events == NULL);
+
+	PrtTestSendAdd(counter, 5);
+	PRT_TEST_CHECK(context->eventQueue.events != NULL);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 5);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PRT_TEST_CHECK(PrtTestGetCell(counter) == 5);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(counting.allocs == counting.frees);
+	PRT_TEST_CHECK(PrtTestLastError == P_TEST_ERROR_NONE);
+}
+
+static void TestSetAllocatorRestoresPrevious(void)
+{
+	PRT_ALLOCATOR *arena = PrtMkArenaAllocator();
+	PRT_ALLOCATOR *previous = PrtSetAllocator(arena);
+	PRT_TEST_CHECK(previous == NULL);
+	PRT_VALUE *value = PrtMkIntValue(7);
+	PRT_TEST_CHECK(PrtSetAllocator(previous) == arena);
+
+	// values are freed by the arena even though the default allocator is current again.
+	PRT_VALUE *clone = PrtCloneValue(value);
+	PRT_TEST_CHECK(PrtIsEqualValue(value, clone));
+	PrtFreeValue(value);
+	PrtFreeValue(clone);
+
+	// blocks larger than the biggest size class survive reallocation.
+	PrtSetAllocator(arena);
+	PRT_UINT8 *block = (PRT_UINT8 *)PrtMalloc(100);
+	for (PRT_UINT32 i = 0; i < 100; i++)
+	{
+		block[i] = (PRT_UINT8)i;
+	}
+	block = (PRT_UINT8 *)PrtRealloc(block, 10000);
+	PrtSetAllocator(previous);
+	for (PRT_UINT32 i = 0; i < 100; i++)
+	{
+		PRT_TEST_CHECK(block[i] == (PRT_UINT8)i);
+	}
+	PrtFree(block);
+	PrtFree(NULL);
+	PrtFreeArenaAllocator(arena);
+}
+
+#define ARENA_THREADS 4
+#define ARENA_ROUNDS 20000
+
+static PRT_ALLOCATOR *sharedArena;
+static void *volatile handoff[ARENA_THREADS];
+
+static void *ArenaWorker(void *arg)
+{
+	PRT_UINT32 self = (PRT_UINT32)(size_t)arg;
+	PrtSetAllocator(sharedArena);
+	for (PRT_UINT32 i = 0; i < ARENA_ROUNDS; i++)
+	{
+		PRT_UINT32 *block = (PRT_UINT32 *)PrtMalloc(8 + (i % 300));
+		block[0] = self;
+		// blocks allocated by one thread are freed by another.
+		void *other = __atomic_exchange_n(&handoff[(self + 1) % ARENA_THREADS], block, __ATOMIC_ACQ_REL);
+		PrtFree(other);
+	}
+	PrtSetAllocator(NULL);
+	return NULL;
+}
+
+static void TestArenaSharedByThreads(void)
+{
+	pthread_t threads[ARENA_THREADS];
+	sharedArena = PrtMkArenaAllocator();
+	for (PRT_UINT32 i = 0; i < ARENA_THREADS; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&threads[i], NULL, &ArenaWorker, (void *)(size_t)i) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < ARENA_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	for (PRT_UINT32 i = 0; i < ARENA_THREADS; i++)
+	{
+		PrtFree(handoff[i]);
+	}
+	PrtFreeArenaAllocator(sharedArena);
+}
+
+#define CYCLED_ARENAS 6		/* more than the 4 arenas a thread caches blocks for */
+#define CYCLE_ROUNDS 3000
+#define CYCLE_BLOCKS 100
+
+// Allocates and frees a round of blocks from arena on the calling thread, leaving some cached for it.
+static void UseArena(PRT_ALLOCATOR *arena)
+{
+	void *blocks[CYCLE_BLOCKS];
+	PRT_ALLOCATOR *previous = PrtSetAllocator(arena);
+	for (PRT_UINT32 i = 0; i < CYCLE_BLOCKS; i++)
+	{
+		blocks[i] = PrtMalloc(24);
+	}
+	for (PRT_UINT32 i = 0; i < CYCLE_BLOCKS; i++)
+	{
+		PrtFree(blocks[i]);
+	}
+	PrtSetAllocator(previous);
+}
+
+static void TestCyclingArenasStaysBounded(void)
+{
+	// the thread caches fewer arenas than it uses, so each visit to an arena finds its cache evicted.
+	PRT_ALLOCATOR *arenas[CYCLED_ARENAS];
+	size_t sizes[CYCLED_ARENAS];
+	for (PRT_UINT32 i = 0; i < CYCLED_ARENAS; i++)
+	{
+		arenas[i] = PrtMkArenaAllocator();
+	}
+	for (PRT_UINT32 round = 0; round < CYCLED_ARENAS; round++)
+	{
+		UseArena(arenas[round]);
+	}
+	for (PRT_UINT32 i = 0; i < CYCLED_ARENAS; i++)
+	{
+		sizes[i] = PrtGetArenaAllocatorSize(arenas[i]);
+		PRT_TEST_CHECK(sizes[i] > 0);
+	}
+	for (PRT_UINT32 round = 0; round < CYCLE_ROUNDS; round++)
+	{
+		UseArena(arenas[round % CYCLED_ARENAS]);
+	}
+	for (PRT_UINT32 i = 0; i < CYCLED_ARENAS; i++)
+	{
+		PRT_TEST_CHECK(PrtGetArenaAllocatorSize(arenas[i]) == sizes[i]);
+		PrtFreeArenaAllocator(arenas[i]);
+	}
+}
+
+static void *ShortLivedWorker(void *arg)
+{
+	UseArena((PRT_ALLOCATOR *)arg);
+	PrtFlushArenaCaches();
+	return NULL;
+}
+
+static void TestExitedThreadsHandBlocksBack(void)
+{
+	PRT_ALLOCATOR *arena = PrtMkArenaAllocator();
+	UseArena(arena);
+	size_t size = PrtGetArenaAllocatorSize(arena);
+	for (PRT_UINT32 i = 0; i < CYCLE_ROUNDS / 10; i++)
+	{
+		pthread_t thread;
+		PRT_TEST_CHECK(pthread_create(&thread, NULL, &ShortLivedWorker, arena) == 0);
+		pthread_join(thread, NULL);
+	}
+	PRT_TEST_CHECK(PrtGetArenaAllocatorSize(arena) == size);
+	PrtFreeArenaAllocator(arena);
+}
+
+int main(int argc, char *argv[])
+{
+	TestTwoProcessesWithDifferentAllocators();
+	TestFreshMachineIsLazy();
+	TestSetAllocatorRestoresPrevious();
+	TestArenaSharedByThreads();
+	TestCyclingArenasStaysBounded();
+	TestExitedThreadsHandBlocksBack();
+	printf("PrtAllocatorTest passed\n");
+	return 0;
+}
@@ -0,0 +1,185 @@
+#include "PrtTestProgram.h"
+
+/*
+* Sends runs of events to Counters and checks that a machine takes the run at the head of its queue in one go, hands
+* it out in order in the steps that follow, puts what is left back at the head of its queue when it enters a state or
+* a receive, and drops it when it halts; a process that records takes events one at a time.
+*/
+
+static PRT_MACHINEINST *MkIdleCounter(_Inout_ PRT_PROCESS *process)
+{
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	while (PrtStepMachine((PRT_MACHINEINST_PRIV *)counter))
+	{
+		continue;
+	}
+	return counter;
+}
+
+static PRT_PROCESS *StartBatchProcess(_In_ PRT_UINT32 data1)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	return process;
+}
+
+static PRT_UINT32 QueueSize(_In_ PRT_MACHINEINST *counter)
+{
+	return ((PRT_MACHINEINST_PRIV *)counter)->eventQueue.size;
+}
+
+static PRT_UINT32 BatchSize(_In_ PRT_MACHINEINST *counter)
+{
+	return ((PRT_MACHINEINST_PRIV *)counter)->batchCount;
+}
+
+static void CheckHistoryCountsUp(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 length)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_TEST_CHECK(PrtSeqSizeOf(history) == length);
+	for (PRT_UINT32 i = 0; i < length; i++)
+	{
+		PRT_TEST_CHECK(PrtPrimGetInt(PrtSeqGetNCIntIndex(history, i)) == (PRT_INT32)i + 1);
+	}
+	PrtFreeValue(history);
+}
+
+#define EVENTS (3 * PRT_MAX_DEQUEUE_BATCH)
+
+static void TestRunIsTakenInOneGo(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBatchProcess(1);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	for (PRT_INT32 i = 1; i <= EVENTS; i++)
+	{
+		PrtTestSendAdd(counter, i);
+	}
+
+	// the first step takes a full batch behind the event it handles, and the next ones leave the queue alone.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PRT_TEST_CHECK(BatchSize(counter) == PRT_MAX_DEQUEUE_BATCH);
+	PRT_TEST_CHECK(QueueSize(counter) == EVENTS - 1 - PRT_MAX_DEQUEUE_BATCH);
+	for (PRT_UINT32 i = 0; i < PRT_MAX_DEQUEUE_BATCH; i++)
+	{
+		PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	}
+	PRT_TEST_CHECK(BatchSize(counter) == 0);
+	PRT_TEST_CHECK(QueueSize(counter) == EVENTS - 1 - PRT_MAX_DEQUEUE_BATCH);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == PRT_MAX_DEQUEUE_BATCH + 1);
+
+	// events sent while a batch is out go behind it.
+	PrtTestSendAdd(counter, EVENTS + 1);
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	CheckHistoryCountsUp(counter, EVENTS + 1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestStateChangeReturnsBatch(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBatchProcess(2);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	PrtTestSendAdd(counter, 1);
+	PrtTestSendReset(counter);
+	PrtTestSendAdd(counter, 2);
+	PrtTestSendAdd(counter, 3);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(BatchSize(counter) == 3 && QueueSize(counter) == 0);
+
+	// the Counter leaves its state and enters it again on Reset, in two steps, so it goes back to its queue for the
+	// events behind it.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(BatchSize(counter) == 1 && QueueSize(counter) == 0);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	CheckHistoryCountsUp(counter, 3);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReceiveSeesBatch(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBatchProcess(3);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	PrtTestSendAdd(counter, 1);
+	PrtTestSendWait(counter, 1000000);
+	PrtTestSendAdd(counter, 2);
+	PrtTestSendAdd(counter, 3);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(BatchSize(counter) == 3);
+
+	// the receive in the Wait handler takes the Add that was batched behind it, and does not block.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->receive == NULL);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(BatchSize(counter) == 0 && QueueSize(counter) == 1);
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	CheckHistoryCountsUp(counter, 3);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestHaltDropsBatch(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBatchProcess(4);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	for (PRT_INT32 i = 1; i <= EVENTS; i++)
+	{
+		PrtTestSendAdd(counter, i);
+	}
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(BatchSize(counter) == 0);
+	PRT_TEST_CHECK(!PrtStepMachine((PRT_MACHINEINST_PRIV *)counter));
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestRecordingTakesOneAtATime(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBatchProcess(5);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	for (PRT_INT32 i = 1; i <= EVENTS; i++)
+	{
+		PrtTestSendAdd(counter, i);
+	}
+
+	// a recording has a dequeue for every event, in the step that handles it.
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		PRT_TEST_CHECK(BatchSize(counter) == 0);
+	}
+	CheckHistoryCountsUp(counter, EVENTS);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtFree(recording);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestRunIsTakenInOneGo();
+	TestStateChangeReturnsBatch();
+	TestReceiveSeesBatch();
+	TestHaltDropsBatch();
+	TestRecordingTakesOneAtATime();
+	printf("PrtBatchTest passed\n");
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include <pthread.h>
+#include <time.h>
+#include "PrtTestProgram.h"
+
+/*
+* Runs Counters that call a blocking foreign function, and host code that posts blocking jobs to Counters, and checks
+* that the Counter waits for the result without holding up its thread or other machines, handles events queued
+* meanwhile only after it, and that the results come back the same in a replay and are not lost when the process stops.
+*/
+
+/* How long a test waits for helpers before it gives up, in milliseconds */
+#define PATIENCE 5000
+
+static PRT_PROCESS *StartBlockingProcess(_In_ PRT_UINT32 data1, _In_ PRT_BOOLEAN cooperative)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	if (cooperative)
+	{
+		PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	}
+	return process;
+}
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+// Runs the machines of a cooperative process on the calling thread until counter has length events in its history.
+static void RunUntilHistory(_Inout_ PRT_PROCESS *process, _In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 length)
+{
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	RunUntilIdle(process);
+	while (PrtTestGetHistoryLength(counter) < length)
+	{
+		PRT_TEST_CHECK(PrtGetMonotonicTime() < start + PATIENCE);
+		PRT_TEST_CHECK(!PrtWaitForWork(process));
+		RunUntilIdle(process);
+	}
+}
+
+// Waits until counter, run by helpers of a task-neutral process, has length events in its history.
+static void WaitForHistory(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 length)
+{
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	while (PrtTestGetHistoryLength(counter) < length)
+	{
+		PRT_TEST_CHECK(PrtGetMonotonicTime() < start + PATIENCE);
+		struct timespec pause = { 0, 1000000 };
+		nanosleep(&pause, NULL);
+	}
+}
+
+static PRT_INT32 HistoryAt(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 index)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_INT32 value = PrtPrimGetInt(PrtSeqGetNCIntIndex(history, index));
+	PrtFreeValue(history);
+	return value;
+}
+
+static pthread_mutex_t lookupLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t lookupThread;		/* guarded by lookupLock; several helpers may run Lookup at once */
+static volatile PRT_UINT32 lookups = 0;
+
+// A blocking function for PrtPostBlocking that returns its argument.
+static PRT_VALUE *PRT_CALL_CONV Lookup(_Inout_ void *arg)
+{
+	if (PrtTestDoubleGate != NULL)
+	{
+		PrtWaitSemaphore(PrtTestDoubleGate, -1);
+	}
+	pthread_mutex_lock(&lookupLock);
+	lookupThread = pthread_self();
+	pthread_mutex_unlock(&lookupLock);
+	PrtAtomicIncrement(&lookups);
+	return PrtMkIntValue((PRT_INT32)(size_t)arg);
+}
+
+static PRT_VALUE *PRT_CALL_CONV LookupNothing(_Inout_ void *arg)
+{
+	PrtAtomicIncrement(&lookups);
+	return NULL;
+}
+
+static void TestCallSuspendsMachineOnly(void)
+{
+	PrtTestResetErrors();
+	PrtTestDoubleGate = PrtCreateSemaphore(0, 32767);
+	PRT_PROCESS *process = StartBlockingProcess(1, PRT_TRUE);
+	PRT_MACHINEINST *fetcher = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *other = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendFetch(fetcher, 5);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)fetcher)->blockingJob != NULL);
+
+	// the worker is free to run other machines, and the fetcher leaves its queue alone until Double returns.
+	PrtTestSendAdd(fetcher, 3);
+	PrtTestSendAdd(other, 1);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetTotal(other) == 1);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(fetcher) == 0);
+
+	PrtReleaseSemaphore(PrtTestDoubleGate);
+	RunUntilHistory(process, fetcher, 2);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)fetcher)->blockingJob == NULL);
+	PRT_TEST_CHECK(HistoryAt(fetcher, 0) == 10);
+	PRT_TEST_CHECK(HistoryAt(fetcher, 1) == 3);
+	PRT_TEST_CHECK(PrtTestGetTotal(fetcher) == 13);
+
+	PrtStopProcess(process);
+	PrtDestroySemaphore(PrtTestDoubleGate);
+	PrtTestDoubleGate = NULL;
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestCallUnderTaskNeutral(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBlockingProcess(2, PRT_FALSE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendFetch(counter, 4);
+	WaitForHistory(counter, 1);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == 8);
+
+	PrtTestSendFetch(counter, 1);
+	PrtTestSendAdd(counter, 2);
+	WaitForHistory(counter, 3);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 2) == 2);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 12);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestPostBlocking(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBlockingProcess(3, PRT_FALSE);
+	PrtSetHelperThreads(process, 1);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	lookupThread = pthread_self();
+	lookups = 0;
+
+	// one helper runs the jobs in the order they were posted.
+	PrtPostBlocking(counter, &Lookup, (void *)(size_t)7, P_EVENT_ADD);
+	PrtPostBlocking(counter, &Lookup, (void *)(size_t)9, P_EVENT_ADD);
+	PrtPostBlocking(counter, &LookupNothing, NULL, P_EVENT_RESET);
+	WaitForHistory(counter, 2);
+	pthread_mutex_lock(&lookupLock);
+	PRT_TEST_CHECK(!pthread_equal(lookupThread, pthread_self()));
+	pthread_mutex_unlock(&lookupLock);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == 7);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == 9);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(lookups == 3);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define STOPPED_FETCHERS 4
+#define STOPPED_POSTS 3
+
+static void *OpenGateLater(void *arg)
+{
+	struct timespec pause = { 0, 20000000 };
+	nanosleep(&pause, NULL);
+	for (PRT_UINT32 i = 0; i < STOPPED_FETCHERS + STOPPED_POSTS; i++)
+	{
+		PrtReleaseSemaphore(PrtTestDoubleGate);
+	}
+	return NULL;
+}
+
+static void TestStopRunsPendingJobs(void)
+{
+	PrtTestResetErrors();
+	PrtTestDoubleGate = PrtCreateSemaphore(0, 32767);
+	PRT_PROCESS *process = StartBlockingProcess(4, PRT_TRUE);
+	PrtSetHelperThreads(process, 2);
+	lookups = 0;
+	for (PRT_UINT32 i = 0; i < STOPPED_FETCHERS; i++)
+	{
+		PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtTestSendFetch(counter, (PRT_INT32)i);
+		if (i < STOPPED_POSTS)
+		{
+			PrtPostBlocking(counter, &Lookup, (void *)(size_t)i, P_EVENT_ADD);
+		}
+	}
+	RunUntilIdle(process);
+
+	// the stop waits for every job, including those no helper has picked up yet, and drops what they return.
+	pthread_t opener;
+	PRT_TEST_CHECK(pthread_create(&opener, NULL, &OpenGateLater, NULL) == 0);
+	PrtStopProcess(process);
+	pthread_join(opener, NULL);
+	PRT_TEST_CHECK(lookups == STOPPED_POSTS);
+
+	PrtDestroySemaphore(PrtTestDoubleGate);
+	PrtTestDoubleGate = NULL;
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReplayUsesRecordedResults(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartBlockingProcess(5, PRT_TRUE);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendFetch(counter, 6);
+	PrtTestSendAdd(counter, 1);
+	RunUntilHistory(process, counter, 2);
+	PrtPostBlocking(counter, &Lookup, (void *)(size_t)4, P_EVENT_ADD);
+	RunUntilHistory(process, counter, 3);
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	lookups = 0;
+	PRT_PROCESS *replay = StartBlockingProcess(6, PRT_FALSE);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	PRT_VALUE *replayed = PrtTestGetHistory(((PRT_PROCESS_PRIV *)replay)->machines[0]);
+	PRT_TEST_CHECK(PrtIsEqualValue(history, replayed));
+
+	// the posted job is not run again: the event it sent is in the recording.
+	PRT_TEST_CHECK(lookups == 0);
+	PrtFreeValue(history);
+	PrtFreeValue(replayed);
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestCallSuspendsMachineOnly();
+	TestCallUnderTaskNeutral();
+	TestPostBlocking();
+	TestStopRunsPendingJobs();
+	TestReplayUsesRecordedResults();
+	printf("PrtBlockingTest passed\n");
+	return 0;
+}
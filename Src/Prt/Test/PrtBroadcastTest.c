@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include "PrtTestProgram.h"
+
+/*
+* Broadcasts Add and Forward to many Counters, and checks that every receiver handles the event once with a payload of
+* its own, that the shared payload is freed once every receiver has dequeued or dropped the event, including receivers
+* that halt and queues cleared by PrtStopProcess, and that broadcasts come back the same in a replay.
+*/
+
+#define RECEIVERS 150
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_PROCESS *StartBroadcastProcess(_In_ PRT_UINT32 data1, _In_ PRT_MACHINEINST **counters, _In_ PRT_UINT32 n)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	for (PRT_UINT32 i = 0; i < n; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	}
+	return process;
+}
+
+static void BroadcastAdd(_Inout_ PRT_MACHINEINST **counters, _In_ PRT_UINT32 n, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtBroadcast(NULL, counters, n, event, payload);
+	PrtFreeValue(payload);
+	PrtFreeValue(event);
+}
+
+// Broadcasts Forward(target, x), a tuple every receiver takes apart to send Add to target.
+static void BroadcastForward(_Inout_ PRT_MACHINEINST **counters, _In_ PRT_UINT32 n, _In_ PRT_MACHINEINST *target, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_FORWARD);
+	PRT_VALUE *payload = PrtMkDefaultValue(PrtGetPayloadType((PRT_MACHINEINST_PRIV *)counters[0], event));
+	PRT_VALUE *amount = PrtMkIntValue(x);
+	PrtTupleSet(payload, 0, target->id);
+	PrtTupleSet(payload, 1, amount);
+	PrtBroadcast(NULL, counters, n, event, payload);
+	PrtFreeValue(amount);
+	PrtFreeValue(payload);
+	PrtFreeValue(event);
+}
+
+static void TestEveryReceiverHandlesOnce(void)
+{
+	PrtTestResetErrors();
+	PRT_MACHINEINST *counters[RECEIVERS + 1];
+	PRT_PROCESS *process = StartBroadcastProcess(1, counters, RECEIVERS + 1);
+	PRT_MACHINEINST *sink = counters[RECEIVERS];
+	BroadcastAdd(counters, RECEIVERS, 4);
+	BroadcastAdd(counters, RECEIVERS, 5);
+	BroadcastForward(counters, RECEIVERS, sink, 2);
+	RunUntilIdle(process);
+	for (PRT_UINT32 i = 0; i < RECEIVERS; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetTotal(counters[i]) == 9);
+		PRT_TEST_CHECK(PrtTestGetHistoryLength(counters[i]) == 2);
+	}
+
+	// every Forward reached the sink, whichever way the choice in it went.
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(sink) == RECEIVERS);
+
+	// a broadcast to no one sends nothing.
+	BroadcastAdd(counters, 0, 1);
+	PRT_TEST_CHECK(PrtStepProcess(process) == PRT_STEP_IDLE);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestDroppedEventsLetGo(void)
+{
+	PrtTestResetErrors();
+	PRT_MACHINEINST *counters[RECEIVERS];
+	PRT_PROCESS *process = StartBroadcastProcess(2, counters, RECEIVERS);
+
+	// some receivers have halted before the broadcast, some halt with it queued, and the rest never dequeue it.
+	for (PRT_UINT32 i = 0; i < RECEIVERS; i += 3)
+	{
+		PrtHaltMachine((PRT_MACHINEINST_PRIV *)counters[i]);
+	}
+	BroadcastForward(counters, RECEIVERS, counters[1], 7);
+	for (PRT_UINT32 i = 1; i < RECEIVERS; i += 3)
+	{
+		PrtHaltMachine((PRT_MACHINEINST_PRIV *)counters[i]);
+	}
+	for (PRT_UINT32 i = 2; i < RECEIVERS; i += 3)
+	{
+		PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counters[i])->eventQueue.size == 1);
+		PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counters[i])->eventQueue.events[0].shared != NULL);
+	}
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define BROADCASTERS 4
+#define ROUNDS 200
+
+static PRT_MACHINEINST *sharedCounters[RECEIVERS];
+
+static void *BroadcastRounds(void *arg)
+{
+	for (PRT_UINT32 i = 0; i < ROUNDS; i++)
+	{
+		BroadcastAdd(sharedCounters, RECEIVERS, 1);
+	}
+	return NULL;
+}
+
+static void TestConcurrentBroadcasts(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	for (PRT_UINT32 i = 0; i < RECEIVERS; i++)
+	{
+		sharedCounters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	}
+	pthread_t threads[BROADCASTERS];
+	for (PRT_UINT32 i = 0; i < BROADCASTERS; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&threads[i], NULL, &BroadcastRounds, NULL) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < BROADCASTERS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	for (PRT_UINT32 i = 0; i < RECEIVERS; i++)
+	{
+		while (PrtTestGetTotal(sharedCounters[i]) < BROADCASTERS * ROUNDS)
+		{
+			PRT_TEST_CHECK(PrtGetMonotonicTime() < start + 10000);
+			PrtYieldThread();
+		}
+		PRT_TEST_CHECK(PrtTestGetTotal(sharedCounters[i]) == BROADCASTERS * ROUNDS);
+	}
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReplayMatches(void)
+{
+	PrtTestResetErrors();
+	PRT_MACHINEINST *counters[RECEIVERS];
+	PRT_PROCESS *process = StartBroadcastProcess(4, counters, 0);
+	PrtStartRecording(process);
+	for (PRT_UINT32 i = 0; i < RECEIVERS; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	}
+	BroadcastAdd(counters, RECEIVERS, 3);
+	BroadcastForward(counters, RECEIVERS - 1, counters[RECEIVERS - 1], 6);
+	RunUntilIdle(process);
+	PRT_VALUE *history = PrtTestGetHistory(counters[RECEIVERS - 1]);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	PRT_PROCESS *replay = PrtTestStartProcess(5, NULL);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	PRT_VALUE *replayed = PrtTestGetHistory(((PRT_PROCESS_PRIV *)replay)->machines[RECEIVERS - 1]);
+	PRT_TEST_CHECK(PrtIsEqualValue(history, replayed));
+	PrtFreeValue(history);
+	PrtFreeValue(replayed);
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestEveryReceiverHandlesOnce();
+	TestDroppedEventsLetGo();
+	TestConcurrentBroadcasts();
+	TestReplayMatches();
+	printf("PrtBroadcastTest passed\n");
+	return 0;
+}
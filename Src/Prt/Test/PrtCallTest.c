@@ -0,0 +1,268 @@
+#include "PrtTestProgram.h"
+
+/*
+* Has Counters call each other, on a clock the test moves by hand, and checks that a reply reaches the caller that
+* made the call without going through its queue, that a call ends when its timeout passes or its responder halts,
+* that a reply to a call that is over is dropped, and that calls end the same way under both scheduling policies and
+* in a replay.
+*/
+
+static volatile PRT_UINT64 fakeNow = 0;
+
+static PRT_UINT64 PRT_CALL_CONV FakeNow(_Inout_ void *state)
+{
+	return fakeNow;
+}
+
+static PRT_CLOCK fakeClock = { &FakeNow, NULL };
+
+static PRT_PROCESS *StartCallProcess(_In_ PRT_UINT32 data1, _In_ PRT_BOOLEAN cooperative)
+{
+	fakeNow = 1000;
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	if (cooperative)
+	{
+		PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	}
+	PrtSetClock(process, &fakeClock);
+	return process;
+}
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_MACHINEINST *MkIdleCounter(_Inout_ PRT_PROCESS *process)
+{
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	while (PrtStepMachine((PRT_MACHINEINST_PRIV *)counter))
+	{
+		continue;
+	}
+	return counter;
+}
+
+static PRT_INT32 HistoryAt(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 index)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_INT32 value = PrtPrimGetInt(PrtSeqGetNCIntIndex(history, index));
+	PrtFreeValue(history);
+	return value;
+}
+
+static PRT_BOOLEAN IsInCall(_In_ PRT_MACHINEINST *counter)
+{
+	return ((PRT_MACHINEINST_PRIV *)counter)->call != NULL;
+}
+
+#define CALLERS 8
+
+static void TestReplyReachesCaller(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartCallProcess(1, PRT_TRUE);
+	PRT_MACHINEINST *responder = MkIdleCounter(process);
+	PRT_MACHINEINST *callers[CALLERS];
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		callers[i] = MkIdleCounter(process);
+		PrtTestSendAsk(callers[i], responder, i + 1, 0);
+	}
+
+	// every caller is suspended before the responder sees any request.
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		PrtStepMachine((PRT_MACHINEINST_PRIV *)callers[i]);
+		PRT_TEST_CHECK(IsInCall(callers[i]));
+	}
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)responder)->eventQueue.size == CALLERS);
+
+	// each reply goes to the caller whose call it answers, and none of them through a queue.
+	RunUntilIdle(process);
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		PRT_TEST_CHECK(!IsInCall(callers[i]));
+		PRT_TEST_CHECK(PrtTestGetTotal(callers[i]) == 2 * (i + 1));
+		PRT_TEST_CHECK(PrtTestGetHistoryLength(callers[i]) == 1);
+		PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)callers[i])->eventQueue.size == 0);
+	}
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(responder) == 0);
+
+	// a caller suspended in a call leaves the events sent to it in its queue until the call is over.
+	PrtTestSendAsk(callers[0], responder, 10, 0);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)callers[0]);
+	PrtTestSendAdd(callers[0], 1);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)callers[0]);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(callers[0]) == 1);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(callers[0]) == 3);
+	PRT_TEST_CHECK(HistoryAt(callers[0], 1) == 20);
+	PRT_TEST_CHECK(HistoryAt(callers[0], 2) == 1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestTimeoutEndsCall(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartCallProcess(2, PRT_TRUE);
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_MACHINEINST *caller = MkIdleCounter(process);
+	PRT_MACHINEINST *responder = MkIdleCounter(process);
+
+	// the responder ignores the request, so the call ends at its timeout, not before.
+	PrtTestSendAsk(caller, responder, -1, 50);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(IsInCall(caller));
+	PRT_TEST_CHECK(privateProcess->timers.armed == 1);
+	fakeNow += 49;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(caller) == 0);
+	fakeNow += 1;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(!IsInCall(caller));
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(caller) == 1);
+	PRT_TEST_CHECK(HistoryAt(caller, 0) == -1);
+
+	// a reply to the call that timed out is not taken for the reply to the next call.
+	PrtTestSendAsk(caller, responder, 3, 10);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)caller);
+	fakeNow += 10;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 1);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)caller);
+	PrtTestSendAsk(caller, responder, 5, 0);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)caller);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)responder)->eventQueue.size == 2);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(caller) == 3);
+	PRT_TEST_CHECK(HistoryAt(caller, 1) == -1);
+	PRT_TEST_CHECK(HistoryAt(caller, 2) == 10);
+	PRT_TEST_CHECK(PrtTestGetTotal(caller) == 10);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 0);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestHaltEndsCall(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartCallProcess(3, PRT_TRUE);
+	PRT_MACHINEINST *caller = MkIdleCounter(process);
+	PRT_MACHINEINST *other = MkIdleCounter(process);
+	PRT_MACHINEINST *responder = MkIdleCounter(process);
+	PRT_MACHINEINST *late = MkIdleCounter(process);
+	PrtTestSendAsk(caller, responder, -1, 0);
+	PrtTestSendAsk(other, caller, -1, 0);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(IsInCall(caller) && IsInCall(other));
+
+	// only the calls to the machine that halts end, and a machine that halted already ends a call at once.
+	PrtTestSendAsk(caller, late, 1, 0);
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)late);
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)responder);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(!IsInCall(caller) && IsInCall(other));
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(caller) == 2);
+	PRT_TEST_CHECK(HistoryAt(caller, 0) == -2);
+	PRT_TEST_CHECK(HistoryAt(caller, 1) == -2);
+
+	// a reply to a caller that halted is dropped, and so is the call of a machine that halts in it.
+	PrtTestSendAsk(caller, other, 1, 0);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)caller);
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)caller);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(other) == 1);
+	PRT_TEST_CHECK(HistoryAt(other, 0) == -2);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestTaskNeutral(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartCallProcess(4, PRT_FALSE);
+	PRT_MACHINEINST *caller = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *responder = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// the responder runs on the sending thread, and replies before the send returns.
+	PrtTestSendAsk(caller, responder, 4, 0);
+	PRT_TEST_CHECK(!IsInCall(caller));
+	PRT_TEST_CHECK(PrtTestGetTotal(caller) == 8);
+
+	PrtTestSendAsk(caller, responder, -1, 20);
+	PRT_TEST_CHECK(IsInCall(caller));
+	fakeNow += 20;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 1);
+	PRT_TEST_CHECK(!IsInCall(caller));
+	PRT_TEST_CHECK(HistoryAt(caller, 1) == -1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReplayMatches(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartCallProcess(5, PRT_TRUE);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *callers[CALLERS];
+	PRT_MACHINEINST *responder = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *doomed = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		callers[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtTestSendAsk(callers[i], i % 4 == 3 ? doomed : responder, i % 2 == 0 ? i : -1, i % 4 == 1 ? 30 : 0);
+	}
+	RunUntilIdle(process);
+	fakeNow += 30;
+	RunUntilIdle(process);
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)doomed);
+	RunUntilIdle(process);
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		PrtTestSendAsk(callers[i], responder, i, 0);
+	}
+	RunUntilIdle(process);
+
+	PRT_VALUE *histories[CALLERS];
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		histories[i] = PrtTestGetHistory(callers[i]);
+		PRT_TEST_CHECK(PrtSeqSizeOf(histories[i]) == 2);
+	}
+	PRT_TEST_CHECK(HistoryAt(callers[1], 0) == -1);
+	PRT_TEST_CHECK(HistoryAt(callers[2], 0) == 4);
+	PRT_TEST_CHECK(HistoryAt(callers[3], 0) == -2);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	// the replay runs on the platform clock, on which no call would have timed out.
+	PRT_PROCESS *replay = PrtTestStartProcess(6, NULL);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	for (PRT_INT32 i = 0; i < CALLERS; i++)
+	{
+		PRT_MACHINEINST *replayed = ((PRT_PROCESS_PRIV *)replay)->machines[2 + i];
+		PRT_VALUE *replayedHistory = PrtTestGetHistory(replayed);
+		PRT_TEST_CHECK(PrtIsEqualValue(histories[i], replayedHistory));
+		PrtFreeValue(replayedHistory);
+		PrtFreeValue(histories[i]);
+	}
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestReplyReachesCaller();
+	TestTimeoutEndsCall();
+	TestHaltEndsCall();
+	TestTaskNeutral();
+	TestReplayMatches();
+	printf("PrtCallTest passed\n");
+	return 0;
+}
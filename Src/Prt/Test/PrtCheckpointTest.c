@@ -0,0 +1,233 @@
+#include "PrtTestProgram.h"
+
+#define MACHINES 50
+#define CHECKPOINT_PATH "PrtCheckpointTest.ckpt"
+#define DAMAGED_PATH "PrtCheckpointTest.damaged"
+
+static PRT_MACHINEINST *GetMachine(PRT_PROCESS *process, PRT_UINT32 index)
+{
+	return ((PRT_PROCESS_PRIV *)process)->machines[index];
+}
+
+static void TestRestoreKeepsStateAndIds(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	for (PRT_UINT32 i = 0; i < MACHINES; i++)
+	{
+		PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		for (PRT_UINT32 j = 0; j <= i; j++)
+		{
+			PrtTestSendAdd(counter, (PRT_INT32)j - 10);
+		}
+	}
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)GetMachine(process, 3));
+	PrtSetHibernationPolicy(process, 0);
+	PrtHibernateMachine((PRT_MACHINEINST_PRIV *)GetMachine(process, 4));
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+
+	process = PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(process != NULL);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->guid.data1 == 1);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->numMachines == MACHINES);
+	for (PRT_UINT32 i = 0; i < MACHINES; i++)
+	{
+		PRT_MACHINEINST_PRIV *counter = (PRT_MACHINEINST_PRIV *)GetMachine(process, i);
+		if (i == 3)
+		{
+			PRT_TEST_CHECK(counter->runState & PRT_RUNSTATE_HALTED);
+			continue;
+		}
+		PRT_INT32 expected = (PRT_INT32)((i + 1) * i / 2) - 10 * (PRT_INT32)(i + 1);
+		PRT_TEST_CHECK(counter->id->valueUnion.mid->machineId == i + 1);
+		PRT_TEST_CHECK(PrtGetMachine(process, counter->id) == (PRT_MACHINEINST *)counter);
+		PRT_TEST_CHECK(PrtTestGetTotal((PRT_MACHINEINST *)counter) == expected);
+		PRT_TEST_CHECK(PrtTestGetCell((PRT_MACHINEINST *)counter) == expected);
+		PRT_TEST_CHECK(PrtTestGetHistoryLength((PRT_MACHINEINST *)counter) == i + 1);
+
+		// the restored machine keeps handling events where it left off.
+		PrtTestSendAdd((PRT_MACHINEINST *)counter, 1000);
+		PRT_TEST_CHECK(PrtTestGetTotal((PRT_MACHINEINST *)counter) == expected + 1000);
+	}
+
+	// machines made after the restore get fresh ids.
+	PRT_MACHINEINST *fresh = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(fresh->id->valueUnion.mid->machineId == MACHINES + 1);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+	PrtStopProcess(process);
+}
+
+static void TestQueuedEventsAreRestored(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+
+	// nothing runs until the process is stepped, so the entry function and the events are still pending.
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 1; i <= 100; i++)
+	{
+		PrtTestSendAdd(counter, i);
+	}
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->eventQueue.size == 100);
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+
+	process = PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(process != NULL);
+	counter = GetMachine(process, 0);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 5050);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 100);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+	PrtStopProcess(process);
+}
+
+static void TestBadFilesAreRejected(void)
+{
+	PRT_TEST_CHECK(PrtRestoreProcess("PrtCheckpointTest.missing", &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+
+	// bump the version.
+	FILE *file = fopen(CHECKPOINT_PATH, "r+b");
+	PRT_TEST_CHECK(file != NULL);
+	fseek(file, sizeof(PRT_UINT32), SEEK_SET);
+	PRT_UINT32 version = PRT_CHECKPOINT_VERSION + 1;
+	fwrite(&version, sizeof(PRT_UINT32), 1, file);
+	fclose(file);
+	PRT_TEST_CHECK(PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+}
+
+static PRT_UINT8 *ReadWholeFile(_In_ const char *path, _Out_ PRT_UINT32 *size)
+{
+	FILE *file = fopen(path, "rb");
+	PRT_TEST_CHECK(file != NULL);
+	fseek(file, 0, SEEK_END);
+	*size = (PRT_UINT32)ftell(file);
+	fseek(file, 0, SEEK_SET);
+	PRT_UINT8 *bytes = (PRT_UINT8 *)malloc(*size);
+	PRT_TEST_CHECK(fread(bytes, 1, *size, file) == *size);
+	fclose(file);
+	return bytes;
+}
+
+static void WriteWholeFile(_In_ const char *path, _In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size)
+{
+	FILE *file = fopen(path, "wb");
+	PRT_TEST_CHECK(file != NULL);
+	PRT_TEST_CHECK(fwrite(bytes, 1, size, file) == size);
+	fclose(file);
+}
+
+// writes records with the trailer a checkpoint of them would have, so that the restore gets past the hash.
+static void WriteRecords(_In_ const char *path, _In_ const PRT_UINT8 *records, _In_ PRT_UINT32 size)
+{
+	PRT_UINT8 *bytes = (PRT_UINT8 *)malloc(size + sizeof(PRT_UINT32));
+	PRT_UINT32 hash = 2166136261u;
+	for (PRT_UINT32 i = 0; i < size; i++)
+	{
+		hash = (hash ^ records[i]) * 16777619u;
+	}
+	memcpy(bytes, records, size);
+	memcpy(bytes + size, &hash, sizeof(PRT_UINT32));
+	WriteWholeFile(path, bytes, size + sizeof(PRT_UINT32));
+	free(bytes);
+}
+
+static void TestDamagedFilesAreRejected(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(4, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PrtTestSendAdd(counter, 7);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PrtTestSendAdd(counter, -300);
+	PrtTestSendReset(counter);
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+	PRT_UINT32 size;
+	PRT_UINT8 *bytes = ReadWholeFile(CHECKPOINT_PATH, &size);
+
+	// every cut of the records ends in the middle of something the reader needs, even with a hash that matches.
+	PRT_UINT32 records = size - sizeof(PRT_UINT32);
+	for (PRT_UINT32 length = 0; length < records; length++)
+	{
+		WriteRecords(DAMAGED_PATH, bytes, length);
+		PRT_TEST_CHECK(PrtRestoreProcess(DAMAGED_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+		WriteWholeFile(DAMAGED_PATH, bytes, length);
+		PRT_TEST_CHECK(PrtRestoreProcess(DAMAGED_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+	}
+
+	// a damaged byte anywhere fails the hash, and records with trailing bytes are rejected too.
+	for (PRT_UINT32 i = 0; i < size; i++)
+	{
+		bytes[i] ^= 0x40;
+		WriteWholeFile(DAMAGED_PATH, bytes, size);
+		PRT_TEST_CHECK(PrtRestoreProcess(DAMAGED_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+		bytes[i] ^= 0x40;
+	}
+	PRT_UINT8 *longer = (PRT_UINT8 *)malloc(records + 1);
+	memcpy(longer, bytes, records);
+	longer[records] = 0;
+	WriteRecords(DAMAGED_PATH, longer, records + 1);
+	PRT_TEST_CHECK(PrtRestoreProcess(DAMAGED_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL) == NULL);
+	free(longer);
+
+	// and the records as written still restore.
+	WriteRecords(DAMAGED_PATH, bytes, records);
+	process = PrtRestoreProcess(DAMAGED_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(process != NULL);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(GetMachine(process, 0)) == 2);
+	PrtStopProcess(process);
+	free(bytes);
+	remove(DAMAGED_PATH);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestFailedCheckpointKeepsOldOne(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(5, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendAdd(counter, 5);
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+
+	// a machine waiting in a receive cannot be written, and the checkpoint already at the path stays as it was.
+	PrtTestSendWait(counter, 1000000);
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->receive != NULL);
+	PRT_TEST_CHECK(!PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PRT_TEST_CHECK(fopen(CHECKPOINT_PATH ".tmp", "rb") == NULL);
+	PrtStopProcess(process);
+
+	process = PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(process != NULL);
+	PRT_TEST_CHECK(PrtTestGetTotal(GetMachine(process, 0)) == 5);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestRestoreKeepsStateAndIds();
+	TestQueuedEventsAreRestored();
+	TestBadFilesAreRejected();
+	TestDamagedFilesAreRejected();
+	TestFailedCheckpointKeepsOldOne();
+	remove(CHECKPOINT_PATH);
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include "PrtTestProgram.h"
+
+/*
+* Checks that the choices of a machine depend only on the seed of its process and the id of the machine:
+* Counters forward events with a chosen sign, and the Counters they forward to must see the same history
+* whatever order the forwarders run in, and a different one under another seed.
+*/
+
+#define FORWARDERS 2
+#define FORWARDS 200
+#define SEED 12345
+
+typedef struct CHOICE_RUN
+{
+	PRT_PROCESS		*process;
+	PRT_MACHINEINST	*forwarders[FORWARDERS];
+	PRT_MACHINEINST	*targets[FORWARDERS];
+} CHOICE_RUN;
+
+static void StartChoiceRun(_Out_ CHOICE_RUN *run, _In_ PRT_UINT32 data1, _In_ PRT_UINT64 seed)
+{
+	run->process = PrtTestStartProcess(data1, NULL);
+	PrtSetChoiceSeed(run->process, seed);
+	for (PRT_UINT32 i = 0; i < FORWARDERS; i++)
+	{
+		run->forwarders[i] = PrtMkMachine(run->process, P_MACHINE_COUNTER, 0);
+		run->targets[i] = PrtMkMachine(run->process, P_MACHINE_COUNTER, 0);
+	}
+}
+
+static PRT_BOOLEAN SameTargetHistories(_In_ CHOICE_RUN *first, _In_ CHOICE_RUN *second)
+{
+	PRT_BOOLEAN same = PRT_TRUE;
+	for (PRT_UINT32 i = 0; i < FORWARDERS; i++)
+	{
+		PRT_VALUE *firstHistory = PrtTestGetHistory(first->targets[i]);
+		PRT_VALUE *secondHistory = PrtTestGetHistory(second->targets[i]);
+		PRT_TEST_CHECK(PrtSeqSizeOf(firstHistory) == FORWARDS);
+		same = same && PrtIsEqualValue(firstHistory, secondHistory);
+		PrtFreeValue(firstHistory);
+		PrtFreeValue(secondHistory);
+	}
+	return same;
+}
+
+static void TestStreamsArePerMachine(void)
+{
+	PrtTestResetErrors();
+
+	// one forwarder after the other
+	CHOICE_RUN sequential;
+	StartChoiceRun(&sequential, 1, SEED);
+	PRT_TEST_CHECK(PrtGetChoiceSeed(sequential.process) == SEED);
+	for (PRT_UINT32 i = 0; i < FORWARDERS; i++)
+	{
+		for (PRT_INT32 x = 1; x <= FORWARDS; x++)
+		{
+			PrtTestSendForward(sequential.forwarders[i], sequential.targets[i], x);
+		}
+	}
+
+	// the forwarders interleaved, in reverse order
+	CHOICE_RUN interleaved;
+	StartChoiceRun(&interleaved, 2, SEED);
+	for (PRT_INT32 x = 1; x <= FORWARDS; x++)
+	{
+		for (PRT_INT32 i = FORWARDERS - 1; i >= 0; i--)
+		{
+			PrtTestSendForward(interleaved.forwarders[i], interleaved.targets[i], x);
+		}
+	}
+	PRT_TEST_CHECK(SameTargetHistories(&sequential, &interleaved));
+
+	// another seed makes other choices
+	CHOICE_RUN reseeded;
+	StartChoiceRun(&reseeded, 3, SEED + 1);
+	for (PRT_UINT32 i = 0; i < FORWARDERS; i++)
+	{
+		for (PRT_INT32 x = 1; x <= FORWARDS; x++)
+		{
+			PrtTestSendForward(reseeded.forwarders[i], reseeded.targets[i], x);
+		}
+	}
+	PRT_TEST_CHECK(!SameTargetHistories(&sequential, &reseeded));
+
+	// both signs are chosen, about equally often
+	PRT_INT32 total = PrtTestGetTotal(sequential.targets[0]);
+	PRT_TEST_CHECK(total != FORWARDS * (FORWARDS + 1) / 2 && total != -FORWARDS * (FORWARDS + 1) / 2);
+
+	PrtStopProcess(sequential.process);
+	PrtStopProcess(interleaved.process);
+	PrtStopProcess(reseeded.process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define CHOOSE_THREADS 4
+#define CHOOSE_ROUNDS 100000
+
+static void *Chooser(void *arg)
+{
+	PRT_UINT32 *trues = (PRT_UINT32 *)arg;
+	for (PRT_UINT32 i = 0; i < CHOOSE_ROUNDS; i++)
+	{
+		*trues += PrtChoose() ? 1 : 0;
+	}
+	return NULL;
+}
+
+static void TestChooseOnManyThreads(void)
+{
+	pthread_t threads[CHOOSE_THREADS];
+	PRT_UINT32 trues[CHOOSE_THREADS] = { 0 };
+	for (PRT_UINT32 i = 0; i < CHOOSE_THREADS; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&threads[i], NULL, &Chooser, &trues[i]) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < CHOOSE_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+		// a fair coin lands within a few percent of half over this many throws.
+		PRT_TEST_CHECK(trues[i] > CHOOSE_ROUNDS * 45 / 100 && trues[i] < CHOOSE_ROUNDS * 55 / 100);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	TestStreamsArePerMachine();
+	TestChooseOnManyThreads();
+	printf("PrtChoiceTest passed\n");
+	return 0;
+}
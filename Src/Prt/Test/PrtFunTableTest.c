@@ -0,0 +1,69 @@
+#include "PrtTestProgram.h"
+
+#define CHECKPOINT_PATH "PrtFunTableTest.ckpt"
+
+/*
+* Checks that the functions a Counter and a restored Counter find through their function table are the ones the
+* function indices of the program name: global functions at even indices, those of the machine at odd ones.
+*/
+
+static void CheckFunTable(_In_ PRT_MACHINEINST *counter)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PRT_PROGRAMDECL *program = context->process->program;
+	PRT_MACHINEDECL *machineDecl = program->machines[context->instanceOf];
+	PRT_TEST_CHECK(context->funs == ((PRT_PROCESS_PRIV *)context->process)->funTables[context->instanceOf]);
+	for (PRT_UINT32 g = 0; g < program->nGlobalFuns; g++)
+	{
+		PRT_TEST_CHECK(context->funs[2 * g].decl == program->globalFuns[g]);
+		PRT_TEST_CHECK(PrtGetFunction(context, 2 * g) == program->globalFuns[g]->implementation);
+	}
+	for (PRT_UINT32 f = 0; f < machineDecl->nFuns; f++)
+	{
+		PRT_TEST_CHECK(context->funs[2 * f + 1].decl == &machineDecl->funs[f]);
+		PRT_TEST_CHECK(PrtGetFunction(context, 2 * f + 1) == machineDecl->funs[f].implementation);
+		PRT_TEST_CHECK((context->funs[2 * f + 1].receiveCases == NULL) == (machineDecl->funs[f].nReceives == 0));
+	}
+}
+
+static void TestFunTable(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	CheckFunTable(counter);
+
+	// entry, do, receive and goto all go through the table.
+	PrtTestSendAdd(counter, 1);
+	PrtTestSendWait(counter, 1000000);
+	PrtTestSendAdd(counter, 2);
+	PrtTestSendReset(counter);
+	PrtTestSendAdd(counter, 3);
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 6);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 3);
+
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+
+	// a restored machine is made without PrtMkMachine, and its events run before PrtRestoreProcess returns.
+	PRT_PROCESS *restored = PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(restored != NULL);
+	PRT_MACHINEINST *again = ((PRT_PROCESS_PRIV *)restored)->machines[0];
+	CheckFunTable(again);
+	PrtTestSendAdd(again, 4);
+	PRT_TEST_CHECK(PrtTestGetTotal(again) == 10);
+	PrtStopProcess(restored);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestFunTable();
+	printf("PrtFunTableTest passed\n");
+	return 0;
+}
@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include "PrtTestProgram.h"
+
+/*
+* Routes keys to a group of Counters, and checks that equal keys always reach the same member, that keys are shared out
+* evenly, that resizing the group moves only the keys that go to the new members and shrinking it back restores the
+* old routes, and that senders on many threads reach the members without a router.
+*/
+
+#define KEYS 4000
+#define MEMBERS 8
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_MACHINEINST *MemberOf(_In_ PRT_MACHINE_GROUP *group, _In_ PRT_INT32 key)
+{
+	PRT_VALUE *value = PrtMkIntValue(key);
+	PRT_MACHINEINST *member = PrtGetGroupMember(group, value);
+	PrtFreeValue(value);
+	return member;
+}
+
+static void SendAddToGroup(_In_ PRT_MACHINE_GROUP *group, _In_ PRT_INT32 key, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *value = PrtMkIntValue(key);
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSendToGroup(NULL, group, value, event, payload);
+	PrtFreeValue(payload);
+	PrtFreeValue(event);
+	PrtFreeValue(value);
+}
+
+static PRT_UINT32 MemberIndex(_In_ PRT_MACHINE_GROUP *group, _In_ PRT_MACHINEINST *member)
+{
+	for (PRT_UINT32 i = 0; i < group->nMembers; i++)
+	{
+		if (group->members[i] == member)
+		{
+			return i;
+		}
+	}
+	PRT_TEST_CHECK(PRT_FALSE);
+	return 0;
+}
+
+static void TestKeysAreSharedOut(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINE_GROUP *group = PrtMkMachineGroup(process, P_MACHINE_COUNTER, MEMBERS, NULL);
+	PRT_TEST_CHECK(PrtGetMachineGroupSize(group) == MEMBERS);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->numMachines == MEMBERS);
+
+	PRT_UINT32 routed[MEMBERS] = { 0 };
+	for (PRT_INT32 key = 0; key < KEYS; key++)
+	{
+		SendAddToGroup(group, key, 1);
+		PRT_TEST_CHECK(MemberOf(group, key) == MemberOf(group, key));
+		routed[MemberIndex(group, MemberOf(group, key))]++;
+	}
+	RunUntilIdle(process);
+	for (PRT_UINT32 i = 0; i < MEMBERS; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetTotal(group->members[i]) == (PRT_INT32)routed[i]);
+		PRT_TEST_CHECK(routed[i] > KEYS / MEMBERS * 3 / 4 && routed[i] < KEYS / MEMBERS * 5 / 4);
+	}
+
+	// keys of any type are routed by their value.
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_FORWARD);
+	PRT_VALUE *first = PrtMkDefaultValue(PrtGetPayloadType((PRT_MACHINEINST_PRIV *)group->members[0], event));
+	PRT_VALUE *second = PrtCloneValue(first);
+	PRT_TEST_CHECK(PrtGetGroupMember(group, first) == PrtGetGroupMember(group, second));
+	PrtFreeValue(first);
+	PrtFreeValue(second);
+	PrtFreeValue(event);
+
+	PrtFreeMachineGroup(group);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestResizeMovesFewKeys(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINE_GROUP *group = PrtMkMachineGroup(process, P_MACHINE_COUNTER, MEMBERS, NULL);
+	static PRT_MACHINEINST *before[KEYS];
+	for (PRT_INT32 key = 0; key < KEYS; key++)
+	{
+		before[key] = MemberOf(group, key);
+	}
+
+	// growing by a quarter moves about a fifth of the keys, all of them to the new members.
+	PrtResizeMachineGroup(group, MEMBERS + MEMBERS / 4);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->numMachines == MEMBERS + MEMBERS / 4);
+	PRT_UINT32 moved = 0;
+	for (PRT_INT32 key = 0; key < KEYS; key++)
+	{
+		PRT_MACHINEINST *member = MemberOf(group, key);
+		if (member != before[key])
+		{
+			moved++;
+			PRT_TEST_CHECK(MemberIndex(group, member) >= MEMBERS);
+		}
+	}
+	PRT_TEST_CHECK(moved > KEYS / 5 * 3 / 4 && moved < KEYS / 5 * 5 / 4);
+
+	// shrinking back restores every route, and growing again makes no new machines.
+	PrtResizeMachineGroup(group, MEMBERS);
+	for (PRT_INT32 key = 0; key < KEYS; key++)
+	{
+		PRT_TEST_CHECK(MemberOf(group, key) == before[key]);
+	}
+	PrtResizeMachineGroup(group, MEMBERS + MEMBERS / 4);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->numMachines == MEMBERS + MEMBERS / 4);
+
+	// the process frees the group the host did not.
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define SENDERS 4
+#define SENDS 2000
+
+static PRT_MACHINE_GROUP *sharedGroup;
+
+static void *SendKeys(void *arg)
+{
+	PRT_INT32 base = (PRT_INT32)(size_t)arg * SENDS;
+	for (PRT_INT32 i = 0; i < SENDS; i++)
+	{
+		SendAddToGroup(sharedGroup, base + i, 1);
+	}
+	return NULL;
+}
+
+static void TestConcurrentSenders(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	sharedGroup = PrtMkMachineGroup(process, P_MACHINE_COUNTER, MEMBERS, NULL);
+	pthread_t threads[SENDERS];
+	for (PRT_UINT32 i = 0; i < SENDERS; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&threads[i], NULL, &SendKeys, (void *)(size_t)i) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < SENDERS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	for (;;)
+	{
+		PRT_INT32 total = 0;
+		for (PRT_UINT32 i = 0; i < MEMBERS; i++)
+		{
+			total += PrtTestGetTotal(sharedGroup->members[i]);
+		}
+		if (total == SENDERS * SENDS)
+		{
+			break;
+		}
+		PRT_TEST_CHECK(total < SENDERS * SENDS && PrtGetMonotonicTime() < start + 10000);
+		PrtYieldThread();
+	}
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestKeysAreSharedOut();
+	TestResizeMovesFewKeys();
+	TestConcurrentSenders();
+	printf("PrtGroupTest passed\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include "PrtTestProgram.h"
+
+#define MACHINES 200
+
+static void TestIdleMachinesShrink(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	PrtSetMemoryQuotas(process, 0, 0, PRT_QUOTAPOLICY_REPORT);
+	PRT_MACHINEINST *counters[MACHINES];
+	for (PRT_UINT32 i = 0; i < MACHINES; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtTestSendAdd(counters[i], (PRT_INT32)i);
+	}
+	PRT_TEST_CHECK(!PrtIsMachineHibernated(counters[0]));
+	PRT_TEST_CHECK(PrtHibernateIdleMachines(process) == 0);
+	size_t awake = PrtGetProcessMemoryUsage(process);
+
+	PrtSetHibernationPolicy(process, 0);
+	PRT_TEST_CHECK(PrtHibernateIdleMachines(process) == MACHINES);
+	PRT_TEST_CHECK(PrtHibernateIdleMachines(process) == 0);
+	size_t asleep = PrtGetProcessMemoryUsage(process);
+	PRT_TEST_CHECK(PrtIsMachineHibernated(counters[MACHINES - 1]));
+	PRT_TEST_CHECK(asleep * 8 < awake);
+
+	// the next event wakes each machine up where it left off.
+	for (PRT_UINT32 i = 0; i < MACHINES; i++)
+	{
+		PrtTestSendAdd(counters[i], 1);
+	}
+	for (PRT_UINT32 i = 0; i < MACHINES; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetTotal(counters[i]) == (PRT_INT32)i + 1);
+		PRT_TEST_CHECK(PrtTestGetHistoryLength(counters[i]) == 2);
+	}
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+	PrtStopProcess(process);
+}
+
+static void TestRoundTripOnEverySend(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetHibernationPolicy(process, 0);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// with no idle period a machine hibernates as soon as it runs out of work.
+	for (PRT_INT32 i = -50; i < 50; i++)
+	{
+		PrtTestSendAdd(counter, i * 1000);
+		PRT_TEST_CHECK(PrtIsMachineHibernated(counter));
+	}
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == -50000);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 100);
+	PRT_TEST_CHECK(!PrtIsMachineHibernated(counter));
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+	PrtStopProcess(process);
+}
+
+static void TestIdlePeriodIsRespected(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	PrtSetHibernationPolicy(process, 60 * 60 * 1000);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendAdd(counter, 1);
+	PRT_TEST_CHECK(PrtHibernateIdleMachines(process) == 0);
+	PRT_TEST_CHECK(!PrtIsMachineHibernated(counter));
+	PrtStopProcess(process);
+}
+
+static void TestStopHibernatedProcess(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(4, NULL);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendAdd(counter, 1);
+	PrtSetHibernationPolicy(process, 0);
+	PRT_TEST_CHECK(PrtHibernateIdleMachines(process) == 1);
+	PrtStopProcess(process);
+}
+
+int main(int argc, char *argv[])
+{
+	TestIdleMachinesShrink();
+	TestRoundTripOnEverySend();
+	TestIdlePeriodIsRespected();
+	TestStopHibernatedProcess();
+	return 0;
+}
@@ -0,0 +1,244 @@
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "PrtTestProgram.h"
+
+/*
+* Runs Counters that watch pipes and sockets with PrtWatchFd, and checks that a Counter hears once of each descriptor
+* it watches becoming ready, with what it is ready for, that one thread of the process watches many descriptors, and
+* that descriptors given up, or watched for a machine that halted, send nothing.
+*/
+
+/* How long a test waits for the I/O thread before it gives up, in milliseconds */
+#define PATIENCE 5000
+
+/* How long a test waits to see that no event comes, in milliseconds */
+#define QUIET 50
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+// Runs the machines of a cooperative process on the calling thread until counter has length events in its history.
+static void RunUntilHistory(_Inout_ PRT_PROCESS *process, _In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 length)
+{
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	RunUntilIdle(process);
+	while (PrtTestGetHistoryLength(counter) < length)
+	{
+		PRT_TEST_CHECK(PrtGetMonotonicTime() < start + PATIENCE);
+		PRT_TEST_CHECK(!PrtWaitForWork(process));
+		RunUntilIdle(process);
+	}
+}
+
+// Runs the machines of a cooperative process for a while, for events that should not come.
+static void RunQuietly(_Inout_ PRT_PROCESS *process)
+{
+	struct timespec pause = { 0, QUIET * 1000000 };
+	nanosleep(&pause, NULL);
+	RunUntilIdle(process);
+}
+
+static PRT_INT32 HistoryAt(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 index)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_INT32 value = PrtPrimGetInt(PrtSeqGetNCIntIndex(history, index));
+	PrtFreeValue(history);
+	return value;
+}
+
+static PRT_PROCESS *StartIoProcess(_In_ PRT_UINT32 data1)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	return process;
+}
+
+static void Put(_In_ int fd)
+{
+	char byte = 'x';
+	PRT_TEST_CHECK(write(fd, &byte, 1) == 1);
+}
+
+static void Take(_In_ int fd)
+{
+	char byte;
+	PRT_TEST_CHECK(read(fd, &byte, 1) == 1);
+}
+
+static void TestReadIsReportedOnce(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartIoProcess(1);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	int fds[2];
+	PRT_TEST_CHECK(pipe(fds) == 0);
+	PRT_TEST_CHECK(PrtWatchFd(counter, fds[0], PRT_POLL_READ, P_EVENT_ADD));
+	RunQuietly(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 0);
+
+	Put(fds[1]);
+	RunUntilHistory(process, counter, 1);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == PRT_POLL_READ);
+
+	// the byte is still there, but the watch is used up until the counter watches again.
+	RunQuietly(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PRT_TEST_CHECK(PrtWatchFd(counter, fds[0], PRT_POLL_READ, P_EVENT_ADD));
+	RunUntilHistory(process, counter, 2);
+	Take(fds[0]);
+
+	// the writer hangs up.
+	PRT_TEST_CHECK(PrtWatchFd(counter, fds[0], PRT_POLL_READ, P_EVENT_ADD));
+	close(fds[1]);
+	RunUntilHistory(process, counter, 3);
+	PRT_TEST_CHECK(HistoryAt(counter, 2) & PRT_POLL_HUP);
+
+	PrtStopProcess(process);
+	close(fds[0]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestWriteReadiness(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartIoProcess(2);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	int sockets[2];
+	PRT_TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	PRT_TEST_CHECK(PrtWatchFd(counter, sockets[0], PRT_POLL_WRITE, P_EVENT_ADD));
+	RunUntilHistory(process, counter, 1);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == PRT_POLL_WRITE);
+
+	// watched for both, a socket with data waiting is found ready for both at once.
+	Put(sockets[1]);
+	struct timespec pause = { 0, QUIET * 1000000 };
+	nanosleep(&pause, NULL);
+	PRT_TEST_CHECK(PrtWatchFd(counter, sockets[0], PRT_POLL_READ | PRT_POLL_WRITE, P_EVENT_ADD));
+	RunUntilHistory(process, counter, 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == (PRT_POLL_READ | PRT_POLL_WRITE));
+
+	PrtStopProcess(process);
+	close(sockets[0]);
+	close(sockets[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define MANY_PIPES 200
+
+static void TestManyDescriptors(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartIoProcess(3);
+	PRT_MACHINEINST *counters[4];
+	for (PRT_UINT32 i = 0; i < 4; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	}
+	int fds[MANY_PIPES][2];
+	for (PRT_UINT32 i = 0; i < MANY_PIPES; i++)
+	{
+		PRT_TEST_CHECK(pipe(fds[i]) == 0);
+		PRT_TEST_CHECK(PrtWatchFd(counters[i % 4], fds[i][0], PRT_POLL_READ, P_EVENT_ADD));
+	}
+	for (PRT_UINT32 i = 0; i < MANY_PIPES; i++)
+	{
+		Put(fds[i][1]);
+	}
+	for (PRT_UINT32 i = 0; i < 4; i++)
+	{
+		RunUntilHistory(process, counters[i], MANY_PIPES / 4);
+		PRT_TEST_CHECK(PrtTestGetTotal(counters[i]) == MANY_PIPES / 4 * PRT_POLL_READ);
+	}
+
+	// one thread watched them all.
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->io != NULL);
+	PrtStopProcess(process);
+	for (PRT_UINT32 i = 0; i < MANY_PIPES; i++)
+	{
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestGivenUpDescriptorsAreQuiet(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartIoProcess(4);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *halted = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	int first[2];
+	int second[2];
+	PRT_TEST_CHECK(pipe(first) == 0);
+	PRT_TEST_CHECK(pipe(second) == 0);
+	PRT_TEST_CHECK(PrtWatchFd(counter, first[0], PRT_POLL_READ, P_EVENT_ADD));
+	PRT_TEST_CHECK(PrtWatchFd(halted, second[0], PRT_POLL_READ, P_EVENT_ADD));
+	PrtUnwatchFd(counter, first[0]);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->fdWatches == 0);
+
+	PrtHaltMachine((PRT_MACHINEINST_PRIV *)halted);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)halted)->fdWatches == 0);
+
+	Put(first[1]);
+	Put(second[1]);
+	RunQuietly(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 0);
+
+	// the descriptor is free for another machine.
+	PRT_TEST_CHECK(PrtWatchFd(counter, second[0], PRT_POLL_READ, P_EVENT_ADD));
+	RunUntilHistory(process, counter, 1);
+
+	PrtStopProcess(process);
+	close(first[0]);
+	close(first[1]);
+	close(second[0]);
+	close(second[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestTaskNeutralDelivery(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(5, NULL);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	int fds[2];
+	PRT_TEST_CHECK(pipe(fds) == 0);
+	for (PRT_UINT32 i = 0; i < 3; i++)
+	{
+		PRT_TEST_CHECK(PrtWatchFd(counter, fds[0], PRT_POLL_READ, P_EVENT_ADD));
+		Put(fds[1]);
+		PRT_UINT64 start = PrtGetMonotonicTime();
+		while (PrtTestGetHistoryLength(counter) < i + 1)
+		{
+			PRT_TEST_CHECK(PrtGetMonotonicTime() < start + PATIENCE);
+			struct timespec pause = { 0, 1000000 };
+			nanosleep(&pause, NULL);
+		}
+		Take(fds[0]);
+	}
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 3 * PRT_POLL_READ);
+
+	// the process stops with the descriptor still watched.
+	PRT_TEST_CHECK(PrtWatchFd(counter, fds[0], PRT_POLL_READ, P_EVENT_ADD));
+	PrtStopProcess(process);
+	close(fds[0]);
+	close(fds[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestReadIsReportedOnce();
+	TestWriteReadiness();
+	TestManyDescriptors();
+	TestGivenUpDescriptorsAreQuiet();
+	TestTaskNeutralDelivery();
+	printf("PrtIoTest passed\n");
+	return 0;
+}
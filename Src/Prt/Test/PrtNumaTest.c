@@ -0,0 +1,262 @@
+#include <pthread.h>
+#include <sched.h>
+#include "PrtTestProgram.h"
+
+/*
+* Places Counters on the nodes of a fake topology, in which every thread says which node it runs on,
+* and checks where their memory comes from and which machines a cooperative worker steps first.
+*/
+
+#define NODES 2
+#define COUNTERS_PER_NODE 4
+#define ADDS 200
+
+static PRT_THREAD_LOCAL PRT_UINT32 fakeNode = 0;
+
+static PRT_UINT32 PRT_CALL_CONV FakeCurrentNode(_Inout_ void *state)
+{
+	return fakeNode;
+}
+
+static PRT_NUMA_TOPOLOGY fakeTopology = { NODES, &FakeCurrentNode, NULL };
+
+/* The home nodes of the machines whose steps were logged, in the order they were logged */
+#define MAX_STEPS 256
+static PRT_UINT32 steppedNodes[MAX_STEPS];
+static volatile PRT_UINT32 stepCount;
+
+/* Events dequeued by a worker on the home node of the machine, and by a worker on another node */
+static volatile PRT_UINT32 localDequeues;
+static volatile PRT_UINT32 remoteDequeues;
+
+static void PRT_CALL_CONV NumaLogFun(_In_ PRT_STEP step, _In_ PRT_MACHINESTATE *senderState, _In_ PRT_MACHINEINST *receiver, _In_ PRT_VALUE *eventid, _In_ PRT_VALUE *payload)
+{
+	// creations and enqueues are logged by the thread that makes the machine or sends the event, not the one that runs it.
+	if (step == PRT_STEP_CREATE || step == PRT_STEP_ENQUEUE)
+	{
+		return;
+	}
+	PRT_UINT32 homeNode = PrtGetMachineHomeNode(receiver);
+	PRT_UINT32 index = PrtAtomicIncrement(&stepCount) - 1;
+	if (index < MAX_STEPS)
+	{
+		steppedNodes[index] = homeNode;
+	}
+	if (step == PRT_STEP_DEQUEUE)
+	{
+		PrtAtomicIncrement(homeNode == fakeNode ? &localDequeues : &remoteDequeues);
+	}
+}
+
+static PRT_PROCESS *StartNumaProcess(_In_ PRT_UINT32 data1)
+{
+	PRT_GUID guid;
+	guid.data1 = data1;
+	guid.data2 = 0;
+	guid.data3 = 0;
+	guid.data4 = 0;
+	stepCount = 0;
+	localDequeues = 0;
+	remoteDequeues = 0;
+	PRT_PROCESS *process = PrtStartProcessEx(guid, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &NumaLogFun, NULL);
+	PrtSetNumaTopology(process, &fakeTopology);
+	return process;
+}
+
+static void TestMachinesAreHomedWhereTheyAreMade(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartNumaProcess(1);
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PrtSetMemoryQuotas(process, 0, 0, PRT_QUOTAPOLICY_REPORT);
+
+	fakeNode = 1;
+	PRT_MACHINEINST *onOne = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	fakeNode = 0;
+	PRT_MACHINEINST *onZero = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_UINT32 prevHint = PrtSetPlacementHint(1);
+	PRT_MACHINEINST *hinted = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(PrtSetPlacementHint(prevHint) == 1);
+	PRT_TEST_CHECK(prevHint == PRT_NUMA_NODE_ANY);
+
+	PRT_TEST_CHECK(PrtGetMachineHomeNode(onOne) == 1);
+	PRT_TEST_CHECK(PrtGetMachineHomeNode(onZero) == 0);
+	PRT_TEST_CHECK(PrtGetMachineHomeNode(hinted) == 1);
+
+	// machines draw their memory from the arena of their home node, and are charged to it on the way to the process.
+	PRT_MACHINEINST *machines[3] = { onOne, onZero, hinted };
+	for (PRT_UINT32 i = 0; i < 3; i++)
+	{
+		PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)machines[i];
+		PRT_NUMA_NODE *home = &privateProcess->numaNodes[context->homeNode];
+		PRT_TEST_CHECK(context->memory.allocator == home->allocator);
+		PRT_TEST_CHECK(context->memory.parent == &home->memory);
+		for (PRT_INT32 j = 1; j <= ADDS; j++)
+		{
+			PrtTestSendAdd(machines[i], j);
+		}
+		PRT_TEST_CHECK(PrtTestGetTotal(machines[i]) == ADDS * (ADDS + 1) / 2);
+	}
+	size_t zeroUsed = privateProcess->numaNodes[0].memory.used;
+	size_t oneUsed = privateProcess->numaNodes[1].memory.used;
+	PRT_TEST_CHECK(zeroUsed >= PrtGetMachineMemoryUsage(onZero));
+	PRT_TEST_CHECK(oneUsed >= PrtGetMachineMemoryUsage(onOne) + PrtGetMachineMemoryUsage(hinted));
+	PRT_TEST_CHECK(oneUsed > zeroUsed);
+	PRT_TEST_CHECK(PrtGetProcessMemoryUsage(process) >= zeroUsed + oneUsed);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestWorkerStepsHomeMachinesFirst(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartNumaProcess(2);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+
+	// machines on both nodes, made in an interleaved order so that the order of creation does not decide the test.
+	PRT_MACHINEINST *counters[NODES * COUNTERS_PER_NODE];
+	for (PRT_UINT32 i = 0; i < NODES * COUNTERS_PER_NODE; i++)
+	{
+		PRT_UINT32 prevHint = PrtSetPlacementHint(i % NODES);
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtSetPlacementHint(prevHint);
+		PrtTestSendAdd(counters[i], 1);
+	}
+
+	// a single worker on node 0 runs everything, but finishes the machines of its node before it touches the others.
+	fakeNode = 0;
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	PRT_TEST_CHECK(stepCount <= MAX_STEPS);
+	PRT_UINT32 firstRemote = stepCount;
+	PRT_UINT32 lastLocal = 0;
+	for (PRT_UINT32 i = 0; i < stepCount; i++)
+	{
+		if (steppedNodes[i] == 0)
+		{
+			lastLocal = i;
+		}
+		else if (firstRemote == stepCount)
+		{
+			firstRemote = i;
+		}
+	}
+	PRT_TEST_CHECK(firstRemote < stepCount);
+	PRT_TEST_CHECK(lastLocal < firstRemote);
+	for (PRT_UINT32 i = 0; i < NODES * COUNTERS_PER_NODE; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetHistoryLength(counters[i]) == 1);
+	}
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+typedef struct NUMA_WORKER
+{
+	PRT_PROCESS				*process;
+	PRT_UINT32				node;
+	volatile PRT_UINT32		*done;
+} NUMA_WORKER;
+
+static void *Worker(void *arg)
+{
+	NUMA_WORKER *worker = (NUMA_WORKER *)arg;
+	fakeNode = worker->node;
+	while (!PrtAtomicLoad(worker->done))
+	{
+		if (PrtStepProcess(worker->process) == PRT_STEP_IDLE)
+		{
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void TestNodeWithoutWorkersIsServed(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartNumaProcess(3);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counters[NODES * COUNTERS_PER_NODE];
+	for (PRT_UINT32 i = 0; i < NODES * COUNTERS_PER_NODE; i++)
+	{
+		PRT_UINT32 prevHint = PrtSetPlacementHint(i % NODES);
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtSetPlacementHint(prevHint);
+	}
+
+	// both workers run on node 0, so the machines of node 1 are only ever run by workers from another node.
+	pthread_t threads[2];
+	volatile PRT_UINT32 done = PRT_FALSE;
+	NUMA_WORKER workers[2] = { { process, 0, &done }, { process, 0, &done } };
+	for (PRT_UINT32 i = 0; i < 2; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&threads[i], NULL, &Worker, &workers[i]) == 0);
+	}
+	for (PRT_INT32 j = 1; j <= ADDS; j++)
+	{
+		for (PRT_UINT32 i = 0; i < NODES * COUNTERS_PER_NODE; i++)
+		{
+			PrtTestSendAdd(counters[i], j);
+		}
+	}
+	// the machines are only looked at once the workers have stopped, since the workers change them.
+	while (PrtAtomicLoad(&localDequeues) + PrtAtomicLoad(&remoteDequeues) < NODES * COUNTERS_PER_NODE * ADDS)
+	{
+		sched_yield();
+	}
+	PrtAtomicCompareExchange(&done, PRT_FALSE, PRT_TRUE);
+	for (PRT_UINT32 i = 0; i < 2; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	for (PRT_UINT32 i = 0; i < NODES * COUNTERS_PER_NODE; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetHistoryLength(counters[i]) == ADDS);
+		PRT_TEST_CHECK(PrtTestGetTotal(counters[i]) == ADDS * (ADDS + 1) / 2);
+	}
+	printf("%u events dequeued on their home node, %u on another node\n", localDequeues, remoteDequeues);
+	PRT_TEST_CHECK(localDequeues + remoteDequeues == NODES * COUNTERS_PER_NODE * ADDS);
+	PRT_TEST_CHECK(remoteDequeues == COUNTERS_PER_NODE * ADDS);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestPlatformTopology(void)
+{
+	PRT_TEST_CHECK(PrtGetNumaNodeCount() >= 1);
+	PRT_TEST_CHECK(PrtGetCurrentNumaNode() < PrtGetNumaNodeCount());
+
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(4, NULL);
+	PrtSetNumaTopology(process, NULL);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(PrtGetMachineHomeNode(counter) < PrtGetNumaNodeCount());
+	for (PRT_INT32 j = 1; j <= ADDS; j++)
+	{
+		PrtTestSendAdd(counter, j);
+	}
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == ADDS * (ADDS + 1) / 2);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+
+	// a process that is not NUMA-aware has no home nodes.
+	process = PrtTestStartProcess(5, NULL);
+	counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(PrtGetMachineHomeNode(counter) == PRT_NUMA_NODE_ANY);
+	PrtStopProcess(process);
+}
+
+int main(int argc, char *argv[])
+{
+	TestMachinesAreHomedWhereTheyAreMade();
+	TestWorkerStepsHomeMachinesFirst();
+	TestNodeWithoutWorkersIsServed();
+	TestPlatformTopology();
+	printf("PrtNumaTest passed\n");
+	return 0;
+}
@@ -0,0 +1,276 @@
+#include "PrtTestProgram.h"
+
+/*
+* Has a Counter that buffers its sends scatter Adds over other Counters and checks, through the steps the process
+* logs, that the Adds reach each receiver together and in the order they were sent, only once the handler is done,
+* that a full outbox is delivered before it takes more, that a send that cannot wait does not overtake those held for
+* its receiver, and that a process that records sends at once.
+*/
+
+#define MAX_LOGGED 64
+
+typedef struct LOGGED_STEP
+{
+	PRT_STEP step;
+	PRT_MACHINEINST *receiver;
+	PRT_INT32 x;
+} LOGGED_STEP;
+
+static LOGGED_STEP logged[MAX_LOGGED];
+static PRT_UINT32 nLogged = 0;
+
+// keeps the enqueues and dequeues of Adds, which are all these tests look at.
+static void PRT_CALL_CONV LogAdds(
+	_In_ PRT_STEP step,
+	_In_ PRT_MACHINESTATE *senderState,
+	_In_ PRT_MACHINEINST *receiver,
+	_In_ PRT_VALUE *eventid,
+	_In_ PRT_VALUE *payload)
+{
+	if ((step != PRT_STEP_ENQUEUE && step != PRT_STEP_DEQUEUE) || PrtPrimGetEvent(eventid) != P_EVENT_ADD)
+	{
+		return;
+	}
+	PRT_TEST_CHECK(nLogged < MAX_LOGGED);
+	logged[nLogged].step = step;
+	logged[nLogged].receiver = receiver;
+	logged[nLogged].x = PrtPrimGetInt(payload);
+	nLogged++;
+}
+
+static PRT_PROCESS *StartOutboxProcess(_In_ PRT_UINT32 data1, _In_ PRT_SCHEDULINGPOLICY policy)
+{
+	PRT_GUID guid;
+	guid.data1 = data1;
+	guid.data2 = 0;
+	guid.data3 = 0;
+	guid.data4 = 0;
+	PRT_PROCESS *process = PrtStartProcessEx(guid, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &LogAdds, NULL);
+	PrtSetSchedulingPolicy(process, policy);
+	nLogged = 0;
+	return process;
+}
+
+static PRT_MACHINEINST *MkIdleCounter(_Inout_ PRT_PROCESS *process)
+{
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	while (PrtStepMachine((PRT_MACHINEINST_PRIV *)counter))
+	{
+		continue;
+	}
+	return counter;
+}
+
+static PRT_UINT32 QueueSize(_In_ PRT_MACHINEINST *counter)
+{
+	return ((PRT_MACHINEINST_PRIV *)counter)->eventQueue.size;
+}
+
+static void RunToIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static void CheckLogged(_In_ PRT_UINT32 i, _In_ PRT_STEP step, _In_ PRT_MACHINEINST *receiver, _In_ PRT_INT32 x)
+{
+	PRT_TEST_CHECK(i < nLogged);
+	PRT_TEST_CHECK(logged[i].step == step && logged[i].receiver == receiver && logged[i].x == x);
+}
+
+static void CheckHistory(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 length, _In_ PRT_INT32 first, _In_ PRT_INT32 step)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_TEST_CHECK(PrtSeqSizeOf(history) == length);
+	for (PRT_UINT32 i = 0; i < length; i++)
+	{
+		PRT_TEST_CHECK(PrtPrimGetInt(PrtSeqGetNCIntIndex(history, i)) == first + (PRT_INT32)i * step);
+	}
+	PrtFreeValue(history);
+}
+
+static void TestSendsAreGroupedByReceiver(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(1, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PRT_MACHINEINST *sender = MkIdleCounter(process);
+	PRT_MACHINEINST *first = MkIdleCounter(process);
+	PRT_MACHINEINST *second = MkIdleCounter(process);
+	PrtTestSendScatter(sender, first, second, 10);
+
+	// the handler sends Add(10) to first, Add(11) to second and Add(12) to first; first gets both of its own together.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)sender);
+	PRT_TEST_CHECK(nLogged == 3);
+	CheckLogged(0, PRT_STEP_ENQUEUE, first, 10);
+	CheckLogged(1, PRT_STEP_ENQUEUE, first, 12);
+	CheckLogged(2, PRT_STEP_ENQUEUE, second, 11);
+	PRT_TEST_CHECK(QueueSize(first) == 2 && QueueSize(second) == 1);
+
+	RunToIdle(process);
+	CheckHistory(first, 2, 10, 2);
+	CheckHistory(second, 1, 11, 0);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(sender) == 0);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReceiversRunAfterHandler(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(2, PRT_SCHEDULINGPOLICY_TASKNEUTRAL);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PRT_MACHINEINST *sender = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *first = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *second = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// under the task-neutral scheduler a receiver runs on the thread that sends to it, but no receiver takes an Add
+	// before the Scatter handler has made all three sends.
+	PrtTestSendScatter(sender, first, second, 20);
+	PRT_TEST_CHECK(nLogged == 6);
+	CheckLogged(0, PRT_STEP_ENQUEUE, first, 20);
+	CheckLogged(1, PRT_STEP_ENQUEUE, first, 22);
+	for (PRT_UINT32 i = 2; i < nLogged; i++)
+	{
+		PRT_TEST_CHECK(logged[i].step == PRT_STEP_DEQUEUE || logged[i].receiver == second);
+	}
+	CheckHistory(first, 2, 20, 2);
+	CheckHistory(second, 1, 21, 0);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestSendsToSelfAreHandled(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(3, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PRT_MACHINEINST *sender = MkIdleCounter(process);
+	PRT_MACHINEINST *other = MkIdleCounter(process);
+	PrtTestSendScatter(sender, sender, other, 30);
+
+	// the Adds the sender gives itself land when its step ends, and the process still gets to them.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)sender);
+	PRT_TEST_CHECK(QueueSize(sender) == 2 && QueueSize(other) == 1);
+	RunToIdle(process);
+	CheckHistory(sender, 2, 30, 2);
+	CheckHistory(other, 1, 31, 0);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define SENDS (PRT_OUTBOX_SIZE + 4)
+
+static void TestFullOutboxIsDelivered(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(4, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PRT_MACHINEINST *sender = MkIdleCounter(process);
+	PRT_MACHINEINST *receiver = MkIdleCounter(process);
+
+	// stands in for a step of the sender that sends more than its outbox holds.
+	PRT_MACHINESTATE state;
+	PrtGetMachineState(sender, &state);
+	PRT_OUTBOX outbox;
+	PRT_OUTBOX *previous = PrtOpenOutbox((PRT_MACHINEINST_PRIV *)sender, &outbox);
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	for (PRT_INT32 i = 1; i <= SENDS; i++)
+	{
+		PrtSendPrivate(&state, (PRT_MACHINEINST_PRIV *)receiver, event, PrtMkIntValue(i));
+		PRT_TEST_CHECK(QueueSize(receiver) == (i <= PRT_OUTBOX_SIZE ? 0 : PRT_OUTBOX_SIZE));
+	}
+	PrtFreeValue(event);
+	PRT_TEST_CHECK(outbox.count == SENDS - PRT_OUTBOX_SIZE);
+	PRT_TEST_CHECK(!PrtCloseOutbox((PRT_MACHINEINST_PRIV *)sender, &outbox, previous));
+	PRT_TEST_CHECK(QueueSize(receiver) == SENDS);
+
+	RunToIdle(process);
+	CheckHistory(receiver, SENDS, 1, 1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestUnbufferedSendsKeepOrder(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(6, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PRT_MACHINEINST *sender = MkIdleCounter(process);
+	PRT_MACHINEINST *receiver = MkIdleCounter(process);
+	PRT_MACHINEINST *other = MkIdleCounter(process);
+
+	// stands in for a step of the sender that mixes held sends with PrtTrySend and PrtBroadcast.
+	PRT_MACHINESTATE state;
+	PrtGetMachineState(sender, &state);
+	PRT_OUTBOX outbox;
+	PRT_OUTBOX *previous = PrtOpenOutbox((PRT_MACHINEINST_PRIV *)sender, &outbox);
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PrtSendPrivate(&state, (PRT_MACHINEINST_PRIV *)receiver, event, PrtMkIntValue(1));
+	PrtSendPrivate(&state, (PRT_MACHINEINST_PRIV *)other, event, PrtMkIntValue(10));
+
+	// the send that cannot wait takes the held send to its receiver along, and leaves the other held.
+	PRT_VALUE *payload = PrtMkIntValue(2);
+	PRT_TEST_CHECK(PrtTrySend(&state, receiver, event, payload) == PRT_SEND_ACCEPTED);
+	PrtFreeValue(payload);
+	PRT_TEST_CHECK(QueueSize(receiver) == 2 && QueueSize(other) == 0 && outbox.count == 1);
+
+	PrtSendPrivate(&state, (PRT_MACHINEINST_PRIV *)receiver, event, PrtMkIntValue(3));
+	PRT_MACHINEINST *both[2] = { other, receiver };
+	payload = PrtMkIntValue(4);
+	PrtBroadcast(&state, both, 2, event, payload);
+	PrtFreeValue(payload);
+	PRT_TEST_CHECK(QueueSize(receiver) == 4 && QueueSize(other) == 2 && outbox.count == 0);
+
+	PrtSendPrivate(&state, (PRT_MACHINEINST_PRIV *)receiver, event, PrtMkIntValue(5));
+	PrtFreeValue(event);
+	PRT_TEST_CHECK(!PrtCloseOutbox((PRT_MACHINEINST_PRIV *)sender, &outbox, previous));
+
+	RunToIdle(process);
+	CheckHistory(receiver, 5, 1, 1);
+	CheckHistory(other, 2, 10, -6);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestRecordingSendsAtOnce(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartOutboxProcess(5, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtSetSendBuffering(process, PRT_TRUE);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *sender = MkIdleCounter(process);
+	PRT_MACHINEINST *first = MkIdleCounter(process);
+	PRT_MACHINEINST *second = MkIdleCounter(process);
+
+	// a recording has each send where the handler made it.
+	PrtTestSendScatter(sender, first, second, 40);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)sender);
+	PRT_TEST_CHECK(nLogged == 3);
+	CheckLogged(0, PRT_STEP_ENQUEUE, first, 40);
+	CheckLogged(1, PRT_STEP_ENQUEUE, second, 41);
+	CheckLogged(2, PRT_STEP_ENQUEUE, first, 42);
+
+	RunToIdle(process);
+	CheckHistory(first, 2, 40, 2);
+	CheckHistory(second, 1, 41, 0);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtFree(recording);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestSendsAreGroupedByReceiver();
+	TestReceiversRunAfterHandler();
+	TestSendsToSelfAreHandled();
+	TestFullOutboxIsDelivered();
+	TestUnbufferedSendsKeepOrder();
+	TestRecordingSendsAtOnce();
+	printf("PrtOutboxTest passed\n");
+	return 0;
+}
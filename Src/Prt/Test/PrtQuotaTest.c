@@ -0,0 +1,94 @@
+#include "PrtTestProgram.h"
+
+#define QUOTA (64 * 1024)
+
+static void TestReportPolicyKeepsMachineRunning(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	PrtSetMemoryQuotas(process, 0, QUOTA, PRT_QUOTAPOLICY_REPORT);
+	PRT_MACHINEINST *hog = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *calm = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	for (PRT_INT32 i = 0; i < 5000; i++)
+	{
+		PrtTestSendAdd(hog, 1);
+	}
+	PrtTestSendAdd(calm, 1);
+
+	PRT_TEST_CHECK(PrtTestErrorCount == 1);
+	PRT_TEST_CHECK(PrtTestLastError == PRT_STATUS_MEMORY_QUOTA);
+	PRT_TEST_CHECK(PrtTestLastErrorMachine == hog);
+	PRT_TEST_CHECK(PrtTestGetTotal(hog) == 5000);
+	PRT_TEST_CHECK(PrtGetMachineMemoryUsage(hog) > QUOTA);
+	PRT_TEST_CHECK(PrtGetMachineMemoryUsage(calm) < QUOTA);
+	PRT_TEST_CHECK(PrtGetProcessMemoryUsage(process) >= PrtGetMachineMemoryUsage(hog) + PrtGetMachineMemoryUsage(calm));
+	PrtStopProcess(process);
+}
+
+static void TestHaltPolicyHaltsOnlyTheOffender(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetMemoryQuotas(process, 0, QUOTA, PRT_QUOTAPOLICY_HALT);
+	PRT_MACHINEINST *hog = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *calm = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	for (PRT_INT32 i = 0; i < 5000; i++)
+	{
+		PrtTestSendAdd(hog, 1);
+		if (i % 10 == 0)
+		{
+			PrtTestSendAdd(calm, 1);
+		}
+	}
+
+	PRT_TEST_CHECK(PrtTestErrorCount == 1);
+	PRT_TEST_CHECK(PrtTestLastErrorMachine == hog);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)hog)->runState & PRT_RUNSTATE_HALTED);
+	// halting the machine gave its memory back.
+	PRT_TEST_CHECK(PrtGetMachineMemoryUsage(hog) == 0);
+
+	PRT_TEST_CHECK(!(((PRT_MACHINEINST_PRIV *)calm)->runState & PRT_RUNSTATE_HALTED));
+	PrtSetMachineMemoryQuota(calm, 0);
+	for (PRT_INT32 i = 0; i < 5000; i++)
+	{
+		PrtTestSendAdd(calm, 1);
+	}
+	PRT_TEST_CHECK(PrtTestGetTotal(calm) == 5500);
+	PRT_TEST_CHECK(PrtTestErrorCount == 1);
+	PrtStopProcess(process);
+}
+
+static void TestProcessQuota(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	PrtSetMemoryQuotas(process, QUOTA, 0, PRT_QUOTAPOLICY_HALT);
+	PRT_MACHINEINST *first = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *second = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// neither machine is over a machine quota, but together they exceed the process quota.
+	PRT_MACHINEINST_PRIV *firstPriv = (PRT_MACHINEINST_PRIV *)first;
+	PRT_MACHINEINST_PRIV *secondPriv = (PRT_MACHINEINST_PRIV *)second;
+	for (PRT_INT32 i = 0; i < 5000 && !(firstPriv->runState & PRT_RUNSTATE_HALTED) && !(secondPriv->runState & PRT_RUNSTATE_HALTED); i++)
+	{
+		PrtTestSendAdd(first, 1);
+		PrtTestSendAdd(second, 1);
+	}
+	PRT_TEST_CHECK(PrtTestErrorCount == 1);
+	PRT_TEST_CHECK(PrtTestLastError == PRT_STATUS_MEMORY_QUOTA);
+	PRT_TEST_CHECK((firstPriv->runState & PRT_RUNSTATE_HALTED) != (secondPriv->runState & PRT_RUNSTATE_HALTED));
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)PrtTestLastErrorMachine)->runState & PRT_RUNSTATE_HALTED);
+	PRT_TEST_CHECK(PrtGetProcessMemoryUsage(process) < QUOTA);
+	PrtStopProcess(process);
+}
+
+int main(int argc, char *argv[])
+{
+	TestReportPolicyKeepsMachineRunning();
+	TestHaltPolicyHaltsOnlyTheOffender();
+	TestProcessQuota();
+	printf("PrtQuotaTest passed\n");
+	return 0;
+}
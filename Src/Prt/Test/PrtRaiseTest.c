@@ -0,0 +1,105 @@
+#include "PrtTestProgram.h"
+
+/*
+* Sends Countdown events to Counters, which raise the rest of the countdown to themselves, and checks that short
+* chains of raised events are handled in the step that dequeued the first one while long chains still yield.
+*/
+
+#define SHORT_COUNTDOWN (PRT_MAX_RAISES_PER_STEP / 2)
+#define LONG_COUNTDOWN (PRT_MAX_RAISES_PER_STEP * 10)
+
+static PRT_MACHINEINST *MkIdleCounter(_Inout_ PRT_PROCESS *process)
+{
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	while (PrtStepMachine((PRT_MACHINEINST_PRIV *)counter))
+	{
+		continue;
+	}
+	return counter;
+}
+
+static void TestShortChainIsOneStep(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+
+	PrtTestSendCountdown(counter, SHORT_COUNTDOWN);
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)counter);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == SHORT_COUNTDOWN + 1);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == SHORT_COUNTDOWN * (SHORT_COUNTDOWN + 1) / 2);
+	PRT_TEST_CHECK(!PrtStepMachine((PRT_MACHINEINST_PRIV *)counter));
+
+	// the raised events are handled in order, each with its own payload.
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	for (PRT_UINT32 i = 0; i <= SHORT_COUNTDOWN; i++)
+	{
+		PRT_TEST_CHECK(PrtPrimGetInt(PrtSeqGetNCIntIndex(history, i)) == SHORT_COUNTDOWN - (PRT_INT32)i);
+	}
+	PrtFreeValue(history);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestLongChainYields(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = MkIdleCounter(process);
+	PRT_MACHINEINST *other = MkIdleCounter(process);
+
+	PrtTestSendCountdown(counter, LONG_COUNTDOWN);
+	PrtTestSendAdd(other, 1);
+	PRT_TEST_CHECK(PrtStepMachine((PRT_MACHINEINST_PRIV *)counter));
+	PRT_UINT32 handled = PrtTestGetHistoryLength(counter);
+	PRT_TEST_CHECK(handled > 1 && handled <= PRT_MAX_RAISES_PER_STEP + 1);
+
+	// the other machine runs before the countdown is over.
+	PrtStepMachine((PRT_MACHINEINST_PRIV *)other);
+	PRT_TEST_CHECK(PrtTestGetTotal(other) == 1);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == handled);
+
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == LONG_COUNTDOWN + 1);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == LONG_COUNTDOWN * (LONG_COUNTDOWN + 1) / 2);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestChainsInTaskNeutralProcess(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(3, NULL);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 n = 0; n <= LONG_COUNTDOWN; n += PRT_MAX_RAISES_PER_STEP - 1)
+	{
+		PrtTestSendCountdown(counter, n);
+	}
+	PRT_INT32 total = 0;
+	PRT_UINT32 length = 0;
+	for (PRT_INT32 n = 0; n <= LONG_COUNTDOWN; n += PRT_MAX_RAISES_PER_STEP - 1)
+	{
+		total += n * (n + 1) / 2;
+		length += n + 1;
+	}
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == length);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == total);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestShortChainIsOneStep();
+	TestLongChainYields();
+	TestChainsInTaskNeutralProcess();
+	printf("PrtRaiseTest passed\n");
+	return 0;
+}
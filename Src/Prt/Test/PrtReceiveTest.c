@@ -0,0 +1,277 @@
+#include "PrtTestProgram.h"
+
+/*
+* Runs Counters that wait for an Add with a deadline on a clock the test moves by hand, and checks that the wait ends
+* with the first Add or when the deadline passes, whichever comes first, under both scheduling policies and in a replay,
+* and that an Add is found behind the events the receive has no case for.
+*/
+
+#define TIMEOUT 100
+
+static volatile PRT_UINT64 fakeNow = 0;
+
+static PRT_UINT64 PRT_CALL_CONV FakeNow(_Inout_ void *state)
+{
+	return fakeNow;
+}
+
+static PRT_CLOCK fakeClock = { &FakeNow, NULL };
+
+static PRT_PROCESS *StartReceiveProcess(_In_ PRT_UINT32 data1, _In_ PRT_BOOLEAN cooperative)
+{
+	fakeNow = 1000;
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	if (cooperative)
+	{
+		PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	}
+	PrtSetClock(process, &fakeClock);
+	PRT_TEST_CHECK(PrtGetProcessTime(process) == 1000);
+	return process;
+}
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_INT32 HistoryAt(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 index)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_INT32 value = PrtPrimGetInt(PrtSeqGetNCIntIndex(history, index));
+	PrtFreeValue(history);
+	return value;
+}
+
+static void TestDeadlineEndsWait(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartReceiveProcess(1, PRT_TRUE);
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendWait(counter, TIMEOUT);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 1);
+
+	// events the receive has no case for wait in the queue.
+	PrtTestSendCountdown(counter, 0);
+	fakeNow += TIMEOUT - 1;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 0);
+
+	fakeNow += 1;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 0);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == -1);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == 0);
+
+	// the Counter handles events as usual once the wait is over.
+	PrtTestSendAdd(counter, 5);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 3);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 5);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestEventBeforeDeadline(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartReceiveProcess(2, PRT_TRUE);
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendWait(counter, TIMEOUT);
+	RunUntilIdle(process);
+	fakeNow += TIMEOUT / 2;
+	PrtTestSendAdd(counter, 7);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 0);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 7);
+
+	// the cancelled deadline does not end a later wait early.
+	PrtTestSendWait(counter, TIMEOUT);
+	RunUntilIdle(process);
+	fakeNow += TIMEOUT / 2 + 1;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	fakeNow += TIMEOUT;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == -1);
+
+	// a deadline that has already passed ends the wait at once.
+	PrtTestSendWait(counter, 0);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 3);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 0);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define QUEUED 1000
+
+static void TestCaseEventBehindOthers(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartReceiveProcess(7, PRT_TRUE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// the case event is already queued, behind others, when the machine reaches the receive.
+	PrtTestSendWait(counter, TIMEOUT);
+	PrtTestSendCountdown(counter, 0);
+	PrtTestSendAdd(counter, 3);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == 3);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == 0);
+
+	// the case event comes while the machine waits, behind a deep queue; only the first one ends the wait.
+	PrtTestSendWait(counter, TIMEOUT);
+	RunUntilIdle(process);
+	for (PRT_UINT32 i = 0; i < QUEUED; i++)
+	{
+		PrtTestSendCountdown(counter, 0);
+	}
+	PrtTestSendAdd(counter, 4);
+	PrtTestSendAdd(counter, 5);
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2 + 1 + QUEUED + 1);
+	PRT_TEST_CHECK(HistoryAt(counter, 2) == 4);
+	PRT_TEST_CHECK(HistoryAt(counter, 3) == 0);
+	PRT_TEST_CHECK(HistoryAt(counter, 2 + QUEUED + 1) == 5);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 3 + 4 + 5);
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define WAITERS 300
+
+static void TestManyWaitersOnHostTimers(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartReceiveProcess(3, PRT_FALSE);
+	PRT_PROCESS_PRIV *privateProcess = (PRT_PROCESS_PRIV *)process;
+
+	// deadlines spread over more than a turn of the wheel, so some share a slot with later ones.
+	PRT_MACHINEINST *counters[WAITERS];
+	for (PRT_UINT32 i = 0; i < WAITERS; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+		PrtTestSendWait(counters[i], (PRT_INT32)(i * 3 + 1));
+	}
+	PRT_TEST_CHECK(privateProcess->timers.armed == WAITERS);
+	PRT_TEST_CHECK(PrtGetTimerDelay(&privateProcess->timers, fakeNow) == 1);
+	for (PRT_UINT32 i = 0; i < WAITERS; i += 2)
+	{
+		PrtTestSendAdd(counters[i], 1);
+	}
+	PRT_TEST_CHECK(privateProcess->timers.armed == WAITERS / 2);
+
+	// under the task-neutral policy the host fires the timers, and the machines run on its thread.
+	PRT_UINT32 fired = 0;
+	for (PRT_UINT32 t = 1; t <= WAITERS * 3; t++)
+	{
+		fakeNow++;
+		fired += PrtFireTimers(process);
+		for (PRT_UINT32 i = 1; i < WAITERS; i += 2)
+		{
+			PRT_UINT32 expected = i * 3 + 1 <= t ? 1 : 0;
+			PRT_TEST_CHECK(PrtTestGetHistoryLength(counters[i]) == expected);
+		}
+	}
+	PRT_TEST_CHECK(fired == WAITERS / 2);
+	PRT_TEST_CHECK(privateProcess->timers.armed == 0);
+	for (PRT_UINT32 i = 0; i < WAITERS; i++)
+	{
+		PRT_TEST_CHECK(HistoryAt(counters[i], 0) == (i % 2 == 0 ? 1 : -1));
+	}
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReplayReproducesTimeouts(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartReceiveProcess(4, PRT_TRUE);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *first = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *second = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendWait(first, TIMEOUT);
+	PrtTestSendWait(second, 2 * TIMEOUT);
+	RunUntilIdle(process);
+	fakeNow += TIMEOUT;
+	RunUntilIdle(process);
+	PrtTestSendAdd(second, 3);
+	PrtTestSendAdd(first, 4);
+	RunUntilIdle(process);
+	PRT_VALUE *firstHistory = PrtTestGetHistory(first);
+	PRT_VALUE *secondHistory = PrtTestGetHistory(second);
+	PRT_TEST_CHECK(PrtSeqSizeOf(firstHistory) == 2);
+	PRT_TEST_CHECK(PrtSeqSizeOf(secondHistory) == 1);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	// the replay runs on a clock that never moves, so it can only end the wait where the recording says it ended.
+	PRT_PROCESS *replay = StartReceiveProcess(5, PRT_FALSE);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	PRT_PROCESS_PRIV *privateReplay = (PRT_PROCESS_PRIV *)replay;
+	PRT_TEST_CHECK(privateReplay->timers.armed == 0);
+	PRT_VALUE *replayedFirst = PrtTestGetHistory(privateReplay->machines[0]);
+	PRT_VALUE *replayedSecond = PrtTestGetHistory(privateReplay->machines[1]);
+	PRT_TEST_CHECK(PrtIsEqualValue(firstHistory, replayedFirst));
+	PRT_TEST_CHECK(PrtIsEqualValue(secondHistory, replayedSecond));
+	PrtFreeValue(firstHistory);
+	PrtFreeValue(secondHistory);
+	PrtFreeValue(replayedFirst);
+	PrtFreeValue(replayedSecond);
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestWorkerWakesForDeadline(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = PrtTestStartProcess(6, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_UINT64 start = PrtGetProcessTime(process);
+	PrtTestSendWait(counter, 20);
+	RunUntilIdle(process);
+
+	// nothing else will wake the worker, so it sleeps until the deadline, not in a busy loop.
+	PRT_UINT32 waits = 0;
+	while (PrtTestGetHistoryLength(counter) == 0)
+	{
+		PRT_TEST_CHECK(!PrtWaitForWork(process));
+		RunUntilIdle(process);
+		waits++;
+	}
+	PRT_TEST_CHECK(PrtGetProcessTime(process) >= start + 20);
+	PRT_TEST_CHECK(waits <= 3);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == -1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestDeadlineEndsWait();
+	TestEventBeforeDeadline();
+	TestCaseEventBehindOthers();
+	TestManyWaitersOnHostTimers();
+	TestReplayReproducesTimeouts();
+	TestWorkerWakesForDeadline();
+	printf("PrtReceiveTest passed\n");
+	return 0;
+}
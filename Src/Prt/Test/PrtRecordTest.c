@@ -0,0 +1,311 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "PrtTestProgram.h"
+
+/*
+* Records runs in which several threads send to Counters that forward events to each other with a nondeterministic
+* sign, replays each recording on one thread, and checks that every Counter saw the same events in the same order.
+* Also checks that a recording passed to a flush function a chunk at a time replays, that one without stops at its limit,
+* and that a damaged recording is turned away before anything runs.
+*/
+
+#define COUNTERS 8
+#define SENDERS 3
+#define STEPPERS 3
+#define SENDS 400
+
+typedef struct RECORD_RUN
+{
+	PRT_PROCESS				*process;
+	PRT_MACHINEINST			*counters[COUNTERS];
+	volatile PRT_UINT32		sendersDone;
+} RECORD_RUN;
+
+typedef struct RECORD_SENDER
+{
+	RECORD_RUN				*run;
+	unsigned int			seed;
+} RECORD_SENDER;
+
+static void *Sender(void *arg)
+{
+	RECORD_SENDER *sender = (RECORD_SENDER *)arg;
+	for (PRT_INT32 i = 1; i <= SENDS; i++)
+	{
+		int r = rand_r(&sender->seed);
+		PRT_MACHINEINST *target = sender->run->counters[r % COUNTERS];
+		if ((r >> 8) & 1)
+		{
+			PrtTestSendForward(sender->run->counters[(r >> 9) % COUNTERS], target, i);
+		}
+		else
+		{
+			PrtTestSendAdd(target, i);
+		}
+	}
+	return NULL;
+}
+
+static void *Stepper(void *arg)
+{
+	RECORD_RUN *run = (RECORD_RUN *)arg;
+	while (PrtStepProcess(run->process) != PRT_STEP_IDLE || !PrtAtomicLoad(&run->sendersDone))
+	{
+		sched_yield();
+	}
+	return NULL;
+}
+
+static PRT_UINT32 QueuedEvents(RECORD_RUN *run)
+{
+	PRT_UINT32 queued = 0;
+	for (PRT_UINT32 i = 0; i < COUNTERS; i++)
+	{
+		queued += ((PRT_MACHINEINST_PRIV *)run->counters[i])->eventQueue.size;
+	}
+	return queued;
+}
+
+static void TestReplayReproducesRun(PRT_BOOLEAN cooperative)
+{
+	PrtTestResetErrors();
+	RECORD_RUN run;
+	run.process = PrtTestStartProcess(1, NULL);
+	run.sendersDone = PRT_FALSE;
+	if (cooperative)
+	{
+		PrtSetSchedulingPolicy(run.process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	}
+	PrtStartRecording(run.process);
+	for (PRT_UINT32 i = 0; i < COUNTERS; i++)
+	{
+		run.counters[i] = PrtMkMachine(run.process, P_MACHINE_COUNTER, 0);
+	}
+
+	// with the task-neutral policy the senders run the Counters themselves; otherwise the steppers do.
+	pthread_t steppers[STEPPERS];
+	pthread_t senders[SENDERS];
+	RECORD_SENDER senderArgs[SENDERS];
+	for (PRT_UINT32 i = 0; cooperative && i < STEPPERS; i++)
+	{
+		PRT_TEST_CHECK(pthread_create(&steppers[i], NULL, &Stepper, &run) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < SENDERS; i++)
+	{
+		senderArgs[i].run = &run;
+		senderArgs[i].seed = i + 1;
+		PRT_TEST_CHECK(pthread_create(&senders[i], NULL, &Sender, &senderArgs[i]) == 0);
+	}
+	for (PRT_UINT32 i = 0; i < SENDERS; i++)
+	{
+		pthread_join(senders[i], NULL);
+	}
+	PrtAtomicCompareExchange(&run.sendersDone, PRT_FALSE, PRT_TRUE);
+	for (PRT_UINT32 i = 0; cooperative && i < STEPPERS; i++)
+	{
+		pthread_join(steppers[i], NULL);
+	}
+	while (cooperative && (PrtStepProcess(run.process) != PRT_STEP_IDLE || QueuedEvents(&run) != 0))
+	{
+		continue;
+	}
+
+	PRT_VALUE *histories[COUNTERS];
+	PRT_UINT32 events = 0;
+	for (PRT_UINT32 i = 0; i < COUNTERS; i++)
+	{
+		histories[i] = PrtTestGetHistory(run.counters[i]);
+		events += PrtSeqSizeOf(histories[i]);
+	}
+	PRT_TEST_CHECK(events == SENDERS * SENDS);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(run.process, &size);
+	PRT_TEST_CHECK(recording != NULL);
+	printf("%s: %u events recorded in %u bytes\n", cooperative ? "cooperative" : "task-neutral", events, size);
+	PrtStopProcess(run.process);
+
+	PRT_PROCESS *replay = PrtTestStartProcess(1, NULL);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)replay)->numMachines == COUNTERS);
+	for (PRT_UINT32 i = 0; i < COUNTERS; i++)
+	{
+		PRT_VALUE *history = PrtTestGetHistory(((PRT_PROCESS_PRIV *)replay)->machines[i]);
+		PRT_TEST_CHECK(PrtIsEqualValue(history, histories[i]));
+		PrtFreeValue(history);
+		PrtFreeValue(histories[i]);
+	}
+	PrtStopProcess(replay);
+	PrtFree(recording);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define SMALL_SENDS 20
+#define FLUSH_LIMIT 48
+#define FLUSHED_MAX 4096
+
+typedef struct FLUSHED_RECORDING
+{
+	PRT_UINT8		bytes[FLUSHED_MAX];
+	PRT_UINT32		size;
+	PRT_UINT32		chunks;
+} FLUSHED_RECORDING;
+
+static void PRT_CALL_CONV CollectChunk(_Inout_ void *state, _In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size)
+{
+	FLUSHED_RECORDING *flushed = (FLUSHED_RECORDING *)state;
+	PRT_TEST_CHECK(flushed->size + size <= FLUSHED_MAX);
+	memcpy(&flushed->bytes[flushed->size], bytes, size);
+	flushed->size += size;
+	flushed->chunks++;
+}
+
+// records two Counters on one thread, with Adds and Forwards that make nondeterministic choices.
+static PRT_PROCESS *RecordSmallRun(_In_ PRT_UINT32 limit, _In_ FLUSHED_RECORDING *flushed, _Out_ PRT_VALUE **histories)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(2, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	PrtStartRecording(process);
+	if (limit != 0)
+	{
+		PrtSetRecordingLimit(process, limit, flushed != NULL ? &CollectChunk : NULL, flushed);
+	}
+	PRT_MACHINEINST *first = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *second = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 1; i <= SMALL_SENDS; i++)
+	{
+		if (i % 2 == 0)
+		{
+			PrtTestSendForward(first, second, i);
+		}
+		else
+		{
+			PrtTestSendAdd(second, i);
+		}
+	}
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+	histories[0] = PrtTestGetHistory(first);
+	histories[1] = PrtTestGetHistory(second);
+	return process;
+}
+
+static PRT_BOOLEAN ReplaysAs(_In_ const PRT_UINT8 *recording, _In_ PRT_UINT32 size, _In_ PRT_VALUE **histories)
+{
+	PRT_PROCESS *replay = PrtTestStartProcess(2, NULL);
+	PRT_BOOLEAN same = PrtReplayProcess(replay, recording, size) && ((PRT_PROCESS_PRIV *)replay)->numMachines == 2;
+	for (PRT_UINT32 i = 0; same && i < 2; i++)
+	{
+		PRT_VALUE *history = PrtTestGetHistory(((PRT_PROCESS_PRIV *)replay)->machines[i]);
+		same = PrtIsEqualValue(history, histories[i]);
+		PrtFreeValue(history);
+	}
+	PrtStopProcess(replay);
+	return same;
+}
+
+static void TestFlushedRecordingReplays(void)
+{
+	PrtTestResetErrors();
+	static FLUSHED_RECORDING flushed;
+	flushed.size = 0;
+	flushed.chunks = 0;
+	PRT_VALUE *histories[2];
+	PRT_PROCESS *process = RecordSmallRun(FLUSH_LIMIT, &flushed, histories);
+
+	// the recorder holds less than a chunk, and gives up the rest when the process stops.
+	PRT_UINT32 size;
+	PRT_UINT8 *held = PrtGetRecording(process, &size);
+	PRT_TEST_CHECK(size < FLUSH_LIMIT && flushed.chunks > 1);
+	PrtFree(held);
+	PRT_UINT32 flushedBeforeStop = flushed.size;
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(flushed.size == flushedBeforeStop + size);
+
+	PRT_TEST_CHECK(ReplaysAs(flushed.bytes, flushed.size, histories));
+	PrtFreeValue(histories[0]);
+	PrtFreeValue(histories[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestRecordingStopsAtLimit(void)
+{
+	PrtTestResetErrors();
+	PRT_VALUE *histories[2];
+	PRT_PROCESS *process = RecordSmallRun(FLUSH_LIMIT, NULL, histories);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PRT_TEST_CHECK(size > 0 && size <= FLUSH_LIMIT);
+	PrtStopProcess(process);
+
+	// what was kept ends with a whole record, so it is read in full.
+	PRT_PROCESS *replay = PrtTestStartProcess(2, NULL);
+	PrtReplayProcess(replay, recording, size);
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)replay)->numMachines == 2);
+	PrtStopProcess(replay);
+	PrtFree(recording);
+	PrtFreeValue(histories[0]);
+	PrtFreeValue(histories[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+// replays size bytes from a block of exactly that size, so reading past it is caught; returns whether any machine was made.
+static PRT_BOOLEAN ReplayMadeMachines(_In_ const PRT_UINT8 *recording, _In_ PRT_UINT32 size, _Out_ PRT_BOOLEAN *reproduced)
+{
+	PRT_UINT8 *copy = (PRT_UINT8 *)malloc(size == 0 ? 1 : size);
+	memcpy(copy, recording, size);
+	PRT_PROCESS *replay = PrtTestStartProcess(2, NULL);
+	*reproduced = PrtReplayProcess(replay, copy, size);
+	PRT_BOOLEAN made = ((PRT_PROCESS_PRIV *)replay)->numMachines != 0;
+	PrtStopProcess(replay);
+	free(copy);
+	return made;
+}
+
+static void TestDamagedRecordingIsRejected(void)
+{
+	PrtTestResetErrors();
+	PRT_VALUE *histories[2];
+	PRT_PROCESS *process = RecordSmallRun(0, NULL, histories);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(ReplaysAs(recording, size, histories));
+
+	// a cut in the middle of a record is turned away; a cut between records replays what is left.
+	PRT_BOOLEAN reproduced;
+	for (PRT_UINT32 cut = 1; cut < size; cut++)
+	{
+		ReplayMadeMachines(recording, cut, &reproduced);
+	}
+
+	// an unknown kind, a record missing its machine, and a machine id no run has.
+	static const PRT_UINT8 tails[3][6] = { { 0x7f, 0x01 }, { 0x01 }, { 0x01, 0xff, 0xff, 0xff, 0xff, 0x0f } };
+	static const PRT_UINT32 tailSizes[3] = { 2, 1, 6 };
+	PRT_UINT8 *damaged = (PRT_UINT8 *)malloc(size + 6);
+	memcpy(damaged, recording, size);
+	for (PRT_UINT32 i = 0; i < 3; i++)
+	{
+		memcpy(&damaged[size], tails[i], tailSizes[i]);
+		PRT_TEST_CHECK(!ReplayMadeMachines(damaged, size + tailSizes[i], &reproduced) && !reproduced);
+	}
+	free(damaged);
+
+	PrtFree(recording);
+	PrtFreeValue(histories[0]);
+	PrtFreeValue(histories[1]);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestReplayReproducesRun(PRT_TRUE);
+	TestReplayReproducesRun(PRT_FALSE);
+	TestFlushedRecordingReplays();
+	TestRecordingStopsAtLimit();
+	TestDamagedRecordingIsRejected();
+	printf("PrtRecordTest passed\n");
+	return 0;
+}
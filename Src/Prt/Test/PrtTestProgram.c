@@ -0,0 +1,545 @@
+#include "PrtTestProgram.h"
+
+PRT_STATUS PrtTestLastError = P_TEST_ERROR_NONE;
+PRT_MACHINEINST *PrtTestLastErrorMachine = NULL;
+PRT_UINT32 PrtTestErrorCount = 0;
+PRT_SEMAPHORE PrtTestDoubleGate = NULL;
+
+static PRT_TYPE P_GEND_TYPE_NULL = { PRT_KIND_NULL, { NULL } };
+static PRT_TYPE P_GEND_TYPE_INT = { PRT_KIND_INT, { NULL } };
+static PRT_SEQTYPE P_GEND_TYPE_SEQ_INT_STRUCT = { &P_GEND_TYPE_INT };
+static PRT_TYPE P_GEND_TYPE_SEQ_INT = { PRT_KIND_SEQ, { .seq = &P_GEND_TYPE_SEQ_INT_STRUCT } };
+static PRT_TYPE P_GEND_TYPE_CELL = { PRT_KIND_FORGN, { .typeTag = P_FORGN_CELL } };
+static PRT_TYPE P_GEND_TYPE_TIMER_REF = { PRT_KIND_FORGN, { .typeTag = P_FORGN_TIMER_REF } };
+static PRT_TYPE P_GEND_TYPE_MACHINE = { PRT_KIND_MACHINE, { NULL } };
+static PRT_TYPE *P_GEND_TYPE_FORWARD_FIELDS[] = { &P_GEND_TYPE_MACHINE, &P_GEND_TYPE_INT };
+static PRT_TUPTYPE P_GEND_TYPE_FORWARD_STRUCT = { 2, P_GEND_TYPE_FORWARD_FIELDS };
+static PRT_TYPE P_GEND_TYPE_FORWARD = { PRT_KIND_TUPLE, { .tuple = &P_GEND_TYPE_FORWARD_STRUCT } };
+static PRT_TYPE *P_GEND_TYPE_ASK_FIELDS[] = { &P_GEND_TYPE_MACHINE, &P_GEND_TYPE_INT, &P_GEND_TYPE_INT };
+static PRT_TUPTYPE P_GEND_TYPE_ASK_STRUCT = { 3, P_GEND_TYPE_ASK_FIELDS };
+static PRT_TYPE P_GEND_TYPE_ASK = { PRT_KIND_TUPLE, { .tuple = &P_GEND_TYPE_ASK_STRUCT } };
+static PRT_TYPE *P_GEND_TYPE_SCATTER_FIELDS[] = { &P_GEND_TYPE_MACHINE, &P_GEND_TYPE_MACHINE, &P_GEND_TYPE_INT };
+static PRT_TUPTYPE P_GEND_TYPE_SCATTER_STRUCT = { 3, P_GEND_TYPE_SCATTER_FIELDS };
+static PRT_TYPE P_GEND_TYPE_SCATTER = { PRT_KIND_TUPLE, { .tuple = &P_GEND_TYPE_SCATTER_STRUCT } };
+
+//
+// A Cell is a heap-allocated PRT_INT64, cloned by copying
+//
+static PRT_UINT64 PRT_CALL_CONV P_CELL_MKDEF(void)
+{
+	return (PRT_UINT64)(size_t)calloc(1, sizeof(PRT_INT64));
+}
+
+static PRT_UINT64 PRT_CALL_CONV P_CELL_CLONE(_In_ PRT_UINT64 frgnVal)
+{
+	PRT_INT64 *clone = (PRT_INT64 *)malloc(sizeof(PRT_INT64));
+	*clone = *(PRT_INT64 *)(size_t)frgnVal;
+	return (PRT_UINT64)(size_t)clone;
+}
+
+static void PRT_CALL_CONV P_CELL_FREE(_Inout_ PRT_UINT64 frgnVal)
+{
+	free((void *)(size_t)frgnVal);
+}
+
+static PRT_UINT32 PRT_CALL_CONV P_CELL_HASH(_In_ PRT_UINT64 frgnVal)
+{
+	return (PRT_UINT32)*(PRT_INT64 *)(size_t)frgnVal;
+}
+
+static PRT_BOOLEAN PRT_CALL_CONV P_CELL_ISEQUAL(_In_ PRT_UINT64 frgnVal1, _In_ PRT_UINT64 frgnVal2)
+{
+	return *(PRT_INT64 *)(size_t)frgnVal1 == *(PRT_INT64 *)(size_t)frgnVal2;
+}
+
+static PRT_STRING PRT_CALL_CONV P_CELL_TOSTRING(_In_ PRT_UINT64 frgnVal)
+{
+	return NULL;
+}
+
+static void PRT_CALL_CONV P_CELL_SERIALIZE(_In_ PRT_UINT64 frgnVal, _Inout_ PRT_BYTE_BUFFER *buffer)
+{
+	PrtWriteBytes(buffer, (PRT_INT64 *)(size_t)frgnVal, sizeof(PRT_INT64));
+}
+
+static PRT_UINT64 PRT_CALL_CONV P_CELL_DESERIALIZE(_In_ const PRT_UINT8 *bytes, _Inout_ PRT_UINT32 *position)
+{
+	PRT_INT64 *cell = (PRT_INT64 *)malloc(sizeof(PRT_INT64));
+	PrtReadBytes(bytes, position, cell, sizeof(PRT_INT64));
+	return (PRT_UINT64)(size_t)cell;
+}
+
+//
+// A TimerRef is a PRT_EVENT_TIMER that is freed with the value; the tests never clone one
+//
+static PRT_UINT64 PRT_CALL_CONV P_TIMER_REF_MKDEF(void)
+{
+	return 0;
+}
+
+static PRT_UINT64 PRT_CALL_CONV P_TIMER_REF_CLONE(_In_ PRT_UINT64 frgnVal)
+{
+	return frgnVal;
+}
+
+static void PRT_CALL_CONV P_TIMER_REF_FREE(_Inout_ PRT_UINT64 frgnVal)
+{
+	if (frgnVal != 0)
+	{
+		PrtFreeEventTimer((PRT_EVENT_TIMER *)(size_t)frgnVal);
+	}
+}
+
+static PRT_UINT32 PRT_CALL_CONV P_TIMER_REF_HASH(_In_ PRT_UINT64 frgnVal)
+{
+	return (PRT_UINT32)frgnVal;
+}
+
+static PRT_BOOLEAN PRT_CALL_CONV P_TIMER_REF_ISEQUAL(_In_ PRT_UINT64 frgnVal1, _In_ PRT_UINT64 frgnVal2)
+{
+	return frgnVal1 == frgnVal2;
+}
+
+static PRT_STRING PRT_CALL_CONV P_TIMER_REF_TOSTRING(_In_ PRT_UINT64 frgnVal)
+{
+	return NULL;
+}
+
+static PRT_FOREIGNTYPEDECL P_GEND_FOREIGNTYPES[] =
+{
+	{
+		P_FORGN_CELL, "Cell", &P_CELL_MKDEF, &P_CELL_CLONE, &P_CELL_FREE, &P_CELL_HASH, &P_CELL_ISEQUAL, &P_CELL_TOSTRING, 0, NULL,
+		&P_CELL_SERIALIZE, &P_CELL_DESERIALIZE
+	},
+	{
+		P_FORGN_TIMER_REF, "TimerRef", &P_TIMER_REF_MKDEF, &P_TIMER_REF_CLONE, &P_TIMER_REF_FREE, &P_TIMER_REF_HASH,
+		&P_TIMER_REF_ISEQUAL, &P_TIMER_REF_TOSTRING, 0, NULL, NULL, NULL
+	}
+};
+
+static PRT_EVENTDECL P_EVENT_NULL_STRUCT = { P_EVENT_NULL, "null", 0, &P_GEND_TYPE_NULL, 0, NULL };
+static PRT_EVENTDECL P_EVENT_HALT_STRUCT = { P_EVENT_HALT, "halt", 0, &P_GEND_TYPE_NULL, 0, NULL };
+static PRT_EVENTDECL P_EVENT_ADD_STRUCT = { P_EVENT_ADD, "Add", 0xffffffff, &P_GEND_TYPE_INT, 0, NULL };
+static PRT_EVENTDECL P_EVENT_FORWARD_STRUCT = { P_EVENT_FORWARD, "Forward", 0xffffffff, &P_GEND_TYPE_FORWARD, 0, NULL };
+static PRT_EVENTDECL P_EVENT_COUNTDOWN_STRUCT = { P_EVENT_COUNTDOWN, "Countdown", 0xffffffff, &P_GEND_TYPE_INT, 0, NULL };
+static PRT_EVENTDECL P_EVENT_RESET_STRUCT = { P_EVENT_RESET, "Reset", 0xffffffff, &P_GEND_TYPE_NULL, 0, NULL };
+static PRT_EVENTDECL P_EVENT_WAIT_STRUCT = { P_EVENT_WAIT, "Wait", 0xffffffff, &P_GEND_TYPE_INT, 0, NULL };
+static PRT_EVENTDECL P_EVENT_FETCH_STRUCT = { P_EVENT_FETCH, "Fetch", 0xffffffff, &P_GEND_TYPE_INT, 0, NULL };
+static PRT_EVENTDECL P_EVENT_ASK_STRUCT = { P_EVENT_ASK, "Ask", 0xffffffff, &P_GEND_TYPE_ASK, 0, NULL };
+static PRT_EVENTDECL P_EVENT_TWICE_STRUCT = { P_EVENT_TWICE, "Twice", 0xffffffff, &P_GEND_TYPE_INT, 0, NULL };
+static PRT_EVENTDECL P_EVENT_SCATTER_STRUCT = { P_EVENT_SCATTER, "Scatter", 0xffffffff, &P_GEND_TYPE_SCATTER, 0, NULL };
+
+static PRT_EVENTDECL *P_GEND_EVENTS[] =
+{
+	&P_EVENT_NULL_STRUCT, &P_EVENT_HALT_STRUCT, &P_EVENT_ADD_STRUCT, &P_EVENT_FORWARD_STRUCT, &P_EVENT_COUNTDOWN_STRUCT,
+	&P_EVENT_RESET_STRUCT, &P_EVENT_WAIT_STRUCT, &P_EVENT_FETCH_STRUCT, &P_EVENT_ASK_STRUCT, &P_EVENT_TWICE_STRUCT,
+	&P_EVENT_SCATTER_STRUCT
+};
+
+static PRT_UINT32 P_GEND_EVENTSET_EMPTY_PACKED[] = { 0x0U };
+static PRT_UINT32 P_GEND_EVENTSET_COUNTER_DOS_PACKED[] =
+{
+	(1U << P_EVENT_ADD) | (1U << P_EVENT_FORWARD) | (1U << P_EVENT_COUNTDOWN) | (1U << P_EVENT_WAIT) | (1U << P_EVENT_FETCH) |
+	(1U << P_EVENT_ASK) | (1U << P_EVENT_TWICE) | (1U << P_EVENT_SCATTER)
+};
+static PRT_UINT32 P_GEND_EVENTSET_COUNTER_TRANS_PACKED[] = { 1U << P_EVENT_RESET };
+static PRT_UINT32 P_GEND_EVENTSET_COUNTER_WAIT_CASES_PACKED[] = { 1U << P_EVENT_ADD };
+
+static PRT_EVENTSETDECL P_GEND_EVENTSETS[] =
+{
+	{ 0, P_GEND_EVENTSET_EMPTY_PACKED },
+	{ 1, P_GEND_EVENTSET_COUNTER_DOS_PACKED },
+	{ 2, P_GEND_EVENTSET_COUNTER_TRANS_PACKED },
+	{ 3, P_GEND_EVENTSET_COUNTER_WAIT_CASES_PACKED }
+};
+
+static PRT_FUNDECL P_FUN_IGNORE_PUSH_STRUCT = { 0, 0, "ignore", NULL, 0, 0, 0, NULL, NULL, 0, NULL, 0, NULL };
+
+static PRT_FUNDECL *P_GEND_FUNS[] = { &P_FUN_IGNORE_PUSH_STRUCT };
+
+static PRT_VALUE *P_FUN_Counter_Add_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *x = p_tmp_frame.locals[0];
+	PRT_VALUE *total = PrtGetGlobalVar(p_tmp_mach_priv, 0);
+	PRT_VALUE *history = PrtGetGlobalVar(p_tmp_mach_priv, 1);
+	PRT_VALUE *cell = PrtGetGlobalVar(p_tmp_mach_priv, 2);
+	PrtPrimSetInt(total, PrtPrimGetInt(total) + PrtPrimGetInt(x));
+	*(PRT_INT64 *)(size_t)PrtGetForeignValue(cell) += PrtPrimGetInt(x);
+	PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), x, PRT_TRUE);
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Forward_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *p = p_tmp_frame.locals[0];
+	PRT_VALUE *target = PrtTupleGetNC(p, 0);
+	PRT_VALUE *choice = PrtMkNondetBoolValue();
+	PRT_INT32 x = PrtPrimGetInt(PrtTupleGetNC(p, 1));
+	PRT_VALUE *y = PrtMkIntValue(PrtPrimGetBool(choice) ? x : -x);
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PrtSendInternal(context, PrtGetMachine(context->process, target), event, 1, PRT_FUN_PARAM_MOVE, &y);
+	PrtFreeValue(event);
+	PrtFreeValue(choice);
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Countdown_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *n = p_tmp_frame.locals[0];
+	PRT_VALUE *total = PrtGetGlobalVar(p_tmp_mach_priv, 0);
+	PRT_VALUE *history = PrtGetGlobalVar(p_tmp_mach_priv, 1);
+	PrtPrimSetInt(total, PrtPrimGetInt(total) + PrtPrimGetInt(n));
+	PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), n, PRT_TRUE);
+	if (PrtPrimGetInt(n) > 0)
+	{
+		PRT_VALUE *m = PrtMkIntValue(PrtPrimGetInt(n) - 1);
+		PRT_VALUE *event = PrtMkEventValue(P_EVENT_COUNTDOWN);
+		PrtRaise(p_tmp_mach_priv, event, 1, PRT_FUN_PARAM_MOVE, &m);
+		PrtFreeValue(event);
+	}
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Wait_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *timeout = p_tmp_frame.locals[0];
+	switch (PrtReceiveWithTimeout(p_tmp_mach_priv, &p_tmp_frame, 0, (PRT_UINT64)PrtPrimGetInt(timeout)))
+	{
+	case PRT_RECEIVE_BLOCKED:
+		return NULL;
+	case PRT_RECEIVE_CASE:
+		// the only case is Add, whose frame the receive pushed.
+		PrtAssert(p_tmp_frame.rcase->triggerEventIndex == P_EVENT_ADD, "Wait receives only Add");
+		P_FUN_Counter_Add_IMPL(context);
+		break;
+	case PRT_RECEIVE_TIMEOUT:
+	{
+		PRT_VALUE *history = PrtGetGlobalVar(p_tmp_mach_priv, 1);
+		PRT_VALUE *marker = PrtMkIntValue(-1);
+		PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), marker, PRT_FALSE);
+		break;
+	}
+	}
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *PRT_CALL_CONV P_FOREIGN_Double(_Inout_ void *arg)
+{
+	if (PrtTestDoubleGate != NULL)
+	{
+		PrtWaitSemaphore(PrtTestDoubleGate, -1);
+	}
+	return PrtMkIntValue(2 * (PRT_INT32)(size_t)arg);
+}
+
+static PRT_VALUE *P_FUN_Counter_Fetch_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *x = p_tmp_frame.locals[0];
+	PRT_VALUE *y;
+	if (!PrtCallBlocking(p_tmp_mach_priv, &p_tmp_frame, 1, &P_FOREIGN_Double, (void *)(size_t)PrtPrimGetInt(x), &y))
+	{
+		return NULL;
+	}
+	PRT_VALUE *total = PrtGetGlobalVar(p_tmp_mach_priv, 0);
+	PRT_VALUE *history = PrtGetGlobalVar(p_tmp_mach_priv, 1);
+	PrtPrimSetInt(total, PrtPrimGetInt(total) + PrtPrimGetInt(y));
+	PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), y, PRT_FALSE);
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Ask_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *p = p_tmp_frame.locals[0];
+	PRT_MACHINEINST_PRIV *target = (PRT_MACHINEINST_PRIV *)PrtGetMachine(context->process, PrtTupleGetNC(p, 0));
+	PRT_VALUE *x = PrtCloneValue(PrtTupleGetNC(p, 1));
+	PRT_UINT64 timeout = (PRT_UINT64)PrtPrimGetInt(PrtTupleGetNC(p, 2));
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_TWICE);
+	PRT_VALUE *y = NULL;
+	PRT_CALL_RESULT result = PrtCallMachine(p_tmp_mach_priv, &p_tmp_frame, 1, target, event, x, timeout, &y);
+	PrtFreeValue(event);
+	if (result == PRT_CALL_PENDING)
+	{
+		return NULL;
+	}
+	PRT_VALUE *history = PrtGetGlobalVar(p_tmp_mach_priv, 1);
+	if (result == PRT_CALL_REPLIED)
+	{
+		PRT_VALUE *total = PrtGetGlobalVar(p_tmp_mach_priv, 0);
+		PrtPrimSetInt(total, PrtPrimGetInt(total) + PrtPrimGetInt(y));
+		PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), y, PRT_FALSE);
+	}
+	else
+	{
+		PRT_VALUE *marker = PrtMkIntValue(result == PRT_CALL_TIMEOUT ? -1 : -2);
+		PrtSeqInsertExIntIndex(history, PrtSeqSizeOf(history), marker, PRT_FALSE);
+	}
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Twice_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_INT32 x = PrtPrimGetInt(p_tmp_frame.locals[0]);
+	if (x >= 0)
+	{
+		PrtReply(p_tmp_mach_priv, PrtGetCallToken(p_tmp_mach_priv), PrtMkIntValue(2 * x));
+	}
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_VALUE *P_FUN_Counter_Scatter_IMPL(PRT_MACHINEINST *context)
+{
+	PRT_MACHINEINST_PRIV *p_tmp_mach_priv = (PRT_MACHINEINST_PRIV *)context;
+	PRT_FUNSTACK_INFO p_tmp_frame;
+	PrtPopFrame(p_tmp_mach_priv, &p_tmp_frame);
+	PRT_VALUE *p = p_tmp_frame.locals[0];
+	PRT_MACHINEINST *first = PrtGetMachine(context->process, PrtTupleGetNC(p, 0));
+	PRT_MACHINEINST *second = PrtGetMachine(context->process, PrtTupleGetNC(p, 1));
+	PRT_INT32 x = PrtPrimGetInt(PrtTupleGetNC(p, 2));
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PRT_VALUE *y = PrtMkIntValue(x);
+	PrtSendInternal(context, first, event, 1, PRT_FUN_PARAM_MOVE, &y);
+	y = PrtMkIntValue(x + 1);
+	PrtSendInternal(context, second, event, 1, PRT_FUN_PARAM_MOVE, &y);
+	y = PrtMkIntValue(x + 2);
+	PrtSendInternal(context, first, event, 1, PRT_FUN_PARAM_MOVE, &y);
+	PrtFreeValue(event);
+	PrtFreeLocals(p_tmp_mach_priv, &p_tmp_frame);
+	return NULL;
+}
+
+static PRT_CASEDECL P_GEND_COUNTER_WAIT_CASES[] =
+{
+	{ P_EVENT_ADD, 2 * 1 + 1 }
+};
+
+static PRT_RECEIVEDECL P_GEND_COUNTER_WAIT_RECEIVES[] =
+{
+	{ 0, 3, 1, P_GEND_COUNTER_WAIT_CASES }
+};
+
+static PRT_FUNDECL P_GEND_COUNTER_FUNS[] =
+{
+	{ 0, P_MACHINE_COUNTER, "Init_entry", NULL, 0, 0, 0, NULL, NULL, 0, NULL, 0, NULL },
+	{ 1, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Add_IMPL, 1, 1, 1, &P_GEND_TYPE_INT, NULL, 0, NULL, 0, NULL },
+	{ 2, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Forward_IMPL, 1, 1, 1, &P_GEND_TYPE_FORWARD, NULL, 0, NULL, 0, NULL },
+	{ 3, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Countdown_IMPL, 1, 1, 1, &P_GEND_TYPE_INT, NULL, 0, NULL, 0, NULL },
+	{ 4, P_MACHINE_COUNTER, NULL, NULL, 1, 1, 1, &P_GEND_TYPE_NULL, NULL, 0, NULL, 0, NULL },
+	{ 5, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Wait_IMPL, 1, 1, 1, &P_GEND_TYPE_INT, NULL, 1, P_GEND_COUNTER_WAIT_RECEIVES, 0, NULL },
+	{ 6, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Fetch_IMPL, 1, 1, 1, &P_GEND_TYPE_INT, NULL, 0, NULL, 0, NULL },
+	{ 7, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Ask_IMPL, 1, 1, 1, &P_GEND_TYPE_ASK, NULL, 0, NULL, 0, NULL },
+	{ 8, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Twice_IMPL, 1, 1, 1, &P_GEND_TYPE_INT, NULL, 0, NULL, 0, NULL },
+	{ 9, P_MACHINE_COUNTER, NULL, &P_FUN_Counter_Scatter_IMPL, 1, 1, 1, &P_GEND_TYPE_SCATTER, NULL, 0, NULL, 0, NULL }
+};
+
+static PRT_TRANSDECL P_GEND_COUNTER_INIT_TRANS[] =
+{
+	{ 0, 0, P_MACHINE_COUNTER, P_EVENT_RESET, 0, 2 * 4 + 1, 0, NULL }
+};
+
+static PRT_DODECL P_GEND_COUNTER_INIT_DOS[] =
+{
+	{ 0, 0, P_MACHINE_COUNTER, P_EVENT_ADD, 2 * 1 + 1, 0, NULL },
+	{ 1, 0, P_MACHINE_COUNTER, P_EVENT_FORWARD, 2 * 2 + 1, 0, NULL },
+	{ 2, 0, P_MACHINE_COUNTER, P_EVENT_COUNTDOWN, 2 * 3 + 1, 0, NULL },
+	{ 3, 0, P_MACHINE_COUNTER, P_EVENT_WAIT, 2 * 5 + 1, 0, NULL },
+	{ 4, 0, P_MACHINE_COUNTER, P_EVENT_FETCH, 2 * 6 + 1, 0, NULL },
+	{ 5, 0, P_MACHINE_COUNTER, P_EVENT_ASK, 2 * 7 + 1, 0, NULL },
+	{ 6, 0, P_MACHINE_COUNTER, P_EVENT_TWICE, 2 * 8 + 1, 0, NULL },
+	{ 7, 0, P_MACHINE_COUNTER, P_EVENT_SCATTER, 2 * 9 + 1, 0, NULL }
+};
+
+static PRT_STATEDECL P_GEND_COUNTER_STATES[] =
+{
+	{ 0, P_MACHINE_COUNTER, "Init", 1, 8, 0, 2, 1, P_GEND_COUNTER_INIT_TRANS, P_GEND_COUNTER_INIT_DOS, 2 * 0 + 1, 2 * 0 + 1, 0, NULL }
+};
+
+static PRT_VARDECL P_GEND_COUNTER_VARS[] =
+{
+	{ 0, P_MACHINE_COUNTER, "total", &P_GEND_TYPE_INT, 0, NULL },
+	{ 1, P_MACHINE_COUNTER, "history", &P_GEND_TYPE_SEQ_INT, 0, NULL },
+	{ 2, P_MACHINE_COUNTER, "cell", &P_GEND_TYPE_CELL, 0, NULL }
+};
+
+static PRT_MACHINEDECL P_MACHINE_COUNTER_STRUCT =
+{
+	P_MACHINE_COUNTER, "Counter", 3, 1, 10, 0xffffffff, 0,
+	P_GEND_COUNTER_VARS, P_GEND_COUNTER_STATES, P_GEND_COUNTER_FUNS, 0, NULL
+};
+
+static PRT_MACHINEDECL *P_GEND_MACHINES[] = { &P_MACHINE_COUNTER_STRUCT };
+
+static PRT_UINT32 P_GEND_LINKMAP_COUNTER[] = { 0 };
+static PRT_UINT32 *P_GEND_LINKMAP[] = { P_GEND_LINKMAP_COUNTER };
+static PRT_UINT32 P_GEND_RENAMEMAP[] = { P_MACHINE_COUNTER };
+
+PRT_PROGRAMDECL P_GEND_TEST_PROGRAM =
+{
+	P_EVENT_COUNT, 4, 1, 1, 2,
+	P_GEND_EVENTS, P_GEND_EVENTSETS, P_GEND_MACHINES, P_GEND_FUNS, P_GEND_FOREIGNTYPES,
+	P_GEND_LINKMAP, P_GEND_RENAMEMAP, 0, NULL
+};
+
+void PRT_CALL_CONV PrtTestErrorFun(_In_ PRT_STATUS status, _In_ PRT_MACHINEINST *context)
+{
+	PrtTestLastError = status;
+	PrtTestLastErrorMachine = context;
+	PrtTestErrorCount++;
+}
+
+void PrtTestResetErrors(void)
+{
+	PrtTestLastError = P_TEST_ERROR_NONE;
+	PrtTestLastErrorMachine = NULL;
+	PrtTestErrorCount = 0;
+}
+
+void PRT_CALL_CONV PrtTestLogFun(_In_ PRT_STEP step, _In_ PRT_MACHINESTATE *senderState, _In_ PRT_MACHINEINST *receiver, _In_ PRT_VALUE *eventid, _In_ PRT_VALUE *payload)
+{
+}
+
+PRT_PROCESS *PrtTestStartProcess(_In_ PRT_UINT32 data1, _In_ PRT_ALLOCATOR *allocator)
+{
+	PRT_GUID guid;
+	guid.data1 = data1;
+	guid.data2 = 0;
+	guid.data3 = 0;
+	guid.data4 = 0;
+	return PrtStartProcessEx(guid, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, allocator);
+}
+
+void PrtTestSendAdd(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ADD);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSend(NULL, counter, event, 1, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendForward(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *target, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_FORWARD);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSend(NULL, counter, event, 2, PRT_FUN_PARAM_CLONE, target->id, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendScatter(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *first, _In_ PRT_MACHINEINST *second, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_SCATTER);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSend(NULL, counter, event, 3, PRT_FUN_PARAM_CLONE, first->id, PRT_FUN_PARAM_CLONE, second->id, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendCountdown(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 n)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_COUNTDOWN);
+	PRT_VALUE *payload = PrtMkIntValue(n);
+	PrtSend(NULL, counter, event, 1, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendReset(_Inout_ PRT_MACHINEINST *counter)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_RESET);
+	PrtSend(NULL, counter, event, 0);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendWait(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 timeout)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_WAIT);
+	PRT_VALUE *payload = PrtMkIntValue(timeout);
+	PrtSend(NULL, counter, event, 1, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendFetch(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 x)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_FETCH);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSend(NULL, counter, event, 1, PRT_FUN_PARAM_MOVE, &payload);
+	PrtFreeValue(event);
+}
+
+void PrtTestSendAsk(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *target, _In_ PRT_INT32 x, _In_ PRT_INT32 timeout)
+{
+	PRT_VALUE *event = PrtMkEventValue(P_EVENT_ASK);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PRT_VALUE *after = PrtMkIntValue(timeout);
+	PrtSend(NULL, counter, event, 3, PRT_FUN_PARAM_CLONE, target->id, PRT_FUN_PARAM_MOVE, &payload, PRT_FUN_PARAM_MOVE, &after);
+	PrtFreeValue(event);
+}
+
+PRT_INT32 PrtTestGetTotal(_In_ PRT_MACHINEINST *counter)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtThawMachine(context);
+	PRT_INT32 total = PrtPrimGetInt(PrtGetGlobalVar(context, 0));
+	PrtReleaseLock(&context->stateMachineLock);
+	return total;
+}
+
+PRT_INT64 PrtTestGetCell(_In_ PRT_MACHINEINST *counter)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtThawMachine(context);
+	PRT_INT64 cell = *(PRT_INT64 *)(size_t)PrtGetForeignValue(PrtGetGlobalVar(context, 2));
+	PrtReleaseLock(&context->stateMachineLock);
+	return cell;
+}
+
+PRT_VALUE *PrtTestMkTimerRef(_In_ PRT_EVENT_TIMER *timer)
+{
+	return PrtMkForeignValue((PRT_UINT64)(size_t)timer, &P_GEND_TYPE_TIMER_REF);
+}
+
+PRT_UINT32 PrtTestGetHistoryLength(_In_ PRT_MACHINEINST *counter)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtThawMachine(context);
+	PRT_UINT32 length = PrtSeqSizeOf(PrtGetGlobalVar(context, 1));
+	PrtReleaseLock(&context->stateMachineLock);
+	return length;
+}
+
+PRT_VALUE *PrtTestGetHistory(_In_ PRT_MACHINEINST *counter)
+{
+	PRT_MACHINEINST_PRIV *context = (PRT_MACHINEINST_PRIV *)counter;
+	PrtAcquireLock(&context->stateMachineLock);
+	PrtThawMachine(context);
+	PRT_VALUE *history = PrtCloneValue(PrtGetGlobalVar(context, 1));
+	PrtReleaseLock(&context->stateMachineLock);
+	return history;
+}
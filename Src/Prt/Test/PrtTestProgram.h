@@ -0,0 +1,135 @@
+/**
+* \file PrtTestProgram.h
+* \brief A small P program, written out the way the compiler emits it, that the runtime tests run.
+*
+* type Cell; // foreign: a boxed 64-bit integer
+* type TimerRef; // foreign: an event timer, freed along with the value that holds it
+* fun Double(x: int): int; // foreign and blocking: returns 2 * x, on a helper thread
+*
+* machine Counter {
+*   var total: int;
+*   var history: seq[int];
+*   var cell: Cell;
+*   start state Init {
+*     on Reset goto Init;
+*     on Add do (x: int) { total = total + x; history += (sizeof(history), x); IncrementCell(cell, x); }
+*     on Forward do (p: (machine, int)) { if ($) send p.0, Add, p.1; else send p.0, Add, -p.1; }
+*     on Countdown do (n: int) { total = total + n; history += (sizeof(history), n); if (n > 0) raise Countdown, n - 1; }
+*     on Wait do (timeout: int) {
+*       receive { case Add: (x: int) { total = total + x; history += (sizeof(history), x); IncrementCell(cell, x); } }
+*       after timeout { history += (sizeof(history), -1); }
+*     }
+*     on Fetch do (x: int) { var y: int; y = Double(x); total = total + y; history += (sizeof(history), y); }
+*     on Ask do (p: (machine, int, int)) {
+*       var y: int;
+*       y = call p.0, Twice, p.1 after p.2 { history += (sizeof(history), -1); return; } halted { history += (sizeof(history), -2); return; }
+*       total = total + y; history += (sizeof(history), y);
+*     }
+*     on Twice do (x: int) { if (x >= 0) reply 2 * x; }
+*     on Scatter do (p: (machine, machine, int)) { send p.0, Add, p.2; send p.1, Add, p.2 + 1; send p.0, Add, p.2 + 2; }
+*   }
+* }
+*/
+#ifndef PRTTESTPROGRAM_H
+#define PRTTESTPROGRAM_H
+
+#include <stdio.h>
+#include "PrtExecution.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** Fails the running test with the location and text of cond if cond does not hold. */
+#define PRT_TEST_CHECK(cond) \
+	do { if (!(cond)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+enum
+{
+	P_EVENT_NULL = 0,
+	P_EVENT_HALT = 1,
+	P_EVENT_ADD = 2,
+	P_EVENT_FORWARD = 3,
+	P_EVENT_COUNTDOWN = 4,
+	P_EVENT_RESET = 5,
+	P_EVENT_WAIT = 6,
+	P_EVENT_FETCH = 7,
+	P_EVENT_ASK = 8,
+	P_EVENT_TWICE = 9,
+	P_EVENT_SCATTER = 10,
+	P_EVENT_COUNT = 11
+};
+
+enum
+{
+	P_MACHINE_COUNTER = 0
+};
+
+enum
+{
+	P_FORGN_CELL = 0,
+	P_FORGN_TIMER_REF = 1
+};
+
+extern PRT_PROGRAMDECL P_GEND_TEST_PROGRAM;
+
+/** The last error reported by a test process, and the machine it was reported for; P_TEST_ERROR_NONE until the first error. */
+#define P_TEST_ERROR_NONE ((PRT_STATUS)-1)
+extern PRT_STATUS PrtTestLastError;
+extern PRT_MACHINEINST *PrtTestLastErrorMachine;
+extern PRT_UINT32 PrtTestErrorCount;
+
+/** While not NULL, Double waits on this semaphore before it returns, so that tests can hold Counters in a blocking call. */
+extern PRT_SEMAPHORE PrtTestDoubleGate;
+
+/** Forgets all errors reported so far. */
+void PrtTestResetErrors(void);
+
+void PRT_CALL_CONV PrtTestErrorFun(_In_ PRT_STATUS status, _In_ PRT_MACHINEINST *context);
+void PRT_CALL_CONV PrtTestLogFun(_In_ PRT_STEP step, _In_ PRT_MACHINESTATE *senderState, _In_ PRT_MACHINEINST *receiver, _In_ PRT_VALUE *eventid, _In_ PRT_VALUE *payload);
+
+/** Makes a process for the test program with fresh guid data1 and the given allocator (NULL for default). */
+PRT_PROCESS *PrtTestStartProcess(_In_ PRT_UINT32 data1, _In_ PRT_ALLOCATOR *allocator);
+
+/** Sends Add(x) to a Counter. */
+void PrtTestSendAdd(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 x);
+
+/** Sends Forward(target, x) to a Counter, which sends Add(x) or Add(-x) to target. */
+void PrtTestSendForward(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *target, _In_ PRT_INT32 x);
+
+/** Sends Scatter(first, second, x) to a Counter, which sends Add(x) to first, Add(x + 1) to second and Add(x + 2) to first. */
+void PrtTestSendScatter(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *first, _In_ PRT_MACHINEINST *second, _In_ PRT_INT32 x);
+
+/** Sends Countdown(n) to a Counter, which raises Countdown(n - 1) to itself until n is 0. */
+void PrtTestSendCountdown(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 n);
+
+/** Sends Reset to a Counter, which leaves its state and enters it again; the Counter has no entry, exit or transition code. */
+void PrtTestSendReset(_Inout_ PRT_MACHINEINST *counter);
+
+/** Sends Wait(timeout) to a Counter, which then receives only Add, and appends -1 to its history if none comes within timeout ms. */
+void PrtTestSendWait(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 timeout);
+
+/** Sends Fetch(x) to a Counter, which calls Double(x) on a helper thread and adds the result once it comes back. */
+void PrtTestSendFetch(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_INT32 x);
+
+/** Sends Ask(target, x, timeout) to a Counter, which calls target with Twice(x) and adds the reply, 2 * x, once it
+* comes back; it appends -1 to its history if no reply comes within timeout ms (0 for no limit), and -2 if target halts.
+* A Counter replies to Twice only if x is not negative.
+*/
+void PrtTestSendAsk(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_MACHINEINST *target, _In_ PRT_INT32 x, _In_ PRT_INT32 timeout);
+
+/** Reads the variables of a Counter, thawing it if it is hibernated. */
+PRT_INT32 PrtTestGetTotal(_In_ PRT_MACHINEINST *counter);
+PRT_UINT32 PrtTestGetHistoryLength(_In_ PRT_MACHINEINST *counter);
+PRT_INT64 PrtTestGetCell(_In_ PRT_MACHINEINST *counter);
+
+/** Makes a TimerRef that frees timer when it is freed. */
+PRT_VALUE *PrtTestMkTimerRef(_In_ PRT_EVENT_TIMER *timer);
+
+/** Copies the history of a Counter; the caller frees the copy. */
+PRT_VALUE *PrtTestGetHistory(_In_ PRT_MACHINEINST *counter);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,416 @@
+#include <pthread.h>
+#include <time.h>
+#include "PrtTestProgram.h"
+
+/*
+* Arms timers on a wheel of its own with deadlines from a millisecond to past the reach of the coarsest level, moves
+* it in steps of all sizes, and checks that each timer fires with the first step that reaches its deadline. Then starts
+* event timers of Counters on a clock the test moves by hand and on the platform clock, and checks that each sends
+* its Add once, unless it was started over or cancelled, under both scheduling policies and in a replay, and that a
+* timer whose payload frees it is freed once.
+*/
+
+/* How long a test waits for a timer on the platform clock before it gives up, in milliseconds */
+#define PATIENCE 5000
+
+#define WHEEL_TIMERS 2000
+
+static volatile PRT_UINT64 fakeNow = 0;
+
+static PRT_UINT64 PRT_CALL_CONV FakeNow(_Inout_ void *state)
+{
+	return fakeNow;
+}
+
+static PRT_CLOCK fakeClock = { &FakeNow, NULL };
+
+static PRT_UINT64 randomState = 88172645463325252ULL;
+
+static PRT_UINT64 NextRandom(void)
+{
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+	return randomState;
+}
+
+typedef struct WHEEL_TIMER
+{
+	PRT_TIMER	timer;
+	PRT_UINT64	deadline;
+	PRT_UINT64	firedAt;	/* 0 until it fires */
+	PRT_UINT32	fired;
+	PRT_BOOLEAN	cancelled;
+} WHEEL_TIMER;
+
+static WHEEL_TIMER wheelTimers[WHEEL_TIMERS];
+static PRT_UINT64 wheelNow;
+
+static void WheelTimerFired(_Inout_ void *owner, _In_ PRT_UINT32 generation)
+{
+	WHEEL_TIMER *timer = (WHEEL_TIMER *)owner;
+	PRT_TEST_CHECK(timer->timer.generation == generation);
+	timer->firedAt = wheelNow;
+	timer->fired++;
+}
+
+// Deadlines up to 2^27 milliseconds ahead, mostly near so that many share the finer levels.
+static PRT_UINT64 RandomDelay(void)
+{
+	PRT_UINT32 bits = (PRT_UINT32)(NextRandom() % 28);
+	return 1 + NextRandom() % ((PRT_UINT64)1 << bits);
+}
+
+static void TestWheelFiresOnTime(void)
+{
+	PrtTestResetErrors();
+	PRT_TIMER_WHEEL wheel;
+	wheelNow = 5000;
+	PrtInitTimerWheel(&wheel, wheelNow, NULL, NULL);
+	for (PRT_UINT32 i = 0; i < WHEEL_TIMERS; i++)
+	{
+		WHEEL_TIMER *timer = &wheelTimers[i];
+		PrtInitTimer(&timer->timer, &WheelTimerFired, timer);
+		timer->deadline = wheelNow + RandomDelay();
+		timer->firedAt = 0;
+		timer->fired = 0;
+		timer->cancelled = PRT_FALSE;
+		PrtArmTimer(&wheel, &timer->timer, timer->deadline);
+	}
+	PRT_TEST_CHECK(wheel.armed == WHEEL_TIMERS);
+
+	PRT_UINT64 last = wheelNow;
+	PRT_UINT32 steps = 0;
+	while (wheel.armed > 0)
+	{
+		// partway through, some timers are cancelled and some moved, both nearer and further.
+		if (steps == 200)
+		{
+			for (PRT_UINT32 i = 0; i < WHEEL_TIMERS; i += 7)
+			{
+				WHEEL_TIMER *timer = &wheelTimers[i];
+				if (timer->fired == 0)
+				{
+					if (i % 2 == 0)
+					{
+						PRT_TEST_CHECK(PrtCancelTimer(&wheel, &timer->timer));
+						timer->cancelled = PRT_TRUE;
+					}
+					else
+					{
+						timer->deadline = wheelNow + RandomDelay();
+						PrtArmTimer(&wheel, &timer->timer, timer->deadline);
+					}
+				}
+			}
+		}
+		last = wheelNow;
+		wheelNow += 1 + NextRandom() % (steps % 3 == 0 ? 300 : 1 << (steps % 20));
+		PrtAdvanceTimerWheel(&wheel, wheelNow);
+		for (PRT_UINT32 i = 0; i < WHEEL_TIMERS; i++)
+		{
+			WHEEL_TIMER *timer = &wheelTimers[i];
+			if (timer->firedAt == wheelNow)
+			{
+				PRT_TEST_CHECK(timer->deadline > last && timer->deadline <= wheelNow);
+			}
+			else if (!timer->cancelled && timer->fired == 0)
+			{
+				PRT_TEST_CHECK(timer->deadline > wheelNow);
+			}
+		}
+		steps++;
+	}
+	for (PRT_UINT32 i = 0; i < WHEEL_TIMERS; i++)
+	{
+		PRT_TEST_CHECK(wheelTimers[i].fired == (wheelTimers[i].cancelled ? 0 : 1));
+		PRT_TEST_CHECK(!PrtCancelTimer(&wheel, &wheelTimers[i].timer));
+	}
+	PRT_TEST_CHECK(wheel.near == 0);
+	PrtDestroyTimerWheel(&wheel);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestDelayReachesFarTimer(void)
+{
+	PrtTestResetErrors();
+	PRT_TIMER_WHEEL wheel;
+	wheelNow = 0;
+	PrtInitTimerWheel(&wheel, wheelNow, NULL, NULL);
+	PRT_TEST_CHECK(PrtGetTimerDelay(&wheel, wheelNow) == PRT_TIMER_NONE);
+	WHEEL_TIMER *timer = &wheelTimers[0];
+	PrtInitTimer(&timer->timer, &WheelTimerFired, timer);
+	timer->deadline = 100000;
+	timer->fired = 0;
+	PrtArmTimer(&wheel, &timer->timer, timer->deadline);
+
+	// a waiter wakes up at each turn of the millisecond slots until the timer is in them, then at its deadline.
+	PRT_UINT32 wakeups = 0;
+	while (timer->fired == 0)
+	{
+		PRT_UINT32 delay = PrtGetTimerDelay(&wheel, wheelNow);
+		PRT_TEST_CHECK(delay > 0 && delay <= PRT_TIMER_WHEEL_SLOTS);
+		wheelNow += delay;
+		PRT_TEST_CHECK(wheelNow <= timer->deadline);
+		PrtAdvanceTimerWheel(&wheel, wheelNow);
+		wakeups++;
+	}
+	PRT_TEST_CHECK(timer->firedAt == timer->deadline);
+	PRT_TEST_CHECK(wakeups <= timer->deadline / PRT_TIMER_WHEEL_SLOTS + 2);
+	PRT_TEST_CHECK(PrtGetTimerDelay(&wheel, wheelNow) == PRT_TIMER_NONE);
+	PrtDestroyTimerWheel(&wheel);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static PRT_PROCESS *StartTimerProcess(_In_ PRT_UINT32 data1, _In_ PRT_BOOLEAN cooperative, _In_ PRT_BOOLEAN byHand)
+{
+	fakeNow = 1000;
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	if (cooperative)
+	{
+		PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	}
+	if (byHand)
+	{
+		PrtSetClock(process, &fakeClock);
+	}
+	return process;
+}
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static void TestEventTimerSendsOnce(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTimerProcess(1, PRT_FALSE, PRT_TRUE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_EVENT_TIMER *timer = PrtMkEventTimer(counter, P_EVENT_ADD);
+	PRT_TEST_CHECK(!PrtCancelEventTimer(timer));
+
+	PrtStartEventTimer(timer, 50, PrtMkIntValue(3));
+	fakeNow += 49;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 0);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 0);
+	fakeNow += 1;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 1);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 3);
+	PRT_TEST_CHECK(!PrtCancelEventTimer(timer));
+
+	// starting over replaces the deadline and the payload.
+	PrtStartEventTimer(timer, 10, PrtMkIntValue(4));
+	PrtStartEventTimer(timer, 30, PrtMkIntValue(5));
+	fakeNow += 10;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 0);
+	fakeNow += 20;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 1);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 8);
+
+	PrtStartEventTimer(timer, 20, PrtMkIntValue(6));
+	PRT_TEST_CHECK(PrtCancelEventTimer(timer));
+	fakeNow += 50;
+	PRT_TEST_CHECK(PrtFireTimers(process) == 0);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 8);
+	PrtFreeEventTimer(timer);
+
+	// a timer the host does not free goes with the process.
+	PRT_EVENT_TIMER *left = PrtMkEventTimer(counter, P_EVENT_RESET);
+	PrtStartEventTimer(left, 1000, NULL);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+#define COOPERATIVE_TIMERS 1000
+#define COOPERATIVE_COUNTERS 8
+
+static void TestManyTimersReplay(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTimerProcess(2, PRT_TRUE, PRT_TRUE);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *counters[COOPERATIVE_COUNTERS];
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_COUNTERS; i++)
+	{
+		counters[i] = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	}
+	PRT_EVENT_TIMER *timers[COOPERATIVE_TIMERS];
+	PRT_INT32 expected[COOPERATIVE_COUNTERS] = { 0 };
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_TIMERS; i++)
+	{
+		timers[i] = PrtMkEventTimer(counters[i % COOPERATIVE_COUNTERS], P_EVENT_ADD);
+		PrtStartEventTimer(timers[i], (PRT_UINT32)(NextRandom() % 20000), PrtMkIntValue((PRT_INT32)i));
+		expected[i % COOPERATIVE_COUNTERS] += (PRT_INT32)i;
+	}
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_TIMERS; i += 10)
+	{
+		if (PrtCancelEventTimer(timers[i]))
+		{
+			expected[i % COOPERATIVE_COUNTERS] -= (PRT_INT32)i;
+		}
+	}
+	while (((PRT_PROCESS_PRIV *)process)->timers.armed > 0)
+	{
+		fakeNow += 1 + NextRandom() % 500;
+		RunUntilIdle(process);
+	}
+	PRT_VALUE *histories[COOPERATIVE_COUNTERS];
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_COUNTERS; i++)
+	{
+		PRT_TEST_CHECK(PrtTestGetTotal(counters[i]) == expected[i]);
+		histories[i] = PrtTestGetHistory(counters[i]);
+	}
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_TIMERS; i++)
+	{
+		PrtFreeEventTimer(timers[i]);
+	}
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	// the events the timers sent are in the recording, and the replay's clock never moves.
+	PRT_PROCESS *replay = StartTimerProcess(3, PRT_FALSE, PRT_TRUE);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	for (PRT_UINT32 i = 0; i < COOPERATIVE_COUNTERS; i++)
+	{
+		PRT_VALUE *replayed = PrtTestGetHistory(((PRT_PROCESS_PRIV *)replay)->machines[i]);
+		PRT_TEST_CHECK(PrtIsEqualValue(histories[i], replayed));
+		PrtFreeValue(histories[i]);
+		PrtFreeValue(replayed);
+	}
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void WaitForTotal(_In_ PRT_MACHINEINST *counter, _In_ PRT_INT32 total)
+{
+	PRT_UINT64 start = PrtGetMonotonicTime();
+	while (PrtTestGetTotal(counter) != total)
+	{
+		PRT_TEST_CHECK(PrtGetMonotonicTime() < start + PATIENCE);
+		struct timespec pause = { 0, 1000000 };
+		nanosleep(&pause, NULL);
+	}
+}
+
+static void TestTimerThread(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTimerProcess(4, PRT_FALSE, PRT_FALSE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_EVENT_TIMER *late = PrtMkEventTimer(counter, P_EVENT_ADD);
+	PRT_EVENT_TIMER *early = PrtMkEventTimer(counter, P_EVENT_ADD);
+	PRT_UINT64 start = PrtGetProcessTime(process);
+
+	// the thread sleeps until the later deadline at first, and the earlier timer wakes it.
+	PrtStartEventTimer(late, 60, PrtMkIntValue(7));
+	PrtStartEventTimer(early, 20, PrtMkIntValue(1));
+	WaitForTotal(counter, 1);
+	PRT_TEST_CHECK(PrtGetProcessTime(process) >= start + 20);
+	WaitForTotal(counter, 8);
+	PRT_TEST_CHECK(PrtGetProcessTime(process) >= start + 60);
+	PrtFreeEventTimer(early);
+
+	// timers freed while the thread fires them are freed by whichever lets go last.
+	PRT_EVENT_TIMER *timers[200];
+	for (PRT_UINT32 i = 0; i < 200; i++)
+	{
+		timers[i] = PrtMkEventTimer(counter, P_EVENT_ADD);
+		PrtStartEventTimer(timers[i], i % 4, PrtMkIntValue(1));
+	}
+	struct timespec pause = { 0, 1000000 };
+	nanosleep(&pause, NULL);
+	for (PRT_UINT32 i = 0; i < 200; i++)
+	{
+		PrtFreeEventTimer(timers[i]);
+	}
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static volatile PRT_BOOLEAN stopWorker = PRT_FALSE;
+
+static void *RunWorker(void *arg)
+{
+	PRT_PROCESS *process = (PRT_PROCESS *)arg;
+	while (!stopWorker)
+	{
+		RunUntilIdle(process);
+		PrtWaitForWork(process);
+	}
+	return NULL;
+}
+
+static void TestWorkerWakesForNewTimer(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTimerProcess(5, PRT_TRUE, PRT_FALSE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_EVENT_TIMER *timer = PrtMkEventTimer(counter, P_EVENT_ADD);
+	stopWorker = PRT_FALSE;
+	pthread_t worker;
+	PRT_TEST_CHECK(pthread_create(&worker, NULL, &RunWorker, process) == 0);
+
+	// the worker has nothing to do, so it sleeps until something wakes it.
+	struct timespec pause = { 0, 10000000 };
+	nanosleep(&pause, NULL);
+	PRT_UINT64 start = PrtGetProcessTime(process);
+	PrtStartEventTimer(timer, 20, PrtMkIntValue(2));
+	WaitForTotal(counter, 2);
+	PRT_TEST_CHECK(PrtGetProcessTime(process) >= start + 20);
+
+	// the worker is done with the process before it is stopped.
+	stopWorker = PRT_TRUE;
+	PrtTestSendAdd(counter, 0);
+	pthread_join(worker, NULL);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestPayloadFreesItsTimer(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTimerProcess(5, PRT_TRUE, PRT_TRUE);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// the host frees the timer, which drops the payload, which frees the timer again.
+	PRT_EVENT_TIMER *timer = PrtMkEventTimer(counter, P_EVENT_RESET);
+	PrtStartEventTimer(timer, 100, PrtTestMkTimerRef(timer));
+	PrtFreeEventTimer(timer);
+
+	// cancelling drops the payload, which frees the timer under the cancel.
+	timer = PrtMkEventTimer(counter, P_EVENT_RESET);
+	PrtStartEventTimer(timer, 100, PrtTestMkTimerRef(timer));
+	PRT_TEST_CHECK(PrtCancelEventTimer(timer));
+
+	// starting over drops the first payload, which frees the timer while it is armed with the second.
+	timer = PrtMkEventTimer(counter, P_EVENT_RESET);
+	PrtStartEventTimer(timer, 100, PrtTestMkTimerRef(timer));
+	PrtStartEventTimer(timer, 100, NULL);
+
+	// a process that stops frees the timers left to it, payloads and all.
+	PRT_TEST_CHECK(((PRT_PROCESS_PRIV *)process)->eventTimers == NULL);
+	timer = PrtMkEventTimer(counter, P_EVENT_RESET);
+	PrtStartEventTimer(timer, 100, PrtTestMkTimerRef(timer));
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestWheelFiresOnTime();
+	TestDelayReachesFarTimer();
+	TestEventTimerSendsOnce();
+	TestManyTimersReplay();
+	TestTimerThread();
+	TestWorkerWakesForNewTimer();
+	TestPayloadFreesItsTimer();
+	printf("PrtTimerTest passed\n");
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "PrtTestProgram.h"
+
+/*
+* Sends Reset to Counters, whose state has no entry, exit or transition code, and checks that the transitions
+* are still taken and logged and that they neither lose the variables of the machine nor leak memory.
+*/
+
+#define RESETS 1000
+
+static volatile PRT_UINT32 entries;
+static volatile PRT_UINT32 exits;
+
+static void PRT_CALL_CONV TransitionLogFun(_In_ PRT_STEP step, _In_ PRT_MACHINESTATE *senderState, _In_ PRT_MACHINEINST *receiver, _In_ PRT_VALUE *eventid, _In_ PRT_VALUE *payload)
+{
+	if (step == PRT_STEP_ENTRY)
+	{
+		entries++;
+	}
+	else if (step == PRT_STEP_EXIT)
+	{
+		exits++;
+	}
+}
+
+static void TestEmptyFunctionsAreSkipped(void)
+{
+	PrtTestResetErrors();
+	entries = 0;
+	exits = 0;
+	PRT_GUID guid;
+	guid.data1 = 1;
+	guid.data2 = 0;
+	guid.data3 = 0;
+	guid.data4 = 0;
+	PRT_PROCESS *process = PrtStartProcessEx(guid, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &TransitionLogFun, NULL);
+	PrtSetMemoryQuotas(process, 0, 0, PRT_QUOTAPOLICY_REPORT);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_TEST_CHECK(entries == 1);
+
+	PRT_MACHINEINST *unreset = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 1; i <= RESETS; i++)
+	{
+		PrtTestSendAdd(counter, i);
+		PrtTestSendReset(counter);
+		PrtTestSendAdd(unreset, i);
+	}
+	PRT_TEST_CHECK(entries == RESETS + 2);
+	PRT_TEST_CHECK(exits == RESETS);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == RESETS * (RESETS + 1) / 2);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == RESETS);
+
+	// the transitions keep nothing, so the Counter uses as much memory as one that only saw the Adds.
+	PRT_TEST_CHECK(PrtGetMachineMemoryUsage(counter) == PrtGetMachineMemoryUsage(unreset));
+
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestEmptyFunctionsAreSkipped();
+	printf("PrtTransitionTest passed\n");
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include "PrtTestProgram.h"
+
+/*
+* Sends Counters events that expire, with a time to live given per send or by the declaration of the event, on a clock
+* the test moves by hand, and checks that a Counter drops the events that expired in its queue and counts them, or
+* handles the expiry event of the process in their place, that a receive passes over them, and that expiry comes back
+* the same in a replay and survives a checkpoint.
+*/
+
+#define CHECKPOINT_PATH "PrtTtlTest.ckpt"
+
+static volatile PRT_UINT64 fakeNow = 0;
+
+static PRT_UINT64 PRT_CALL_CONV FakeNow(_Inout_ void *state)
+{
+	return fakeNow;
+}
+
+static PRT_CLOCK fakeClock = { &FakeNow, NULL };
+
+static void RunUntilIdle(_Inout_ PRT_PROCESS *process)
+{
+	while (PrtStepProcess(process) != PRT_STEP_IDLE)
+	{
+		continue;
+	}
+}
+
+static PRT_PROCESS *StartTtlProcess(_In_ PRT_UINT32 data1)
+{
+	PRT_PROCESS *process = PrtTestStartProcess(data1, NULL);
+	PrtSetSchedulingPolicy(process, PRT_SCHEDULINGPOLICY_COOPERATIVE);
+	fakeNow = 1000;
+	PrtSetClock(process, &fakeClock);
+	return process;
+}
+
+static void SendExpiring(_Inout_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 eventIndex, _In_ PRT_INT32 x, _In_ PRT_UINT32 timeToLive)
+{
+	PRT_VALUE *event = PrtMkEventValue(eventIndex);
+	PRT_VALUE *payload = PrtMkIntValue(x);
+	PrtSendWithTimeToLive(NULL, counter, event, payload, timeToLive);
+	PrtFreeValue(payload);
+	PrtFreeValue(event);
+}
+
+static PRT_INT32 HistoryAt(_In_ PRT_MACHINEINST *counter, _In_ PRT_UINT32 index)
+{
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_INT32 value = PrtPrimGetInt(PrtSeqGetNCIntIndex(history, index));
+	PrtFreeValue(history);
+	return value;
+}
+
+static void TestExpiredEventsAreDropped(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(1);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	SendExpiring(counter, P_EVENT_ADD, 1, 10);
+	PrtTestSendAdd(counter, 2);
+	SendExpiring(counter, P_EVENT_ADD, 4, 100);
+	SendExpiring(counter, P_EVENT_ADD, 8, 50);
+
+	// an event expires once its deadline is reached, not before.
+	fakeNow += 50;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 6);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 2);
+	PRT_TEST_CHECK(((PRT_MACHINEINST_PRIV *)counter)->eventQueue.size == 0);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestDeclarationTimeToLive(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(2);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	P_GEND_TEST_PROGRAM.events[P_EVENT_ADD]->timeToLive = 20;
+	for (PRT_INT32 i = 0; i < 3; i++)
+	{
+		PrtTestSendAdd(counter, 1);
+	}
+
+	// a time to live given with the send wins over the declaration, even one of 0.
+	SendExpiring(counter, P_EVENT_ADD, 8, 0);
+	SendExpiring(counter, P_EVENT_ADD, 16, 30);
+	fakeNow += 25;
+	RunUntilIdle(process);
+	P_GEND_TEST_PROGRAM.events[P_EVENT_ADD]->timeToLive = 0;
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 24);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 3);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestExpiryEvent(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(3);
+	PrtSetExpiryEvent(process, P_EVENT_ADD);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+
+	// the Counter adds the index of the event it missed, in the place of the event in its queue.
+	SendExpiring(counter, P_EVENT_COUNTDOWN, 3, 5);
+	PrtTestSendAdd(counter, 100);
+	fakeNow += 5;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 2);
+	PRT_TEST_CHECK(HistoryAt(counter, 0) == P_EVENT_COUNTDOWN);
+	PRT_TEST_CHECK(HistoryAt(counter, 1) == 100);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 1);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReceivePassesOverExpired(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(4);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PrtTestSendWait(counter, 1000);
+	RunUntilIdle(process);
+
+	// the first Add to come while the Counter waits is noted for the receive, and has expired when the receive looks.
+	SendExpiring(counter, P_EVENT_ADD, 1, 5);
+	SendExpiring(counter, P_EVENT_ADD, 2, 5);
+	PrtTestSendAdd(counter, 4);
+	fakeNow += 10;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 4);
+	PRT_TEST_CHECK(PrtTestGetHistoryLength(counter) == 1);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 2);
+	PrtStopProcess(process);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestReplayMatches(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(5);
+	PrtStartRecording(process);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	PRT_MACHINEINST *target = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	for (PRT_INT32 i = 0; i < 10; i++)
+	{
+		SendExpiring(counter, P_EVENT_ADD, i, 5 * i);
+		PrtTestSendForward(counter, target, i);
+	}
+	fakeNow += 22;
+	RunUntilIdle(process);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 4);
+	PRT_VALUE *history = PrtTestGetHistory(counter);
+	PRT_UINT32 size;
+	PRT_UINT8 *recording = PrtGetRecording(process, &size);
+	PrtStopProcess(process);
+
+	// the replay runs on the platform clock, on which nothing would have expired.
+	PRT_PROCESS *replay = PrtTestStartProcess(6, NULL);
+	PRT_TEST_CHECK(PrtReplayProcess(replay, recording, size));
+	PRT_MACHINEINST *replayed = ((PRT_PROCESS_PRIV *)replay)->machines[0];
+	PRT_VALUE *replayedHistory = PrtTestGetHistory(replayed);
+	PRT_TEST_CHECK(PrtIsEqualValue(history, replayedHistory));
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(replayed) == 4);
+	PrtFreeValue(history);
+	PrtFreeValue(replayedHistory);
+	PrtFree(recording);
+	PrtStopProcess(replay);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+static void TestCheckpointKeepsTimeToLive(void)
+{
+	PrtTestResetErrors();
+	PRT_PROCESS *process = StartTtlProcess(7);
+	PRT_MACHINEINST *counter = PrtMkMachine(process, P_MACHINE_COUNTER, 0);
+	SendExpiring(counter, P_EVENT_ADD, 1, 100000);
+	PrtTestSendAdd(counter, 2);
+	fakeNow += 40000;
+	PRT_EVENT *queued = &((PRT_MACHINEINST_PRIV *)counter)->eventQueue.events[0];
+	PRT_TEST_CHECK(queued->deadline == 101000);
+	PRT_TEST_CHECK(PrtCheckpointProcess(process, CHECKPOINT_PATH));
+	PrtStopProcess(process);
+
+	// the restored Counter handles both at once, with a minute still to go on the first.
+	process = PrtRestoreProcess(CHECKPOINT_PATH, &P_GEND_TEST_PROGRAM, &PrtTestErrorFun, &PrtTestLogFun, NULL);
+	PRT_TEST_CHECK(process != NULL);
+	counter = ((PRT_PROCESS_PRIV *)process)->machines[0];
+	PRT_TEST_CHECK(PrtTestGetTotal(counter) == 3);
+	PRT_TEST_CHECK(PrtGetExpiredEventCount(counter) == 0);
+	PrtStopProcess(process);
+	remove(CHECKPOINT_PATH);
+	PRT_TEST_CHECK(PrtTestErrorCount == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TestExpiredEventsAreDropped();
+	TestDeclarationTimeToLive();
+	TestExpiryEvent();
+	TestReceivePassesOverExpired();
+	TestReplayMatches();
+	TestCheckpointKeepsTimeToLive();
+	printf("PrtTtlTest passed\n");
+	return 0;
+}
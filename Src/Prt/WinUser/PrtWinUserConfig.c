@@ -1,5 +1,6 @@
 #include "PrtWinUserConfig.h"
 #include "Prt.h"
+#include <io.h>
 
 PRT_RECURSIVE_MUTEX PRT_CALL_CONV PrtCreateMutex()
 {
@@ -26,6 +27,26 @@ void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
 	PrtAssert(result != FALSE, "Unable to unlock mutex");
 }
 
+void PRT_CALL_CONV PrtInitLock(_Out_ PRT_LOCK *lock)
+{
+	InitializeSRWLock(lock);
+}
+
+void PRT_CALL_CONV PrtDestroyLock(_Inout_ PRT_LOCK *lock)
+{
+	// slim reader/writer locks own no kernel resources.
+}
+
+void PRT_CALL_CONV PrtAcquireLock(_Inout_ PRT_LOCK *lock)
+{
+	AcquireSRWLockExclusive(lock);
+}
+
+void PRT_CALL_CONV PrtReleaseLock(_Inout_ PRT_LOCK *lock)
+{
+	ReleaseSRWLockExclusive(lock);
+}
+
 PRT_SEMAPHORE PRT_CALL_CONV PrtCreateSemaphore(int initialCount, int maximumCount)
 {
     HANDLE h = CreateSemaphore(NULL, initialCount, maximumCount, NULL);
@@ -56,44 +77,171 @@ void PRT_CALL_CONV PrtYieldThread(void)
     // windows doesn't need this since it has preemtive multitasking.
 }
 
-void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
+/* What a thread started by PrtCreateThread runs, handed over to the thread, which frees it */
+typedef struct PRT_THREAD_START
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	void *ptr = malloc(size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+    PRT_THREAD_FUN fun;
+    void *arg;
+} PRT_THREAD_START;
+
+static DWORD WINAPI PrtThreadStart(LPVOID param)
+{
+    PRT_THREAD_START start = *(PRT_THREAD_START *)param;
+    free(param);
+    start.fun(start.arg);
+    return 0;
 }
 
-void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
+PRT_THREAD PRT_CALL_CONV PrtCreateThread(_In_ PRT_THREAD_FUN fun, _Inout_ void *arg)
 {
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
-	PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
+    PRT_THREAD_START *start = (PRT_THREAD_START *)malloc(sizeof(PRT_THREAD_START));
+    PrtAssert(start != NULL, "Unable to create thread");
+    start->fun = fun;
+    start->arg = arg;
+    HANDLE thread = CreateThread(NULL, 0, &PrtThreadStart, start, 0, NULL);
+    PrtAssert(thread != NULL, "Unable to create thread");
+    return thread;
+}
 
-	void *ptr = calloc(nmemb, size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+void PRT_CALL_CONV PrtJoinThread(_In_ PRT_THREAD thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
 }
 
-void * PRT_CALL_CONV PrtRealloc(_Inout_ void *ptr, _In_ size_t size)
+PRT_POLLER PRT_CALL_CONV PrtCreatePoller(void)
 {
-	PrtAssert(ptr != NULL, "Memory must be non-null to avoid platform-specific behavior");
-	PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+    // file descriptors cannot be watched in this configuration.
+    return NULL;
+}
 
-	ptr = realloc(ptr, size);
-	PrtAssert(ptr != NULL, "Memory allocation error");
-	return ptr;
+void PRT_CALL_CONV PrtDestroyPoller(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to destroy");
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtPollerWatch(_In_ PRT_POLLER poller, _In_ int fd, _In_ PRT_UINT32 interest, _In_ PRT_UINT64 key)
+{
+    return PRT_FALSE;
+}
+
+void PRT_CALL_CONV PrtPollerUnwatch(_In_ PRT_POLLER poller, _In_ int fd)
+{
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtPollerWait(_In_ PRT_POLLER poller, _In_ long maxWaitTime, _Out_ PRT_POLL_EVENT *ready, _In_ PRT_UINT32 capacity)
+{
+    PrtAssert(PRT_FALSE, "No poller to wait on");
+    return 0;
+}
+
+void PRT_CALL_CONV PrtPollerWake(_In_ PRT_POLLER poller)
+{
+    PrtAssert(PRT_FALSE, "No poller to wake");
 }
 
-void PRT_CALL_CONV PrtFree(void *ptr)
+PRT_UINT32 PRT_CALL_CONV PrtAtomicIncrement(_Inout_ volatile PRT_UINT32 *target)
 {
-	free(ptr);
+	return (PRT_UINT32)InterlockedIncrement((volatile LONG *)target);
 }
 
-PRT_BOOLEAN PRT_CALL_CONV PrtChoose()
+PRT_UINT32 PRT_CALL_CONV PrtAtomicDecrement(_Inout_ volatile PRT_UINT32 *target)
 {
-	PRT_UINT32 value = rand();
-	if (value < RAND_MAX / 2)
-		return PRT_FALSE;
-	else
-		return PRT_TRUE;
-}
\ No newline at end of file
+	return (PRT_UINT32)InterlockedDecrement((volatile LONG *)target);
+}
+
+size_t PRT_CALL_CONV PrtAtomicAdd(_Inout_ volatile size_t *target, _In_ size_t value)
+{
+#ifdef _WIN64
+	return (size_t)InterlockedExchangeAdd64((volatile LONG64 *)target, (LONG64)value) + value;
+#else
+	return (size_t)InterlockedExchangeAdd((volatile LONG *)target, (LONG)value) + value;
+#endif
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicCompareExchange(_Inout_ volatile PRT_UINT32 *target, _In_ PRT_UINT32 expected, _In_ PRT_UINT32 desired)
+{
+	return (PRT_UINT32)InterlockedCompareExchange((volatile LONG *)target, (LONG)desired, (LONG)expected);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtAtomicLoad(_In_ volatile PRT_UINT32 *target)
+{
+	return (PRT_UINT32)InterlockedCompareExchange((volatile LONG *)target, 0, 0);
+}
+
+PRT_UINT64 PRT_CALL_CONV PrtGetMonotonicTime()
+{
+	return GetTickCount64();
+}
+
+const PRT_UINT8 * PRT_CALL_CONV PrtMapFile(_In_ const char *path, _Out_ PRT_UINT32 *size)
+{
+	*size = 0;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+	LARGE_INTEGER length;
+	const PRT_UINT8 *bytes = NULL;
+	if (GetFileSizeEx(file, &length) && length.QuadPart > 0 && length.QuadPart <= 0xFFFFFFFF)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			// the view keeps the mapping alive after its handle is closed.
+			bytes = (const PRT_UINT8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	if (bytes != NULL)
+	{
+		*size = (PRT_UINT32)length.QuadPart;
+	}
+	return bytes;
+}
+
+void PRT_CALL_CONV PrtUnmapFile(_In_ const PRT_UINT8 *bytes, _In_ PRT_UINT32 size)
+{
+	UnmapViewOfFile(bytes);
+}
+
+PRT_BOOLEAN PRT_CALL_CONV PrtReplaceFile(_Inout_ FILE *file, _In_ const char *tempPath, _In_ const char *path)
+{
+	// MoveFileEx replaces path in one step, and only after the data it will point to is on disk.
+	PRT_BOOLEAN ok = fflush(file) == 0 && _commit(_fileno(file)) == 0;
+	ok = fclose(file) == 0 && ok;
+	return ok && MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetNumaNodeCount()
+{
+	ULONG highest;
+	return GetNumaHighestNodeNumber(&highest) ? highest + 1 : 1;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtGetCurrentNumaNode()
+{
+	PROCESSOR_NUMBER processor;
+	USHORT node;
+	GetCurrentProcessorNumberEx(&processor);
+	return GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+}
+
+void * PRT_CALL_CONV PrtAllocNodeMemory(_In_ size_t size, _In_ PRT_UINT32 node)
+{
+	// the node is only preferred: pages come from other nodes when it has none left.
+	void *ptr = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+	if (ptr == NULL)
+	{
+		ptr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	PrtAssert(ptr != NULL, "Memory allocation error");
+	return ptr;
+}
+
+void PRT_CALL_CONV PrtFreeNodeMemory(_Inout_ void *ptr, _In_ size_t size)
+{
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
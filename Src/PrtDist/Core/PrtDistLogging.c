@@ -53,7 +53,7 @@ PrtDistSMExceptionHandler(
 
 	PRT_MACHINEINST_PRIV *c = (PRT_MACHINEINST_PRIV*)vcontext;
 
-	PrtLockMutex(((PRT_PROCESS_PRIV*)c->process)->processLock);
+	PrtAcquireLock(&((PRT_PROCESS_PRIV*)c->process)->processLock);
 
 	PRT_CHAR log[MAX_LOG_SIZE];
 
@@ -87,6 +87,13 @@ PrtDistSMExceptionHandler(
 			MachineName,
 			MachineId);
 		break;
+	case PRT_STATUS_MEMORY_QUOTA:
+		sprintf_s(log,
+			MAX_LOG_SIZE,
+			"<EXCEPTION> Machine %s(%d) : Memory Quota Exceeded\n",
+			MachineName,
+			MachineId);
+		break;
 	default:
 		sprintf_s(log,
 			MAX_LOG_SIZE,
@@ -98,7 +105,7 @@ PrtDistSMExceptionHandler(
 
     PrtDistLog(log);
 
-	PrtUnlockMutex(((PRT_PROCESS_PRIV*)c->process)->processLock);
+	PrtReleaseLock(&((PRT_PROCESS_PRIV*)c->process)->processLock);
 
 #ifdef PRT_DEBUG
 	int msgboxID = MessageBoxEx(
@@ -124,7 +131,7 @@ PrtDistSMExceptionHandler(
 void PrtDistSMLogHandler(PRT_STEP step, PRT_MACHINESTATE *senderState, PRT_MACHINEINST* receiver, PRT_VALUE* event, PRT_VALUE* payload)
 {
 	PRT_MACHINEINST_PRIV *c = (PRT_MACHINEINST_PRIV*)receiver;
-	PrtLockMutex(((PRT_PROCESS_PRIV*)ContainerProcess)->processLock);
+	PrtAcquireLock(&((PRT_PROCESS_PRIV*)ContainerProcess)->processLock);
 
 	if (logfile == NULL)
 	{
@@ -156,7 +163,7 @@ void PrtDistSMLogHandler(PRT_STEP step, PRT_MACHINESTATE *senderState, PRT_MACHI
         }
     }
 
-	PrtUnlockMutex(((PRT_PROCESS_PRIV*)ContainerProcess)->processLock);
+	PrtReleaseLock(&((PRT_PROCESS_PRIV*)ContainerProcess)->processLock);
 }
 
 void PrtDistLog(PRT_STRING log)
@@ -1,35 +1,52 @@
 #include "FailureDetector.h"
 
-static PRT_UINT32 numTimerInstances = 0;
+static volatile LONG numTimerInstances = 0;
 typedef struct TimerContext {
-	PRT_UINT32 refCount;
+	volatile LONG refCount;
 	PRT_UINT32 timerInstance;
 	PRT_MACHINEINST *clientContext;
-	HANDLE timer;
+	PRT_EVENT_TIMER *timer;
 	BOOL started;
 } TimerContext;
 
+// The TimerPtr a timer sends with TIMEOUT is tagged, and holds no reference: the runtime keeps it until the timer fires
+// or is cancelled, and dropping it there must not free the timer it belongs to.
+#define TIMER_PAYLOAD_TAG ((PRT_UINT64)1)
+#define TIMER_CONTEXT(frgnVal) ((TimerContext *)((frgnVal) & ~TIMER_PAYLOAD_TAG))
+
+PRT_UINT64 PRT_FORGN_MKDEF_TimerPtr_IMPL(void)
+{
+	return 0;
+}
+
+PRT_UINT64 PRT_FORGN_CLONE_TimerPtr_IMPL(PRT_UINT64 frgnVal)
+{
+	if (frgnVal == 0 || (frgnVal & TIMER_PAYLOAD_TAG) != 0) return frgnVal;
+	TimerContext *timerContext = (TimerContext *)frgnVal;
+	InterlockedIncrement(&timerContext->refCount);
+	return frgnVal;
+}
+
 void PRT_FORGN_FREE_TimerPtr_IMPL(PRT_UINT64 frgnVal)
 {
-	if (frgnVal == 0) return;
+	if (frgnVal == 0 || (frgnVal & TIMER_PAYLOAD_TAG) != 0) return;
 	TimerContext *timerContext = (TimerContext *)frgnVal;
-	timerContext->refCount--;
-	if (timerContext->refCount == 0)
+	if (InterlockedDecrement(&timerContext->refCount) == 0)
 	{
-		CloseHandle(timerContext->timer);
+		PrtFreeEventTimer(timerContext->timer);
 		PrtFree(timerContext);
 	}
 }
 
 PRT_BOOLEAN PRT_FORGN_ISEQUAL_TimerPtr_IMPL(PRT_UINT64 frgnVal1, PRT_UINT64 frgnVal2)
 {
-	return frgnVal1 == frgnVal2;
+	return TIMER_CONTEXT(frgnVal1) == TIMER_CONTEXT(frgnVal2);
 }
 
 PRT_STRING PRT_FORGN_TOSTRING_TimerPtr_IMPL(PRT_UINT64 frgnVal)
 {
 	if (frgnVal == 0) return "";
-	TimerContext *timerContext = (TimerContext *)frgnVal;
+	TimerContext *timerContext = TIMER_CONTEXT(frgnVal);
 	PRT_STRING str = PrtMalloc(sizeof(PRT_CHAR) * 100);
 	sprintf_s(str, 100, "Timer : %d", timerContext->timerInstance);
 	return str;
@@ -37,74 +54,36 @@ PRT_STRING PRT_FORGN_TOSTRING_TimerPtr_IMPL(PRT_UINT64 frgnVal)
 
 PRT_UINT32 PRT_FORGN_GETHASHCODE_TimerPtr_IMPL(PRT_UINT64 frgnVal)
 {
-	return (PRT_UINT32)frgnVal;
-}
-
-PRT_UINT64 PRT_FORGN_MKDEF_TimerPtr_IMPL(void)
-{
-	return 0;
-}
-
-PRT_UINT64 PRT_FORGN_CLONE_TimerPtr_IMPL(PRT_UINT64 frgnVal)
-{
-	if (frgnVal == 0) return 0;
-	TimerContext *timerContext = (TimerContext *)frgnVal;
-	timerContext->refCount++;
-	return frgnVal;
-}
-
-VOID CALLBACK Callback(LPVOID arg, DWORD dwTimerLowValue, DWORD dwTimerHighValue)
-{
-	//printf("Entering Timer Callback\n");	
-	TimerContext *timerContext = (TimerContext *)arg;
-	PRT_MACHINEINST *context = timerContext->clientContext;
-	PRT_VALUE *ev = PrtMkEventValue(P_EVENT_TIMEOUT);
-	PRT_MACHINEINST* clientMachine = PrtGetMachine(context->process, context->id);
-	PRT_VALUE *timerId = PrtMkForeignValue((PRT_UINT64)timerContext, &P_GEND_TYPE_TimerPtr);
-	PRT_MACHINESTATE state;
-	state.machineId = timerContext->timerInstance;
-	state.machineName = "Timer";
-	state.stateId = 1;
-	state.stateName = "Tick";
-	PrtSend(&state, clientMachine, ev, 1, PRT_FUN_PARAM_MOVE, &timerId);
-	PrtFreeValue(ev);
+	return (PRT_UINT32)(PRT_UINT64)TIMER_CONTEXT(frgnVal);
 }
 
+// The runtime sends TIMEOUT to the client when the timer runs out, with the tagged timer as its payload.
 PRT_VALUE *P_FUN_CreateTimer_FOREIGN(PRT_MACHINEINST *context, PRT_VALUE **owner)
 {
 	TimerContext *timerContext = (TimerContext *)PrtMalloc(sizeof(TimerContext));
 	timerContext->refCount = 1;
 	timerContext->clientContext = PrtGetMachine(context->process, *owner);
 	timerContext->started = FALSE;
-	timerContext->timer = CreateWaitableTimer(NULL, TRUE, NULL);
-	timerContext->timerInstance = numTimerInstances;
-	numTimerInstances++;
-
-	PrtAssert(timerContext->timer != NULL, "CreateWaitableTimer failed");
+	timerContext->timer = PrtMkEventTimer(timerContext->clientContext, P_EVENT_TIMEOUT);
+	timerContext->timerInstance = (PRT_UINT32)InterlockedIncrement(&numTimerInstances) - 1;
 	return PrtMkForeignValue((PRT_UINT64)timerContext, &P_GEND_TYPE_TimerPtr);
 }
 
 PRT_VALUE *P_FUN_StartTimer_FOREIGN(PRT_MACHINEINST *context, PRT_VALUE **timer, PRT_VALUE **time)
 {
-	LARGE_INTEGER liDueTime;
-	BOOL success;
-
-	TimerContext *timerContext = (TimerContext *)PrtGetForeignValue(*timer);
+	TimerContext *timerContext = TIMER_CONTEXT(PrtGetForeignValue(*timer));
 	int timeout_value = (*time)->valueUnion.nt;
-	liDueTime.QuadPart = -10000 * timeout_value;
-	success = SetWaitableTimer(timerContext->timer, &liDueTime, 0, Callback, timerContext, FALSE);
-	timerContext->started = success;
-	PrtAssert(success, "SetWaitableTimer failed");
-
+	PRT_VALUE *payload = PrtMkForeignValue((PRT_UINT64)timerContext | TIMER_PAYLOAD_TAG, &P_GEND_TYPE_TimerPtr);
+	PrtStartEventTimer(timerContext->timer, (PRT_UINT32)timeout_value, payload);
+	timerContext->started = TRUE;
 	return NULL;
 }
 
 PRT_VALUE *P_FUN_CancelTimer_FOREIGN(PRT_MACHINEINST *context, PRT_VALUE **timer)
 {
-	BOOL success;
 	PRT_VALUE *ev;
 	PRT_MACHINESTATE state;
-	TimerContext *timerContext = (TimerContext *)PrtGetForeignValue(*timer);
+	TimerContext *timerContext = TIMER_CONTEXT(PrtGetForeignValue(*timer));
 	state.machineId = timerContext->timerInstance;
 	state.machineName = "Timer";
 	state.stateId = 1;
@@ -113,8 +92,7 @@ PRT_VALUE *P_FUN_CancelTimer_FOREIGN(PRT_MACHINEINST *context, PRT_VALUE **timer
 	PrtAssert(timerContext->started, "Trying to cancel a timer without starting it");
 
 	timerContext->started = FALSE;
-	success = CancelWaitableTimer(timerContext->timer);
-	if (success) {
+	if (PrtCancelEventTimer(timerContext->timer)) {
 		ev = PrtMkEventValue(P_EVENT_CANCEL_SUCCESS);
 		PrtSend(&state, timerContext->clientContext, ev, 1, PRT_FUN_PARAM_CLONE, *timer);
 	}
@@ -126,4 +104,3 @@ PRT_VALUE *P_FUN_CancelTimer_FOREIGN(PRT_MACHINEINST *context, PRT_VALUE **timer
 
 	return NULL;
 }
-